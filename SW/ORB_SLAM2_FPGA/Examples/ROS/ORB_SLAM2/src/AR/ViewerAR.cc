@@ -19,6 +19,7 @@
 */
 
 #include "ViewerAR.h"
+#include "../../../include/Converter.h"
 
 #include <opencv2/highgui/highgui.hpp>
 
@@ -404,7 +405,7 @@ Plane* ViewerAR::DetectPlane(const cv::Mat Tcw, const std::vector<MapPoint*> &vM
         {
             if(pMP->Observations()>5)
             {
-                vPoints.push_back(pMP->GetWorldPos());
+                vPoints.push_back(Converter::toCvMat(pMP->GetWorldPos()));
                 vPointMP.push_back(pMP);
             }
         }
@@ -529,7 +530,7 @@ void Plane::Recompute()
         MapPoint* pMP = mvMPs[i];
         if(!pMP->isBad())
         {
-            cv::Mat Xw = pMP->GetWorldPos();
+            cv::Mat Xw = Converter::toCvMat(pMP->GetWorldPos());
             o+=Xw;
             A.row(nPoints).colRange(0,3) = Xw.t();
             nPoints++;
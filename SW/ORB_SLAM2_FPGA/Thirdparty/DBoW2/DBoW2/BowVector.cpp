@@ -33,9 +33,15 @@ BowVector::~BowVector(void)
 
 void BowVector::addWeight(WordId id, WordValue v)
 {
+  if(this->empty() || this->back().first < id)
+  {
+    this->push_back(value_type(id, v));
+    return;
+  }
+
   BowVector::iterator vit = this->lower_bound(id);
   
-  if(vit != this->end() && !(this->key_comp()(id, vit->first)))
+  if(vit->first == id)
   {
     vit->second += v;
   }
@@ -49,9 +55,15 @@ void BowVector::addWeight(WordId id, WordValue v)
 
 void BowVector::addIfNotExist(WordId id, WordValue v)
 {
+  if(this->empty() || this->back().first < id)
+  {
+    this->push_back(value_type(id, v));
+    return;
+  }
+
   BowVector::iterator vit = this->lower_bound(id);
   
-  if(vit == this->end() || (this->key_comp()(id, vit->first)))
+  if(vit->first != id)
   {
     this->insert(vit, BowVector::value_type(id, v));
   }
@@ -59,6 +71,58 @@ void BowVector::addIfNotExist(WordId id, WordValue v)
 
 // --------------------------------------------------------------------------
 
+static inline bool compareWordId(const BowVector::value_type &a, WordId id)
+{
+  return a.first < id;
+}
+
+BowVector::iterator BowVector::lower_bound(WordId id)
+{
+  return std::lower_bound(this->begin(), this->end(), id, compareWordId);
+}
+
+BowVector::const_iterator BowVector::lower_bound(WordId id) const
+{
+  return std::lower_bound(this->begin(), this->end(), id, compareWordId);
+}
+
+// --------------------------------------------------------------------------
+
+BowVector::const_iterator BowVector::lower_bound(const_iterator first, 
+  WordId id) const
+{
+  const const_iterator last = this->end();
+
+  // gallop to bound the word, then binary search
+  size_t step = 1;
+  while(first != last && first->first < id)
+  {
+    if((size_t)(last - first) <= step)
+      return std::lower_bound(first, last, id, compareWordId);
+    if(!((first + step)->first < id))
+      return std::lower_bound(first, first + step, id, compareWordId);
+    first += step;
+    step *= 2;
+  }
+  return first;
+}
+
+// --------------------------------------------------------------------------
+
+BowVector::iterator BowVector::find(WordId id)
+{
+  BowVector::iterator vit = this->lower_bound(id);
+  return (vit != this->end() && vit->first == id) ? vit : this->end();
+}
+
+BowVector::const_iterator BowVector::find(WordId id) const
+{
+  BowVector::const_iterator vit = this->lower_bound(id);
+  return (vit != this->end() && vit->first == id) ? vit : this->end();
+}
+
+// --------------------------------------------------------------------------
+
 void BowVector::normalize(LNorm norm_type)
 {
   double norm = 0.0; 
@@ -11,8 +11,8 @@
 #define __D_T_BOW_VECTOR__
 
 #include <iostream>
-#include <map>
 #include <vector>
+#include <utility>
 
 namespace DBoW2 {
 
@@ -52,9 +52,11 @@ enum ScoringType
   DOT_PRODUCT,
 };
 
-/// Vector of words to represent images
+/// Vector of words to represent images. 
+/// The words are kept in a contiguous array sorted by id, which can be 
+/// iterated and searched like the std::map<WordId, WordValue> it replaces
 class BowVector: 
-	public std::map<WordId, WordValue>
+	public std::vector<std::pair<WordId, WordValue> >
 {
 public:
 
@@ -70,19 +72,44 @@ public:
 	
 	/**
 	 * Adds a value to a word value existing in the vector, or creates a new
-	 * word with the given value
+	 * word with the given value. Constant time if id is not lower than the
+	 * last word of the vector
 	 * @param id word id to look for
 	 * @param v value to create the word with, or to add to existing word
 	 */
 	void addWeight(WordId id, WordValue v);
 	
 	/**
-	 * Adds a word with a value to the vector only if this does not exist yet
+	 * Adds a word with a value to the vector only if this does not exist yet.
+	 * Constant time if id is not lower than the last word of the vector
 	 * @param id word id to look for
 	 * @param v value to give to the word if this does not exist
 	 */
 	void addIfNotExist(WordId id, WordValue v);
 
+	/**
+	 * Returns the first word whose id is not lower than the given one
+	 * @param id word id
+	 */
+	iterator lower_bound(WordId id);
+	const_iterator lower_bound(WordId id) const;
+
+	/**
+	 * Returns the first word from first on whose id is not lower than the 
+	 * given one. The search gallops from first, so it is cheap when the word
+	 * is close, as when two vectors are merged
+	 * @param first position to start the search from
+	 * @param id word id
+	 */
+	const_iterator lower_bound(const_iterator first, WordId id) const;
+
+	/**
+	 * Returns the word with the given id, or end() if it is not in the vector
+	 * @param id word id
+	 */
+	iterator find(WordId id);
+	const_iterator find(WordId id) const;
+
 	/**
 	 * L1-Normalizes the values in the vector 
 	 * @param norm_type norm used
@@ -8,8 +8,8 @@
  */
 
 #include "FeatureVector.h"
-#include <map>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 
 namespace DBoW2 {
@@ -30,18 +30,111 @@ FeatureVector::~FeatureVector(void)
 
 void FeatureVector::addFeature(NodeId id, unsigned int i_feature)
 {
-  FeatureVector::iterator vit = this->lower_bound(id);
-  
-  if(vit != this->end() && vit->first == id)
+  if(m_nodes.empty() || m_nodes.back() < id)
+  {
+    m_nodes.push_back(id);
+    m_offsets.push_back(m_features.size());
+    m_features.push_back(i_feature);
+    return;
+  }
+
+  if(m_nodes.back() == id)
+  {
+    m_features.push_back(i_feature);
+    return;
+  }
+
+  // the node is before the last one
+  const size_t i = 
+    std::lower_bound(m_nodes.begin(), m_nodes.end(), id) - m_nodes.begin();
+
+  if(m_nodes[i] == id)
   {
-    vit->second.push_back(i_feature);
+    // add at the end of the indexes of node i
+    m_features.insert(m_features.begin() + m_offsets[i+1], i_feature);
+    for(size_t j = i + 1; j < m_offsets.size(); ++j) ++m_offsets[j];
   }
   else
   {
-    vit = this->insert(vit, FeatureVector::value_type(id, 
-      std::vector<unsigned int>() ));
-    vit->second.push_back(i_feature);
+    // new node at position i
+    const unsigned int offset = m_offsets[i];
+    m_nodes.insert(m_nodes.begin() + i, id);
+    m_offsets.insert(m_offsets.begin() + i, offset);
+    m_features.insert(m_features.begin() + offset, i_feature);
+    for(size_t j = i + 1; j < m_offsets.size(); ++j) ++m_offsets[j];
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+void FeatureVector::reserve(size_t nodes, size_t features)
+{
+  m_nodes.reserve(nodes);
+  m_offsets.reserve(nodes);
+  m_features.reserve(features);
+}
+
+// ---------------------------------------------------------------------------
+
+void FeatureVector::clear()
+{
+  m_nodes.clear();
+  m_offsets.clear();
+  m_features.clear();
+}
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::const_iterator FeatureVector::lower_bound(NodeId id) const
+{
+  return const_iterator(this, 
+    std::lower_bound(m_nodes.begin(), m_nodes.end(), id) - m_nodes.begin());
+}
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::const_iterator FeatureVector::lower_bound(
+  const_iterator first, NodeId id) const
+{
+  const std::vector<NodeId>::const_iterator nbegin = m_nodes.begin();
+  const std::vector<NodeId>::const_iterator nend = m_nodes.end();
+  std::vector<NodeId>::const_iterator nit = nbegin + first.index();
+
+  // gallop to bound the node, then binary search
+  size_t step = 1;
+  while(nit != nend && *nit < id)
+  {
+    if((size_t)(nend - nit) <= step)
+    {
+      nit = std::lower_bound(nit, nend, id);
+      break;
+    }
+    if(!(*(nit + step) < id))
+    {
+      nit = std::lower_bound(nit, nit + step, id);
+      break;
+    }
+    nit += step;
+    step *= 2;
   }
+
+  return const_iterator(this, nit - nbegin);
+}
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::const_iterator FeatureVector::find(NodeId id) const
+{
+  const_iterator it = lower_bound(id);
+  return (it != end() && m_nodes[it.index()] == id) ? it : end();
+}
+
+// ---------------------------------------------------------------------------
+
+bool FeatureVector::operator==(const FeatureVector &v) const
+{
+  return m_nodes == v.m_nodes && m_offsets == v.m_offsets && 
+    m_features == v.m_features;
 }
 
 // ---------------------------------------------------------------------------
@@ -53,25 +146,25 @@ std::ostream& operator<<(std::ostream &out,
   {
     FeatureVector::const_iterator vit = v.begin();
     
-    const std::vector<unsigned int>* f = &vit->second;
+    FeatureVector::Features f = vit->second;
 
     out << "<" << vit->first << ": [";
-    if(!f->empty()) out << (*f)[0];
-    for(unsigned int i = 1; i < f->size(); ++i)
+    if(!f.empty()) out << f[0];
+    for(unsigned int i = 1; i < f.size(); ++i)
     {
-      out << ", " << (*f)[i];
+      out << ", " << f[i];
     }
     out << "]>";
     
     for(++vit; vit != v.end(); ++vit)
     {
-      f = &vit->second;
+      f = vit->second;
       
       out << ", <" << vit->first << ": [";
-      if(!f->empty()) out << (*f)[0];
-      for(unsigned int i = 1; i < f->size(); ++i)
+      if(!f.empty()) out << f[0];
+      for(unsigned int i = 1; i < f.size(); ++i)
       {
-        out << ", " << (*f)[i];
+        out << ", " << f[i];
       }
       out << "]>";
     }
@@ -11,43 +11,195 @@
 #define __D_T_FEATURE_VECTOR__
 
 #include "BowVector.h"
-#include <map>
 #include <vector>
+#include <utility>
 #include <iostream>
 
 namespace DBoW2 {
 
-/// Vector of nodes with indexes of local features
-class FeatureVector: 
-  public std::map<NodeId, std::vector<unsigned int> >
+/// Vector of nodes with indexes of local features.
+/// The nodes are kept sorted by id in a contiguous array, and the indexes
+/// of all the nodes in a single array with the offset of each node. It is
+/// iterated like the std::map<NodeId, std::vector<unsigned int> > it
+/// replaces: it->first is the node id and it->second the indexes of the
+/// node (a read-only range)
+class FeatureVector
 {
 public:
 
+  /// Read-only range of feature indexes of a node
+  class Features
+  {
+  public:
+    typedef const unsigned int* const_iterator;
+
+    Features(): m_begin(NULL), m_end(NULL){}
+    Features(const unsigned int *b, const unsigned int *e):
+      m_begin(b), m_end(e){}
+
+    inline const_iterator begin() const { return m_begin; }
+    inline const_iterator end() const { return m_end; }
+    inline size_t size() const { return m_end - m_begin; }
+    inline bool empty() const { return m_begin == m_end; }
+    inline unsigned int operator[](size_t i) const { return m_begin[i]; }
+
+    /// Copy of the indexes
+    inline operator std::vector<unsigned int>() const
+    {
+      return std::vector<unsigned int>(m_begin, m_end);
+    }
+
+  protected:
+    const unsigned int *m_begin;
+    const unsigned int *m_end;
+  };
+
+  typedef std::pair<NodeId, Features> value_type;
+
+  /// Iterator over the nodes
+  class const_iterator
+  {
+  public:
+    /// Value returned by operator->
+    struct pointer
+    {
+      value_type value;
+      inline const value_type* operator->() const { return &value; }
+    };
+
+    const_iterator(): m_v(NULL), m_i(0){}
+    const_iterator(const FeatureVector *v, size_t i): m_v(v), m_i(i){}
+
+    inline value_type operator*() const
+    {
+      return value_type(m_v->m_nodes[m_i], m_v->features(m_i));
+    }
+
+    inline pointer operator->() const
+    {
+      pointer p;
+      p.value = **this;
+      return p;
+    }
+
+    inline const_iterator& operator++() { ++m_i; return *this; }
+    inline const_iterator operator++(int)
+      { const_iterator it = *this; ++m_i; return it; }
+    inline const_iterator& operator--() { --m_i; return *this; }
+    inline const_iterator operator--(int)
+      { const_iterator it = *this; --m_i; return it; }
+
+    inline bool operator==(const const_iterator &it) const
+      { return m_i == it.m_i; }
+    inline bool operator!=(const const_iterator &it) const
+      { return m_i != it.m_i; }
+    inline bool operator<(const const_iterator &it) const
+      { return m_i < it.m_i; }
+
+    /// Position of the node in the vector
+    inline size_t index() const { return m_i; }
+
+  protected:
+    const FeatureVector *m_v;
+    size_t m_i;
+  };
+
+  typedef const_iterator iterator;
+
   /**
    * Constructor
    */
   FeatureVector(void);
-  
+
   /**
    * Destructor
    */
   ~FeatureVector(void);
-  
+
   /**
    * Adds a feature to an existing node, or adds a new node with an initial
-   * feature
+   * feature. Constant time if id is not lower than the last node of the
+   * vector
    * @param id node id to add or to modify
    * @param i_feature index of feature to add to the given node
    */
   void addFeature(NodeId id, unsigned int i_feature);
 
+  /**
+   * Reserves memory
+   * @param nodes number of nodes
+   * @param features number of feature indexes
+   */
+  void reserve(size_t nodes, size_t features);
+
+  /**
+   * Removes all the nodes
+   */
+  void clear();
+
+  /// Number of nodes
+  inline size_t size() const { return m_nodes.size(); }
+  inline bool empty() const { return m_nodes.empty(); }
+
+  /// Number of feature indexes
+  inline size_t numFeatures() const { return m_features.size(); }
+
+  inline const_iterator begin() const { return const_iterator(this, 0); }
+  inline const_iterator end() const
+    { return const_iterator(this, m_nodes.size()); }
+
+  /// Id of the i-th node
+  inline NodeId node(size_t i) const { return m_nodes[i]; }
+
+  /// Feature indexes of the i-th node
+  inline Features features(size_t i) const
+  {
+    const unsigned int *p = m_features.empty() ? NULL : &m_features[0];
+    return Features(p + m_offsets[i],
+      p + (i + 1 < m_offsets.size() ? m_offsets[i+1] : m_features.size()));
+  }
+
+  /**
+   * Returns the first node whose id is not lower than the given one
+   * @param id node id
+   */
+  const_iterator lower_bound(NodeId id) const;
+
+  /**
+   * Returns the first node from first on whose id is not lower than the
+   * given one. The search gallops from first, so it is cheap when the node
+   * is close, as when two vectors are merged
+   * @param first position to start the search from
+   * @param id node id
+   */
+  const_iterator lower_bound(const_iterator first, NodeId id) const;
+
+  /**
+   * Returns the node with the given id, or end() if it is not in the vector
+   * @param id node id
+   */
+  const_iterator find(NodeId id) const;
+
+  bool operator==(const FeatureVector &v) const;
+  inline bool operator!=(const FeatureVector &v) const { return !(*this == v); }
+
   /**
    * Sends a string versions of the feature vector through the stream
    * @param out stream
    * @param v feature vector
    */
   friend std::ostream& operator<<(std::ostream &out, const FeatureVector &v);
-    
+
+protected:
+
+  /// Node ids, sorted
+  std::vector<NodeId> m_nodes;
+
+  /// Position in m_features of the first index of each node
+  std::vector<unsigned int> m_offsets;
+
+  /// Feature indexes of all the nodes
+  std::vector<unsigned int> m_features;
 };
 
 } // namespace DBoW2
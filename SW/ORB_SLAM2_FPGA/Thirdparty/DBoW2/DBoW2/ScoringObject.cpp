@@ -47,13 +47,13 @@ double L1Scoring::score(const BowVector &v1, const BowVector &v2) const
     else if(v1_it->first < v2_it->first)
     {
       // move v1 forward
-      v1_it = v1.lower_bound(v2_it->first);
+      v1_it = v1.lower_bound(v1_it, v2_it->first);
       // v1_it = (first element >= v2_it.id)
     }
     else
     {
       // move v2 forward
-      v2_it = v2.lower_bound(v1_it->first);
+      v2_it = v2.lower_bound(v2_it, v1_it->first);
       // v2_it = (first element >= v1_it.id)
     }
   }
@@ -97,13 +97,13 @@ double L2Scoring::score(const BowVector &v1, const BowVector &v2) const
     else if(v1_it->first < v2_it->first)
     {
       // move v1 forward
-      v1_it = v1.lower_bound(v2_it->first);
+      v1_it = v1.lower_bound(v1_it, v2_it->first);
       // v1_it = (first element >= v2_it.id)
     }
     else
     {
       // move v2 forward
-      v2_it = v2.lower_bound(v1_it->first);
+      v2_it = v2.lower_bound(v2_it, v1_it->first);
       // v2_it = (first element >= v1_it.id)
     }
   }
@@ -154,12 +154,12 @@ double ChiSquareScoring::score(const BowVector &v1, const BowVector &v2)
     else if(v1_it->first < v2_it->first)
     {
       // move v1 forward
-      v1_it = v1.lower_bound(v2_it->first);
+      v1_it = v1.lower_bound(v1_it, v2_it->first);
     }
     else
     {
       // move v2 forward
-      v2_it = v2.lower_bound(v1_it->first);
+      v2_it = v2.lower_bound(v2_it, v1_it->first);
     }
   }
     
@@ -207,7 +207,7 @@ double KLScoring::score(const BowVector &v1, const BowVector &v2) const
     else
     {
       // move v2_it forward, do not add any score
-      v2_it = v2.lower_bound(v1_it->first);
+      v2_it = v2.lower_bound(v2_it, v1_it->first);
       // v2_it = (first element >= v1_it.id)
     }
   }
@@ -251,13 +251,13 @@ double BhattacharyyaScoring::score(const BowVector &v1,
     else if(v1_it->first < v2_it->first)
     {
       // move v1 forward
-      v1_it = v1.lower_bound(v2_it->first);
+      v1_it = v1.lower_bound(v1_it, v2_it->first);
       // v1_it = (first element >= v2_it.id)
     }
     else
     {
       // move v2 forward
-      v2_it = v2.lower_bound(v1_it->first);
+      v2_it = v2.lower_bound(v2_it, v1_it->first);
       // v2_it = (first element >= v1_it.id)
     }
   }
@@ -296,13 +296,13 @@ double DotProductScoring::score(const BowVector &v1,
     else if(v1_it->first < v2_it->first)
     {
       // move v1 forward
-      v1_it = v1.lower_bound(v2_it->first);
+      v1_it = v1.lower_bound(v1_it, v2_it->first);
       // v1_it = (first element >= v2_it.id)
     }
     else
     {
       // move v2 forward
-      v2_it = v2.lower_bound(v1_it->first);
+      v2_it = v2.lower_bound(v2_it, v1_it->first);
       // v2_it = (first element >= v1_it.id)
     }
   }
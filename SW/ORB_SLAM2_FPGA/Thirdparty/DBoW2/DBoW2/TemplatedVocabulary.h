@@ -26,6 +26,15 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include <functional>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
@@ -257,6 +266,56 @@ public:
    * @param filename
    */
   void saveToBinaryFile(const std::string &filename) const;  
+
+  /**
+   * Maps a vocabulary image (see saveToImageFile) read-only and uses it in
+   * place: loading does not parse nor copy the tree, and the pages are
+   * shared by all the processes mapping the same file. Only the compiled
+   * tree is available, so the functions that need the node tree (create,
+   * getWord, getWordWeight, getParentNode, getWordsFromNode, stopWords and
+   * the other save functions) must not be used on a mapped vocabulary.
+   * @param filename
+   * @param verify also check the checksum of the whole image (reads it)
+   * @return false if the file is not a valid image for this descriptor
+   */
+  bool loadFromImageFile(const std::string &filename, bool verify = false);
+
+  /**
+   * Saves the compiled tree as a vocabulary image: versioned, checksummed,
+   * little-endian, with every section 64-byte aligned
+   * @param filename
+   * @return false if there is no compiled tree or the file cannot be written
+   */
+  bool saveToImageFile(const std::string &filename) const;
+
+  /**
+   * Returns whether the vocabulary is mapped from an image file
+   */
+  inline bool isMapped() const { return m_image != NULL; }
+
+  /**
+   * Sets the number of threads used to transform a set of descriptors into
+   * a bow vector and a feature vector. The result does not depend on it.
+   * @param n number of threads (1 by default)
+   */
+  inline void setNumThreads(int n) { m_num_threads = n > 1 ? n : 1; }
+
+  /**
+   * Returns the number of threads used by transform
+   */
+  inline int getNumThreads() const { return m_num_threads; }
+
+  /**
+   * Sets the function that runs the parts of a transform in parallel, instead
+   * of a new thread for each part. It must call f(t) for every t in [0,n) and
+   * return once all of them are done.
+   * @param parallel_for function (empty to create threads)
+   */
+  inline void setParallelFor(const std::function<void(int,
+    const std::function<void(int)>&)> &parallel_for)
+  {
+    m_parallel_for = parallel_for;
+  }
   
   /**
    * Saves the vocabulary into a file
@@ -340,6 +399,105 @@ protected:
     inline bool isLeaf() const { return children.empty(); }
   };
 
+  /// Node of the compiled tree (fixed layout, also used in image files)
+  struct FlatNode
+  {
+    /// First child slot
+    uint32_t first;
+    /// Number of children (0 if the node is a word)
+    uint32_t n;
+    /// Word id if the node is a word
+    uint32_t word_id;
+    uint32_t reserved;
+    /// Weight if the node is a word
+    double weight;
+
+    FlatNode(): first(0), n(0), word_id(0), reserved(0), weight(0){}
+  };
+
+  /// Header of a vocabulary image file
+  struct ImageHeader
+  {
+    /// "DBOW2IMG"
+    char magic[8];
+    uint32_t version;
+    /// 0x01020304 as written by the (little-endian) host
+    uint32_t byte_order;
+    int32_t k;
+    int32_t L;
+    int32_t scoring;
+    int32_t weighting;
+    uint32_t descriptor_bytes;
+    uint32_t num_words;
+    uint64_t num_nodes;
+    uint64_t num_slots;
+    /// Sections, from the beginning of the file
+    uint64_t nodes_offset;
+    uint64_t children_offset;
+    uint64_t descriptors_offset;
+    uint64_t file_size;
+    /// FNV-1a of the file after the header
+    uint64_t checksum;
+  };
+
+  static const uint32_t IMAGE_VERSION = 1;
+
+  /// Word and node of a feature, as found by transform
+  struct TransformEntry
+  {
+    WordId word_id;
+    NodeId node_id;
+    unsigned int feature;
+    WordValue weight;
+  };
+
+  /// Minimum number of features per transform thread
+  static const unsigned int MIN_FEATURES_PER_THREAD = 256;
+
+  /**
+   * Transforms a set of descriptors into entries in feature order (stopped
+   * words are not included). With several threads, each thread transforms
+   * a block of descriptors.
+   * @param features
+   * @param levelsup levels to go up the tree to get the node id
+   * @param entries (out)
+   */
+  void transformEntries(const std::vector<TDescriptor>& features, 
+    int levelsup, std::vector<TransformEntry> &entries) const;
+
+  /**
+   * Transforms the features [begin, end) into entries (stopped words are
+   * not included)
+   */
+  void transformRange(const std::vector<TDescriptor>& features, int levelsup,
+    unsigned int begin, unsigned int end,
+    std::vector<TransformEntry> &entries) const;
+
+  /**
+   * Fills a bow vector from the entries of a set of descriptors, before the
+   * tf division and normalization. The entries are sorted by word and
+   * feature index, so that the vector is built in order and the weights of
+   * a word are added in feature order.
+   * @param entries (in/out) entries, sorted on return
+   * @param v (out) bow vector (must be empty)
+   */
+  void fillBowVector(std::vector<TransformEntry> &entries, BowVector &v) const;
+
+  static bool compareEntryWords(const TransformEntry &a, const TransformEntry &b)
+  {
+    return a.word_id < b.word_id || (a.word_id == b.word_id && a.feature < b.feature);
+  }
+
+  static bool compareEntryNodes(const TransformEntry &a, const TransformEntry &b)
+  {
+    return a.node_id < b.node_id || (a.node_id == b.node_id && a.feature < b.feature);
+  }
+
+  /**
+   * FNV-1a 64-bit hash
+   */
+  static uint64_t imageChecksum(const unsigned char *data, size_t size);
+
 protected:
 
   /**
@@ -405,6 +563,20 @@ protected:
    * Create the words of the vocabulary once the tree has been built
    */
   void createWords();
+
+  /**
+   * Builds the compiled tree used by transform: the descriptors of the
+   * children of each node are packed contiguously, so that a descent step
+   * computes all the distances of a level over one block of memory. Must be
+   * called whenever the tree or the word weights change. If the descriptors
+   * cannot be packed, transform uses the node tree.
+   */
+  void compile();
+
+  /**
+   * Removes the compiled tree (before modifying the node tree)
+   */
+  void clearCompiled();
   
   /**
    * Sets the weights of the nodes of tree according to the given features.
@@ -437,6 +609,40 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Compiled tree used by transform (see compile()). It points either to
+  /// the storage vectors below or to a mapped image file.
+  /// Nodes, indexed by node id
+  const FlatNode *m_flat_nodes;
+
+  /// Node id of each child slot. The children of a node use consecutive slots
+  const uint32_t *m_flat_children;
+
+  /// Descriptor of each child slot (F::L bytes as 64-bit words). The children
+  /// of a node start at a 64-byte boundary
+  const uint64_t *m_flat_descriptors;
+
+  size_t m_flat_num_nodes;
+  size_t m_flat_num_slots;
+  unsigned int m_flat_num_words;
+
+  /// 64-bit words per descriptor
+  unsigned int m_flat_W;
+
+  /// Storage of a compiled tree
+  std::vector<FlatNode> m_flat_nodes_storage;
+  std::vector<uint32_t> m_flat_children_storage;
+  std::vector<uint64_t> m_flat_storage;
+
+  /// Mapped image file, if any
+  void *m_image;
+  size_t m_image_size;
+
+  /// Threads used by transform
+  int m_num_threads;
+
+  /// Runs the parts of a transform, if set
+  std::function<void(int, const std::function<void(int)>&)> m_parallel_for;
   
 };
 
@@ -446,7 +652,10 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_flat_nodes(NULL), m_flat_children(NULL),
+  m_flat_descriptors(NULL), m_flat_num_nodes(0), m_flat_num_slots(0),
+  m_flat_num_words(0), m_flat_W(0), m_image(NULL), m_image_size(0),
+  m_num_threads(1)
 {
   createScoringObject();
 }
@@ -455,7 +664,11 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL),
+  m_flat_nodes(NULL), m_flat_children(NULL),
+  m_flat_descriptors(NULL), m_flat_num_nodes(0), m_flat_num_slots(0),
+  m_flat_num_words(0), m_flat_W(0), m_image(NULL), m_image_size(0),
+  m_num_threads(1)
 {
   load(filename);
 }
@@ -464,7 +677,11 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL),
+  m_flat_nodes(NULL), m_flat_children(NULL),
+  m_flat_descriptors(NULL), m_flat_num_nodes(0), m_flat_num_slots(0),
+  m_flat_num_words(0), m_flat_W(0), m_image(NULL), m_image_size(0),
+  m_num_threads(1)
 {
   load(filename);
 }
@@ -528,7 +745,10 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_flat_nodes(NULL), m_flat_children(NULL),
+  m_flat_descriptors(NULL), m_flat_num_nodes(0), m_flat_num_slots(0),
+  m_flat_num_words(0), m_flat_W(0), m_image(NULL), m_image_size(0),
+  m_num_threads(1)
 {
   *this = voc;
 }
@@ -539,6 +759,7 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::~TemplatedVocabulary()
 {
   delete m_scoring_object;
+  clearCompiled();
 }
 
 // --------------------------------------------------------------------------
@@ -559,7 +780,33 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   this->m_words.clear();
   
   this->m_nodes = voc.m_nodes;
+  this->m_num_threads = voc.m_num_threads;
+  this->m_parallel_for = voc.m_parallel_for;
   this->createWords();
+
+  if(!voc.m_nodes.empty() || voc.m_flat_W == 0)
+  {
+    this->compile();
+  }
+  else
+  {
+    // mapped vocabulary: copy its compiled tree
+    this->clearCompiled();
+    this->m_flat_nodes_storage.assign(voc.m_flat_nodes, voc.m_flat_nodes + voc.m_flat_num_nodes);
+    this->m_flat_children_storage.assign(voc.m_flat_children, voc.m_flat_children + voc.m_flat_num_slots);
+    this->m_flat_storage.assign(voc.m_flat_num_slots * voc.m_flat_W + 8, 0);
+    const size_t misalignment = ((uintptr_t)&this->m_flat_storage[0] % 64) / 8;
+    uint64_t *descriptors = &this->m_flat_storage[misalignment == 0 ? 0 : 8 - misalignment];
+    std::copy(voc.m_flat_descriptors, voc.m_flat_descriptors + voc.m_flat_num_slots * voc.m_flat_W, descriptors);
+
+    this->m_flat_nodes = &this->m_flat_nodes_storage[0];
+    this->m_flat_children = this->m_flat_children_storage.empty() ? NULL : &this->m_flat_children_storage[0];
+    this->m_flat_descriptors = descriptors;
+    this->m_flat_num_nodes = voc.m_flat_num_nodes;
+    this->m_flat_num_slots = voc.m_flat_num_slots;
+    this->m_flat_num_words = voc.m_flat_num_words;
+    this->m_flat_W = voc.m_flat_W;
+  }
   
   return *this;
 }
@@ -570,6 +817,7 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::create(
   const std::vector<std::vector<TDescriptor> > &training_features)
 {
+  clearCompiled();
   m_nodes.clear();
   m_words.clear();
   
@@ -595,6 +843,8 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
+
+  compile();
   
 }
 
@@ -951,6 +1201,92 @@ void TemplatedVocabulary<TDescriptor,F>::createWords()
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::clearCompiled()
+{
+  m_flat_nodes = NULL;
+  m_flat_children = NULL;
+  m_flat_descriptors = NULL;
+  m_flat_num_nodes = 0;
+  m_flat_num_slots = 0;
+  m_flat_num_words = 0;
+  m_flat_W = 0;
+
+  m_flat_nodes_storage.clear();
+  m_flat_children_storage.clear();
+  m_flat_storage.clear();
+
+  if(m_image)
+  {
+    munmap(m_image, m_image_size);
+    m_image = NULL;
+    m_image_size = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::compile()
+{
+  clearCompiled();
+
+  // descriptors must be whole 64-bit words
+  if(m_nodes.empty() || F::L % 8 != 0) return;
+
+  const unsigned int W = F::L / 8;
+
+  // blocks of children padded to an even number of slots (64 bytes for
+  // 32-byte descriptors), so that every block starts at a cache line
+  size_t nslots = 0;
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+    nslots += (m_nodes[i].children.size() + 1) & ~(size_t)1;
+
+  m_flat_storage.assign(nslots * W + 8, 0);
+  const size_t misalignment = ((uintptr_t)&m_flat_storage[0] % 64) / 8;
+  uint64_t *descriptors = &m_flat_storage[misalignment == 0 ? 0 : 8 - misalignment];
+
+  m_flat_children_storage.assign(nslots, 0);
+  m_flat_nodes_storage.resize(m_nodes.size());
+
+  size_t slot = 0;
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    const Node &node = m_nodes[i];
+    FlatNode &flat = m_flat_nodes_storage[i];
+    flat.first = slot;
+    flat.n = node.children.size();
+    flat.word_id = node.word_id;
+    flat.weight = node.weight;
+
+    for(unsigned int j = 0; j < flat.n; ++j)
+    {
+      const NodeId cid = node.children[j];
+      const TDescriptor &d = m_nodes[cid].descriptor;
+      if(d.total() * d.elemSize() < (size_t)F::L)
+      {
+        // malformed node, keep using the node tree
+        clearCompiled();
+        return;
+      }
+      m_flat_children_storage[slot + j] = cid;
+      memcpy(descriptors + (slot + j) * W, d.data, F::L);
+    }
+
+    slot += (flat.n + 1) & ~1u;
+  }
+
+  m_flat_nodes = &m_flat_nodes_storage[0];
+  m_flat_children = nslots > 0 ? &m_flat_children_storage[0] : NULL;
+  m_flat_descriptors = descriptors;
+  m_flat_num_nodes = m_nodes.size();
+  m_flat_num_slots = nslots;
+  m_flat_num_words = m_words.size();
+  m_flat_W = W;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
   (const vector<vector<TDescriptor> > &training_features)
@@ -1012,7 +1348,8 @@ void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
 template<class TDescriptor, class F>
 inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 {
-  return m_words.size();
+  // a mapped vocabulary only has the compiled tree
+  return m_words.empty() ? m_flat_num_words : m_words.size();
 }
 
 // --------------------------------------------------------------------------
@@ -1020,7 +1357,7 @@ inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 template<class TDescriptor, class F>
 inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
 {
-  return m_words.empty();
+  return size() == 0;
 }
 
 // --------------------------------------------------------------------------
@@ -1089,46 +1426,17 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
 
-	typename vector<TDescriptor>::const_iterator fit;
-
-  if(m_weighting == TF || m_weighting == TF_IDF)
+  std::vector<TransformEntry> entries;
+  transformEntries(features, 0, entries);
+  fillBowVector(entries, v);
+  
+  if((m_weighting == TF || m_weighting == TF_IDF) && !v.empty() && !must)
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w; 
-      // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w);
-      
-      // not stopped
-      if(w > 0) v.addWeight(id, w);
-    }
-    
-    if(!v.empty() && !must)
-    {
-      // unnecessary when normalizing
-      const double nd = v.size();
-      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
-        vit->second /= nd;
-    }
-    
+    // unnecessary when normalizing
+    const double nd = v.size();
+    for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
+      vit->second /= nd;
   }
-  else // IDF || BINARY
-  {
-    for(fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w);
-      
-      // not stopped
-      if(w > 0) v.addIfNotExist(id, w);
-      
-    } // if add_features
-  } // if m_weighting == ...
   
   if(must) v.normalize(norm);
 }
@@ -1152,57 +1460,122 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
   
-  typename vector<TDescriptor>::const_iterator fit;
+  std::vector<TransformEntry> entries;
+  transformEntries(features, levelsup, entries);
+
+  // feature vector: features of each node in increasing order
+  std::sort(entries.begin(), entries.end(), compareEntryNodes);
+  fv.reserve(entries.size(), entries.size());
+  for(size_t i = 0; i < entries.size(); ++i)
+    fv.addFeature(entries[i].node_id, entries[i].feature);
+
+  fillBowVector(entries, v);
+  
+  if((m_weighting == TF || m_weighting == TF_IDF) && !v.empty() && !must)
+  {
+    // unnecessary when normalizing
+    const double nd = v.size();
+    for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
+      vit->second /= nd;
+  }
   
-  if(m_weighting == TF || m_weighting == TF_IDF)
+  if(must) v.normalize(norm);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transformRange(
+  const std::vector<TDescriptor>& features, int levelsup,
+  unsigned int begin, unsigned int end,
+  std::vector<TransformEntry> &entries) const
+{
+  entries.reserve(end - begin);
+
+  for(unsigned int i = begin; i < end; ++i)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    TransformEntry e;
+    transform(features[i], e.word_id, e.weight, &e.node_id, levelsup);
+    if(e.weight > 0) // not stopped
     {
-      WordId id;
-      NodeId nid;
-      WordValue w; 
-      // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      { 
-        v.addWeight(id, w);
-        fv.addFeature(nid, i_feature);
-      }
+      e.feature = i;
+      entries.push_back(e);
     }
-    
-    if(!v.empty() && !must)
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transformEntries(
+  const std::vector<TDescriptor>& features, int levelsup,
+  std::vector<TransformEntry> &entries) const
+{
+  const unsigned int N = features.size();
+  const int nthreads = std::min<int>(m_num_threads, N / MIN_FEATURES_PER_THREAD);
+
+  if(nthreads <= 1)
+  {
+    transformRange(features, levelsup, 0, N, entries);
+    return;
+  }
+
+  // thread t transforms the features [N*t/nthreads, N*(t+1)/nthreads)
+  std::vector<std::vector<TransformEntry> > thread_entries(nthreads);
+  if(m_parallel_for)
+  {
+    m_parallel_for(nthreads, [&](int t)
     {
-      // unnecessary when normalizing
-      const double nd = v.size();
-      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++) 
-        vit->second /= nd;
-    }
-  
+      transformRange(features, levelsup,
+        (unsigned int)((size_t)N * t / nthreads),
+        (unsigned int)((size_t)N * (t+1) / nthreads), thread_entries[t]);
+    });
   }
-  else // IDF || BINARY
+  else
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads - 1);
+    for(int t = 1; t < nthreads; ++t)
     {
-      WordId id;
-      NodeId nid;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      {
-        v.addIfNotExist(id, w);
-        fv.addFeature(nid, i_feature);
-      }
+      threads.push_back(std::thread(
+        &TemplatedVocabulary<TDescriptor,F>::transformRange, this,
+        std::cref(features), levelsup,
+        (unsigned int)((size_t)N * t / nthreads),
+        (unsigned int)((size_t)N * (t+1) / nthreads),
+        std::ref(thread_entries[t])));
     }
-  } // if m_weighting == ...
-  
-  if(must) v.normalize(norm);
+    transformRange(features, levelsup, 0, N / nthreads, thread_entries[0]);
+    for(size_t t = 0; t < threads.size(); ++t)
+      threads[t].join();
+  }
+
+  entries.clear();
+  entries.reserve(N);
+  for(int t = 0; t < nthreads; ++t)
+    entries.insert(entries.end(), thread_entries[t].begin(), thread_entries[t].end());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::fillBowVector(
+  std::vector<TransformEntry> &entries, BowVector &v) const
+{
+  // the weights of each word are added in feature order
+  std::sort(entries.begin(), entries.end(), compareEntryWords);
+  v.reserve(entries.size());
+  if(m_weighting == TF || m_weighting == TF_IDF)
+  {
+    // w is the idf value if TF_IDF, 1 if TF
+    for(size_t i = 0; i < entries.size(); ++i)
+      v.addWeight(entries[i].word_id, entries[i].weight);
+  }
+  else // IDF || BINARY
+  {
+    // w is idf if IDF, or 1 if BINARY
+    for(size_t i = 0; i < entries.size(); ++i)
+      v.addIfNotExist(entries[i].word_id, entries[i].weight);
+  }
 }
 
 // --------------------------------------------------------------------------
@@ -1230,14 +1603,84 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
-  // propagate the feature down the tree
-  vector<NodeId> nodes;
-  typename vector<NodeId>::const_iterator nit;
-
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
   if(nid_level <= 0 && nid != NULL) *nid = 0; // root
 
+  if(m_flat_W > 0)
+  {
+    // compiled tree: all the children distances of a level are computed over
+    // one contiguous block. Same distance (bits set in a ^ b) and same
+    // tie-breaking (first child with the minimum distance) as F::distance
+    // over the node tree.
+    const unsigned int W = m_flat_W;
+    uint64_t f[8];
+    const bool small = W <= 8;
+    std::vector<uint64_t> fbig;
+    uint64_t *pf = f;
+    if(!small)
+    {
+      fbig.resize(W);
+      pf = &fbig[0];
+    }
+    memcpy(pf, feature.data, F::L);
+
+    NodeId final_id = 0; // root
+    int current_level = 0;
+
+    do
+    {
+      ++current_level;
+      const FlatNode &node = m_flat_nodes[final_id];
+      const uint64_t *d = m_flat_descriptors + (size_t)node.first * W;
+
+      unsigned int best = 0;
+      int best_d = std::numeric_limits<int>::max();
+      if(W == 4)
+      {
+        const uint64_t f0 = pf[0], f1 = pf[1], f2 = pf[2], f3 = pf[3];
+        for(unsigned int j = 0; j < node.n; ++j, d += 4)
+        {
+          const int dist = __builtin_popcountll(f0 ^ d[0]) + __builtin_popcountll(f1 ^ d[1])
+            + __builtin_popcountll(f2 ^ d[2]) + __builtin_popcountll(f3 ^ d[3]);
+          if(dist < best_d)
+          {
+            best_d = dist;
+            best = j;
+          }
+        }
+      }
+      else
+      {
+        for(unsigned int j = 0; j < node.n; ++j, d += W)
+        {
+          int dist = 0;
+          for(unsigned int w = 0; w < W; ++w)
+            dist += __builtin_popcountll(pf[w] ^ d[w]);
+          if(dist < best_d)
+          {
+            best_d = dist;
+            best = j;
+          }
+        }
+      }
+
+      final_id = m_flat_children[node.first + best];
+
+      if(nid != NULL && current_level == nid_level)
+        *nid = final_id;
+
+    } while(m_flat_nodes[final_id].n > 0);
+
+    word_id = m_flat_nodes[final_id].word_id;
+    weight = m_flat_nodes[final_id].weight;
+    return;
+  }
+
+  // propagate the feature down the tree
+  vector<NodeId> nodes;
+  typename vector<NodeId>::const_iterator nit;
+
   NodeId final_id = 0; // root
   int current_level = 0;
 
@@ -1341,6 +1784,7 @@ int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
       (*wit)->weight = 0;
     }
   }
+  compile();
   return c;
 }
 
@@ -1355,6 +1799,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
     if(f.eof())
 	return false;
 
+    clearCompiled();
     m_words.clear();
     m_nodes.clear();
 
@@ -1431,6 +1876,8 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
         }
     }
 
+    compile();
+
     return true;
 
 }
@@ -1474,6 +1921,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &f
   f.read((char*)&m_weighting, sizeof(m_weighting));
   createScoringObject();
 
+  clearCompiled();
   m_words.clear();
   m_words.reserve(pow((double)m_k, (double)m_L + 1));
   m_nodes.clear();
@@ -1502,6 +1950,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &f
 	nid+=1;
   }
   f.close();
+  compile();
   return true;
 }
 
@@ -1533,6 +1982,188 @@ void TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(const std::string &fil
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+uint64_t TemplatedVocabulary<TDescriptor,F>::imageChecksum(
+  const unsigned char *data, size_t size)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for(size_t i = 0; i < size; ++i)
+  {
+    h ^= data[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::saveToImageFile(
+  const std::string &filename) const
+{
+  const uint32_t one = 1;
+  if(*(const unsigned char*)&one != 1)
+  {
+    std::cerr << "Vocabulary image: only little-endian hosts are supported" << std::endl;
+    return false;
+  }
+
+  if(m_flat_W == 0)
+  {
+    std::cerr << "Vocabulary image: the vocabulary has no compiled tree" << std::endl;
+    return false;
+  }
+
+  const uint64_t nodes_size = m_flat_num_nodes * sizeof(FlatNode);
+  const uint64_t children_size = m_flat_num_slots * sizeof(uint32_t);
+  const uint64_t descriptors_size = m_flat_num_slots * m_flat_W * sizeof(uint64_t);
+
+  ImageHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "DBOW2IMG", 8);
+  h.version = IMAGE_VERSION;
+  h.byte_order = 0x01020304;
+  h.k = m_k;
+  h.L = m_L;
+  h.scoring = m_scoring;
+  h.weighting = m_weighting;
+  h.descriptor_bytes = F::L;
+  h.num_words = m_flat_num_words;
+  h.num_nodes = m_flat_num_nodes;
+  h.num_slots = m_flat_num_slots;
+  h.nodes_offset = (sizeof(ImageHeader) + 63) & ~(uint64_t)63;
+  h.children_offset = (h.nodes_offset + nodes_size + 63) & ~(uint64_t)63;
+  h.descriptors_offset = (h.children_offset + children_size + 63) & ~(uint64_t)63;
+  h.file_size = h.descriptors_offset + descriptors_size;
+
+  std::vector<unsigned char> image(h.file_size, 0);
+  memcpy(&image[h.nodes_offset], m_flat_nodes, nodes_size);
+  if(children_size > 0)
+    memcpy(&image[h.children_offset], m_flat_children, children_size);
+  if(descriptors_size > 0)
+    memcpy(&image[h.descriptors_offset], m_flat_descriptors, descriptors_size);
+
+  h.checksum = imageChecksum(&image[sizeof(ImageHeader)], h.file_size - sizeof(ImageHeader));
+  memcpy(&image[0], &h, sizeof(h));
+
+  ofstream f(filename.c_str(), ios_base::out | ios_base::binary);
+  if(!f.is_open())
+    return false;
+  f.write((const char*)&image[0], image.size());
+  return f.good();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::loadFromImageFile(
+  const std::string &filename, bool verify)
+{
+  const uint32_t one = 1;
+  if(*(const unsigned char*)&one != 1)
+  {
+    std::cerr << "Vocabulary image: only little-endian hosts are supported" << std::endl;
+    return false;
+  }
+
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader))
+  {
+    close(fd);
+    return false;
+  }
+
+  const size_t size = st.st_size;
+  void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(addr == MAP_FAILED)
+    return false;
+
+  const unsigned char *data = (const unsigned char*)addr;
+  ImageHeader h;
+  memcpy(&h, data, sizeof(h));
+
+  const char *error = NULL;
+  if(memcmp(h.magic, "DBOW2IMG", 8) != 0)
+    error = "not a vocabulary image";
+  else if(h.version != IMAGE_VERSION)
+    error = "unsupported version";
+  else if(h.byte_order != 0x01020304)
+    error = "wrong byte order";
+  else if(h.descriptor_bytes != (uint32_t)F::L || F::L % 8 != 0)
+    error = "wrong descriptor size";
+  else if(h.file_size != size || h.num_nodes == 0 ||
+    h.num_nodes > size / sizeof(FlatNode) || h.num_slots > size / F::L ||
+    h.nodes_offset % 64 != 0 || h.children_offset % 64 != 0 || h.descriptors_offset % 64 != 0 ||
+    h.nodes_offset < sizeof(ImageHeader) ||
+    h.nodes_offset + h.num_nodes * sizeof(FlatNode) > h.children_offset ||
+    h.children_offset + h.num_slots * sizeof(uint32_t) > h.descriptors_offset ||
+    h.descriptors_offset + h.num_slots * F::L != size)
+    error = "truncated or inconsistent file";
+  else if(verify && imageChecksum(data + sizeof(ImageHeader), size - sizeof(ImageHeader)) != h.checksum)
+    error = "checksum mismatch";
+
+  // the tree is walked without checks: every child block must be in the file,
+  // every child must come after its parent (so that a walk ends at a leaf)
+  // and every leaf must be a valid word. The root must have children.
+  if(!error)
+  {
+    const FlatNode *nodes = (const FlatNode*)(data + h.nodes_offset);
+    const uint32_t *children = (const uint32_t*)(data + h.children_offset);
+    if(nodes[0].n == 0)
+      error = "empty tree";
+    for(uint64_t i = 0; !error && i < h.num_nodes; ++i)
+    {
+      const FlatNode &node = nodes[i];
+      if((uint64_t)node.first + node.n > h.num_slots)
+        error = "children out of range";
+      else if(node.n == 0 && node.word_id >= h.num_words)
+        error = "word out of range";
+      for(uint32_t j = 0; !error && j < node.n; ++j)
+      {
+        const uint32_t cid = children[node.first + j];
+        if(cid <= i || cid >= h.num_nodes)
+          error = "child node out of range";
+      }
+    }
+  }
+
+  if(error)
+  {
+    std::cerr << "Vocabulary image " << filename << ": " << error << std::endl;
+    munmap(addr, size);
+    return false;
+  }
+
+  clearCompiled();
+  m_words.clear();
+  m_nodes.clear();
+
+  m_k = h.k;
+  m_L = h.L;
+  m_scoring = (ScoringType)h.scoring;
+  m_weighting = (WeightingType)h.weighting;
+  createScoringObject();
+
+  m_image = addr;
+  m_image_size = size;
+  m_flat_nodes = (const FlatNode*)(data + h.nodes_offset);
+  m_flat_children = h.num_slots > 0 ? (const uint32_t*)(data + h.children_offset) : NULL;
+  m_flat_descriptors = (const uint64_t*)(data + h.descriptors_offset);
+  m_flat_num_nodes = h.num_nodes;
+  m_flat_num_slots = h.num_slots;
+  m_flat_num_words = h.num_words;
+  m_flat_W = F::L / 8;
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
@@ -1656,6 +2287,7 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
   const std::string &name)
 {
+  clearCompiled();
   m_words.clear();
   m_nodes.clear();
   
@@ -1702,6 +2334,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  compile();
 }
 
 // --------------------------------------------------------------------------
@@ -67,8 +67,13 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
 
   if (fromNotFixed || toNotFixed) {
 #ifdef G2O_OPENMP
-    from->lockQuadraticForm();
-    to->lockQuadraticForm();
+    // lock in address order, two edges may connect the same vertices in opposite directions
+    OptimizableGraph::Vertex* firstLocked = static_cast<OptimizableGraph::Vertex*>(_vertices[0]);
+    OptimizableGraph::Vertex* secondLocked = static_cast<OptimizableGraph::Vertex*>(_vertices[1]);
+    if (secondLocked < firstLocked)
+      std::swap(firstLocked, secondLocked);
+    firstLocked->lockQuadraticForm();
+    secondLocked->lockQuadraticForm();
 #endif
     const InformationType& omega = _information;
     Matrix<double, D, 1> omega_r = - omega * _error;
@@ -113,8 +118,8 @@ void BaseBinaryEdge<D, E, VertexXiType, VertexXjType>::constructQuadraticForm()
       }
     }
 #ifdef G2O_OPENMP
-    to->unlockQuadraticForm();
-    from->unlockQuadraticForm();
+    secondLocked->unlockQuadraticForm();
+    firstLocked->unlockQuadraticForm();
 #endif
   }
 }
@@ -376,7 +376,10 @@ bool BlockSolver<Traits>::solve(){
   //_DInvSchur->clear();
   memset (_coefficients, 0, _sizePoses*sizeof(double));
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) schedule(dynamic, 10)
+  // landmarks are distributed among the threads, the pose blocks they update are protected
+  // by one mutex per pose (held for the whole column of _HschurTransposedCCS)
+  const int numThreads = _optimizer->numThreads();
+# pragma omp parallel for default (shared) schedule(dynamic, 10) num_threads(numThreads) if (numThreads > 1)
 # endif
   for (int landmarkIndex = 0; landmarkIndex < static_cast<int>(_Hll->blockCols().size()); ++landmarkIndex) {
     const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
@@ -503,7 +506,8 @@ bool BlockSolver<Traits>::buildSystem()
 {
   // clear b vector
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) if (_optimizer->indexMapping().size() > 1000)
+  const int numThreads = _optimizer->numThreads();
+# pragma omp parallel for default (shared) num_threads(numThreads) if (numThreads > 1 && _optimizer->indexMapping().size() > 1000)
 # endif
   for (int i = 0; i < static_cast<int>(_optimizer->indexMapping().size()); ++i) {
     OptimizableGraph::Vertex* v=_optimizer->indexMapping()[i];
@@ -522,9 +526,12 @@ bool BlockSolver<Traits>::buildSystem()
   // no threading, we do not need to copy the workspace
   JacobianWorkspace& jacobianWorkspace = _optimizer->jacobianWorkspace();
 # else
-  // if running with threads need to produce copies of the workspace for each thread
+  // if running with threads need to produce copies of the workspace for each thread.
+  // The active edges are sorted by id, and the edges of a landmark are usually added
+  // together: a static schedule hands each thread contiguous runs of edges, so most
+  // landmark blocks are only touched by one thread and their locks are not contended.
   JacobianWorkspace jacobianWorkspace = _optimizer->jacobianWorkspace();
-# pragma omp parallel for default (shared) firstprivate(jacobianWorkspace) if (_optimizer->activeEdges().size() > 100)
+# pragma omp parallel for default (shared) firstprivate(jacobianWorkspace) schedule(static) num_threads(numThreads) if (numThreads > 1 && _optimizer->activeEdges().size() > 100)
 # endif
   for (int k = 0; k < static_cast<int>(_optimizer->activeEdges().size()); ++k) {
     OptimizableGraph::Edge* e = _optimizer->activeEdges()[k];
@@ -546,7 +553,7 @@ bool BlockSolver<Traits>::buildSystem()
 
   // flush the current system in a sparse block matrix
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) if (_optimizer->indexMapping().size() > 1000)
+# pragma omp parallel for default (shared) num_threads(numThreads) if (numThreads > 1 && _optimizer->indexMapping().size() > 1000)
 # endif
   for (int i = 0; i < static_cast<int>(_optimizer->indexMapping().size()); ++i) {
     OptimizableGraph::Vertex* v=_optimizer->indexMapping()[i];
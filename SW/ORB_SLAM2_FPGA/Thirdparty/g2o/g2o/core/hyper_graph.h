@@ -167,9 +167,11 @@ namespace g2o {
       const Vertex* vertex(int id) const;
 
       //! removes a vertex from the graph. Returns true on success (vertex was present)
-      virtual bool removeVertex(Vertex* v);
+      //! If detach is true the vertex and its edges are not deleted, the caller keeps ownership
+      virtual bool removeVertex(Vertex* v, bool detach=false);
       //! removes a vertex from the graph. Returns true on success (edge was present)
-      virtual bool removeEdge(Edge* e);
+      //! If detach is true the edge is not deleted, the caller keeps ownership
+      virtual bool removeEdge(Edge* e, bool detach=false);
       //! clears the graph and empties all structures.
       virtual void clear();
 
@@ -48,7 +48,7 @@ namespace g2o{
 
 
   SparseOptimizer::SparseOptimizer() :
-    _forceStopFlag(0), _verbose(false), _algorithm(0), _computeBatchStatistics(false)
+    _forceStopFlag(0), _verbose(false), _numThreads(1), _algorithm(0), _computeBatchStatistics(false)
   {
     _graphActions.resize(AT_NUM_ELEMENTS);
   }
@@ -68,7 +68,7 @@ namespace g2o{
     }
 
 #   ifdef G2O_OPENMP
-#   pragma omp parallel for default (shared) if (_activeEdges.size() > 50)
+#   pragma omp parallel for default (shared) num_threads(_numThreads) if (_numThreads > 1 && _activeEdges.size() > 50)
 #   endif
     for (int k = 0; k < static_cast<int>(_activeEdges.size()); ++k) {
       OptimizableGraph::Edge* e = _activeEdges[k];
@@ -558,6 +558,11 @@ namespace g2o{
     _verbose = verbose;
   }
 
+  void SparseOptimizer::setNumThreads(int numThreads)
+  {
+    _numThreads = numThreads > 0 ? numThreads : 1;
+  }
+
   void SparseOptimizer::setAlgorithm(OptimizationAlgorithm* algorithm)
   {
     if (_algorithm) // reset the optimizer for the formerly used solver
@@ -576,14 +581,14 @@ namespace g2o{
     _forceStopFlag=flag;
   }
 
-  bool SparseOptimizer::removeVertex(HyperGraph::Vertex* v)
+  bool SparseOptimizer::removeVertex(HyperGraph::Vertex* v, bool detach)
   {
     OptimizableGraph::Vertex* vv = static_cast<OptimizableGraph::Vertex*>(v);
     if (vv->hessianIndex() >= 0) {
       clearIndexMapping();
       _ivMap.clear();
     }
-    return HyperGraph::removeVertex(v);
+    return HyperGraph::removeVertex(v, detach);
   }
 
   bool SparseOptimizer::addComputeErrorAction(HyperGraphAction* action)
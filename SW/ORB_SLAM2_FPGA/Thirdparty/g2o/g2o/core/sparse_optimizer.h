@@ -178,6 +178,15 @@ namespace g2o {
     bool verbose()  const {return _verbose;}
     void setVerbose(bool verbose);
 
+    /**
+     * number of threads used to evaluate the errors, linearize the edges and
+     * build the Schur complement. Only has an effect if g2o is built with OpenMP.
+     * All the edges must provide an analytic Jacobian (the numeric one modifies
+     * the vertices while linearizing).
+     */
+    int numThreads() const { return _numThreads;}
+    void setNumThreads(int numThreads);
+
     /**
      * sets a variable checked at every iteration to force a user stop. The iteration exits when the variable is true;
      */
@@ -200,7 +209,7 @@ namespace g2o {
      * mapping is erased. In case you need the index mapping for manipulating the
      * graph, you have to store it in your own copy.
      */
-    virtual bool removeVertex(HyperGraph::Vertex* v);
+    virtual bool removeVertex(HyperGraph::Vertex* v, bool detach=false);
 
     /**
      * search for an edge in _activeVertices and return the iterator pointing to it
@@ -289,6 +298,7 @@ namespace g2o {
     protected:
     bool* _forceStopFlag;
     bool _verbose;
+    int _numThreads;
 
     VertexContainer _ivMap;
     VertexContainer _activeVertices;   ///< sorted according to VertexIDCompare
@@ -0,0 +1,213 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 H. Strasdat
+// Copyright (C) 2012 R. Kümmerle
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_LINEAR_SOLVER_PCG_H
+#define G2O_LINEAR_SOLVER_PCG_H
+
+#include "../core/linear_solver.h"
+#include "../core/batch_stats.h"
+
+#include <vector>
+#include <cmath>
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
+
+namespace g2o {
+
+  /**
+   * \brief linear solver using preconditioned conjugate gradient
+   *
+   * The preconditioner is the inverse of the diagonal blocks of A (block Jacobi). The
+   * matrix-vector products are done row by row over a copy of the block structure
+   * holding both triangles, so they can be distributed among OpenMP threads.
+   * Intended for systems too large for a sparse Cholesky, where an approximate solution
+   * is enough (the outer Levenberg-Marquardt iterations correct it).
+   */
+  template <typename MatrixType>
+  class LinearSolverPCG : public LinearSolver<MatrixType>
+  {
+    public:
+      LinearSolverPCG() :
+        LinearSolver<MatrixType>(),
+        _tolerance(1e-6), _maxIter(-1), _numThreads(1), _iterations(0), _residual(-1.)
+      {
+      }
+
+      virtual ~LinearSolverPCG()
+      {
+      }
+
+      virtual bool init()
+      {
+        _residual = -1.;
+        return true;
+      }
+
+      //! relative tolerance on the residual, ||r|| <= tolerance * ||b||
+      double tolerance() const { return _tolerance;}
+      void setTolerance(double tolerance) { _tolerance = tolerance;}
+
+      //! maximum number of iterations, -1 for the dimension of the system
+      int maxIterations() const { return _maxIter;}
+      void setMaxIterations(int maxIter) { _maxIter = maxIter;}
+
+      int numThreads() const { return _numThreads;}
+      void setNumThreads(int numThreads) { _numThreads = numThreads > 0 ? numThreads : 1;}
+
+      //! iterations and relative residual of the last solve
+      int iterations() const { return _iterations;}
+      double residual() const { return _residual;}
+
+      bool solve(const SparseBlockMatrix<MatrixType>& A, double* x, double* b)
+      {
+        const int n = A.rows();
+        const int numBlocks = static_cast<int>(A.blockCols().size());
+
+        // block rows of the full symmetric matrix and block Jacobi preconditioner
+        _rows.assign(numBlocks, RowBlocks());
+        _diagInv.resize(numBlocks);
+        for (int c = 0; c < numBlocks; ++c) {
+          const typename SparseBlockMatrix<MatrixType>::IntBlockMap& col = A.blockCols()[c];
+          for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = col.begin(); it != col.end(); ++it) {
+            const int r = it->first;
+            // only the upper triangular block is processed
+            if (r > c)
+              continue;
+            if (r == c) {
+              _diagInv[c] = it->second->inverse();
+              _rows[r].push_back(BlockRef(c, it->second, false));
+            } else {
+              _rows[r].push_back(BlockRef(c, it->second, false));
+              _rows[c].push_back(BlockRef(r, it->second, true));
+            }
+          }
+        }
+
+        Eigen::VectorXd::MapType xvec(x, n);
+        Eigen::VectorXd::ConstMapType bvec(b, n);
+
+        xvec.setZero();
+        _r = bvec;
+        _z.resize(n);
+        _q.resize(n);
+        applyPreconditioner(A, _r, _z);
+        _p = _z;
+
+        const double bnorm2 = bvec.squaredNorm();
+        const double th2 = _tolerance * _tolerance * bnorm2;
+        const int maxIter = _maxIter < 0 ? n : _maxIter;
+
+        double rz = _r.dot(_z);
+        double r2 = _r.squaredNorm();
+        _iterations = 0;
+        while (_iterations < maxIter && r2 > th2) {
+          multiply(A, _p, _q);
+          const double pq = _p.dot(_q);
+          if (pq <= 0.)
+            break;
+          const double alpha = rz / pq;
+          xvec += alpha * _p;
+          _r -= alpha * _q;
+          r2 = _r.squaredNorm();
+          applyPreconditioner(A, _r, _z);
+          const double rzNew = _r.dot(_z);
+          _p = _z + (rzNew / rz) * _p;
+          rz = rzNew;
+          ++_iterations;
+        }
+
+        _residual = bnorm2 > 0. ? std::sqrt(r2 / bnorm2) : 0.;
+
+        G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+        if (globalStats) {
+          globalStats->iterationsLinearSolver = _iterations;
+        }
+
+        return std::isfinite(_residual);
+      }
+
+    protected:
+      struct BlockRef
+      {
+        BlockRef(int c, const MatrixType* b, bool t) : col(c), block(b), transposed(t) {}
+        int col;
+        const MatrixType* block;
+        bool transposed;
+      };
+      typedef std::vector<BlockRef> RowBlocks;
+
+      //! dst = A * src
+      void multiply(const SparseBlockMatrix<MatrixType>& A, const Eigen::VectorXd& src, Eigen::VectorXd& dst)
+      {
+        const int numBlocks = static_cast<int>(_rows.size());
+#       ifdef G2O_OPENMP
+#       pragma omp parallel for default (shared) schedule(dynamic, 10) num_threads(_numThreads) if (_numThreads > 1)
+#       endif
+        for (int r = 0; r < numBlocks; ++r) {
+          const int rBase = A.rowBaseOfBlock(r);
+          const int rSize = A.rowsOfBlock(r);
+          Eigen::VectorXd::SegmentReturnType y = dst.segment(rBase, rSize);
+          y.setZero();
+          const RowBlocks& row = _rows[r];
+          for (size_t i = 0; i < row.size(); ++i) {
+            const BlockRef& ref = row[i];
+            const int cBase = A.rowBaseOfBlock(ref.col);
+            if (ref.transposed)
+              y.noalias() += ref.block->transpose() * src.segment(cBase, ref.block->rows());
+            else
+              y.noalias() += (*ref.block) * src.segment(cBase, ref.block->cols());
+          }
+        }
+      }
+
+      //! dst = diag(A)^-1 * src
+      void applyPreconditioner(const SparseBlockMatrix<MatrixType>& A, const Eigen::VectorXd& src, Eigen::VectorXd& dst)
+      {
+        const int numBlocks = static_cast<int>(_diagInv.size());
+        for (int r = 0; r < numBlocks; ++r) {
+          const int rBase = A.rowBaseOfBlock(r);
+          const int rSize = A.rowsOfBlock(r);
+          dst.segment(rBase, rSize).noalias() = _diagInv[r] * src.segment(rBase, rSize);
+        }
+      }
+
+      double _tolerance;
+      int _maxIter;
+      int _numThreads;
+      int _iterations;
+      double _residual;
+
+      std::vector<RowBlocks> _rows;
+      std::vector<MatrixType, Eigen::aligned_allocator<MatrixType> > _diagInv;
+      Eigen::VectorXd _r, _z, _p, _q;
+  };
+
+
+}// end namespace
+
+#endif
@@ -36,6 +36,7 @@ public:
     static std::vector<cv::Mat> toDescriptorVector(const cv::Mat &Descriptors);
 
     static g2o::SE3Quat toSE3Quat(const cv::Mat &cvT);
+    static g2o::SE3Quat toSE3Quat(const Eigen::Matrix4f &T);
     static g2o::SE3Quat toSE3Quat(const g2o::Sim3 &gSim3);
 
     static cv::Mat toCvMat(const g2o::SE3Quat &SE3);
@@ -43,13 +44,27 @@ public:
     static cv::Mat toCvMat(const Eigen::Matrix<double,4,4> &m);
     static cv::Mat toCvMat(const Eigen::Matrix3d &m);
     static cv::Mat toCvMat(const Eigen::Matrix<double,3,1> &m);
+    static cv::Mat toCvMat(const Eigen::Matrix4f &m);
+    static cv::Mat toCvMat(const Eigen::Matrix3f &m);
+    static cv::Mat toCvMat(const Eigen::Vector3f &m);
     static cv::Mat toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matrix<double,3,1> &t);
 
     static Eigen::Matrix<double,3,1> toVector3d(const cv::Mat &cvVector);
     static Eigen::Matrix<double,3,1> toVector3d(const cv::Point3f &cvPoint);
+    static Eigen::Matrix<double,3,1> toVector3d(const Eigen::Vector3f &v);
     static Eigen::Matrix<double,3,3> toMatrix3d(const cv::Mat &cvMat3);
+    static Eigen::Matrix<double,3,3> toMatrix3d(const Eigen::Matrix3f &m);
+
+    static Eigen::Matrix4f toMatrix4f(const cv::Mat &cvT);
+    static Eigen::Matrix4f toMatrix4f(const g2o::SE3Quat &SE3);
+    static Eigen::Matrix4f toMatrix4f(const g2o::Sim3 &Sim3);
+    static Eigen::Matrix3f toMatrix3f(const cv::Mat &cvMat3);
+    static Eigen::Vector3f toVector3f(const cv::Mat &cvVector);
+    static Eigen::Vector3f toVector3f(const cv::Point3f &cvPoint);
+    static Eigen::Vector3f toVector3f(const Eigen::Matrix<double,3,1> &v);
 
     static std::vector<float> toQuaternion(const cv::Mat &M);
+    static std::vector<float> toQuaternion(const Eigen::Matrix3f &M);
 };
 
 }// namespace ORB_SLAM
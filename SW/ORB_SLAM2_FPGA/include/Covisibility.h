@@ -0,0 +1,86 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COVISIBILITY_H
+#define COVISIBILITY_H
+
+#include<vector>
+#include<utility>
+#include<stdint.h>
+#include<stddef.h>
+
+namespace ORB_SLAM2
+{
+
+class KeyFrame;
+
+// Covisibility edges of a keyframe, immutable once published. A single allocation holds the
+// connections sorted by keyframe id with their weights, and the covisible keyframes ordered
+// by decreasing weight.
+//
+// A keyframe replaces its record on every change and retires the old one to the map's
+// EpochManager, so the threads that announce epochs read it without locks or copies (see
+// KeyFrame::GetCovisibility).
+class Covisibility
+{
+public:
+    // vConnections in any order, without duplicates. The ordered keyframes are the connections
+    // with at least nMinOrderedWeight, or the best connection if none reaches it.
+    static Covisibility* Create(const std::vector<std::pair<KeyFrame*,int> > &vConnections,
+                                const int nMinOrderedWeight=0);
+
+    // Allocated by Create()
+    static void operator delete(void* p);
+
+    // Connections, sorted by keyframe id
+    size_t NumConnections() const { return mnConnections; }
+    KeyFrame* GetConnection(const size_t i) const { return Connections()[i]; }
+    long unsigned int GetConnectionId(const size_t i) const { return ConnectionIds()[i]; }
+    int GetConnectionWeight(const size_t i) const { return ConnectionWeights()[i]; }
+
+    // Weight of the connection to pKF, 0 if not connected
+    int GetWeight(KeyFrame* pKF) const;
+
+    // Covisible keyframes by decreasing weight
+    size_t NumOrdered() const { return mnOrdered; }
+    KeyFrame* GetOrdered(const size_t i) const { return Ordered()[i]; }
+    int GetOrderedWeight(const size_t i) const { return OrderedWeights()[i]; }
+
+    // Number of ordered keyframes with a weight of at least w
+    size_t NumOrderedWithWeight(const int w) const;
+
+protected:
+    Covisibility() {}
+
+    // Arrays after the header: connections, ordered keyframes, connection ids, connection
+    // weights and ordered weights (decreasing alignment)
+    KeyFrame** Connections() const { return reinterpret_cast<KeyFrame**>(const_cast<Covisibility*>(this)+1); }
+    KeyFrame** Ordered() const { return Connections()+mnConnections; }
+    long unsigned int* ConnectionIds() const { return reinterpret_cast<long unsigned int*>(Ordered()+mnOrdered); }
+    int* ConnectionWeights() const { return reinterpret_cast<int*>(ConnectionIds()+mnConnections); }
+    int* OrderedWeights() const { return ConnectionWeights()+mnConnections; }
+
+    uint32_t mnConnections;
+    uint32_t mnOrdered;
+};
+
+} //namespace ORB_SLAM
+
+#endif // COVISIBILITY_H
@@ -0,0 +1,131 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ENTITYARENA_H
+#define ENTITYARENA_H
+
+#include<vector>
+#include<mutex>
+#include<new>
+#include<cstdlib>
+#include<cstddef>
+
+namespace ORB_SLAM2
+{
+
+// Storage for the objects of one class (MapPoint, KeyFrame) in cache line aligned slabs.
+// Every object lives in a slot, and the slot index is a dense id: freed slots go to a
+// free list and are reused first, so ids stay below the peak number of live objects and
+// containers indexed by slot do not grow with the length of the run. Slabs are only
+// returned to the system when the arena is destroyed.
+// The slot index is stored right after the object, in the padding of its slot, so it is
+// read without locking the arena. Objects must not be larger than T.
+template<class T>
+class EntityArena
+{
+public:
+    static const size_t ALIGNMENT = 64;
+
+    EntityArena(const size_t nSlotsPerSlab=1024):
+        mnSlotsPerSlab(nSlotsPerSlab), mnStride((sizeof(T)+sizeof(unsigned int)+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT),
+        mnUsed(0), mnLive(0)
+    {
+    }
+
+    ~EntityArena()
+    {
+        for(size_t i=0; i<mvpSlabs.size(); i++)
+            free(mvpSlabs[i]);
+    }
+
+    // Uninitialized storage for one object
+    void* Allocate()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        unsigned int nSlot;
+        if(!mvFreeSlots.empty())
+        {
+            nSlot = mvFreeSlots.back();
+            mvFreeSlots.pop_back();
+        }
+        else
+        {
+            if(mnUsed==mvpSlabs.size()*mnSlotsPerSlab)
+            {
+                void* pSlab = NULL;
+                if(posix_memalign(&pSlab,ALIGNMENT,mnSlotsPerSlab*mnStride)!=0)
+                    throw std::bad_alloc();
+                mvpSlabs.push_back(static_cast<char*>(pSlab));
+            }
+            nSlot = mnUsed++;
+        }
+        mnLive++;
+
+        char* p = mvpSlabs[nSlot/mnSlotsPerSlab]+(nSlot%mnSlotsPerSlab)*mnStride;
+        *reinterpret_cast<unsigned int*>(p+sizeof(T)) = nSlot;
+        return p;
+    }
+
+    void Free(void* p)
+    {
+        if(!p)
+            return;
+        const unsigned int nSlot = GetSlot(p);
+        std::unique_lock<std::mutex> lock(mMutex);
+        mvFreeSlots.push_back(nSlot);
+        mnLive--;
+    }
+
+    // Slot of an object allocated by this arena (set once by Allocate, no lock)
+    static unsigned int GetSlot(const void* p)
+    {
+        return *reinterpret_cast<const unsigned int*>(static_cast<const char*>(p)+sizeof(T));
+    }
+
+    // Number of live objects and of slots ever used (upper bound of the slot ids)
+    size_t Size()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mnLive;
+    }
+
+    size_t Capacity()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mnUsed;
+    }
+
+protected:
+
+    const size_t mnSlotsPerSlab;
+    const size_t mnStride;
+
+    std::vector<char*> mvpSlabs;
+
+    std::vector<unsigned int> mvFreeSlots;
+    size_t mnUsed;
+    size_t mnLive;
+
+    std::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // ENTITYARENA_H
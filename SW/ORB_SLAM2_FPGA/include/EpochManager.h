@@ -0,0 +1,110 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EPOCHMANAGER_H
+#define EPOCHMANAGER_H
+
+#include<vector>
+#include<deque>
+#include<mutex>
+
+namespace ORB_SLAM2
+{
+
+// Epoch based reclamation of map entities. Threads keep pointers to MapPoints (and
+// keyframes) between calls without holding any lock, so an entity removed from the map
+// is only retired here and deleted once every reader has moved past it.
+//
+// A reader is anything that keeps pointers across time: a thread, or a keyframe waiting
+// in a queue. A reader reads the epoch with GetEpoch(), drops every pointer to a bad
+// entity, and then announces that epoch: it holds nothing retired before it. An idle
+// reader (sleeping with no pointers) does not hold back reclamation.
+class EpochManager
+{
+public:
+    EpochManager();
+    ~EpochManager();
+
+    // New reader at the current epoch, or at an older epoch since which it has held its pointers.
+    int Register();
+    int Register(const unsigned long nEpoch);
+    void Unregister(const int nReader);
+
+    unsigned long GetEpoch();
+    void Announce(const int nReader, const unsigned long nEpoch);
+    void SetIdle(const int nReader);
+
+    // Delete p when no reader can still reach it
+    template<class T>
+    void Retire(T* p)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        Retired r;
+        r.p = p;
+        r.pDelete = &Delete<T>;
+        r.nEpoch = mnEpoch;
+        mdRetired.push_back(r);
+    }
+
+    // Advance the epoch and delete what can be deleted. Returns the number of deleted entities.
+    size_t Reclaim();
+
+    // Delete everything retired (after a reset, when no thread holds map pointers).
+    void Clear();
+
+    size_t NumRetired();
+    size_t NumReclaimed();
+
+protected:
+
+    template<class T>
+    static void Delete(void* p)
+    {
+        delete static_cast<T*>(p);
+    }
+
+    struct Retired
+    {
+        void* p;
+        void (*pDelete)(void*);
+        unsigned long nEpoch;
+    };
+
+    unsigned long mnEpoch;
+
+    // Announced epoch and state of every reader slot
+    enum eReaderState
+    {
+        FREE=0,
+        ACTIVE=1,
+        IDLE=2
+    };
+    std::vector<unsigned long> mvReaderEpochs;
+    std::vector<int> mvReaderStates;
+
+    std::deque<Retired> mdRetired;
+    size_t mnReclaimed;
+
+    std::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // EPOCHMANAGER_H
@@ -29,8 +29,10 @@
 #include "ORBVocabulary.h"
 #include "KeyFrame.h"
 #include "ORBextractor.h"
+#include "Undistorter.h"
 
 #include <opencv2/opencv.hpp>
+#include <Eigen/Dense>
 
 namespace ORB_SLAM2
 {
@@ -43,19 +45,21 @@ class KeyFrame;
 class Frame
 {
 public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
     Frame();
 
     // Copy constructor.
     Frame(const Frame &frame);
 
     // Constructor for stereo cameras.
-    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, Undistorter* undistorter, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
 
     // Constructor for RGB-D cameras.
-    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor, Undistorter* undistorter, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
 
     // Constructor for Monocular cameras.
-    Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor, Undistorter* undistorter, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
 
     // Extract ORB on the image. 0 for left image and 1 for right image.
     void ExtractORB(int flag, const cv::Mat &im);
@@ -64,19 +68,19 @@ public:
     void ComputeBoW();
 
     // Set the camera pose.
-    void SetPose(cv::Mat Tcw);
+    void SetPose(const Eigen::Matrix4f &Tcw);
 
     // Computes rotation, translation and camera center matrices from the camera pose.
     void UpdatePoseMatrices();
 
     // Returns the camera center.
-    inline cv::Mat GetCameraCenter(){
-        return mOw.clone();
+    inline Eigen::Vector3f GetCameraCenter(){
+        return mOw;
     }
 
     // Returns inverse of rotation
-    inline cv::Mat GetRotationInverse(){
-        return mRwc.clone();
+    inline Eigen::Matrix3f GetRotationInverse(){
+        return mRwc;
     }
 
     // Check if a MapPoint is in the frustum of the camera
@@ -96,7 +100,8 @@ public:
     void ComputeStereoFromRGBD(const cv::Mat &imDepth);
 
     // Backprojects a keypoint (if stereo/depth info available) into 3D world coordinates.
-    cv::Mat UnprojectStereo(const int &i);
+    // Returns false if the keypoint has no valid depth.
+    bool UnprojectStereo(const int &i, Eigen::Vector3f &x3D);
 
 public:
     // Vocabulary used for relocalization.
@@ -105,6 +110,9 @@ public:
     // Feature extractor. The right is used only in the stereo case.
     ORBextractor* mpORBextractorLeft, *mpORBextractorRight;
 
+    // Keypoint undistortion grid, owned by Tracking.
+    Undistorter* mpUndistorter;
+
     // Frame timestamp.
     double mTimeStamp;
 
@@ -160,8 +168,9 @@ public:
     static float mfGridElementHeightInv;
     std::vector<std::size_t> mGrid[FRAME_GRID_COLS][FRAME_GRID_ROWS];
 
-    // Camera pose.
-    cv::Mat mTcw;
+    // Camera pose. Only meaningful if mbHasPose is true.
+    Eigen::Matrix4f mTcw;
+    bool mbHasPose;
 
     // Current and Next Frame id.
     static long unsigned int nNextId;
@@ -193,7 +202,7 @@ private:
     // Undistort keypoints given OpenCV distortion parameters.
     // Only for the RGB-D case. Stereo must be already rectified!
     // (called in the constructor).
-    void UndistortKeyPoints();
+    void UndistortKeyPoints(const cv::Mat &im);
 
     // Computes image bounds for the undistorted image (called in the constructor).
     void ComputeImageBounds(const cv::Mat &imLeft);
@@ -201,11 +210,16 @@ private:
     // Assign keypoints to the grid for speed up feature matching (called in the constructor).
     void AssignFeaturesToGrid();
 
+    // Stereo search for the left keypoints in [iniL,endL). Right keypoint candidates of
+    // image row v are vRowIdx[vRowStart[v]..vRowStart[v+1]). Run concurrently on disjoint ranges.
+    void ComputeStereoMatchesRange(const int iniL, const int endL, const vector<int> &vRowStart,
+                                   const vector<int> &vRowIdx, vector<pair<int,int> > &vDistIdx);
+
     // Rotation, translation and camera center
-    cv::Mat mRcw;
-    cv::Mat mtcw;
-    cv::Mat mRwc;
-    cv::Mat mOw; //==mtwc
+    Eigen::Matrix3f mRcw;
+    Eigen::Vector3f mtcw;
+    Eigen::Matrix3f mRwc;
+    Eigen::Vector3f mOw; //==mtwc
 };
 
 }// namespace ORB_SLAM
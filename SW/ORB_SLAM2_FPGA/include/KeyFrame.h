@@ -28,8 +28,12 @@
 #include "ORBextractor.h"
 #include "Frame.h"
 #include "KeyFrameDatabase.h"
+#include "EntityArena.h"
+#include "Covisibility.h"
 
 #include <mutex>
+#include <atomic>
+#include <Eigen/Dense>
 
 
 namespace ORB_SLAM2
@@ -39,20 +43,32 @@ class Map;
 class MapPoint;
 class Frame;
 class KeyFrameDatabase;
+class MapImage;
 
 class KeyFrame
 {
+    // Saves and restores the protected state
+    friend class MapImage;
+
 public:
     KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
+    // i-th keyframe of a map image. Its descriptors stay in the image.
+    KeyFrame(const MapImage &image, const size_t i, Map* pMap, KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc);
+    ~KeyFrame();
+
+    // KeyFrames are allocated from a shared arena (see mnSlot). Its slots are cache line
+    // aligned, which also satisfies the alignment of the fixed size Eigen members.
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
 
     // Pose functions
-    void SetPose(const cv::Mat &Tcw);
-    cv::Mat GetPose();
-    cv::Mat GetPoseInverse();
-    cv::Mat GetCameraCenter();
-    cv::Mat GetStereoCenter();
-    cv::Mat GetRotation();
-    cv::Mat GetTranslation();
+    void SetPose(const Eigen::Matrix4f &Tcw);
+    Eigen::Matrix4f GetPose();
+    Eigen::Matrix4f GetPoseInverse();
+    Eigen::Vector3f GetCameraCenter();
+    Eigen::Vector3f GetStereoCenter();
+    Eigen::Matrix3f GetRotation();
+    Eigen::Vector3f GetTranslation();
 
     // Bag of Words Representation
     void ComputeBoW();
@@ -62,6 +78,10 @@ public:
     void EraseConnection(KeyFrame* pKF);
     void UpdateConnections();
     void UpdateBestCovisibles();
+    // Current covisibility record, read without locks. Only for threads announced in the map's
+    // EpochManager: the record stays valid until the thread announces a new epoch. The functions
+    // below read it the same way and return copies, so the same rule applies to their callers.
+    const Covisibility* GetCovisibility();
     std::set<KeyFrame *> GetConnectedKeyFrames();
     std::vector<KeyFrame* > GetVectorCovisibleKeyFrames();
     std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int &N);
@@ -87,19 +107,23 @@ public:
     void ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP);
     std::set<MapPoint*> GetMapPoints();
     std::vector<MapPoint*> GetMapPointMatches();
+    // Same, also returning the version of the matches (increased on every change).
+    std::vector<MapPoint*> GetMapPointMatches(long unsigned int &nVersion);
+    long unsigned int GetMatchesVersion();
     int TrackedMapPoints(const int &minObs);
     MapPoint* GetMapPoint(const size_t &idx);
 
     // KeyPoint functions
     std::vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r) const;
-    cv::Mat UnprojectStereo(int i);
+    bool UnprojectStereo(int i, Eigen::Vector3f &x3D);
 
     // Image
     bool IsInImage(const float &x, const float &y) const;
 
-    // Enable/Disable bad flag changes
+    // Enable/Disable bad flag changes. SetErase() returns true if the keyframe was culled while
+    // it could not be erased: it must then be set bad, by the local mapping (see LocalMapping::EraseKeyFrame).
     void SetNotErase();
-    void SetErase();
+    bool SetErase();
 
     // Set/check bad flag
     void SetBadFlag();
@@ -122,6 +146,10 @@ public:
 
     static long unsigned int nNextId;
     long unsigned int mnId;
+    // Dense id: slot in the arena
+    unsigned int mnSlot;
+    // Changed since the journal last wrote it (see Map::Touch)
+    std::atomic<bool> mbJournalDirty;
     const long unsigned int mnFrameId;
 
     const double mTimeStamp;
@@ -135,22 +163,26 @@ public:
     // Variables used by the tracking
     long unsigned int mnTrackReferenceForFrame;
     long unsigned int mnFuseTargetForKF;
+    long unsigned int mnTrackVotesForFrame;
+    int mnTrackVotes;
+
+    // Local map bookkeeping of the tracking: matches of this keyframe that were
+    // added to the local map, and the version they were taken at.
+    bool mbTrackInLocalMap;
+    long unsigned int mnTrackLocalMapStamp;
+    long unsigned int mnTrackLocalMapVersion;
+    std::vector<MapPoint*> mvpTrackLocalMapPoints;
+    // Epoch reader that keeps the matches alive while the keyframe waits for the local
+    // mapping (they are not linked to the points until then), -1 otherwise.
+    int mnEpochReader;
 
     // Variables used by the local mapping
     long unsigned int mnBALocalForKF;
     long unsigned int mnBAFixedForKF;
 
-    // Variables used by the keyframe database
-    long unsigned int mnLoopQuery;
-    int mnLoopWords;
-    float mLoopScore;
-    long unsigned int mnRelocQuery;
-    int mnRelocWords;
-    float mRelocScore;
-
     // Variables used by loop closing
-    cv::Mat mTcwGBA;
-    cv::Mat mTcwBefGBA;
+    Eigen::Matrix4f mTcwGBA;
+    Eigen::Matrix4f mTcwBefGBA;
     long unsigned int mnBAGlobalForKF;
 
     // Calibration parameters
@@ -171,7 +203,7 @@ public:
     DBoW2::FeatureVector mFeatVec;
 
     // Pose relative to parent (this is computed when bad flag is activated)
-    cv::Mat mTcp;
+    Eigen::Matrix4f mTcp;
 
     // Scale
     const int mnScaleLevels;
@@ -193,14 +225,15 @@ public:
 protected:
 
     // SE3 Pose and camera center
-    cv::Mat Tcw;
-    cv::Mat Twc;
-    cv::Mat Ow;
+    Eigen::Matrix4f Tcw;
+    Eigen::Matrix4f Twc;
+    Eigen::Vector3f Ow;
 
-    cv::Mat Cw; // Stereo middel point. Only for visualization
+    Eigen::Vector3f Cw; // Stereo middel point. Only for visualization
 
     // MapPoints associated to keypoints
     std::vector<MapPoint*> mvpMapPoints;
+    long unsigned int mnMatchesVersion;
 
     // BoW
     KeyFrameDatabase* mpKeyFrameDB;
@@ -209,9 +242,8 @@ protected:
     // Grid over the image to speed up feature matching
     std::vector< std::vector <std::vector<size_t> > > mGrid;
 
-    std::map<KeyFrame*,int> mConnectedKeyFrameWeights;
-    std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
-    std::vector<int> mvOrderedWeights;
+    // Covisibility graph. Replaced under mMutexConnections, read without it by GetCovisibility().
+    std::atomic<const Covisibility*> mpCovisibility;
 
     // Spanning Tree and Loop Edges
     bool mbFirstConnection;
@@ -228,6 +260,20 @@ protected:
 
     Map* mpMap;
 
+    static EntityArena<KeyFrame> mArena;
+
+    // Publish a new covisibility record, the previous one is retired (mMutexConnections held).
+    // Keeps the back-references of the keyframes added or removed up to date.
+    void SetCovisibility(const Covisibility* pCov);
+
+    // Keyframes whose covisibility record holds this one. They can be connected to it while
+    // it does not know them (weights are not symmetric): a keyframe set bad removes itself
+    // from all of them before it is deleted. Never held while taking another lock.
+    std::set<KeyFrame*> mspCovisibleBy;
+    std::mutex mMutexCovisibleBy;
+    void AddCovisibleBy(KeyFrame* pKF);
+    void EraseCovisibleBy(KeyFrame* pKF);
+
     std::mutex mMutexPose;
     std::mutex mMutexConnections;
     std::mutex mMutexFeatures;
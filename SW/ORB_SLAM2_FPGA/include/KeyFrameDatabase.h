@@ -41,6 +41,8 @@ class Frame;
 
 class KeyFrameDatabase
 {
+    friend class MapImage;
+
 public:
 
     KeyFrameDatabase(const ORBVocabulary &voc);
@@ -59,11 +61,33 @@ public:
 
 protected:
 
+  // Keyframes sharing words with vBow (except those in spExcluded), scored and accumulated
+  // by covisibility. Query state lives in per-thread scratch arrays indexed by keyframe id.
+  std::vector<KeyFrame*> DetectCandidates(const DBoW2::BowVector &vBow, const std::set<KeyFrame*> &spExcluded,
+                                          const float minScore);
+
+  // Drop the postings of erased keyframes
+  void Compact();
+
+  // Keyframe (by id) and weight of the word in its BoW vector
+  struct Posting
+  {
+      Posting(const unsigned int id, const double w): nKF(id), weight(w) {}
+      unsigned int nKF;
+      double weight;
+  };
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
   // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  std::vector<std::vector<Posting> > mvInvertedFile;
+
+  // Keyframe of each id, NULL if erased (its postings are tombstones until the next compaction)
+  std::vector<KeyFrame*> mvpKeyFrames;
+  std::vector<char> mvbErased;
+  size_t mnPostings;
+  size_t mnTombstones;
 
   // Mutex
   std::mutex mMutex;
@@ -0,0 +1,117 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCALBAGRAPH_H
+#define LOCALBAGRAPH_H
+
+#include<vector>
+#include<unordered_map>
+
+#include "Thirdparty/g2o/g2o/core/sparse_optimizer.h"
+#include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+
+namespace ORB_SLAM2
+{
+
+class KeyFrame;
+class MapPoint;
+
+// Persistent g2o problem for the local bundle adjustment. Consecutive local windows share
+// most of their keyframes, points and observations, so vertices and edges are kept in the
+// graph between calls and only the differences are added or removed. Removed vertices and
+// edges go back to pools and are reused.
+//
+// Usage: BeginUpdate(), set every keyframe, point and observation of the new window
+// (estimates and measurements are always set again), EndUpdate() to drop the rest.
+// Only used from the Local Mapping thread.
+class LocalBAGraph
+{
+public:
+    LocalBAGraph();
+    ~LocalBAGraph();
+
+    g2o::SparseOptimizer &GetOptimizer() { return mOptimizer; }
+
+    void BeginUpdate();
+    g2o::VertexSE3Expmap* SetKeyFrame(KeyFrame* pKF, const bool bFixed);
+    g2o::VertexSBAPointXYZ* SetMapPoint(MapPoint* pMP);
+
+    // Edge for the observation of pMP in pKF. Both vertices must have been set in this update.
+    // The robust kernel is a Huber kernel owned by the edge.
+    g2o::EdgeSE3ProjectXYZ* SetMonoObservation(MapPoint* pMP, KeyFrame* pKF);
+    g2o::EdgeStereoSE3ProjectXYZ* SetStereoObservation(MapPoint* pMP, KeyFrame* pKF);
+
+    void EndUpdate();
+
+    // Remove everything (the keyframes and points may be deleted after a reset).
+    void Clear();
+
+    static int KeyFrameVertexId(KeyFrame* pKF);
+    static int MapPointVertexId(MapPoint* pMP);
+
+protected:
+
+    struct Observation
+    {
+        KeyFrame* pKF;
+        g2o::EdgeSE3ProjectXYZ* pEdgeMono;
+        g2o::EdgeStereoSE3ProjectXYZ* pEdgeStereo;
+        unsigned long nStamp;
+    };
+
+    struct PointEntry
+    {
+        g2o::VertexSBAPointXYZ* pVertex;
+        // Id of the point, a deleted point may be replaced by another one at the same address
+        long unsigned int nId;
+        unsigned long nStamp;
+        std::vector<Observation> vObservations;
+    };
+
+    struct KeyFrameEntry
+    {
+        g2o::VertexSE3Expmap* pVertex;
+        // Id of the keyframe, as for the points
+        long unsigned int nId;
+        unsigned long nStamp;
+    };
+
+    Observation* FindObservation(MapPoint* pMP, KeyFrame* pKF);
+    void RemoveObservation(Observation &obs);
+    void RemovePointVertex(PointEntry &entry);
+
+    g2o::SparseOptimizer mOptimizer;
+
+    std::unordered_map<KeyFrame*,KeyFrameEntry> mmKeyFrames;
+    std::unordered_map<MapPoint*,PointEntry> mmMapPoints;
+
+    // Stamp of the current update
+    unsigned long mnStamp;
+
+    // Vertices and edges removed from the graph, ready to be reused
+    std::vector<g2o::VertexSE3Expmap*> mvpFreeKeyFrameVertices;
+    std::vector<g2o::VertexSBAPointXYZ*> mvpFreeMapPointVertices;
+    std::vector<g2o::EdgeSE3ProjectXYZ*> mvpFreeEdgesMono;
+    std::vector<g2o::EdgeStereoSE3ProjectXYZ*> mvpFreeEdgesStereo;
+};
+
+} //namespace ORB_SLAM
+
+#endif // LOCALBAGRAPH_H
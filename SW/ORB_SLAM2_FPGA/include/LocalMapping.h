@@ -26,8 +26,11 @@
 #include "LoopClosing.h"
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
+#include "ThreadEvent.h"
+#include "LocalBAGraph.h"
 #include <unistd.h>
 #include <mutex>
+#include <chrono>
 
 
 namespace ORB_SLAM2
@@ -36,21 +39,41 @@ namespace ORB_SLAM2
 class Tracking;
 class LoopClosing;
 class Map;
+class MemoryBudget;
 
 class LocalMapping
 {
 public:
+
+    struct Stats
+    {
+        // Mean time from the insertion of a keyframe to the start of its local BA (ms).
+        // Keyframes whose local BA is skipped (new keyframes waiting) are not counted.
+        double tLocalBALatency;
+        unsigned long nLocalBA;
+        // Mean time from the insertion of a keyframe to the wake-up of the idle thread (ms)
+        double tWakeUp;
+        unsigned long nWakeUps;
+    };
+
     LocalMapping(Map* pMap, const float bMonocular);
 
     void SetLoopCloser(LoopClosing* pLoopCloser);
 
     void SetTracker(Tracking* pTracker);
 
+    // No new points are triangulated while the point budget is full
+    void SetMemoryBudget(MemoryBudget* pMemoryBudget);
+
     // Main function
     void Run();
 
     void InsertKeyFrame(KeyFrame* pKF);
 
+    // Set the keyframe bad in this thread, before the next keyframe is processed.
+    // Used for the keyframes whose culling was deferred by other threads (KeyFrame::SetErase).
+    void EraseKeyFrame(KeyFrame* pKF);
+
     // Thread Synch
     void RequestStop();
     void RequestReset();
@@ -67,6 +90,12 @@ public:
     void RequestFinish();
     bool isFinished();
 
+    // Block until Local Mapping has stopped (or finished).
+    void WaitUntilStopped();
+    void WaitUntilFinished();
+
+    Stats GetStats();
+
     int KeyframesInQueue(){
         unique_lock<std::mutex> lock(mMutexNewKFs);
         return mlNewKeyFrames.size();
@@ -76,20 +105,37 @@ protected:
 
     bool CheckNewKeyFrames();
     void ProcessNewKeyFrame();
+    void EraseRequestedKeyFrames();
+    // The keyframe no longer keeps its matches alive (processed or dropped)
+    void ReleaseEpochReader(KeyFrame* pKF);
     void CreateNewMapPoints();
 
+    // Point triangulated between the current keyframe (idx1) and a neighbor (idx2)
+    struct TriangulatedPoint
+    {
+        int idx1;
+        int idx2;
+        Eigen::Vector3f x3D;
+    };
+
+    // Epipolar search and triangulation with one neighbor. Does not modify the map,
+    // so several neighbors can be processed concurrently.
+    void TriangulateWithNeighbor(KeyFrame* pKF2, std::vector<TriangulatedPoint> &vPoints);
+
     void MapPointCulling();
     void SearchInNeighbors();
 
     void KeyFrameCulling();
+    bool IsRedundantKeyFrame(KeyFrame* pKF);
 
-    cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
+    Eigen::Matrix3f ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
 
-    cv::Mat SkewSymmetricMatrix(const cv::Mat &v);
+    Eigen::Matrix3f SkewSymmetricMatrix(const Eigen::Vector3f &v);
 
     bool mbMonocular;
 
     void ResetIfRequested();
+    bool ResetRequested();
     bool mbResetRequested;
     std::mutex mMutexReset;
 
@@ -105,6 +151,10 @@ protected:
     Tracking* mpTracker;
 
     std::list<KeyFrame*> mlNewKeyFrames;
+    std::list<std::chrono::steady_clock::time_point> mlNewKeyFrameTimes;
+
+    // Keyframes to set bad (protected by mMutexNewKFs)
+    std::list<KeyFrame*> mlpKeyFramesToErase;
 
     KeyFrame* mpCurrentKeyFrame;
 
@@ -114,13 +164,35 @@ protected:
 
     bool mbAbortBA;
 
+    bool StopPending();
     bool mbStopped;
     bool mbStopRequested;
     bool mbNotStop;
     std::mutex mMutexStop;
 
+    // Notified on every change of the queue and of the stop/reset/finish flags
+    ThreadEvent mEventState;
+
+    // Insertion time of the current keyframe
+    std::chrono::steady_clock::time_point mtCurrentKeyFrame;
+
+    // Summed keyframe-to-local-BA latencies and wake-up times (ms)
+    std::mutex mMutexStats;
+    double mtLocalBALatency;
+    unsigned long mnLocalBA;
+    double mtWakeUp;
+    unsigned long mnWakeUps;
+
     bool mbAcceptKeyFrames;
     std::mutex mMutexAccept;
+
+    // Local BA problem kept between keyframes
+    LocalBAGraph mLocalBAGraph;
+
+    // Epoch reader of the local mapping (announced after the point culling)
+    int mnEpochReader;
+
+    MemoryBudget* mpMemoryBudget;
 };
 
 } //namespace ORB_SLAM
@@ -28,6 +28,7 @@
 #include "Tracking.h"
 
 #include "KeyFrameDatabase.h"
+#include "ThreadEvent.h"
 
 #include <thread>
 #include <mutex>
@@ -45,7 +46,7 @@ class LoopClosing
 {
 public:
 
-    typedef pair<set<KeyFrame*>,int> ConsistentGroup;    
+    typedef pair<set<long unsigned int>,int> ConsistentGroup;
     typedef map<KeyFrame*,g2o::Sim3,std::less<KeyFrame*>,
         Eigen::aligned_allocator<std::pair<KeyFrame *const, g2o::Sim3> > > KeyFrameAndPose;
 
@@ -80,12 +81,21 @@ public:
 
     bool isFinished();
 
+    // Block until the thread has finished and no Global BA is running.
+    void WaitUntilFinished();
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
 protected:
 
     bool CheckNewKeyFrames();
 
+    // Release the hold taken when the keyframe was queued
+    void ReleaseEpochReader(KeyFrame* pKF);
+
+    // Allow the keyframe to be culled again (it is culled by Local Mapping if it was requested)
+    void SetErase(KeyFrame* pKF);
+
     bool DetectLoop();
 
     bool ComputeSim3();
@@ -94,7 +104,14 @@ protected:
 
     void CorrectLoop();
 
+    // Global BA correction of the keyframes and points not included in it (propagated through
+    // the spanning tree). Computed without the map mutex, Local Mapping must be stopped.
+    void PropagateGlobalBACorrection(const unsigned long nLoopKF, std::vector<KeyFrame*> &vpKFs,
+                                     std::vector<MapPoint*> &vpMPs, std::vector<Eigen::Vector3f> &vPos,
+                                     std::vector<char> &vbUpdate);
+
     void ResetIfRequested();
+    bool ResetRequested();
     bool mbResetRequested;
     std::mutex mMutexReset;
 
@@ -116,6 +133,9 @@ protected:
 
     std::mutex mMutexLoopQueue;
 
+    // Notified on new keyframes, reset/finish requests and the end of a Global BA
+    ThreadEvent mEventState;
+
     // Loop detector parameters
     float mnCovisibilityConsistencyTh;
 
@@ -127,7 +147,7 @@ protected:
     std::vector<KeyFrame*> mvpCurrentConnectedKFs;
     std::vector<MapPoint*> mvpCurrentMatchedPoints;
     std::vector<MapPoint*> mvpLoopMapPoints;
-    cv::Mat mScw;
+    Eigen::Matrix4f mScw;
     g2o::Sim3 mg2oScw;
 
     long unsigned int mLastLoopKFid;
@@ -144,6 +164,9 @@ protected:
 
 
     bool mnFullBAIdx;
+
+    // Epoch reader of the loop closing thread, idle while it sleeps
+    int mnEpochReader;
 };
 
 } //namespace ORB_SLAM
@@ -23,9 +23,11 @@
 
 #include "MapPoint.h"
 #include "KeyFrame.h"
+#include "EpochManager.h"
 #include <set>
 
 #include <mutex>
+#include <atomic>
 
 
 
@@ -34,6 +36,8 @@ namespace ORB_SLAM2
 
 class MapPoint;
 class KeyFrame;
+class MapImage;
+class MapJournal;
 
 class Map
 {
@@ -55,8 +59,30 @@ public:
     long unsigned int MapPointsInMap();
     long unsigned  KeyFramesInMap();
 
+    // Keyframes erased from the map are deleted. The pose relative to their parent is kept
+    // until Tracking has placed the frames tracked with respect to them (see Trajectory).
+    struct ErasedKeyFrame
+    {
+        long unsigned int mnId;
+        long unsigned int mnParentId;
+        Eigen::Matrix<float,4,4,Eigen::DontAlign> mTcp;
+    };
+    // Keyframes erased since the last call, in order of erasure
+    void TakeErasedKeyFrames(std::vector<ErasedKeyFrame> &vErasedKFs);
+
     long unsigned int GetMaxKFid();
 
+    // Image the map was loaded from. The keyframes point to it, it is released by clear().
+    void SetImage(MapImage* pImage);
+
+    // Journal the changes of the map (NULL to stop). Every keyframe and point in the map is marked.
+    void SetJournal(MapJournal* pJournal);
+
+    // Mark a keyframe or point as changed for the journal (a flag in the entity, no lock).
+    // Called after the change. The journal writes the marked entities that are in the map.
+    void Touch(KeyFrame* pKF);
+    void Touch(MapPoint* pMP);
+
     void clear();
 
     vector<KeyFrame*> mvpKeyFrameOrigins;
@@ -66,14 +92,27 @@ public:
     // This avoid that two points are created simultaneously in separate threads (id conflict)
     std::mutex mMutexPointCreation;
 
+    // Erased MapPoints and KeyFrames are retired here and deleted when no thread can reach them
+    EpochManager mEpochManager;
+
 protected:
-    std::set<MapPoint*> mspMapPoints;
-    std::set<KeyFrame*> mspKeyFrames;
+    // Indexed by the dense id (mnSlot) of the entities, NULL for free slots
+    std::vector<MapPoint*> mvpMapPoints;
+    std::vector<KeyFrame*> mvpKeyFrames;
+    long unsigned int mnMapPoints;
+    long unsigned int mnKeyFrames;
 
     std::vector<MapPoint*> mvpReferenceMapPoints;
 
+    std::vector<ErasedKeyFrame> mvErasedKeyFrames;
+
     long unsigned int mnMaxKFid;
 
+    MapImage* mpImage;
+
+    // Read without the mutex, the entities are changed much more often than it is set
+    std::atomic<MapJournal*> mpJournal;
+
     // Index related to a big change in the map (loop closure, global BA)
     int mnBigChangeIdx;
 
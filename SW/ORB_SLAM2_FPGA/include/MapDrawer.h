@@ -34,6 +34,8 @@ namespace ORB_SLAM2
 class MapDrawer
 {
 public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
     MapDrawer(Map* pMap, const string &strSettingPath);
 
     Map* mpMap;
@@ -41,7 +43,7 @@ public:
     void DrawMapPoints();
     void DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph);
     void DrawCurrentCamera(pangolin::OpenGlMatrix &Twc);
-    void SetCurrentCameraPose(const cv::Mat &Tcw);
+    void SetCurrentCameraPose(const Eigen::Matrix4f &Tcw);
     void SetReferenceKeyFrame(KeyFrame *pKF);
     void GetCurrentOpenGLCameraMatrix(pangolin::OpenGlMatrix &M);
 
@@ -54,7 +56,8 @@ private:
     float mCameraSize;
     float mCameraLineWidth;
 
-    cv::Mat mCameraPose;
+    Eigen::Matrix4f mCameraPose;
+    bool mbCameraPose;
 
     std::mutex mMutexCamera;
 };
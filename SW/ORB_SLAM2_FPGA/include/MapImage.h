@@ -0,0 +1,264 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPIMAGE_H
+#define MAPIMAGE_H
+
+#include<vector>
+#include<string>
+#include<stdint.h>
+
+#include<opencv2/core/core.hpp>
+
+#include"ORBVocabulary.h"
+
+namespace ORB_SLAM2
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+class KeyFrameDatabase;
+
+// Binary map file: keyframes (pose, keypoints, descriptors, BoW), map points, covisibility
+// graph, spanning tree, loop edges and the inverted index of the keyframe database.
+//
+// Same layout as the vocabulary images (see TemplatedVocabulary::saveToImageFile): a versioned,
+// little-endian header followed by 64-byte aligned sections, covered by an FNV-1a checksum.
+// Per-feature data is stored as structure of arrays, each array in its own section, and
+// variable length data of a keyframe or point is referenced by its first element and count.
+//
+// A map image is loaded by mapping the file read-only. The keyframes keep pointing to their
+// descriptors in the file, which are only read from disk when they are first matched.
+class MapImage
+{
+public:
+
+    enum eSection
+    {
+        KEYFRAMES=0,
+        // Features (structure of arrays)
+        KEYS_X, KEYS_Y, KEYS_UN_X, KEYS_UN_Y, KEYS_SIZE, KEYS_ANGLE, KEYS_RESPONSE, KEYS_OCTAVE,
+        KEYS_U_RIGHT, KEYS_DEPTH, DESCRIPTORS,
+        // Bag of words
+        BOW_WORDS, BOW_WEIGHTS, FEAT_NODES, FEAT_OFFSETS, FEAT_INDICES,
+        // Graph
+        CONNECTION_IDS, CONNECTION_WEIGHTS, LOOP_EDGES,
+        // Map points
+        MAPPOINTS, OBSERVATION_IDS, OBSERVATION_INDICES,
+        // Inverted index
+        POSTING_OFFSETS, POSTING_IDS, POSTING_WEIGHTS,
+        NUM_SECTIONS
+    };
+
+    // Camera and ORB scale pyramid shared by all the keyframes
+    struct Camera
+    {
+        float fx, fy, cx, cy, bf, thDepth;
+        float minX, maxX, minY, maxY;
+        float gridElementWidthInv, gridElementHeightInv;
+        int32_t gridCols, gridRows;
+        int32_t scaleLevels;
+        float scaleFactor;
+    };
+
+    struct Header
+    {
+        // "ORBSLMAP"
+        char magic[8];
+        uint32_t version;
+        // 0x01020304 as written by the (little-endian) host
+        uint32_t byte_order;
+
+        Camera camera;
+
+        // Number of elements
+        uint64_t num_keyframes;
+        uint64_t num_mappoints;
+        uint64_t num_features;
+        uint64_t num_bow;
+        uint64_t num_feat_nodes;
+        uint64_t num_feat_indices;
+        uint64_t num_connections;
+        uint64_t num_loop_edges;
+        uint64_t num_observations;
+        uint64_t num_words;
+        uint64_t num_postings;
+
+        // Sections, from the beginning of the file, and their size in bytes
+        uint64_t section_offset[NUM_SECTIONS];
+        uint64_t section_size[NUM_SECTIONS];
+        uint64_t file_size;
+        // FNV-1a of the file after the header
+        uint64_t checksum;
+    };
+
+    static const uint32_t VERSION = 1;
+    static const uint64_t NO_ID = ~(uint64_t)0;
+
+    struct KeyFrameRecord
+    {
+        uint64_t id;
+        uint64_t frame_id;
+        double timestamp;
+        // Tcw, first three rows in row major order
+        float Tcw[12];
+        // NO_ID for the root of the spanning tree
+        uint64_t parent_id;
+        // First element and number of elements in the per-keyframe sections
+        uint64_t features;
+        uint32_t n_features;
+        uint32_t n_bow;
+        uint64_t bow;
+        uint64_t feat_nodes;
+        uint32_t n_feat_nodes;
+        uint32_t n_connections;
+        uint64_t connections;
+        uint64_t loop_edges;
+        uint32_t n_loop_edges;
+        uint32_t reserved;
+    };
+
+    struct MapPointRecord
+    {
+        uint64_t id;
+        int64_t first_kf_id;
+        int64_t first_frame;
+        uint64_t ref_kf_id;
+        float pos[3];
+        float normal[3];
+        float min_distance;
+        float max_distance;
+        int32_t visible;
+        int32_t found;
+        uint64_t observations;
+        uint32_t n_observations;
+        uint32_t reserved;
+        unsigned char descriptor[32];
+    };
+
+    // Content of a keyframe and of a map point. Graph edges and observations may refer to
+    // keyframes that are not in the image, Build() drops them.
+    struct KeyFrameData
+    {
+        // Only id, frame_id, timestamp, Tcw and parent_id are used
+        KeyFrameRecord record;
+        std::vector<cv::KeyPoint> vKeys;
+        std::vector<cv::KeyPoint> vKeysUn;
+        std::vector<float> vuRight;
+        std::vector<float> vDepth;
+        std::vector<unsigned char> vDescriptors;
+        std::vector<uint32_t> vBowWords;
+        std::vector<double> vBowWeights;
+        std::vector<uint32_t> vFeatNodes;
+        // First index of each node in vFeatIndices, and the end
+        std::vector<uint32_t> vFeatOffsets;
+        std::vector<uint32_t> vFeatIndices;
+        std::vector<uint64_t> vConnectionIds;
+        std::vector<int32_t> vConnectionWeights;
+        std::vector<uint64_t> vLoopEdges;
+    };
+
+    struct MapPointData
+    {
+        // observations and n_observations are not used
+        MapPointRecord record;
+        std::vector<uint64_t> vObservationIds;
+        std::vector<uint32_t> vObservationIndices;
+    };
+
+    // Features (keypoints, descriptors, BoW) and/or state (pose, spanning tree and graph edges)
+    // of a keyframe. The features never change.
+    static void GetKeyFrameData(KeyFrame* pKF, const bool bFeatures, const bool bState, KeyFrameData &data);
+    static void GetMapPointData(MapPoint* pMP, MapPointData &data);
+    static void GetCamera(KeyFrame* pKF, Camera &camera);
+
+    // Image of the given keyframes and points. The inverted index (nWords words) is built from
+    // the BoW vectors of the keyframes.
+    static void Build(const Camera &camera, const uint64_t nWords, const std::vector<KeyFrameData> &vKFs,
+                      const std::vector<MapPointData> &vMPs, std::vector<unsigned char> &image);
+
+    // Serialize the map. The map must not change meanwhile: Local Mapping stopped and
+    // Map::mMutexMapUpdate locked.
+    static void Serialize(Map* pMap, KeyFrameDatabase* pKFDB, std::vector<unsigned char> &image);
+
+    // Set the checksum of a serialized image and write it
+    static bool Write(const std::string &filename, std::vector<unsigned char> &image);
+
+    // Load a map image into pMap and pKFDB, which must be empty. The map keeps the image
+    // mapped until it is cleared. verify also checks the checksum (reads the whole file).
+    static bool Load(const std::string &filename, Map* pMap, KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc,
+                     const bool verify=false);
+
+    // Same for an image in memory (e.g. replayed from a MapJournal). The map takes the buffer.
+    static bool Load(std::vector<unsigned char> &image, const std::string &name, Map* pMap,
+                     KeyFrameDatabase* pKFDB, ORBVocabulary* pVoc);
+
+    ~MapImage();
+
+    // Used by the KeyFrame constructor
+    const Header &GetHeader() const { return *mpHeader; }
+    const KeyFrameRecord &GetKeyFrame(const size_t i) const { return Get<KeyFrameRecord>(KEYFRAMES)[i]; }
+    template<class T> const T* Get(const eSection s) const
+    {
+        return reinterpret_cast<const T*>(mpData+mpHeader->section_offset[s]);
+    }
+    std::vector<cv::KeyPoint> GetKeyPoints(const KeyFrameRecord &kf, const bool bUndistorted) const;
+    std::vector<float> GetFloats(const KeyFrameRecord &kf, const eSection s) const;
+
+    const cv::Mat &GetK() const { return mK; }
+    const std::vector<float> &GetScaleFactors() const { return mvScaleFactors; }
+    const std::vector<float> &GetLevelSigma2() const { return mvLevelSigma2; }
+    const std::vector<float> &GetInvLevelSigma2() const { return mvInvLevelSigma2; }
+
+    static uint64_t Checksum(const unsigned char *data, const size_t size);
+
+protected:
+
+    // Mapped file, unmapped on destruction
+    MapImage(const unsigned char* pData, const size_t size);
+    // Buffer in memory (swapped in)
+    MapImage(std::vector<unsigned char> &buffer);
+
+    // Check the header and the sections. Returns an error message or NULL.
+    static const char* Check(const Header &h, const size_t size);
+
+    // Check the references between sections and build the map. Takes pImage (deleted on error).
+    static bool Load(MapImage* pImage, const std::string &name, Map* pMap, KeyFrameDatabase* pKFDB,
+                     ORBVocabulary* pVoc, const bool verify);
+
+    // Calibration matrix and scale factors (once the header has been checked)
+    void SetCamera();
+
+    const unsigned char* mpData;
+    size_t mnSize;
+    const Header* mpHeader;
+    bool mbMapped;
+    std::vector<unsigned char> mvBuffer;
+
+    cv::Mat mK;
+    std::vector<float> mvScaleFactors;
+    std::vector<float> mvLevelSigma2;
+    std::vector<float> mvInvLevelSigma2;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPIMAGE_H
@@ -0,0 +1,188 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPJOURNAL_H
+#define MAPJOURNAL_H
+
+#include<string>
+#include<vector>
+#include<mutex>
+#include<unordered_map>
+#include<stdint.h>
+
+#include "ThreadEvent.h"
+
+namespace ORB_SLAM2
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+
+// Append-only journal of the changes of the map, written by its own thread while the system
+// runs (crash recovery, sharing maps). Settings:
+//   Journal.File: journal file (no journal if missing)
+//   Journal.Period: ms between batches (default 500)
+//   Journal.CompactRatio: compact once the file is this many times the size of its live
+//   records (default 2, 0 never)
+//
+// The threads that change the map only mark the keyframes and points they change (an atomic
+// flag, see Map::Touch) and queue the ids of erased ones under a short lock: they never wait
+// for the disk. The journal thread takes the marked entities of the map every period, reads
+// their current state and appends it as a single checksummed batch. A keyframe is written in full
+// (keypoints, descriptors, BoW) once, then only its pose and graph edges. Insertions,
+// culling, fusion and the corrections of local BA, loop closing and global BA all end up
+// as new states or erasures.
+//
+// Records are compact: integers are varints, ids and words are delta coded. Replaying the
+// journal gives the latest state of every entity still alive, that is the map at the last
+// batch. After a crash, replay stops at the first incomplete batch. When most of the file
+// is superseded states, it is compacted: the live records are copied into a new file, which
+// replaces the old one (a snapshot of the map in the journal format).
+//
+// The erasures are called through the Map (Map::SetJournal), for entities in the map.
+class MapJournal
+{
+public:
+
+    MapJournal(Map* pMap, const uint64_t nWords, const std::string &strSettingPath);
+    ~MapJournal();
+
+    const std::string &GetFile() const { return mStrFile; }
+
+    // Create the file. Every entity in the map is written in the first batch, to a temporary
+    // file that only replaces an existing one (possibly the loaded map) once it is on disk.
+    bool Open();
+
+    // Main function
+    void Run();
+
+    // Called by the Map (holding its mutex)
+    void Erase(KeyFrame* pKF);
+    void Erase(MapPoint* pMP, MapPoint* pReplacement);
+
+    // The map is cleared: waits for the current batch, and drops the erasures. Called before
+    // the entities are deleted.
+    void Reset();
+
+    // The last batch is written before the thread finishes
+    void RequestFinish();
+    bool isFinished();
+    void WaitUntilFinished();
+
+    struct Stats
+    {
+        size_t nBatches;
+        size_t nBytes;
+        size_t nCompactions;
+        size_t nFileSize;
+    };
+    Stats GetStats();
+
+    // Journal file (checks the magic)
+    static bool IsJournal(const std::string &filename);
+
+    // Replay a journal into a map image (see MapImage::Load). Returns false if the journal
+    // cannot be read or holds no keyframes.
+    static bool Replay(const std::string &filename, std::vector<unsigned char> &image);
+
+protected:
+
+    enum eRecord
+    {
+        CAMERA=1,
+        RESET=2,
+        KEYFRAME=3,
+        KEYFRAME_STATE=4,
+        KEYFRAME_ERASED=5,
+        MAPPOINT=6,
+        MAPPOINT_ERASED=7,
+        MAPPOINT_REPLACED=8
+    };
+
+    struct Erased
+    {
+        int nType;
+        uint64_t nId;
+        uint64_t nReplacementId;
+    };
+
+    // Position of a record in the file
+    struct Extent
+    {
+        uint64_t nOffset;
+        uint32_t nSize;
+    };
+
+    // Take the marks and append a batch
+    void WriteBatch();
+
+    // Append a batch at nFileSize. vRecords are the extents of the records in the payload, they are
+    // made relative to the file.
+    static bool Append(const int fd, uint64_t &nFileSize, const std::vector<unsigned char> &payload,
+                       std::vector<Extent> &vRecords);
+
+    void Compact();
+
+    bool CheckFinish();
+    void SetFinish();
+
+    Map* mpMap;
+    uint64_t mnWords;
+
+    std::string mStrFile;
+    int mnPeriod;
+    float mfCompactRatio;
+
+    // Erasures, taken by the journal thread
+    std::mutex mMutexQueue;
+    std::vector<Erased> mvErased;
+    bool mbResetPending;
+
+    // Held while a batch is written
+    std::mutex mMutexWriter;
+    int mFd;
+    uint64_t mnFileSize;
+    // Writing the first batch to the temporary file
+    bool mbSnapshot;
+    int mnEpochReader;
+
+    // Live records: camera, features and state of the keyframes, state of the points.
+    // The features of a keyframe are written once.
+    bool mbCamera;
+    Extent mCamera;
+    std::unordered_map<uint64_t,Extent> mmKeyFrames;
+    std::unordered_map<uint64_t,Extent> mmKeyFrameStates;
+    std::unordered_map<uint64_t,Extent> mmMapPoints;
+    uint64_t mnLiveSize;
+
+    std::mutex mMutexStats;
+    Stats mStats;
+
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::mutex mMutexFinish;
+
+    ThreadEvent mEventState;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPJOURNAL_H
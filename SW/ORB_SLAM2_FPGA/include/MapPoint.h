@@ -24,9 +24,14 @@
 #include"KeyFrame.h"
 #include"Frame.h"
 #include"Map.h"
+#include"EntityArena.h"
+#include"SmallVector.h"
 
 #include<opencv2/core/core.hpp>
+#include<Eigen/Dense>
 #include<mutex>
+#include<vector>
+#include<atomic>
 
 namespace ORB_SLAM2
 {
@@ -38,19 +43,31 @@ class Frame;
 
 class MapPoint
 {
+    friend class MapImage;
+
 public:
-    MapPoint(const cv::Mat &Pos, KeyFrame* pRefKF, Map* pMap);
-    MapPoint(const cv::Mat &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
+    MapPoint(const Eigen::Vector3f &Pos, KeyFrame* pRefKF, Map* pMap);
+    MapPoint(const Eigen::Vector3f &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
+
+    // MapPoints are allocated from a shared arena (see mnSlot)
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
 
-    void SetWorldPos(const cv::Mat &Pos);
-    cv::Mat GetWorldPos();
+    void SetWorldPos(const Eigen::Vector3f &Pos);
+    Eigen::Vector3f GetWorldPos();
 
-    cv::Mat GetNormal();
+    Eigen::Vector3f GetNormal();
     KeyFrame* GetReferenceKeyFrame();
 
-    std::map<KeyFrame*,size_t> GetObservations();
+    // Keyframes observing the point and index of the keypoint in each. Most points have a
+    // few observations, they are copied without allocating.
+    typedef SmallVector<std::pair<KeyFrame*,size_t>,8> ObservationVector;
+    ObservationVector GetObservations();
     int Observations();
 
+    // Number of keyframes observing the point at a pyramid level <= maxLevel.
+    int ObservationsUpToLevel(const int maxLevel);
+
     void AddObservation(KeyFrame* pKF,size_t idx);
     void EraseObservation(KeyFrame* pKF);
 
@@ -72,6 +89,9 @@ public:
 
     void ComputeDistinctiveDescriptors();
 
+    // Same for many points at once, split among the shared worker pool.
+    static void ComputeDistinctiveDescriptors(const std::vector<MapPoint*> &vpMPs);
+
     cv::Mat GetDescriptor();
 
     void UpdateNormalAndDepth();
@@ -84,6 +104,10 @@ public:
 public:
     long unsigned int mnId;
     static long unsigned int nNextId;
+    // Dense id: slot in the arena, reused once the point has been reclaimed
+    unsigned int mnSlot;
+    // Changed since the journal last wrote it (see Map::Touch)
+    std::atomic<bool> mbJournalDirty;
     long int mnFirstKFid;
     long int mnFirstFrame;
     int nObs;
@@ -97,6 +121,9 @@ public:
     float mTrackViewCos;
     long unsigned int mnTrackReferenceForFrame;
     long unsigned int mnLastFrameSeen;
+    // Number of local keyframes matching this point, and its position in the local map
+    int mnTrackLocalMapRefs;
+    int mnTrackLocalMapIdx;
 
     // Variables used by local mapping
     long unsigned int mnBALocalForKF;
@@ -106,7 +133,7 @@ public:
     long unsigned int mnLoopPointForKF;
     long unsigned int mnCorrectedByKF;
     long unsigned int mnCorrectedReference;    
-    cv::Mat mPosGBA;
+    Eigen::Vector3f mPosGBA;
     long unsigned int mnBAGlobalForKF;
 
 
@@ -115,13 +142,17 @@ public:
 protected:    
 
      // Position in absolute coordinates
-     cv::Mat mWorldPos;
+     Eigen::Vector3f mWorldPos;
 
      // Keyframes observing the point and associated index in keyframe
-     std::map<KeyFrame*,size_t> mObservations;
+     ObservationVector mObservations;
+
+     // Number of observations per pyramid level (last bin gathers the coarser levels)
+     static const int OBS_LEVELS = 16;
+     unsigned short mnObsPerLevel[OBS_LEVELS];
 
      // Mean viewing direction
-     cv::Mat mNormalVector;
+     Eigen::Vector3f mNormalVector;
 
      // Best descriptor to fast matching
      cv::Mat mDescriptor;
@@ -133,7 +164,7 @@ protected:
      int mnVisible;
      int mnFound;
 
-     // Bad flag (we do not currently erase MapPoint from memory)
+     // Bad flag. Bad points are erased from the map and deleted when no thread can reach them.
      bool mbBad;
      MapPoint* mpReplaced;
 
@@ -145,6 +176,11 @@ protected:
 
      std::mutex mMutexPos;
      std::mutex mMutexFeatures;
+
+     // Observation of pKF, end() if none (mMutexFeatures held)
+     ObservationVector::iterator FindObservation(KeyFrame* pKF);
+
+     static EntityArena<MapPoint> mArena;
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,108 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include<string>
+#include<mutex>
+#include<chrono>
+
+namespace ORB_SLAM2
+{
+
+class Map;
+
+// Hard limits on the size of the map and on the memory of the process, for long runs.
+// Settings (0 or missing means no limit):
+//   Memory.MaxKeyFrames, Memory.MaxMapPoints: keyframes and points in the map
+//   Memory.MaxRSS: resident memory of the process in MB
+//   Memory.TrajectoryFile: stream the trajectory of the frames to this file
+// Once the keyframe or memory limit is reached no new keyframes are created: the camera is
+// still tracked (localization) in the existing map. Creation resumes when both are back under
+// 90% of their limit, which mostly happens after a reset since keyframes are only culled when
+// new ones are inserted and the memory of the erased entities is kept for reuse. The point
+// limit only stops the creation of points: points keep being culled while keyframes are
+// inserted, and creation resumes under the limit.
+// The resident memory is read at most once per second (see Sample), not for every frame.
+class MemoryBudget
+{
+public:
+    struct Stats
+    {
+        long unsigned int nKeyFrames;
+        long unsigned int nMapPoints;
+        // Erased entities waiting to be deleted, and deleted so far
+        size_t nRetired;
+        size_t nReclaimed;
+        // Resident memory in bytes
+        size_t nRSS;
+        size_t nPeakRSS;
+    };
+
+    MemoryBudget(Map* pMap, const std::string &strSettingPath);
+
+    bool AllowNewKeyFrame();
+    bool AllowNewMapPoints();
+
+    // Sample the resident memory (keeps the peak). Returns it in bytes.
+    size_t Sample();
+    Stats GetStats();
+
+    // The map was cleared: the limits are checked again from scratch
+    void Reset();
+
+    const std::string &GetTrajectoryFile() const { return mStrTrajectoryFile; }
+
+    // Resident memory of the process in bytes (0 if unknown)
+    static size_t GetRSS();
+
+protected:
+
+    Map* mpMap;
+
+    long unsigned int mnMaxKeyFrames;
+    long unsigned int mnMaxMapPoints;
+    size_t mnMaxRSS;
+    std::string mStrTrajectoryFile;
+
+    // Keyframe creation resumes under these
+    long unsigned int mnResumeKeyFrames;
+    size_t mnResumeRSS;
+
+    // Last sample of the resident memory, the next one is taken after mtNextSample
+    size_t mnRSS;
+    size_t mnPeakRSS;
+    std::chrono::steady_clock::time_point mtNextSample;
+
+    // Resident memory, sampled again if the last sample is too old
+    size_t GetSampledRSS();
+
+    // No new keyframes until both limits are back under their resume level
+    bool mbKeyFramesFull;
+    // A message is printed the first time the point limit is reached
+    bool mbMapPointsFull;
+
+    std::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MEMORYBUDGET_H
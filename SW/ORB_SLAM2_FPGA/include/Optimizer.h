@@ -26,6 +26,7 @@
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Frame.h"
+#include "LocalBAGraph.h"
 
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
@@ -42,7 +43,8 @@ public:
                                  const bool bRobust = true);
     void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
                                        const unsigned long nLoopKF=0, const bool bRobust = true);
-    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap);
+    // pGraph keeps the g2o problem between calls (see LocalBAGraph)
+    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, LocalBAGraph* pGraph);
     int static PoseOptimization(Frame* pFrame);
 
     // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
@@ -55,6 +57,20 @@ public:
     // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono)
     static int OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches1,
                             g2o::Sim3 &g2oS12, const float th2, const bool bFixScale);
+
+    // Threads used by g2o in local and global bundle adjustment (Optimizer.nThreads, also the
+    // size of the WorkerPool)
+    void static SetNumThreads(const int nThreads);
+    int static GetNumThreads();
+
+    // Global bundle adjustment solves the reduced camera system with preconditioned conjugate
+    // gradient instead of sparse Cholesky from this number of keyframes on (0 never)
+    void static SetPCGMinKeyFrames(const int nKFs);
+    int static GetPCGMinKeyFrames();
+
+protected:
+    static int mnThreads;
+    static int mnPCGMinKeyFrames;
 };
 
 } //namespace ORB_SLAM
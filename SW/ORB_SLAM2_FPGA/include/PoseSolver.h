@@ -0,0 +1,335 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include<vector>
+#include<cmath>
+#include<limits>
+#include<algorithm>
+
+#include<Eigen/Core>
+#include<Eigen/Cholesky>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+
+namespace ORB_SLAM2
+{
+
+// Levenberg-Marquardt refinement of a camera pose Tcw from monocular (u,v) and stereo (u,v,ur)
+// observations of fixed 3D points. It solves the same problem as a g2o graph with a single
+// VertexSE3Expmap and EdgeSE3ProjectXYZOnlyPose/EdgeStereoSE3ProjectXYZOnlyPose edges: same
+// error, Jacobians, Huber weighting, damping schedule and stop criteria. The normal equations
+// are a fixed-size 6x6 system and the observations are stored as structure of arrays, so there
+// is no per-observation allocation and the inner loops are straight arithmetic over contiguous
+// arrays.
+class PoseSolver
+{
+public:
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+
+    PoseSolver(const double fx, const double fy, const double cx, const double cy, const double bf):
+        mfx(fx), mfy(fy), mcx(cx), mcy(cy), mbf(bf), mbRobust(true) {}
+
+    void Reserve(const size_t n)
+    {
+        mvX.reserve(n); mvY.reserve(n); mvZ.reserve(n);
+        mvU.reserve(n); mvV.reserve(n); mvUr.reserve(n);
+        mvInvSigma2.reserve(n); mvDelta.reserve(n);
+        mvbStereo.reserve(n); mvbActive.reserve(n);
+        mvXc.reserve(n); mvYc.reserve(n); mvZc.reserve(n);
+        mvE0.reserve(n); mvE1.reserve(n); mvE2.reserve(n); mvChi2.reserve(n);
+    }
+
+    size_t AddMono(const Eigen::Vector3d &Xw, const double u, const double v, const double invSigma2, const double delta)
+    {
+        return Add(Xw,u,v,-1,invSigma2,delta,false);
+    }
+
+    size_t AddStereo(const Eigen::Vector3d &Xw, const double u, const double v, const double ur,
+                     const double invSigma2, const double delta)
+    {
+        return Add(Xw,u,v,ur,invSigma2,delta,true);
+    }
+
+    size_t Size() const { return mvX.size(); }
+    bool IsStereo(const size_t i) const { return mvbStereo[i]; }
+
+    // Inactive observations are left out of the optimization (level 1 edges in g2o)
+    void SetActive(const size_t i, const bool bActive) { mvbActive[i] = bActive; }
+
+    // Huber kernel on/off
+    void SetRobust(const bool bRobust) { mbRobust = bRobust; }
+
+    // Chi2 of the last error computed for observation i
+    double Chi2(const size_t i) const { return mvChi2[i]; }
+
+    // Optimize Tcw for nIterations at most. Returns false if there is no active observation.
+    // As in g2o, the errors of the active observations are those of the last evaluated pose,
+    // which is a rejected step if the optimization stopped after too many failed trials.
+    bool Optimize(g2o::SE3Quat &Tcw, const int nIterations)
+    {
+        if(std::find(mvbActive.begin(),mvbActive.end(),(char)1)==mvbActive.end())
+            return false;
+
+        double currentChi = Evaluate(Tcw,true);
+        double lambda = 0;
+        double ni = 2;
+        int nBad = 0;
+
+        Matrix6d H;
+        Vector6d b;
+
+        for(int it=0; it<nIterations; it++)
+        {
+            const double iniChi = currentChi;
+
+            BuildSystem(H,b);
+
+            if(it==0)
+            {
+                double maxDiagonal = 0;
+                for(int j=0; j<6; j++)
+                    maxDiagonal = std::max(std::fabs(H(j,j)),maxDiagonal);
+                lambda = 1e-5*maxDiagonal;
+                ni = 2;
+                nBad = 0;
+            }
+
+            double rho = 0;
+            int nTrials = 0;
+            do
+            {
+                Matrix6d Hl = H;
+                Hl.diagonal().array() += lambda;
+                Eigen::LDLT<Matrix6d> ldlt(Hl);
+                const bool bSolved = ldlt.isPositive();
+                Vector6d x = Vector6d::Zero();
+                if(bSolved)
+                    x = ldlt.solve(b);
+
+                const g2o::SE3Quat Tnew = g2o::SE3Quat::exp(x)*Tcw;
+                double tempChi = Evaluate(Tnew,true);
+                if(!bSolved)
+                    tempChi = std::numeric_limits<double>::max();
+
+                rho = currentChi-tempChi;
+                const double scale = x.dot(lambda*x+b)+1e-3;
+                rho /= scale;
+
+                if(rho>0 && std::isfinite(tempChi) && bSolved)
+                {
+                    double alpha = 1.-pow((2*rho-1),3);
+                    alpha = std::min(alpha,2./3.);
+                    lambda *= std::max(1./3.,alpha);
+                    ni = 2;
+                    currentChi = tempChi;
+                    Tcw = Tnew;
+                }
+                else
+                {
+                    lambda *= ni;
+                    ni *= 2;
+                }
+                nTrials++;
+            } while(rho<0 && nTrials<10);
+
+            if(nTrials==10 || rho==0)
+                break;
+
+            if((iniChi-currentChi)*1e3<iniChi)
+                nBad++;
+            else
+                nBad=0;
+
+            if(nBad>=3)
+                break;
+        }
+
+        return true;
+    }
+
+    // Error of the inactive observations at Tcw (the active ones keep the error from Optimize).
+    void ComputeInactiveErrors(const g2o::SE3Quat &Tcw)
+    {
+        Evaluate(Tcw,false);
+    }
+
+protected:
+
+    size_t Add(const Eigen::Vector3d &Xw, const double u, const double v, const double ur,
+               const double invSigma2, const double delta, const bool bStereo)
+    {
+        mvX.push_back(Xw[0]); mvY.push_back(Xw[1]); mvZ.push_back(Xw[2]);
+        mvU.push_back(u); mvV.push_back(v); mvUr.push_back(ur);
+        mvInvSigma2.push_back(invSigma2);
+        mvDelta.push_back(delta);
+        mvbStereo.push_back(bStereo);
+        mvbActive.push_back(true);
+        mvXc.push_back(0); mvYc.push_back(0); mvZc.push_back(0);
+        mvE0.push_back(0); mvE1.push_back(0); mvE2.push_back(0);
+        mvChi2.push_back(0);
+        return mvX.size()-1;
+    }
+
+    // Transform, project and compute the error of the observations whose active flag is
+    // bActive. Returns the robust chi2 of those observations.
+    double Evaluate(const g2o::SE3Quat &Tcw, const bool bActive)
+    {
+        const Eigen::Matrix3d R = Tcw.rotation().toRotationMatrix();
+        const Eigen::Vector3d &t = Tcw.translation();
+        const double r00=R(0,0), r01=R(0,1), r02=R(0,2);
+        const double r10=R(1,0), r11=R(1,1), r12=R(1,2);
+        const double r20=R(2,0), r21=R(2,1), r22=R(2,2);
+        const double tx=t[0], ty=t[1], tz=t[2];
+
+        double chi2 = 0;
+        const size_t N = mvX.size();
+        for(size_t i=0; i<N; i++)
+        {
+            if((mvbActive[i]!=0)!=bActive)
+                continue;
+
+            const double x = r00*mvX[i]+r01*mvY[i]+r02*mvZ[i]+tx;
+            const double y = r10*mvX[i]+r11*mvY[i]+r12*mvZ[i]+ty;
+            const double z = r20*mvX[i]+r21*mvY[i]+r22*mvZ[i]+tz;
+            mvXc[i] = x;
+            mvYc[i] = y;
+            mvZc[i] = z;
+
+            const double w = mvInvSigma2[i];
+            double e2;
+            if(mvbStereo[i])
+            {
+                // Same single precision inverse depth as the g2o stereo edge
+                const float invz = 1.0f/z;
+                const double u = x*invz*mfx+mcx;
+                mvE0[i] = mvU[i]-u;
+                mvE1[i] = mvV[i]-(y*invz*mfy+mcy);
+                mvE2[i] = mvUr[i]-(u-mbf*invz);
+                e2 = mvE0[i]*(w*mvE0[i])+mvE1[i]*(w*mvE1[i])+mvE2[i]*(w*mvE2[i]);
+            }
+            else
+            {
+                mvE0[i] = mvU[i]-(x/z*mfx+mcx);
+                mvE1[i] = mvV[i]-(y/z*mfy+mcy);
+                e2 = mvE0[i]*(w*mvE0[i])+mvE1[i]*(w*mvE1[i]);
+            }
+            mvChi2[i] = e2;
+
+            if(mbRobust)
+            {
+                const double dsqr = mvDelta[i]*mvDelta[i];
+                chi2 += e2<=dsqr ? e2 : 2*std::sqrt(e2)*mvDelta[i]-dsqr;
+            }
+            else
+                chi2 += e2;
+        }
+
+        return chi2;
+    }
+
+    // Normal equations H*x = b at the pose of the last evaluation of the active observations
+    void BuildSystem(Matrix6d &H, Vector6d &b) const
+    {
+        H.setZero();
+        b.setZero();
+
+        Eigen::Matrix<double,3,6> J;
+        J(0,4) = 0;
+        J(1,3) = 0;
+        J(2,4) = 0;
+
+        const size_t N = mvX.size();
+        for(size_t i=0; i<N; i++)
+        {
+            if(!mvbActive[i])
+                continue;
+
+            const double x = mvXc[i];
+            const double y = mvYc[i];
+            const double invz = 1.0/mvZc[i];
+            const double invz_2 = invz*invz;
+
+            J(0,0) = x*y*invz_2*mfx;
+            J(0,1) = -(1+(x*x*invz_2))*mfx;
+            J(0,2) = y*invz*mfx;
+            J(0,3) = -invz*mfx;
+            J(0,5) = x*invz_2*mfx;
+
+            J(1,0) = (1+y*y*invz_2)*mfy;
+            J(1,1) = -x*y*invz_2*mfy;
+            J(1,2) = -x*invz*mfy;
+            J(1,4) = -invz*mfy;
+            J(1,5) = y*invz_2*mfy;
+
+            // Huber weight
+            double rho1 = 1;
+            if(mbRobust)
+            {
+                const double e2 = mvChi2[i];
+                if(e2>mvDelta[i]*mvDelta[i])
+                    rho1 = mvDelta[i]/std::sqrt(e2);
+            }
+            const double w = rho1*mvInvSigma2[i];
+
+            if(mvbStereo[i])
+            {
+                J(2,0) = J(0,0)-mbf*y*invz_2;
+                J(2,1) = J(0,1)+mbf*x*invz_2;
+                J(2,2) = J(0,2);
+                J(2,3) = J(0,3);
+                J(2,5) = J(0,5)-mbf*invz_2;
+
+                const Eigen::Vector3d e(mvE0[i],mvE1[i],mvE2[i]);
+                H.noalias() += w*J.transpose()*J;
+                b.noalias() -= w*J.transpose()*e;
+            }
+            else
+            {
+                const Eigen::Vector2d e(mvE0[i],mvE1[i]);
+                H.noalias() += w*J.topRows<2>().transpose()*J.topRows<2>();
+                b.noalias() -= w*J.topRows<2>().transpose()*e;
+            }
+        }
+    }
+
+    const double mfx, mfy, mcx, mcy, mbf;
+    bool mbRobust;
+
+    // Observations (structure of arrays)
+    std::vector<double> mvX, mvY, mvZ;
+    std::vector<double> mvU, mvV, mvUr;
+    std::vector<double> mvInvSigma2;
+    std::vector<double> mvDelta;
+    std::vector<char> mvbStereo;
+    std::vector<char> mvbActive;
+
+    // Last evaluation: point in camera coordinates, error and chi2
+    std::vector<double> mvXc, mvYc, mvZc;
+    std::vector<double> mvE0, mvE1, mvE2;
+    std::vector<double> mvChi2;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSESOLVER_H
@@ -0,0 +1,118 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SMALLVECTOR_H
+#define SMALLVECTOR_H
+
+#include<algorithm>
+#include<iterator>
+#include<cstddef>
+#include<stdint.h>
+
+namespace ORB_SLAM2
+{
+
+// Flat array that keeps up to N elements in place and only moves to the heap beyond that.
+// Meant for short lists of small, cheap to copy elements (pointers, pairs of integers):
+// copying one that fits in place does not allocate. Erasing keeps the order of the rest.
+template<class T, size_t N>
+class SmallVector
+{
+public:
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    SmallVector(): mpData(mInline), mnSize(0), mnCapacity(N) {}
+
+    SmallVector(const SmallVector &other): mpData(mInline), mnSize(0), mnCapacity(N)
+    {
+        assign(other.begin(),other.end());
+    }
+
+    ~SmallVector()
+    {
+        if(mpData!=mInline)
+            delete[] mpData;
+    }
+
+    SmallVector& operator=(const SmallVector &other)
+    {
+        if(this!=&other)
+            assign(other.begin(),other.end());
+        return *this;
+    }
+
+    template<class It>
+    void assign(It first, It last)
+    {
+        mnSize = 0;
+        reserve(std::distance(first,last));
+        for(; first!=last; first++)
+            mpData[mnSize++] = *first;
+    }
+
+    void reserve(const size_t n)
+    {
+        if(n<=mnCapacity)
+            return;
+        T* pData = new T[n];
+        std::copy(mpData,mpData+mnSize,pData);
+        if(mpData!=mInline)
+            delete[] mpData;
+        mpData = pData;
+        mnCapacity = n;
+    }
+
+    void push_back(const T &x)
+    {
+        if(mnSize==mnCapacity)
+            reserve(2*mnCapacity);
+        mpData[mnSize++] = x;
+    }
+
+    void erase(iterator it)
+    {
+        std::copy(it+1,end(),it);
+        mnSize--;
+    }
+
+    void clear() { mnSize = 0; }
+
+    size_t size() const { return mnSize; }
+    bool empty() const { return mnSize==0; }
+
+    iterator begin() { return mpData; }
+    iterator end() { return mpData+mnSize; }
+    const_iterator begin() const { return mpData; }
+    const_iterator end() const { return mpData+mnSize; }
+
+    T& operator[](const size_t i) { return mpData[i]; }
+    const T& operator[](const size_t i) const { return mpData[i]; }
+
+protected:
+    T* mpData;
+    uint32_t mnSize;
+    uint32_t mnCapacity;
+    T mInline[N];
+};
+
+} //namespace ORB_SLAM
+
+#endif // SMALLVECTOR_H
@@ -24,6 +24,7 @@
 
 #include<string>
 #include<thread>
+#include<future>
 #include<opencv2/core/core.hpp>
 
 #include "Tracking.h"
@@ -35,6 +36,7 @@
 #include "KeyFrameDatabase.h"
 #include "ORBVocabulary.h"
 #include "Viewer.h"
+#include "TrackingPipeline.h"
 
 namespace ORB_SLAM2
 {
@@ -45,6 +47,8 @@ class Map;
 class Tracking;
 class LocalMapping;
 class LoopClosing;
+class MemoryBudget;
+class MapJournal;
 
 class System
 {
@@ -77,6 +81,18 @@ public:
     // Returns the camera pose (empty if tracking fails).
     cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp);
 
+    // Pipelined versions of the functions above (opt-in). The frame is queued and the call returns
+    // right away. Color conversion, feature extraction and tracking of consecutive frames run
+    // concurrently in three threads. The future gets the camera pose (empty if tracking fails),
+    // or a std::runtime_error once the system has been shut down.
+    // The synchronous functions can still be called, they wait for the queued frames first.
+    std::future<cv::Mat> TrackStereoAsync(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp);
+    std::future<cv::Mat> TrackRGBDAsync(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp);
+    std::future<cv::Mat> TrackMonocularAsync(const cv::Mat &im, const double &timestamp);
+
+    // Queue depths and per-stage latencies of the pipeline (zero if it was never used).
+    TrackingPipeline::Stats GetPipelineStats();
+
     // This stops local mapping thread (map building) and performs only camera tracking.
     void ActivateLocalizationMode();
     // This resumes local mapping thread and performs SLAM again.
@@ -112,18 +128,40 @@ public:
     // See format details at: http://www.cvlibs.net/datasets/kitti/eval_odometry.php
     void SaveTrajectoryKITTI(const string &filename);
 
-    // TODO: Save/Load functions
-    // SaveMap(const string &filename);
-    // LoadMap(const string &filename);
+    // Save the map (keyframes, points, graph and place recognition database) as a binary map image.
+    // The map is serialized right away with Local Mapping stopped, the file is written by a
+    // background thread. Returns false if the map is empty.
+    bool SaveMap(const string &filename);
+
+    // Replace the map with a map image (see MapImage), or with the map replayed from a journal
+    // (see MapJournal). An image file is mapped in memory. The camera is then relocalized in the map.
+    // Call ActivateLocalizationMode() to only localize in it. Can be called in localization mode.
+    bool LoadMap(const string &filename);
 
     // Information from most recent processed frame
     // You can call this right after TrackMonocular (or stereo or RGBD)
     int GetTrackingState();
+    // Bad points are deleted a few frames after they are erased from the map, so the
+    // returned points must not be used after the next frames have been tracked.
     std::vector<MapPoint*> GetTrackedMapPoints();
     std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
 
 private:
 
+    friend class TrackingPipeline;
+
+    // Last stage of the pipeline: track an already built frame. Mode changes and resets are
+    // applied by the pipeline, before the frame is built.
+    cv::Mat TrackFrame(const Frame &frame, const cv::Mat &imGray);
+
+    // Apply pending localization mode changes and reset requests (before tracking a frame).
+    // With the pipeline, only while no frame is in flight.
+    bool ModeChangeOrResetPending();
+    void CheckModeChangeAndReset();
+
+    // Store the tracking state of the last frame and return its pose.
+    cv::Mat UpdateTrackingState(const Eigen::Matrix4f &Tcw);
+
     // Input sensor
     eSensor mSensor;
 
@@ -136,6 +174,9 @@ private:
     // Map structure that stores the pointers to all KeyFrames and MapPoints.
     Map* mpMap;
 
+    // Limits on the size of the map and the memory of the process (Memory.* settings).
+    MemoryBudget* mpMemoryBudget;
+
     // Tracker. It receives a frame and computes the associated camera pose.
     // It also decides when to insert a new keyframe, create some new MapPoints and
     // performs relocalization if tracking fails.
@@ -159,6 +200,12 @@ private:
     std::thread* mptLocalMapping;
     std::thread* mptLoopClosing;
     std::thread* mptViewer;
+    // Writes the last saved map, if any
+    std::thread* mptMapWriter;
+
+    // Journal of the map changes (Journal.* settings), written by its own thread. NULL if disabled.
+    MapJournal* mpJournal;
+    std::thread* mptJournal;
 
     // Reset flag
     std::mutex mMutexReset;
@@ -174,6 +221,9 @@ private:
     std::vector<MapPoint*> mTrackedMapPoints;
     std::vector<cv::KeyPoint> mTrackedKeyPointsUn;
     std::mutex mMutexState;
+
+    // Optional tracking pipeline, created on the first call to a Track*Async function.
+    TrackingPipeline* mpPipeline;
 };
 
 }// namespace ORB_SLAM
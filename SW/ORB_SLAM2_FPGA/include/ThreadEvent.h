@@ -0,0 +1,68 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADEVENT_H
+#define THREADEVENT_H
+
+#include<mutex>
+#include<condition_variable>
+#include<chrono>
+
+namespace ORB_SLAM2
+{
+
+// Wakes up threads waiting for a change in the state of an object (new keyframes, stop,
+// release, reset, finish...). The state itself keeps its own mutexes: call Notify() after
+// changing it, and WaitUntil() with a predicate that reads it.
+class ThreadEvent
+{
+public:
+
+    void Notify()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.notify_all();
+    }
+
+    // Block until pred() is true. Every change of the state read by pred() must be
+    // followed by Notify(), otherwise the waiting thread is never woken up.
+    template<class Predicate>
+    void WaitUntil(Predicate pred)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait(lock,pred);
+    }
+
+    // Same, giving up at tDeadline. Returns pred().
+    template<class Clock, class Duration, class Predicate>
+    bool WaitUntil(const std::chrono::time_point<Clock,Duration> &tDeadline, Predicate pred)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mCond.wait_until(lock,tDeadline,pred);
+    }
+
+protected:
+    std::mutex mMutex;
+    std::condition_variable mCond;
+};
+
+}// namespace ORB_SLAM2
+
+#endif // THREADEVENT_H
@@ -34,11 +34,14 @@
 #include "ORBVocabulary.h"
 #include"KeyFrameDatabase.h"
 #include"ORBextractor.h"
+#include"Undistorter.h"
 #include "Initializer.h"
 #include "MapDrawer.h"
 #include "System.h"
+#include "Trajectory.h"
 
 #include <mutex>
+#include <atomic>
 
 namespace ORB_SLAM2
 {
@@ -49,22 +52,38 @@ class Map;
 class LocalMapping;
 class LoopClosing;
 class System;
+class MemoryBudget;
 
 class Tracking
 {  
 
 public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
     Tracking(System* pSys, ORBVocabulary* pVoc, FrameDrawer* pFrameDrawer, MapDrawer* pMapDrawer, Map* pMap,
              KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor);
 
     // Preprocess the input and call Track(). Extract features and performs stereo matching.
-    cv::Mat GrabImageStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp);
-    cv::Mat GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp);
-    cv::Mat GrabImageMonocular(const cv::Mat &im, const double &timestamp);
+    // The returned pose is only valid if mCurrentFrame.mbHasPose is true.
+    Eigen::Matrix4f GrabImageStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp);
+    Eigen::Matrix4f GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp);
+    Eigen::Matrix4f GrabImageMonocular(const cv::Mat &im, const double &timestamp);
+
+    // The three steps of GrabImage*, usable from different threads (see TrackingPipeline).
+    // ConvertToGray and ConvertDepth are stateless, CreateFrame* use the ORB extractors and
+    // must not run concurrently with each other, TrackFrame must run in a single thread.
+    cv::Mat ConvertToGray(const cv::Mat &im);
+    cv::Mat ConvertDepth(const cv::Mat &imD);
+    Frame CreateFrameStereo(const cv::Mat &imGrayLeft, const cv::Mat &imGrayRight, const double &timestamp);
+    Frame CreateFrameRGBD(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timestamp);
+    Frame CreateFrameMonocular(const cv::Mat &imGray, const double &timestamp);
+    Eigen::Matrix4f TrackFrame(const Frame &frame, const cv::Mat &imGray);
 
     void SetLocalMapper(LocalMapping* pLocalMapper);
     void SetLoopClosing(LoopClosing* pLoopClosing);
     void SetViewer(Viewer* pViewer);
+    // No new keyframes or points are created while the budget is full
+    void SetMemoryBudget(MemoryBudget* pMemoryBudget);
 
     // Load new settings
     // The focal lenght should be similar or scale prediction will fail when projecting points
@@ -74,6 +93,13 @@ public:
     // Use this function if you have deactivated local mapping and you only want to localize the camera.
     void InformOnlyTracking(const bool &flag);
 
+    // Call after a map has been loaded (see System::LoadMap). The camera is relocalized in it.
+    void InformMapLoaded();
+
+    // Place the trajectory records of the keyframes erased from the map relative to their parent.
+    // Called after every frame, and before the trajectory is saved.
+    void UpdateTrajectory();
+
 
 public:
 
@@ -86,7 +112,8 @@ public:
         LOST=3
     };
 
-    eTrackingState mState;
+    // Also read by the frame construction stage of the pipeline (see CreateFrameMonocular)
+    std::atomic<eTrackingState> mState;
     eTrackingState mLastProcessedState;
 
     // Input sensor
@@ -103,12 +130,10 @@ public:
     std::vector<cv::Point3f> mvIniP3D;
     Frame mInitialFrame;
 
-    // Lists used to recover the full camera trajectory at the end of the execution.
+    // Used to recover the full camera trajectory at the end of the execution.
     // Basically we store the reference keyframe for each frame and its relative transformation
-    list<cv::Mat> mlRelativeFramePoses;
-    list<KeyFrame*> mlpReferences;
-    list<double> mlFrameTimes;
-    list<bool> mlbLost;
+    Trajectory mTrajectory;
+    std::vector<Map::ErasedKeyFrame> mvErasedKeyFrames;
 
     // True if local mapping is deactivated and we are performing only localization
     bool mbOnlyTracking;
@@ -120,6 +145,9 @@ protected:
     // Main tracking function. It is independent of the input sensor.
     void Track();
 
+    // First keyframe up the spanning tree that is not bad
+    KeyFrame* GetGoodKeyFrame(KeyFrame* pKF);
+
     // Map initialization for stereo and RGB-D
     void StereoInitialization();
 
@@ -137,6 +165,8 @@ protected:
     void UpdateLocalMap();
     void UpdateLocalPoints();
     void UpdateLocalKeyFrames();
+    void AddLocalMapPoint(MapPoint* pMP);
+    void EraseLocalMapPoint(MapPoint* pMP);
 
     bool TrackLocalMap();
     void SearchLocalPoints();
@@ -169,6 +199,17 @@ protected:
     KeyFrame* mpReferenceKF;
     std::vector<KeyFrame*> mvpLocalKeyFrames;
     std::vector<MapPoint*> mvpLocalMapPoints;
+
+    // Local map is maintained incrementally: keyframes whose points are currently in
+    // mvpLocalMapPoints, and the stamp of the last update.
+    std::vector<KeyFrame*> mvpLastLocalKeyFrames;
+    long unsigned int mnLocalMapStamp;
+    std::vector<KeyFrame*> mvpVotedKeyFrames;
+
+    // Epoch reader of the tracking, and epoch read at the beginning of the current frame.
+    // The epoch is announced once the frame and the local map hold no bad point.
+    int mnEpochReader;
+    unsigned long mnEpoch;
     
     // System
     System* mpSystem;
@@ -184,6 +225,7 @@ protected:
     //Calibration matrix
     cv::Mat mK;
     cv::Mat mDistCoef;
+    Undistorter mUndistorter;
     float mbf;
 
     //New KeyFrame rules (according to fps)
@@ -208,12 +250,15 @@ protected:
     unsigned int mnLastRelocFrameId;
 
     //Motion Model
-    cv::Mat mVelocity;
+    Eigen::Matrix4f mVelocity;
+    bool mbVelocity;
 
     //Color order (true RGB, false BGR, ignored if grayscale)
     bool mbRGB;
 
     list<MapPoint*> mlpTemporalPoints;
+
+    MemoryBudget* mpMemoryBudget;
 };
 
 } //namespace ORB_SLAM
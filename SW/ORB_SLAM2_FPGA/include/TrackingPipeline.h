@@ -0,0 +1,161 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACKINGPIPELINE_H
+#define TRACKINGPIPELINE_H
+
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<future>
+#include<chrono>
+
+#include<opencv2/core/core.hpp>
+
+#include "Frame.h"
+
+namespace ORB_SLAM2
+{
+
+class System;
+class Tracking;
+
+// Fixed capacity FIFO. Push blocks while full, Pop blocks while empty.
+template<class T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(const size_t nCapacity): mnCapacity(nCapacity) {}
+
+    void Push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondNotFull.wait(lock, [this]{return mQueue.size()<mnCapacity;});
+        mQueue.push_back(item);
+        mCondNotEmpty.notify_one();
+    }
+
+    T Pop()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondNotEmpty.wait(lock, [this]{return !mQueue.empty();});
+        T item = mQueue.front();
+        mQueue.pop_front();
+        mCondNotFull.notify_one();
+        return item;
+    }
+
+    size_t Size()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mQueue.size();
+    }
+
+protected:
+    const size_t mnCapacity;
+    std::deque<T> mQueue;
+    std::mutex mMutex;
+    std::condition_variable mCondNotFull;
+    std::condition_variable mCondNotEmpty;
+};
+
+// Optional pipelined front-end. Frames go through three threads connected by bounded queues:
+// grayscale/depth conversion, Frame construction (ORB extraction, undistortion, stereo matching)
+// and tracking. Throughput is bounded by the slowest stage instead of the sum of all of them.
+// Mode changes and resets are applied by the frame construction stage once every frame it
+// built has been tracked, so that no frame is in flight while the tracker changes.
+class TrackingPipeline
+{
+public:
+
+    struct Stats
+    {
+        // Frames waiting in front of each stage
+        size_t nQueued[3];
+        // Mean processing time of each stage and mean submit-to-pose latency (ms)
+        double tStage[3];
+        double tLatency;
+        unsigned long nFrames;
+    };
+
+    TrackingPipeline(System* pSystem, Tracking* pTracker, const int sensor, const size_t nQueueSize=2);
+    ~TrackingPipeline();
+
+    // Queue a frame. im2 is the right image (stereo), the depthmap (RGB-D) or empty (monocular).
+    // Images are copied if needed, the caller can reuse its buffers right away.
+    // The future gets the camera pose (empty if tracking fails). After Shutdown() the frame is
+    // not queued and the future holds a std::runtime_error.
+    std::future<cv::Mat> Push(const cv::Mat &im, const cv::Mat &im2, const double &timestamp);
+
+    // Wait until every queued frame has been tracked.
+    void Flush();
+
+    // Process the remaining frames and join the threads.
+    void Shutdown();
+
+    Stats GetStats();
+
+protected:
+
+    struct Request
+    {
+        cv::Mat im;
+        cv::Mat im2;
+        double timestamp;
+        Frame* pFrame;
+        std::promise<cv::Mat> pose;
+        std::chrono::steady_clock::time_point tSubmit;
+    };
+
+    void RunConvert();
+    void RunExtract();
+    void RunTrack();
+
+    void AddStageTime(const int stage, const std::chrono::steady_clock::time_point &t0);
+
+    System* mpSystem;
+    Tracking* mpTracker;
+    int mSensor;
+
+    BoundedQueue<Request*> mQueueConvert;
+    BoundedQueue<Request*> mQueueExtract;
+    BoundedQueue<Request*> mQueueTrack;
+
+    std::thread* mptConvert;
+    std::thread* mptExtract;
+    std::thread* mptTrack;
+
+    // Frames submitted but not tracked yet, and frames built but not tracked yet
+    std::mutex mMutexPending;
+    std::condition_variable mCondPending;
+    unsigned long mnPending;
+    unsigned long mnBuilt;
+    bool mbShutdown;
+
+    std::mutex mMutexStats;
+    double mtStage[3];
+    double mtLatency;
+    unsigned long mnFrames;
+};
+
+}// namespace ORB_SLAM2
+
+#endif // TRACKINGPIPELINE_H
@@ -0,0 +1,116 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include<vector>
+#include<string>
+#include<fstream>
+#include<unordered_map>
+
+#include<Eigen/Core>
+
+namespace ORB_SLAM2
+{
+
+// Pose of every tracked frame relative to its reference keyframe, to recover the full camera
+// trajectory at the end of the execution. Keyframes are referenced by id. When a keyframe is
+// erased from the map its records are placed relative to its parent (see Reparent), so that
+// they always refer to keyframes in the map.
+//
+// The records are kept in memory, or streamed to a binary file so that the memory used does
+// not grow with the length of the run. The records already in the file are placed when they
+// are read back, from the erased keyframes written to a second file (filename.erased).
+class Trajectory
+{
+public:
+    struct Record
+    {
+        double mTimeStamp;
+        long unsigned int mnRefKFId;
+        // Tcr, first three rows in row major order
+        float mTcr[12];
+        bool mbLost;
+
+        Eigen::Matrix4f GetTcr() const;
+        void SetTcr(const Eigen::Matrix4f &Tcr);
+    };
+
+    Trajectory();
+    ~Trajectory();
+
+    // Stream the records to filename from now on. Returns false if the file cannot be created.
+    bool SetFile(const std::string &filename);
+    bool IsStreaming() const { return !mFilename.empty(); }
+
+    void Add(const double timestamp, const long unsigned int nRefKFId, const Eigen::Matrix4f &Tcr, const bool bLost);
+
+    // A frame without pose: same time, reference and relative pose as the previous frame
+    void AddLast(const bool bLost);
+
+    // Keyframe nKFId was erased from the map, Tcp is its pose relative to nParentId
+    void Reparent(const long unsigned int nKFId, const long unsigned int nParentId, const Eigen::Matrix4f &Tcp);
+
+    bool Empty() const { return mnRecords==0; }
+    size_t Size() const { return mnRecords; }
+    // Last record as it was added (the reference keyframe is not updated by Reparent)
+    const Record &Last() const { return mLast; }
+
+    // Number of records in memory
+    size_t InMemory() const { return mvRecords.size(); }
+
+    // All the records, read back from the file when streaming
+    std::vector<Record> GetRecords();
+
+    // Drop all the records (reset of the system)
+    void Clear();
+
+protected:
+
+    void Flush();
+
+    // Records in memory, or waiting to be written when streaming
+    std::vector<Record> mvRecords;
+    Record mLast;
+    size_t mnRecords;
+
+    // Records of mvRecords by reference keyframe
+    std::unordered_map<long unsigned int,std::vector<size_t> > mmRecordsByKF;
+
+    // Last record, repeated by AddLast (updated by Reparent)
+    Record mLastRecord;
+
+    // Erased keyframe, as written to the second file when streaming
+    struct ErasedKeyFrame
+    {
+        long unsigned int mnKFId;
+        long unsigned int mnParentId;
+        float mTcp[12];
+    };
+
+    std::string mFilename;
+    std::ofstream mFile;
+    std::ofstream mFileErased;
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRAJECTORY_H
@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UNDISTORTER_H
+#define UNDISTORTER_H
+
+#include<vector>
+#include<opencv2/core/core.hpp>
+
+namespace ORB_SLAM2
+{
+
+// Undistorts keypoints by bilinear interpolation in a grid of exactly undistorted
+// image positions. The grid is built once per calibration and image size, and
+// checked against cv::undistortPoints before being used. It is not changed by
+// Undistort, so frames can be created concurrently (see TrackingPipeline).
+class Undistorter
+{
+public:
+    Undistorter();
+
+    // Set a new calibration and build the grid for images of width x height.
+    // Without the image size no grid is built (exact undistortion). Not to be
+    // called while frames are being created.
+    void SetCalibration(const cv::Mat &K, const cv::Mat &DistCoef, const int width=0, const int height=0);
+
+    // Fill vKeysUn with the undistorted vKeys. Falls back to cv::undistortPoints
+    // if the grid could not reach the required accuracy or was built for another
+    // image size.
+    void Undistort(const std::vector<cv::KeyPoint> &vKeys, std::vector<cv::KeyPoint> &vKeysUn,
+                   const int width, const int height) const;
+
+    // Exact (iterative) undistortion, also used to build and validate the grid.
+    void UndistortExact(const std::vector<cv::KeyPoint> &vKeys, std::vector<cv::KeyPoint> &vKeysUn) const;
+
+    // cv::undistortPoints on keypoints, for any calibration (also used by Frame without a grid)
+    static void UndistortExact(const std::vector<cv::KeyPoint> &vKeys, std::vector<cv::KeyPoint> &vKeysUn,
+                               const cv::Mat &K, const cv::Mat &DistCoef);
+
+protected:
+
+    void Build(const int width, const int height);
+
+    cv::Mat mK;
+    cv::Mat mDistCoef;
+    bool mbDistorted;
+
+    // Grid of undistorted coordinates, one node every mnStep pixels, row-major.
+    std::vector<float> mvMapX;
+    std::vector<float> mvMapY;
+    int mnStep;
+    float mfInvStep;
+    int mnCols;
+    int mnRows;
+    int mnWidth;
+    int mnHeight;
+
+    // False if the grid was not accurate enough even at the finest step.
+    bool mbUseGrid;
+};
+
+}// namespace ORB_SLAM2
+
+#endif // UNDISTORTER_H
@@ -26,6 +26,7 @@
 #include "MapDrawer.h"
 #include "Tracking.h"
 #include "System.h"
+#include "ThreadEvent.h"
 
 #include <mutex>
 
@@ -56,6 +57,10 @@ public:
 
     void Release();
 
+    // Block until the viewer has stopped/finished after RequestStop()/RequestFinish().
+    void WaitUntilStopped();
+    void WaitUntilFinished();
+
 private:
 
     bool Stop();
@@ -81,6 +86,9 @@ private:
     bool mbStopRequested;
     std::mutex mMutexStop;
 
+    // Notified on stop, release and finish
+    ThreadEvent mEventState;
+
 };
 
 }
@@ -0,0 +1,79 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include "ThreadEvent.h"
+
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<memory>
+#include<functional>
+
+namespace ORB_SLAM2
+{
+
+// Threads shared by the parallel loops of every thread of the system, instead of threads
+// created per call. Their number is set once, from Optimizer.nThreads, before the system runs.
+//
+// The calling thread takes part in its own loop and only waits for the indices already
+// taken by other threads, so concurrent and nested loops never deadlock: when the pool is
+// busy a loop simply runs on fewer threads.
+class WorkerPool
+{
+public:
+
+    static WorkerPool& Get();
+
+    ~WorkerPool();
+
+    // Threads running a loop, the calling one included (1 runs the loops serially)
+    void SetNumThreads(const int nThreads);
+    int GetNumThreads() const { return mnThreads; }
+
+    // Run f(i) for every i in [0,n), in any order, and return once all of them are done
+    void ParallelFor(const int n, const std::function<void(int)> &f);
+
+protected:
+
+    WorkerPool();
+
+    struct Job;
+
+    void Run();
+    void StopThreads();
+
+    int mnThreads;
+    std::vector<std::thread> mvThreads;
+
+    // Helpers of the running loops, several entries per loop. Idle workers block on
+    // mCondJobs until a loop is queued.
+    std::mutex mMutexJobs;
+    std::condition_variable mCondJobs;
+    std::deque<std::shared_ptr<Job> > mqJobs;
+    bool mbStop;
+};
+
+} //namespace ORB_SLAM
+
+#endif // WORKERPOOL_H
@@ -46,6 +46,14 @@ g2o::SE3Quat Converter::toSE3Quat(const cv::Mat &cvT)
     return g2o::SE3Quat(R,t);
 }
 
+g2o::SE3Quat Converter::toSE3Quat(const Eigen::Matrix4f &T)
+{
+    const Eigen::Matrix<double,3,3> R = T.block<3,3>(0,0).cast<double>();
+    const Eigen::Matrix<double,3,1> t = T.block<3,1>(0,3).cast<double>();
+
+    return g2o::SE3Quat(R,t);
+}
+
 cv::Mat Converter::toCvMat(const g2o::SE3Quat &SE3)
 {
     Eigen::Matrix<double,4,4> eigMat = SE3.to_homogeneous_matrix();
@@ -89,6 +97,35 @@ cv::Mat Converter::toCvMat(const Eigen::Matrix<double,3,1> &m)
     return cvMat.clone();
 }
 
+cv::Mat Converter::toCvMat(const Eigen::Matrix4f &m)
+{
+    cv::Mat cvMat(4,4,CV_32F);
+    for(int i=0;i<4;i++)
+        for(int j=0; j<4; j++)
+            cvMat.at<float>(i,j)=m(i,j);
+
+    return cvMat;
+}
+
+cv::Mat Converter::toCvMat(const Eigen::Matrix3f &m)
+{
+    cv::Mat cvMat(3,3,CV_32F);
+    for(int i=0;i<3;i++)
+        for(int j=0; j<3; j++)
+            cvMat.at<float>(i,j)=m(i,j);
+
+    return cvMat;
+}
+
+cv::Mat Converter::toCvMat(const Eigen::Vector3f &m)
+{
+    cv::Mat cvMat(3,1,CV_32F);
+    for(int i=0;i<3;i++)
+            cvMat.at<float>(i)=m(i);
+
+    return cvMat;
+}
+
 cv::Mat Converter::toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matrix<double,3,1> &t)
 {
     cv::Mat cvMat = cv::Mat::eye(4,4,CV_32F);
@@ -123,6 +160,11 @@ Eigen::Matrix<double,3,1> Converter::toVector3d(const cv::Point3f &cvPoint)
     return v;
 }
 
+Eigen::Matrix<double,3,1> Converter::toVector3d(const Eigen::Vector3f &v)
+{
+    return v.cast<double>();
+}
+
 Eigen::Matrix<double,3,3> Converter::toMatrix3d(const cv::Mat &cvMat3)
 {
     Eigen::Matrix<double,3,3> M;
@@ -134,6 +176,60 @@ Eigen::Matrix<double,3,3> Converter::toMatrix3d(const cv::Mat &cvMat3)
     return M;
 }
 
+Eigen::Matrix<double,3,3> Converter::toMatrix3d(const Eigen::Matrix3f &m)
+{
+    return m.cast<double>();
+}
+
+Eigen::Matrix4f Converter::toMatrix4f(const cv::Mat &cvT)
+{
+    Eigen::Matrix4f M;
+    for(int i=0;i<4;i++)
+        for(int j=0; j<4; j++)
+            M(i,j)=cvT.at<float>(i,j);
+
+    return M;
+}
+
+Eigen::Matrix4f Converter::toMatrix4f(const g2o::SE3Quat &SE3)
+{
+    return SE3.to_homogeneous_matrix().cast<float>();
+}
+
+Eigen::Matrix4f Converter::toMatrix4f(const g2o::Sim3 &Sim3)
+{
+    Eigen::Matrix4f M = Eigen::Matrix4f::Identity();
+    M.block<3,3>(0,0) = (Sim3.scale()*Sim3.rotation().toRotationMatrix()).cast<float>();
+    M.block<3,1>(0,3) = Sim3.translation().cast<float>();
+
+    return M;
+}
+
+Eigen::Matrix3f Converter::toMatrix3f(const cv::Mat &cvMat3)
+{
+    Eigen::Matrix3f M;
+    for(int i=0;i<3;i++)
+        for(int j=0; j<3; j++)
+            M(i,j)=cvMat3.at<float>(i,j);
+
+    return M;
+}
+
+Eigen::Vector3f Converter::toVector3f(const cv::Mat &cvVector)
+{
+    return Eigen::Vector3f(cvVector.at<float>(0), cvVector.at<float>(1), cvVector.at<float>(2));
+}
+
+Eigen::Vector3f Converter::toVector3f(const cv::Point3f &cvPoint)
+{
+    return Eigen::Vector3f(cvPoint.x, cvPoint.y, cvPoint.z);
+}
+
+Eigen::Vector3f Converter::toVector3f(const Eigen::Matrix<double,3,1> &v)
+{
+    return v.cast<float>();
+}
+
 std::vector<float> Converter::toQuaternion(const cv::Mat &M)
 {
     Eigen::Matrix<double,3,3> eigMat = toMatrix3d(M);
@@ -148,4 +244,17 @@ std::vector<float> Converter::toQuaternion(const cv::Mat &M)
     return v;
 }
 
+std::vector<float> Converter::toQuaternion(const Eigen::Matrix3f &M)
+{
+    Eigen::Quaterniond q(M.cast<double>());
+
+    std::vector<float> v(4);
+    v[0] = q.x();
+    v[1] = q.y();
+    v[2] = q.z();
+    v[3] = q.w();
+
+    return v;
+}
+
 } //namespace ORB_SLAM
@@ -0,0 +1,114 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Covisibility.h"
+#include "KeyFrame.h"
+
+#include<algorithm>
+#include<functional>
+#include<cstdlib>
+#include<new>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+Covisibility* Covisibility::Create(const vector<pair<KeyFrame*,int> > &vConnections, const int nMinOrderedWeight)
+{
+    // Scratch buffers, reused between calls of the same thread
+    static thread_local vector<pair<long unsigned int,pair<KeyFrame*,int> > > vById;
+    static thread_local vector<pair<int,KeyFrame*> > vPairs;
+
+    vById.clear();
+    vPairs.clear();
+    for(size_t i=0; i<vConnections.size(); i++)
+    {
+        vById.push_back(make_pair(vConnections[i].first->mnId,vConnections[i]));
+        if(vConnections[i].second>=nMinOrderedWeight)
+            vPairs.push_back(make_pair(vConnections[i].second,vConnections[i].first));
+    }
+    sort(vById.begin(),vById.end());
+
+    if(vPairs.empty() && !vConnections.empty())
+    {
+        size_t best = 0;
+        for(size_t i=1; i<vConnections.size(); i++)
+        {
+            if(vConnections[i].second>vConnections[best].second)
+                best = i;
+        }
+        vPairs.push_back(make_pair(vConnections[best].second,vConnections[best].first));
+    }
+    sort(vPairs.begin(),vPairs.end(),greater<pair<int,KeyFrame*> >());
+
+    const size_t N = vById.size();
+    const size_t M = vPairs.size();
+    void* p = malloc(sizeof(Covisibility)+N*(sizeof(KeyFrame*)+sizeof(long unsigned int)+sizeof(int))+
+                     M*(sizeof(KeyFrame*)+sizeof(int)));
+    if(!p)
+        throw bad_alloc();
+
+    Covisibility* pCov = new(p) Covisibility();
+    pCov->mnConnections = N;
+    pCov->mnOrdered = M;
+
+    KeyFrame** pConnections = pCov->Connections();
+    long unsigned int* pIds = pCov->ConnectionIds();
+    int* pWeights = pCov->ConnectionWeights();
+    for(size_t i=0; i<N; i++)
+    {
+        pConnections[i] = vById[i].second.first;
+        pIds[i] = vById[i].first;
+        pWeights[i] = vById[i].second.second;
+    }
+
+    KeyFrame** pOrdered = pCov->Ordered();
+    int* pOrderedWeights = pCov->OrderedWeights();
+    for(size_t i=0; i<M; i++)
+    {
+        pOrdered[i] = vPairs[i].second;
+        pOrderedWeights[i] = vPairs[i].first;
+    }
+
+    return pCov;
+}
+
+void Covisibility::operator delete(void *p)
+{
+    free(p);
+}
+
+int Covisibility::GetWeight(KeyFrame *pKF) const
+{
+    const long unsigned int* pIds = ConnectionIds();
+    const long unsigned int* pId = lower_bound(pIds,pIds+mnConnections,pKF->mnId);
+    if(pId==pIds+mnConnections || *pId!=pKF->mnId || Connections()[pId-pIds]!=pKF)
+        return 0;
+    return ConnectionWeights()[pId-pIds];
+}
+
+size_t Covisibility::NumOrderedWithWeight(const int w) const
+{
+    const int* pWeights = OrderedWeights();
+    return upper_bound(pWeights,pWeights+mnOrdered,w,greater<int>())-pWeights;
+}
+
+} //namespace ORB_SLAM
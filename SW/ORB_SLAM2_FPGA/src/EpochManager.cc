@@ -0,0 +1,140 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "EpochManager.h"
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+EpochManager::EpochManager(): mnEpoch(1), mnReclaimed(0)
+{
+}
+
+EpochManager::~EpochManager()
+{
+    Clear();
+}
+
+int EpochManager::Register()
+{
+    return Register(GetEpoch());
+}
+
+int EpochManager::Register(const unsigned long nEpoch)
+{
+    unique_lock<mutex> lock(mMutex);
+    for(size_t i=0; i<mvReaderStates.size(); i++)
+    {
+        if(mvReaderStates[i]==FREE)
+        {
+            mvReaderStates[i] = ACTIVE;
+            mvReaderEpochs[i] = nEpoch;
+            return i;
+        }
+    }
+    mvReaderStates.push_back(ACTIVE);
+    mvReaderEpochs.push_back(nEpoch);
+    return mvReaderStates.size()-1;
+}
+
+void EpochManager::Unregister(const int nReader)
+{
+    unique_lock<mutex> lock(mMutex);
+    mvReaderStates[nReader] = FREE;
+}
+
+unsigned long EpochManager::GetEpoch()
+{
+    unique_lock<mutex> lock(mMutex);
+    return mnEpoch;
+}
+
+void EpochManager::Announce(const int nReader, const unsigned long nEpoch)
+{
+    unique_lock<mutex> lock(mMutex);
+    mvReaderStates[nReader] = ACTIVE;
+    mvReaderEpochs[nReader] = nEpoch;
+}
+
+void EpochManager::SetIdle(const int nReader)
+{
+    unique_lock<mutex> lock(mMutex);
+    mvReaderStates[nReader] = IDLE;
+}
+
+size_t EpochManager::Reclaim()
+{
+    vector<Retired> vToDelete;
+    {
+        unique_lock<mutex> lock(mMutex);
+
+        // Entities retired from now on are newer than any epoch announced so far
+        const unsigned long nCurrent = mnEpoch++;
+
+        unsigned long nMin = nCurrent+1;
+        for(size_t i=0; i<mvReaderStates.size(); i++)
+        {
+            if(mvReaderStates[i]==ACTIVE && mvReaderEpochs[i]<nMin)
+                nMin = mvReaderEpochs[i];
+        }
+
+        // Retired in epoch order
+        while(!mdRetired.empty() && mdRetired.front().nEpoch<nMin)
+        {
+            vToDelete.push_back(mdRetired.front());
+            mdRetired.pop_front();
+        }
+        mnReclaimed += vToDelete.size();
+    }
+
+    for(size_t i=0; i<vToDelete.size(); i++)
+        vToDelete[i].pDelete(vToDelete[i].p);
+
+    return vToDelete.size();
+}
+
+void EpochManager::Clear()
+{
+    deque<Retired> dToDelete;
+    {
+        unique_lock<mutex> lock(mMutex);
+        dToDelete.swap(mdRetired);
+        mnReclaimed += dToDelete.size();
+    }
+
+    for(size_t i=0; i<dToDelete.size(); i++)
+        dToDelete[i].pDelete(dToDelete[i].p);
+}
+
+size_t EpochManager::NumRetired()
+{
+    unique_lock<mutex> lock(mMutex);
+    return mdRetired.size();
+}
+
+size_t EpochManager::NumReclaimed()
+{
+    unique_lock<mutex> lock(mMutex);
+    return mnReclaimed;
+}
+
+} //namespace ORB_SLAM
@@ -21,6 +21,7 @@
 #include "Frame.h"
 #include "Converter.h"
 #include "ORBmatcher.h"
+#include "WorkerPool.h"
 #include <thread>
 
 namespace ORB_SLAM2
@@ -33,17 +34,18 @@ float Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
 float Frame::mfGridElementWidthInv, Frame::mfGridElementHeightInv;
 
 Frame::Frame()
+    :mbHasPose(false)
 {}
 
 //Copy Constructor
 Frame::Frame(const Frame &frame)
     :mpORBvocabulary(frame.mpORBvocabulary), mpORBextractorLeft(frame.mpORBextractorLeft), mpORBextractorRight(frame.mpORBextractorRight),
-     mTimeStamp(frame.mTimeStamp), mK(frame.mK.clone()), mDistCoef(frame.mDistCoef.clone()),
+     mpUndistorter(frame.mpUndistorter), mTimeStamp(frame.mTimeStamp), mK(frame.mK.clone()), mDistCoef(frame.mDistCoef.clone()),
      mbf(frame.mbf), mb(frame.mb), mThDepth(frame.mThDepth), N(frame.N), mvKeys(frame.mvKeys),
      mvKeysRight(frame.mvKeysRight), mvKeysUn(frame.mvKeysUn),  mvuRight(frame.mvuRight),
      mvDepth(frame.mvDepth), mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec),
      mDescriptors(frame.mDescriptors.clone()), mDescriptorsRight(frame.mDescriptorsRight.clone()),
-     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mnId(frame.mnId),
+     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mbHasPose(false), mnId(frame.mnId),
      mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels),
      mfScaleFactor(frame.mfScaleFactor), mfLogScaleFactor(frame.mfLogScaleFactor),
      mvScaleFactors(frame.mvScaleFactors), mvInvScaleFactors(frame.mvInvScaleFactors),
@@ -53,14 +55,14 @@ Frame::Frame(const Frame &frame)
         for(int j=0; j<FRAME_GRID_ROWS; j++)
             mGrid[i][j]=frame.mGrid[i][j];
 
-    if(!frame.mTcw.empty())
+    if(frame.mbHasPose)
         SetPose(frame.mTcw);
 }
 
 
-Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
-    :mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
-     mpReferenceKF(static_cast<KeyFrame*>(NULL))
+Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, Undistorter* undistorter, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+    :mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mpUndistorter(undistorter), mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
+     mbHasPose(false), mpReferenceKF(static_cast<KeyFrame*>(NULL))
 {
     // Frame ID
     mnId=nNextId++;
@@ -85,7 +87,7 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     if(mvKeys.empty())
         return;
 
-    UndistortKeyPoints();
+    UndistortKeyPoints(imLeft);
 
     ComputeStereoMatches();
 
@@ -116,9 +118,10 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     AssignFeaturesToGrid();
 }
 
-Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor, Undistorter* undistorter, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
-     mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth)
+     mpUndistorter(undistorter), mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
+     mbHasPose(false)
 {
     // Frame ID
     mnId=nNextId++;
@@ -140,7 +143,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
     if(mvKeys.empty())
         return;
 
-    UndistortKeyPoints();
+    UndistortKeyPoints(imGray);
 
     ComputeStereoFromRGBD(imDepth);
 
@@ -171,9 +174,10 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 }
 
 
-Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor, Undistorter* undistorter, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
-     mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth)
+     mpUndistorter(undistorter), mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
+     mbHasPose(false)
 {
     // Frame ID
     mnId=nNextId++;
@@ -195,7 +199,7 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     if(mvKeys.empty())
         return;
 
-    UndistortKeyPoints();
+    UndistortKeyPoints(imGray);
 
     // Set no stereo information
     mvuRight = vector<float>(N,-1);
@@ -252,18 +256,19 @@ void Frame::ExtractORB(int flag, const cv::Mat &im)
         (*mpORBextractorRight)(im,cv::Mat(),mvKeysRight,mDescriptorsRight);
 }
 
-void Frame::SetPose(cv::Mat Tcw)
+void Frame::SetPose(const Eigen::Matrix4f &Tcw)
 {
-    mTcw = Tcw.clone();
+    mTcw = Tcw;
+    mbHasPose = true;
     UpdatePoseMatrices();
 }
 
 void Frame::UpdatePoseMatrices()
 { 
-    mRcw = mTcw.rowRange(0,3).colRange(0,3);
-    mRwc = mRcw.t();
-    mtcw = mTcw.rowRange(0,3).col(3);
-    mOw = -mRcw.t()*mtcw;
+    mRcw = mTcw.block<3,3>(0,0);
+    mRwc = mRcw.transpose();
+    mtcw = mTcw.block<3,1>(0,3);
+    mOw = -mRwc*mtcw;
 }
 
 bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
@@ -271,13 +276,13 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     pMP->mbTrackInView = false;
 
     // 3D in absolute coordinates
-    cv::Mat P = pMP->GetWorldPos(); 
+    const Eigen::Vector3f P = pMP->GetWorldPos(); 
 
     // 3D in camera coordinates
-    const cv::Mat Pc = mRcw*P+mtcw;
-    const float &PcX = Pc.at<float>(0);
-    const float &PcY= Pc.at<float>(1);
-    const float &PcZ = Pc.at<float>(2);
+    const Eigen::Vector3f Pc = mRcw*P+mtcw;
+    const float &PcX = Pc(0);
+    const float &PcY= Pc(1);
+    const float &PcZ = Pc(2);
 
     // Check positive depth
     if(PcZ<0.0f)
@@ -296,14 +301,14 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     // Check distance is in the scale invariance region of the MapPoint
     const float maxDistance = pMP->GetMaxDistanceInvariance();
     const float minDistance = pMP->GetMinDistanceInvariance();
-    const cv::Mat PO = P-mOw;
-    const float dist = cv::norm(PO);
+    const Eigen::Vector3f PO = P-mOw;
+    const float dist = PO.norm();
 
     if(dist<minDistance || dist>maxDistance)
         return false;
 
    // Check viewing angle
-    cv::Mat Pn = pMP->GetNormal();
+    const Eigen::Vector3f Pn = pMP->GetNormal();
 
     const float viewCos = PO.dot(Pn)/dist;
 
@@ -401,7 +406,7 @@ void Frame::ComputeBoW()
     }
 }
 
-void Frame::UndistortKeyPoints()
+void Frame::UndistortKeyPoints(const cv::Mat &im)
 {
     if(mDistCoef.at<float>(0)==0.0)
     {
@@ -409,28 +414,10 @@ void Frame::UndistortKeyPoints()
         return;
     }
 
-    // Fill matrix with points
-    cv::Mat mat(N,2,CV_32F);
-    for(int i=0; i<N; i++)
-    {
-        mat.at<float>(i,0)=mvKeys[i].pt.x;
-        mat.at<float>(i,1)=mvKeys[i].pt.y;
-    }
-
-    // Undistort points
-    mat=mat.reshape(2);
-    cv::undistortPoints(mat,mat,mK,mDistCoef,cv::Mat(),mK);
-    mat=mat.reshape(1);
-
-    // Fill undistorted keypoint vector
-    mvKeysUn.resize(N);
-    for(int i=0; i<N; i++)
-    {
-        cv::KeyPoint kp = mvKeys[i];
-        kp.pt.x=mat.at<float>(i,0);
-        kp.pt.y=mat.at<float>(i,1);
-        mvKeysUn[i]=kp;
-    }
+    if(mpUndistorter)
+        mpUndistorter->Undistort(mvKeys,mvKeysUn,im.cols,im.rows);
+    else
+        Undistorter::UndistortExact(mvKeys,mvKeysUn,mK,mDistCoef);
 }
 
 void Frame::ComputeImageBounds(const cv::Mat &imLeft)
@@ -463,54 +450,126 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft)
     }
 }
 
+// Hamming distance between two 256-bit ORB descriptors, 64 bits at a time
+static inline int DescriptorDistance256(const uchar *a, const uchar *b)
+{
+    const uint64_t *pa = reinterpret_cast<const uint64_t*>(a);
+    const uint64_t *pb = reinterpret_cast<const uint64_t*>(b);
+    return __builtin_popcountll(pa[0]^pb[0]) + __builtin_popcountll(pa[1]^pb[1]) +
+           __builtin_popcountll(pa[2]^pb[2]) + __builtin_popcountll(pa[3]^pb[3]);
+}
+
 void Frame::ComputeStereoMatches()
 {
     mvuRight = vector<float>(N,-1.0f);
     mvDepth = vector<float>(N,-1.0f);
 
-    const int thOrbDist = (ORBmatcher::TH_HIGH+ORBmatcher::TH_LOW)/2;
-
     const int nRows = mpORBextractorLeft->mvImagePyramid[0].rows;
 
-    //Assign keypoints to row table
-    vector<vector<size_t> > vRowIndices(nRows,vector<size_t>());
-
-    for(int i=0; i<nRows; i++)
-        vRowIndices[i].reserve(200);
-
+    // Assign right keypoints to a flat row table (counting sort by row)
     const int Nr = mvKeysRight.size();
+    vector<int> vRowStart(nRows+1,0);
+    vector<int> vMinRow(Nr), vMaxRow(Nr);
 
     for(int iR=0; iR<Nr; iR++)
     {
         const cv::KeyPoint &kp = mvKeysRight[iR];
         const float &kpY = kp.pt.y;
-        const float r = 2.0f*mvScaleFactors[mvKeysRight[iR].octave];
-        const int maxr = ceil(kpY+r);
-        const int minr = floor(kpY-r);
+        const float r = 2.0f*mvScaleFactors[kp.octave];
+        vMaxRow[iR] = min(nRows-1,(int)ceil(kpY+r));
+        vMinRow[iR] = max(0,(int)floor(kpY-r));
+
+        for(int yi=vMinRow[iR];yi<=vMaxRow[iR];yi++)
+            vRowStart[yi+1]++;
+    }
+
+    for(int yi=0; yi<nRows; yi++)
+        vRowStart[yi+1] += vRowStart[yi];
+
+    vector<int> vRowIdx(vRowStart[nRows]);
+    vector<int> vRowFill(vRowStart.begin(),vRowStart.end()-1);
+    for(int iR=0; iR<Nr; iR++)
+        for(int yi=vMinRow[iR];yi<=vMaxRow[iR];yi++)
+            vRowIdx[vRowFill[yi]++] = iR;
+
+    // For each left keypoint search a match in the right image
+    const int nThreads = N<200 ? 1 : WorkerPool::Get().GetNumThreads();
+    vector<vector<pair<int, int> > > vvDistIdx(nThreads);
 
-        for(int yi=minr;yi<=maxr;yi++)
-            vRowIndices[yi].push_back(iR);
+    if(nThreads==1)
+    {
+        ComputeStereoMatchesRange(0,N,vRowStart,vRowIdx,vvDistIdx[0]);
+    }
+    else
+    {
+        const int nChunk = (N+nThreads-1)/nThreads;
+        WorkerPool::Get().ParallelFor(nThreads,[&](int t)
+        {
+            const int iniL = t*nChunk;
+            const int endL = min(N,iniL+nChunk);
+            ComputeStereoMatchesRange(iniL,endL,vRowStart,vRowIdx,vvDistIdx[t]);
+        });
     }
 
+    vector<pair<int, int> > vDistIdx;
+    vDistIdx.reserve(N);
+    for(int t=0; t<nThreads; t++)
+        vDistIdx.insert(vDistIdx.end(),vvDistIdx[t].begin(),vvDistIdx[t].end());
+
+    if(vDistIdx.empty())
+        return;
+
+    sort(vDistIdx.begin(),vDistIdx.end());
+    const float median = vDistIdx[vDistIdx.size()/2].first;
+    const float thDist = 1.5f*1.4f*median;
+
+    for(int i=vDistIdx.size()-1;i>=0;i--)
+    {
+        if(vDistIdx[i].first<thDist)
+            break;
+        else
+        {
+            mvuRight[vDistIdx[i].second]=-1;
+            mvDepth[vDistIdx[i].second]=-1;
+        }
+    }
+}
+
+void Frame::ComputeStereoMatchesRange(const int iniL, const int endL, const vector<int> &vRowStart,
+                                      const vector<int> &vRowIdx, vector<pair<int,int> > &vDistIdx)
+{
+    const int thOrbDist = (ORBmatcher::TH_HIGH+ORBmatcher::TH_LOW)/2;
+
     // Set limits for search
     const float minZ = mb;
     const float minD = 0;
     const float maxD = mbf/minZ;
 
-    // For each left keypoint search a match in the right image
-    vector<pair<int, int> > vDistIdx;
-    vDistIdx.reserve(N);
+    // Correlation window half size and search range
+    const int w = 5;
+    const int L = 5;
+    const int W = 2*w+1;
 
-    for(int iL=0; iL<N; iL++)
+    vDistIdx.reserve(endL-iniL);
+
+    short IL[W*W];
+    int vDists[2*L+1];
+
+    for(int iL=iniL; iL<endL; iL++)
     {
         const cv::KeyPoint &kpL = mvKeys[iL];
         const int &levelL = kpL.octave;
         const float &vL = kpL.pt.y;
         const float &uL = kpL.pt.x;
 
-        const vector<size_t> &vCandidates = vRowIndices[vL];
+        const int row = vL;
+        if(row<0 || row+1>=(int)vRowStart.size())
+            continue;
+
+        const int *pCand = &vRowIdx[0]+vRowStart[row];
+        const int nCand = vRowStart[row+1]-vRowStart[row];
 
-        if(vCandidates.empty())
+        if(nCand==0)
             continue;
 
         const float minU = uL-maxD;
@@ -520,14 +579,14 @@ void Frame::ComputeStereoMatches()
             continue;
 
         int bestDist = ORBmatcher::TH_HIGH;
-        size_t bestIdxR = 0;
+        int bestIdxR = 0;
 
-        const cv::Mat &dL = mDescriptors.row(iL);
+        const uchar *dL = mDescriptors.ptr<uchar>(iL);
 
         // Compare descriptor to right keypoints
-        for(size_t iC=0; iC<vCandidates.size(); iC++)
+        for(int iC=0; iC<nCand; iC++)
         {
-            const size_t iR = vCandidates[iC];
+            const int iR = pCand[iC];
             const cv::KeyPoint &kpR = mvKeysRight[iR];
 
             if(kpR.octave<levelL-1 || kpR.octave>levelL+1)
@@ -537,8 +596,7 @@ void Frame::ComputeStereoMatches()
 
             if(uR>=minU && uR<=maxU)
             {
-                const cv::Mat &dR = mDescriptorsRight.row(iR);
-                const int dist = ORBmatcher::DescriptorDistance(dL,dR);
+                const int dist = DescriptorDistance256(dL,mDescriptorsRight.ptr<uchar>(iR));
 
                 if(dist<bestDist)
                 {
@@ -554,37 +612,48 @@ void Frame::ComputeStereoMatches()
             // coordinates in image pyramid at keypoint scale
             const float uR0 = mvKeysRight[bestIdxR].pt.x;
             const float scaleFactor = mvInvScaleFactors[kpL.octave];
-            const float scaleduL = round(kpL.pt.x*scaleFactor);
-            const float scaledvL = round(kpL.pt.y*scaleFactor);
-            const float scaleduR0 = round(uR0*scaleFactor);
-
-            // sliding window search
-            const int w = 5;
-            cv::Mat IL = mpORBextractorLeft->mvImagePyramid[kpL.octave].rowRange(scaledvL-w,scaledvL+w+1).colRange(scaleduL-w,scaleduL+w+1);
-            IL.convertTo(IL,CV_32F);
-            IL = IL - IL.at<float>(w,w) *cv::Mat::ones(IL.rows,IL.cols,CV_32F);
+            const int scaleduL = round(kpL.pt.x*scaleFactor);
+            const int scaledvL = round(kpL.pt.y*scaleFactor);
+            const int scaleduR0 = round(uR0*scaleFactor);
 
-            int bestDist = INT_MAX;
-            int bestincR = 0;
-            const int L = 5;
-            vector<float> vDists;
-            vDists.resize(2*L+1);
+            const cv::Mat &imL = mpORBextractorLeft->mvImagePyramid[kpL.octave];
+            const cv::Mat &imR = mpORBextractorRight->mvImagePyramid[kpL.octave];
 
-            const float iniu = scaleduR0+L-w;
-            const float endu = scaleduR0+L+w+1;
-            if(iniu<0 || endu >= mpORBextractorRight->mvImagePyramid[kpL.octave].cols)
+            if(scaledvL-w<0 || scaledvL+w>=imL.rows || scaleduL-w<0 || scaleduL+w>=imL.cols)
+                continue;
+            if(scaleduR0-L-w<0 || scaleduR0+L+w>=imR.cols)
                 continue;
 
+            // Left window with the central intensity removed
+            const int cL = imL.ptr<uchar>(scaledvL)[scaleduL];
+            for(int r=0; r<W; r++)
+            {
+                const uchar *pL = imL.ptr<uchar>(scaledvL-w+r)+scaleduL-w;
+                for(int c=0; c<W; c++)
+                    IL[r*W+c] = (short)pL[c]-cL;
+            }
+
+            // sliding window search (integer SAD on the raw pyramid bytes)
+            int bestSAD = INT_MAX;
+            int bestincR = 0;
+
             for(int incR=-L; incR<=+L; incR++)
             {
-                cv::Mat IR = mpORBextractorRight->mvImagePyramid[kpL.octave].rowRange(scaledvL-w,scaledvL+w+1).colRange(scaleduR0+incR-w,scaleduR0+incR+w+1);
-                IR.convertTo(IR,CV_32F);
-                IR = IR - IR.at<float>(w,w) *cv::Mat::ones(IR.rows,IR.cols,CV_32F);
+                const int u0 = scaleduR0+incR;
+                const int cR = imR.ptr<uchar>(scaledvL)[u0];
 
-                float dist = cv::norm(IL,IR,cv::NORM_L1);
-                if(dist<bestDist)
+                int dist = 0;
+                for(int r=0; r<W; r++)
+                {
+                    const uchar *pR = imR.ptr<uchar>(scaledvL-w+r)+u0-w;
+                    const short *pIL = IL+r*W;
+                    for(int c=0; c<W; c++)
+                        dist += abs(pIL[c]-((short)pR[c]-cR));
+                }
+
+                if(dist<bestSAD)
                 {
-                    bestDist =  dist;
+                    bestSAD = dist;
                     bestincR = incR;
                 }
 
@@ -618,25 +687,10 @@ void Frame::ComputeStereoMatches()
                 }
                 mvDepth[iL]=mbf/disparity;
                 mvuRight[iL] = bestuR;
-                vDistIdx.push_back(pair<int,int>(bestDist,iL));
+                vDistIdx.push_back(pair<int,int>(bestSAD,iL));
             }
         }
     }
-
-    sort(vDistIdx.begin(),vDistIdx.end());
-    const float median = vDistIdx[vDistIdx.size()/2].first;
-    const float thDist = 1.5f*1.4f*median;
-
-    for(int i=vDistIdx.size()-1;i>=0;i--)
-    {
-        if(vDistIdx[i].first<thDist)
-            break;
-        else
-        {
-            mvuRight[vDistIdx[i].second]=-1;
-            mvDepth[vDistIdx[i].second]=-1;
-        }
-    }
 }
 
 
@@ -663,7 +717,7 @@ void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)
     }
 }
 
-cv::Mat Frame::UnprojectStereo(const int &i)
+bool Frame::UnprojectStereo(const int &i, Eigen::Vector3f &x3D)
 {
     const float z = mvDepth[i];
     if(z>0)
@@ -672,11 +726,12 @@ cv::Mat Frame::UnprojectStereo(const int &i)
         const float v = mvKeysUn[i].pt.y;
         const float x = (u-cx)*z*invfx;
         const float y = (v-cy)*z*invfy;
-        cv::Mat x3Dc = (cv::Mat_<float>(3,1) << x, y, z);
-        return mRwc*x3Dc+mOw;
+        const Eigen::Vector3f x3Dc(x, y, z);
+        x3D = mRwc*x3Dc+mOw;
+        return true;
     }
     else
-        return cv::Mat();
+        return false;
 }
 
 } //namespace ORB_SLAM
@@ -21,18 +21,34 @@
 #include "KeyFrame.h"
 #include "Converter.h"
 #include "ORBmatcher.h"
+#include "MapImage.h"
 #include<mutex>
+#include<unordered_map>
+#include<cassert>
 
 namespace ORB_SLAM2
 {
 
 long unsigned int KeyFrame::nNextId=0;
+EntityArena<KeyFrame> KeyFrame::mArena(256);
+
+void* KeyFrame::operator new(size_t size)
+{
+    // The arena keeps the slot index right after the object
+    assert(size<=sizeof(KeyFrame));
+    return mArena.Allocate();
+}
+
+void KeyFrame::operator delete(void *p)
+{
+    mArena.Free(p);
+}
 
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
     mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
-    mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
+    mnBAGlobalForKF(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
     mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
     mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
@@ -44,6 +60,17 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap)
 {
     mnId=nNextId++;
+    mnSlot=mArena.GetSlot(this);
+    mnEpochReader=-1;
+    mbJournalDirty=false;
+
+    mnTrackVotesForFrame=0;
+    mnTrackVotes=0;
+    mbTrackInLocalMap=false;
+    mnTrackLocalMapStamp=0;
+    mnTrackLocalMapVersion=0;
+    mnMatchesVersion=0;
+    mpCovisibility = Covisibility::Create(vector<pair<KeyFrame*,int> >());
 
     mGrid.resize(mnGridCols);
     for(int i=0; i<mnGridCols;i++)
@@ -56,6 +83,86 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     SetPose(F.mTcw);    
 }
 
+KeyFrame::KeyFrame(const MapImage &image, const size_t i, Map *pMap, KeyFrameDatabase *pKFDB, ORBVocabulary *pVoc):
+    mnFrameId(image.GetKeyFrame(i).frame_id), mTimeStamp(image.GetKeyFrame(i).timestamp),
+    mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
+    mfGridElementWidthInv(image.GetHeader().camera.gridElementWidthInv), mfGridElementHeightInv(image.GetHeader().camera.gridElementHeightInv),
+    mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
+    mnBAGlobalForKF(0),
+    fx(image.GetHeader().camera.fx), fy(image.GetHeader().camera.fy), cx(image.GetHeader().camera.cx), cy(image.GetHeader().camera.cy),
+    invfx(1.0f/image.GetHeader().camera.fx), invfy(1.0f/image.GetHeader().camera.fy),
+    mbf(image.GetHeader().camera.bf), mb(image.GetHeader().camera.bf/image.GetHeader().camera.fx), mThDepth(image.GetHeader().camera.thDepth),
+    N(image.GetKeyFrame(i).n_features),
+    mvKeys(image.GetKeyPoints(image.GetKeyFrame(i),false)), mvKeysUn(image.GetKeyPoints(image.GetKeyFrame(i),true)),
+    mvuRight(image.GetFloats(image.GetKeyFrame(i),MapImage::KEYS_U_RIGHT)),
+    mvDepth(image.GetFloats(image.GetKeyFrame(i),MapImage::KEYS_DEPTH)),
+    mDescriptors(image.GetKeyFrame(i).n_features,32,CV_8U,
+                 const_cast<unsigned char*>(image.Get<unsigned char>(MapImage::DESCRIPTORS)+32*image.GetKeyFrame(i).features)),
+    mnScaleLevels(image.GetHeader().camera.scaleLevels), mfScaleFactor(image.GetHeader().camera.scaleFactor),
+    mfLogScaleFactor(log(image.GetHeader().camera.scaleFactor)), mvScaleFactors(image.GetScaleFactors()),
+    mvLevelSigma2(image.GetLevelSigma2()), mvInvLevelSigma2(image.GetInvLevelSigma2()),
+    mnMinX(image.GetHeader().camera.minX), mnMinY(image.GetHeader().camera.minY), mnMaxX(image.GetHeader().camera.maxX),
+    mnMaxY(image.GetHeader().camera.maxY), mK(image.GetK()), mvpMapPoints(image.GetKeyFrame(i).n_features,static_cast<MapPoint*>(NULL)),
+    mpKeyFrameDB(pKFDB), mpORBvocabulary(pVoc), mbFirstConnection(false), mpParent(NULL), mbNotErase(false),
+    mbToBeErased(false), mbBad(false), mHalfBaseline(image.GetHeader().camera.bf/image.GetHeader().camera.fx/2), mpMap(pMap)
+{
+    const MapImage::KeyFrameRecord &r = image.GetKeyFrame(i);
+
+    mnId=r.id;
+    mnSlot=mArena.GetSlot(this);
+    mnEpochReader=-1;
+    mbJournalDirty=false;
+
+    mnTrackVotesForFrame=0;
+    mnTrackVotes=0;
+    mbTrackInLocalMap=false;
+    mnTrackLocalMapStamp=0;
+    mnTrackLocalMapVersion=0;
+    mnMatchesVersion=0;
+    mpCovisibility = Covisibility::Create(vector<pair<KeyFrame*,int> >());
+
+    // BoW and feature vectors are stored sorted, as they are kept in memory
+    const uint32_t* pWords = image.Get<uint32_t>(MapImage::BOW_WORDS)+r.bow;
+    const double* pWeights = image.Get<double>(MapImage::BOW_WEIGHTS)+r.bow;
+    mBowVec.reserve(r.n_bow);
+    for(size_t j=0; j<r.n_bow; j++)
+        mBowVec.push_back(make_pair(pWords[j],pWeights[j]));
+
+    const uint32_t* pNodes = image.Get<uint32_t>(MapImage::FEAT_NODES);
+    const uint64_t* pOffsets = image.Get<uint64_t>(MapImage::FEAT_OFFSETS);
+    const uint32_t* pIndices = image.Get<uint32_t>(MapImage::FEAT_INDICES);
+    const size_t nFirst = r.feat_nodes;
+    const size_t nLast = r.feat_nodes+r.n_feat_nodes;
+    mFeatVec.reserve(r.n_feat_nodes,pOffsets[nLast]-pOffsets[nFirst]);
+    for(size_t j=nFirst; j<nLast; j++)
+        for(size_t k=pOffsets[j]; k<pOffsets[j+1]; k++)
+            mFeatVec.addFeature(pNodes[j],pIndices[k]);
+
+    mGrid.resize(mnGridCols);
+    for(int c=0; c<mnGridCols; c++)
+        mGrid[c].resize(mnGridRows);
+    for(int j=0; j<N; j++)
+    {
+        const cv::KeyPoint &kp = mvKeysUn[j];
+        const int nGridPosX = round((kp.pt.x-mnMinX)*mfGridElementWidthInv);
+        const int nGridPosY = round((kp.pt.y-mnMinY)*mfGridElementHeightInv);
+        if(nGridPosX<0 || nGridPosX>=mnGridCols || nGridPosY<0 || nGridPosY>=mnGridRows)
+            continue;
+        mGrid[nGridPosX][nGridPosY].push_back(j);
+    }
+
+    Eigen::Matrix4f Tcw_ = Eigen::Matrix4f::Identity();
+    for(int row=0; row<3; row++)
+        for(int col=0; col<4; col++)
+            Tcw_(row,col) = r.Tcw[4*row+col];
+    SetPose(Tcw_);
+}
+
+KeyFrame::~KeyFrame()
+{
+    delete mpCovisibility.load();
+}
+
 void KeyFrame::ComputeBoW()
 {
     if(mBowVec.empty() || mFeatVec.empty())
@@ -67,169 +174,216 @@ void KeyFrame::ComputeBoW()
     }
 }
 
-void KeyFrame::SetPose(const cv::Mat &Tcw_)
+void KeyFrame::SetPose(const Eigen::Matrix4f &Tcw_)
 {
-    unique_lock<mutex> lock(mMutexPose);
-    Tcw_.copyTo(Tcw);
-    cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
-    cv::Mat tcw = Tcw.rowRange(0,3).col(3);
-    cv::Mat Rwc = Rcw.t();
-    Ow = -Rwc*tcw;
+    {
+        unique_lock<mutex> lock(mMutexPose);
+        Tcw = Tcw_;
+        const Eigen::Matrix3f Rcw = Tcw.block<3,3>(0,0);
+        const Eigen::Vector3f tcw = Tcw.block<3,1>(0,3);
+        const Eigen::Matrix3f Rwc = Rcw.transpose();
+        Ow = -Rwc*tcw;
+
+        Twc.setIdentity();
+        Twc.block<3,3>(0,0) = Rwc;
+        Twc.block<3,1>(0,3) = Ow;
+        Cw = Rwc*Eigen::Vector3f(mHalfBaseline,0,0)+Ow;
+    }
 
-    Twc = cv::Mat::eye(4,4,Tcw.type());
-    Rwc.copyTo(Twc.rowRange(0,3).colRange(0,3));
-    Ow.copyTo(Twc.rowRange(0,3).col(3));
-    cv::Mat center = (cv::Mat_<float>(4,1) << mHalfBaseline, 0 , 0, 1);
-    Cw = Twc*center;
+    mpMap->Touch(this);
 }
 
-cv::Mat KeyFrame::GetPose()
+Eigen::Matrix4f KeyFrame::GetPose()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.clone();
+    return Tcw;
 }
 
-cv::Mat KeyFrame::GetPoseInverse()
+Eigen::Matrix4f KeyFrame::GetPoseInverse()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Twc.clone();
+    return Twc;
 }
 
-cv::Mat KeyFrame::GetCameraCenter()
+Eigen::Vector3f KeyFrame::GetCameraCenter()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Ow.clone();
+    return Ow;
 }
 
-cv::Mat KeyFrame::GetStereoCenter()
+Eigen::Vector3f KeyFrame::GetStereoCenter()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Cw.clone();
+    return Cw;
 }
 
 
-cv::Mat KeyFrame::GetRotation()
+Eigen::Matrix3f KeyFrame::GetRotation()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).colRange(0,3).clone();
+    return Tcw.block<3,3>(0,0);
 }
 
-cv::Mat KeyFrame::GetTranslation()
+Eigen::Vector3f KeyFrame::GetTranslation()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).col(3).clone();
+    return Tcw.block<3,1>(0,3);
 }
 
 void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
 {
     {
         unique_lock<mutex> lock(mMutexConnections);
-        if(!mConnectedKeyFrameWeights.count(pKF))
-            mConnectedKeyFrameWeights[pKF]=weight;
-        else if(mConnectedKeyFrameWeights[pKF]!=weight)
-            mConnectedKeyFrameWeights[pKF]=weight;
-        else
+        const Covisibility* pCov = mpCovisibility.load(memory_order_relaxed);
+        if(pCov->GetWeight(pKF)==weight)
             return;
+
+        vector<pair<KeyFrame*,int> > vConnections;
+        vConnections.reserve(pCov->NumConnections()+1);
+        for(size_t i=0, iend=pCov->NumConnections(); i<iend; i++)
+        {
+            if(pCov->GetConnection(i)!=pKF)
+                vConnections.push_back(make_pair(pCov->GetConnection(i),pCov->GetConnectionWeight(i)));
+        }
+        vConnections.push_back(make_pair(pKF,weight));
+        SetCovisibility(Covisibility::Create(vConnections));
     }
 
-    UpdateBestCovisibles();
+    mpMap->Touch(this);
 }
 
 void KeyFrame::UpdateBestCovisibles()
 {
     unique_lock<mutex> lock(mMutexConnections);
-    vector<pair<int,KeyFrame*> > vPairs;
-    vPairs.reserve(mConnectedKeyFrameWeights.size());
-    for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
-       vPairs.push_back(make_pair(mit->second,mit->first));
-
-    sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0, iend=vPairs.size(); i<iend;i++)
+    const Covisibility* pCov = mpCovisibility.load(memory_order_relaxed);
+    vector<pair<KeyFrame*,int> > vConnections;
+    vConnections.reserve(pCov->NumConnections());
+    for(size_t i=0, iend=pCov->NumConnections(); i<iend; i++)
+        vConnections.push_back(make_pair(pCov->GetConnection(i),pCov->GetConnectionWeight(i)));
+    SetCovisibility(Covisibility::Create(vConnections));
+}
+
+void KeyFrame::SetCovisibility(const Covisibility *pCov)
+{
+    // Readers without the mutex may still hold the previous record
+    const Covisibility* pOld = mpCovisibility.exchange(pCov,memory_order_acq_rel);
+    if(!pOld)
+        return;
+
+    // Both records are sorted by keyframe id
+    size_t i=0, j=0;
+    const size_t nOld = pOld->NumConnections(), nNew = pCov->NumConnections();
+    while(i<nOld || j<nNew)
     {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
+        if(j==nNew || (i<nOld && pOld->GetConnectionId(i)<pCov->GetConnectionId(j)))
+            pOld->GetConnection(i++)->EraseCovisibleBy(this);
+        else if(i==nOld || pCov->GetConnectionId(j)<pOld->GetConnectionId(i))
+            pCov->GetConnection(j++)->AddCovisibleBy(this);
+        else
+        {
+            i++;
+            j++;
+        }
     }
 
-    mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-    mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());    
+    mpMap->mEpochManager.Retire(const_cast<Covisibility*>(pOld));
+}
+
+void KeyFrame::AddCovisibleBy(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexCovisibleBy);
+    mspCovisibleBy.insert(pKF);
+}
+
+void KeyFrame::EraseCovisibleBy(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexCovisibleBy);
+    mspCovisibleBy.erase(pKF);
+}
+
+const Covisibility* KeyFrame::GetCovisibility()
+{
+    return mpCovisibility.load(memory_order_acquire);
 }
 
 set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    const Covisibility* pCov = GetCovisibility();
     set<KeyFrame*> s;
-    for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin();mit!=mConnectedKeyFrameWeights.end();mit++)
-        s.insert(mit->first);
+    for(size_t i=0, iend=pCov->NumConnections(); i<iend; i++)
+        s.insert(pCov->GetConnection(i));
     return s;
 }
 
 vector<KeyFrame*> KeyFrame::GetVectorCovisibleKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexConnections);
-    return mvpOrderedConnectedKeyFrames;
+    const Covisibility* pCov = GetCovisibility();
+    vector<KeyFrame*> vpKFs(pCov->NumOrdered());
+    for(size_t i=0; i<vpKFs.size(); i++)
+        vpKFs[i] = pCov->GetOrdered(i);
+    return vpKFs;
 }
 
 vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 {
-    unique_lock<mutex> lock(mMutexConnections);
-    if((int)mvpOrderedConnectedKeyFrames.size()<N)
-        return mvpOrderedConnectedKeyFrames;
-    else
-        return vector<KeyFrame*>(mvpOrderedConnectedKeyFrames.begin(),mvpOrderedConnectedKeyFrames.begin()+N);
-
+    const Covisibility* pCov = GetCovisibility();
+    vector<KeyFrame*> vpKFs(min((size_t)max(N,0),pCov->NumOrdered()));
+    for(size_t i=0; i<vpKFs.size(); i++)
+        vpKFs[i] = pCov->GetOrdered(i);
+    return vpKFs;
 }
 
 vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 {
-    unique_lock<mutex> lock(mMutexConnections);
+    const Covisibility* pCov = GetCovisibility();
 
-    if(mvpOrderedConnectedKeyFrames.empty())
+    // Nothing if every covisible keyframe reaches the weight, as it has always been
+    const size_t n = pCov->NumOrderedWithWeight(w);
+    if(n==pCov->NumOrdered())
         return vector<KeyFrame*>();
 
-    vector<int>::iterator it = upper_bound(mvOrderedWeights.begin(),mvOrderedWeights.end(),w,KeyFrame::weightComp);
-    if(it==mvOrderedWeights.end())
-        return vector<KeyFrame*>();
-    else
-    {
-        int n = it-mvOrderedWeights.begin();
-        return vector<KeyFrame*>(mvpOrderedConnectedKeyFrames.begin(), mvpOrderedConnectedKeyFrames.begin()+n);
-    }
+    vector<KeyFrame*> vpKFs(n);
+    for(size_t i=0; i<n; i++)
+        vpKFs[i] = pCov->GetOrdered(i);
+    return vpKFs;
 }
 
 int KeyFrame::GetWeight(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexConnections);
-    if(mConnectedKeyFrameWeights.count(pKF))
-        return mConnectedKeyFrameWeights[pKF];
-    else
-        return 0;
+    return GetCovisibility()->GetWeight(pKF);
 }
 
 void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mnMatchesVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+    mnMatchesVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
 {
     int idx = pMP->GetIndexInKeyFrame(this);
     if(idx>=0)
+    {
+        unique_lock<mutex> lock(mMutexFeatures);
         mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+        mnMatchesVersion++;
+    }
 }
 
 
 void KeyFrame::ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP)
 {
+    unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mnMatchesVersion++;
 }
 
 set<MapPoint*> KeyFrame::GetMapPoints()
@@ -280,6 +434,19 @@ vector<MapPoint*> KeyFrame::GetMapPointMatches()
     return mvpMapPoints;
 }
 
+vector<MapPoint*> KeyFrame::GetMapPointMatches(long unsigned int &nVersion)
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    nVersion = mnMatchesVersion;
+    return mvpMapPoints;
+}
+
+long unsigned int KeyFrame::GetMatchesVersion()
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    return mnMatchesVersion;
+}
+
 MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
@@ -288,7 +455,7 @@ MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 
 void KeyFrame::UpdateConnections()
 {
-    map<KeyFrame*,int> KFcounter;
+    unordered_map<KeyFrame*,int> KFcounter;
 
     vector<MapPoint*> vpMP;
 
@@ -309,9 +476,9 @@ void KeyFrame::UpdateConnections()
         if(pMP->isBad())
             continue;
 
-        map<KeyFrame*,size_t> observations = pMP->GetObservations();
+        const MapPoint::ObservationVector observations = pMP->GetObservations();
 
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(MapPoint::ObservationVector::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             if(mit->first->mnId==mnId)
                 continue;
@@ -325,57 +492,41 @@ void KeyFrame::UpdateConnections()
 
     //If the counter is greater than threshold add connection
     //In case no keyframe counter is over threshold add the one with maximum counter
+    const int th = 15;
+
     int nmax=0;
     KeyFrame* pKFmax=NULL;
-    int th = 15;
-
-    vector<pair<int,KeyFrame*> > vPairs;
-    vPairs.reserve(KFcounter.size());
-    for(map<KeyFrame*,int>::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
+    vector<pair<KeyFrame*,int> > vConnections(KFcounter.begin(),KFcounter.end());
+    for(size_t i=0; i<vConnections.size(); i++)
     {
-        if(mit->second>nmax)
-        {
-            nmax=mit->second;
-            pKFmax=mit->first;
-        }
-        if(mit->second>=th)
+        if(vConnections[i].second>nmax)
         {
-            vPairs.push_back(make_pair(mit->second,mit->first));
-            (mit->first)->AddConnection(this,mit->second);
+            nmax=vConnections[i].second;
+            pKFmax=vConnections[i].first;
         }
+        if(vConnections[i].second>=th)
+            vConnections[i].first->AddConnection(this,vConnections[i].second);
     }
 
-    if(vPairs.empty())
-    {
-        vPairs.push_back(make_pair(nmax,pKFmax));
+    if(nmax<th)
         pKFmax->AddConnection(this,nmax);
-    }
-
-    sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0; i<vPairs.size();i++)
-    {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
-    }
 
     {
         unique_lock<mutex> lockCon(mMutexConnections);
 
-        // mspConnectedKeyFrames = spConnectedKeyFrames;
-        mConnectedKeyFrameWeights = KFcounter;
-        mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-        mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+        const Covisibility* pCov = Covisibility::Create(vConnections,th);
+        SetCovisibility(pCov);
 
         if(mbFirstConnection && mnId!=0)
         {
-            mpParent = mvpOrderedConnectedKeyFrames.front();
+            mpParent = pCov->GetOrdered(0);
             mpParent->AddChild(this);
             mbFirstConnection = false;
         }
 
     }
+
+    mpMap->Touch(this);
 }
 
 void KeyFrame::AddChild(KeyFrame *pKF)
@@ -417,9 +568,12 @@ bool KeyFrame::hasChild(KeyFrame *pKF)
 
 void KeyFrame::AddLoopEdge(KeyFrame *pKF)
 {
-    unique_lock<mutex> lockCon(mMutexConnections);
-    mbNotErase = true;
-    mspLoopEdges.insert(pKF);
+    {
+        unique_lock<mutex> lockCon(mMutexConnections);
+        mbNotErase = true;
+        mspLoopEdges.insert(pKF);
+    }
+    mpMap->Touch(this);
 }
 
 set<KeyFrame*> KeyFrame::GetLoopEdges()
@@ -434,27 +588,22 @@ void KeyFrame::SetNotErase()
     mbNotErase = true;
 }
 
-void KeyFrame::SetErase()
+bool KeyFrame::SetErase()
 {
+    unique_lock<mutex> lock(mMutexConnections);
+    if(mspLoopEdges.empty())
     {
-        unique_lock<mutex> lock(mMutexConnections);
-        if(mspLoopEdges.empty())
-        {
-            mbNotErase = false;
-        }
+        mbNotErase = false;
     }
 
-    if(mbToBeErased)
-    {
-        SetBadFlag();
-    }
+    return mbToBeErased && !mbNotErase && !mbBad;
 }
 
 void KeyFrame::SetBadFlag()
 {   
     {
         unique_lock<mutex> lock(mMutexConnections);
-        if(mnId==0)
+        if(mnId==0 || mbBad)
             return;
         else if(mbNotErase)
         {
@@ -463,18 +612,39 @@ void KeyFrame::SetBadFlag()
         }
     }
 
-    for(map<KeyFrame*,int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
-        mit->first->EraseConnection(this);
+    // Connected keyframes, and those connected to this one that it does not know
+    set<KeyFrame*> spConnected;
+    {
+        unique_lock<mutex> lock(mMutexConnections);
+        const Covisibility* pCov = mpCovisibility.load(memory_order_relaxed);
+        for(size_t i=0, iend=pCov->NumConnections(); i<iend; i++)
+            spConnected.insert(pCov->GetConnection(i));
+    }
+    {
+        unique_lock<mutex> lock(mMutexCovisibleBy);
+        spConnected.insert(mspCovisibleBy.begin(),mspCovisibleBy.end());
+    }
+    for(set<KeyFrame*>::iterator sit=spConnected.begin(), send=spConnected.end(); sit!=send; sit++)
+        (*sit)->EraseConnection(this);
 
     for(size_t i=0; i<mvpMapPoints.size(); i++)
         if(mvpMapPoints[i])
             mvpMapPoints[i]->EraseObservation(this);
+
+    // Children get a new parent, they are marked for the journal once the locks are released
+    vector<KeyFrame*> vpChilds;
     {
         unique_lock<mutex> lock(mMutexConnections);
         unique_lock<mutex> lock1(mMutexFeatures);
 
-        mConnectedKeyFrameWeights.clear();
-        mvpOrderedConnectedKeyFrames.clear();
+        vpChilds.assign(mspChildrens.begin(),mspChildrens.end());
+
+        SetCovisibility(Covisibility::Create(vector<pair<KeyFrame*,int> >()));
+
+        // The points no longer know this keyframe, so they will not erase themselves from
+        // it when they are deleted
+        fill(mvpMapPoints.begin(),mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        mnMatchesVersion++;
 
         // Update Spanning Tree
         set<KeyFrame*> sParentCandidates;
@@ -497,18 +667,18 @@ void KeyFrame::SetBadFlag()
                     continue;
 
                 // Check if a parent candidate is connected to the keyframe
-                vector<KeyFrame*> vpConnected = pKF->GetVectorCovisibleKeyFrames();
-                for(size_t i=0, iend=vpConnected.size(); i<iend; i++)
+                const Covisibility* pCov = pKF->GetCovisibility();
+                for(size_t i=0, iend=pCov->NumOrdered(); i<iend; i++)
                 {
                     for(set<KeyFrame*>::iterator spcit=sParentCandidates.begin(), spcend=sParentCandidates.end(); spcit!=spcend; spcit++)
                     {
-                        if(vpConnected[i]->mnId == (*spcit)->mnId)
+                        if(pCov->GetOrdered(i)->mnId == (*spcit)->mnId)
                         {
-                            int w = pKF->GetWeight(vpConnected[i]);
+                            int w = pCov->GetOrderedWeight(i);
                             if(w>max)
                             {
                                 pC = pKF;
-                                pP = vpConnected[i];
+                                pP = pCov->GetOrdered(i);
                                 max = w;
                                 bContinue = true;
                             }
@@ -542,6 +712,9 @@ void KeyFrame::SetBadFlag()
 
     mpMap->EraseKeyFrame(this);
     mpKeyFrameDB->erase(this);
+
+    for(size_t i=0; i<vpChilds.size(); i++)
+        mpMap->Touch(vpChilds[i]);
 }
 
 bool KeyFrame::isBad()
@@ -552,18 +725,23 @@ bool KeyFrame::isBad()
 
 void KeyFrame::EraseConnection(KeyFrame* pKF)
 {
-    bool bUpdate = false;
     {
         unique_lock<mutex> lock(mMutexConnections);
-        if(mConnectedKeyFrameWeights.count(pKF))
+        const Covisibility* pCov = mpCovisibility.load(memory_order_relaxed);
+        if(!pCov->GetWeight(pKF))
+            return;
+
+        vector<pair<KeyFrame*,int> > vConnections;
+        vConnections.reserve(pCov->NumConnections());
+        for(size_t i=0, iend=pCov->NumConnections(); i<iend; i++)
         {
-            mConnectedKeyFrameWeights.erase(pKF);
-            bUpdate=true;
+            if(pCov->GetConnection(i)!=pKF)
+                vConnections.push_back(make_pair(pCov->GetConnection(i),pCov->GetConnectionWeight(i)));
         }
+        SetCovisibility(Covisibility::Create(vConnections));
     }
 
-    if(bUpdate)
-        UpdateBestCovisibles();
+    mpMap->Touch(this);
 }
 
 vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r) const
@@ -612,7 +790,7 @@ bool KeyFrame::IsInImage(const float &x, const float &y) const
     return (x>=mnMinX && x<mnMaxX && y>=mnMinY && y<mnMaxY);
 }
 
-cv::Mat KeyFrame::UnprojectStereo(int i)
+bool KeyFrame::UnprojectStereo(int i, Eigen::Vector3f &x3D)
 {
     const float z = mvDepth[i];
     if(z>0)
@@ -621,37 +799,37 @@ cv::Mat KeyFrame::UnprojectStereo(int i)
         const float v = mvKeys[i].pt.y;
         const float x = (u-cx)*z*invfx;
         const float y = (v-cy)*z*invfy;
-        cv::Mat x3Dc = (cv::Mat_<float>(3,1) << x, y, z);
+        const Eigen::Vector3f x3Dc(x, y, z);
 
         unique_lock<mutex> lock(mMutexPose);
-        return Twc.rowRange(0,3).colRange(0,3)*x3Dc+Twc.rowRange(0,3).col(3);
+        x3D = Twc.block<3,3>(0,0)*x3Dc+Twc.block<3,1>(0,3);
+        return true;
     }
     else
-        return cv::Mat();
+        return false;
 }
 
 float KeyFrame::ComputeSceneMedianDepth(const int q)
 {
     vector<MapPoint*> vpMapPoints;
-    cv::Mat Tcw_;
+    Eigen::Matrix4f Tcw_;
     {
         unique_lock<mutex> lock(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPose);
         vpMapPoints = mvpMapPoints;
-        Tcw_ = Tcw.clone();
+        Tcw_ = Tcw;
     }
 
     vector<float> vDepths;
     vDepths.reserve(N);
-    cv::Mat Rcw2 = Tcw_.row(2).colRange(0,3);
-    Rcw2 = Rcw2.t();
-    float zcw = Tcw_.at<float>(2,3);
+    const Eigen::Vector3f Rcw2 = Tcw_.block<1,3>(2,0).transpose();
+    const float zcw = Tcw_(2,3);
     for(int i=0; i<N; i++)
     {
         if(mvpMapPoints[i])
         {
             MapPoint* pMP = mvpMapPoints[i];
-            cv::Mat x3Dw = pMP->GetWorldPos();
+            const Eigen::Vector3f x3Dw = pMP->GetWorldPos();
             float z = Rcw2.dot(x3Dw)+zcw;
             vDepths.push_back(z);
         }
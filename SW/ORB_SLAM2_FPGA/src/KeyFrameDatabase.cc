@@ -22,16 +22,68 @@
 
 #include "KeyFrame.h"
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
+#include "WorkerPool.h"
 
 #include<mutex>
+#include<cmath>
+#include<algorithm>
 
 using namespace std;
 
 namespace ORB_SLAM2
 {
 
+namespace
+{
+
+// Per-thread query state indexed by keyframe id. An entry is only valid if its stamp is the
+// one of the current query, so nothing has to be cleared between queries and loop closing
+// and relocalization do not share any state.
+struct QueryScratch
+{
+    QueryScratch(): nStamp(0) {}
+
+    void Reserve(const size_t n)
+    {
+        if(vnStamp.size()>=n)
+            return;
+        vnStamp.resize(n,0);
+        vnExcluded.resize(n,0);
+        vnWords.resize(n,0);
+        vL1.resize(n,0);
+        vScore.resize(n,0);
+        vbScored.resize(n,0);
+    }
+
+    unsigned long nStamp;
+    vector<unsigned long> vnStamp;
+    vector<unsigned long> vnExcluded;
+    vector<int> vnWords;
+    // Sum of |vi-wi|-|vi|-|wi| over the shared words (L1 score, see DBoW2::L1Scoring)
+    vector<double> vL1;
+    vector<float> vScore;
+    vector<char> vbScored;
+};
+
+thread_local QueryScratch tQueryScratch;
+
+// Run f(i) for i in [0,n) on the worker pool taking chunks of nChunk indices. A single chunk
+// runs on the calling thread only.
+template<class Function>
+void ParallelFor(const int n, const int nChunk, Function f)
+{
+    WorkerPool::Get().ParallelFor((n+nChunk-1)/nChunk,[&](int c)
+    {
+        const int iend = min(n,(c+1)*nChunk);
+        for(int i=c*nChunk; i<iend; i++)
+            f(i);
+    });
+}
+
+}
+
 KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
-    mpVoc(&voc)
+    mpVoc(&voc), mnPostings(0), mnTombstones(0)
 {
     mvInvertedFile.resize(voc.size());
 }
@@ -41,271 +93,254 @@ void KeyFrameDatabase::add(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutex);
 
+    // A keyframe culled before it is added would never be erased (erase() checks under the same mutex)
+    if(pKF->isBad())
+        return;
+
+    const unsigned int id = pKF->mnId;
+    if(id>=mvpKeyFrames.size())
+    {
+        mvpKeyFrames.resize(id+1,static_cast<KeyFrame*>(NULL));
+        mvbErased.resize(id+1,0);
+    }
+
+    // Old postings of this id would come back to life
+    if(mvbErased[id])
+        Compact();
+
+    mvpKeyFrames[id] = pKF;
+
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+        mvInvertedFile[vit->first].push_back(Posting(id,vit->second));
+    mnPostings += pKF->mBowVec.size();
 }
 
 void KeyFrameDatabase::erase(KeyFrame* pKF)
 {
     unique_lock<mutex> lock(mMutex);
 
-    // Erase elements in the Inverse File for the entry
-    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-    {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+    const unsigned int id = pKF->mnId;
+    if(id>=mvpKeyFrames.size() || mvpKeyFrames[id]!=pKF)
+        return;
+
+    // The postings stay as tombstones, they are removed once they are a quarter of the index
+    mvpKeyFrames[id] = static_cast<KeyFrame*>(NULL);
+    mvbErased[id] = 1;
+    mnTombstones += pKF->mBowVec.size();
+
+    if(mnTombstones*4>mnPostings)
+        Compact();
+}
 
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+void KeyFrameDatabase::Compact()
+{
+    for(size_t i=0; i<mvInvertedFile.size(); i++)
+    {
+        vector<Posting> &vPostings = mvInvertedFile[i];
+        size_t n=0;
+        for(size_t j=0; j<vPostings.size(); j++)
         {
-            if(pKF==*lit)
-            {
-                lKFs.erase(lit);
-                break;
-            }
+            if(mvpKeyFrames[vPostings[j].nKF])
+                vPostings[n++] = vPostings[j];
         }
+        mnPostings -= vPostings.size()-n;
+        vPostings.resize(n,Posting(0,0));
     }
+
+    fill(mvbErased.begin(),mvbErased.end(),0);
+    mnTombstones = 0;
 }
 
 void KeyFrameDatabase::clear()
 {
+    unique_lock<mutex> lock(mMutex);
+
     mvInvertedFile.clear();
     mvInvertedFile.resize(mpVoc->size());
+    mvpKeyFrames.clear();
+    mvbErased.clear();
+    mnPostings = 0;
+    mnTombstones = 0;
 }
 
 
 vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
 {
+    // Discard keyframes connected to the query keyframe
     set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;
 
-    // Search all keyframes that share a word with current keyframes
-    // Discard keyframes connected to the query keyframe
-    {
-        unique_lock<mutex> lock(mMutex);
+    return DetectCandidates(pKF->mBowVec,spConnectedKeyFrames,minScore);
+}
 
-        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
-        {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
+{
+    return DetectCandidates(F->mBowVec,set<KeyFrame*>(),0);
+}
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnLoopQuery!=pKF->mnId)
-                {
-                    pKFi->mnLoopWords=0;
-                    if(!spConnectedKeyFrames.count(pKFi))
-                    {
-                        pKFi->mnLoopQuery=pKF->mnId;
-                        lKFsSharingWords.push_back(pKFi);
-                    }
-                }
-                pKFi->mnLoopWords++;
-            }
-        }
-    }
+vector<KeyFrame*> KeyFrameDatabase::DetectCandidates(const DBoW2::BowVector &vBow, const set<KeyFrame*> &spExcluded,
+                                                     const float minScore)
+{
+    QueryScratch &scratch = tQueryScratch;
+    const unsigned long nStamp = ++scratch.nStamp;
 
-    if(lKFsSharingWords.empty())
-        return vector<KeyFrame*>();
+    // With L1 scoring the score is accumulated while traversing the inverted file, the shared
+    // words of each keyframe are visited in the same order as in DBoW2::L1Scoring::score
+    const bool bL1 = mpVoc->getScoringType()==DBoW2::L1_NORM;
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
+    vector<unsigned int> vnSharingWords;
+    vector<KeyFrame*> vpSharingWords;
 
-    // Only compare against those keyframes that share enough words
-    int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    // Search all keyframes that share a word with the query
     {
-        if((*lit)->mnLoopWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnLoopWords;
-    }
-
-    int minCommonWords = maxCommonWords*0.8f;
+        unique_lock<mutex> lock(mMutex);
 
-    int nscores=0;
+        const size_t nSlots = mvpKeyFrames.size();
+        scratch.Reserve(nSlots);
 
-    // Compute similarity score. Retain the matches whose score is higher than minScore
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
-    {
-        KeyFrame* pKFi = *lit;
-
-        if(pKFi->mnLoopWords>minCommonWords)
+        for(set<KeyFrame*>::const_iterator sit=spExcluded.begin(), send=spExcluded.end(); sit!=send; sit++)
         {
-            nscores++;
-
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
-
-            pKFi->mLoopScore = si;
-            if(si>=minScore)
-                lScoreAndMatch.push_back(make_pair(si,pKFi));
+            if((*sit)->mnId<nSlots)
+                scratch.vnExcluded[(*sit)->mnId] = nStamp;
         }
-    }
-
-    if(lScoreAndMatch.empty())
-        return vector<KeyFrame*>();
-
-    list<pair<float,KeyFrame*> > lAccScoreAndMatch;
-    float bestAccScore = minScore;
-
-    // Lets now accumulate score by covisibility
-    for(list<pair<float,KeyFrame*> >::iterator it=lScoreAndMatch.begin(), itend=lScoreAndMatch.end(); it!=itend; it++)
-    {
-        KeyFrame* pKFi = it->second;
-        vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
 
-        float bestScore = it->first;
-        float accScore = it->first;
-        KeyFrame* pBestKF = pKFi;
-        for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
+        for(DBoW2::BowVector::const_iterator vit=vBow.begin(), vend=vBow.end(); vit != vend; vit++)
         {
-            KeyFrame* pKF2 = *vit;
-            if(pKF2->mnLoopQuery==pKF->mnId && pKF2->mnLoopWords>minCommonWords)
-            {
-                accScore+=pKF2->mLoopScore;
-                if(pKF2->mLoopScore>bestScore)
-                {
-                    pBestKF=pKF2;
-                    bestScore = pKF2->mLoopScore;
-                }
-            }
-        }
-
-        lAccScoreAndMatch.push_back(make_pair(accScore,pBestKF));
-        if(accScore>bestAccScore)
-            bestAccScore=accScore;
-    }
+            const vector<Posting> &vPostings = mvInvertedFile[vit->first];
+            const double vi = vit->second;
 
-    // Return all those keyframes with a score higher than 0.75*bestScore
-    float minScoreToRetain = 0.75f*bestAccScore;
-
-    set<KeyFrame*> spAlreadyAddedKF;
-    vector<KeyFrame*> vpLoopCandidates;
-    vpLoopCandidates.reserve(lAccScoreAndMatch.size());
-
-    for(list<pair<float,KeyFrame*> >::iterator it=lAccScoreAndMatch.begin(), itend=lAccScoreAndMatch.end(); it!=itend; it++)
-    {
-        if(it->first>minScoreToRetain)
-        {
-            KeyFrame* pKFi = it->second;
-            if(!spAlreadyAddedKF.count(pKFi))
+            for(size_t j=0, jend=vPostings.size(); j<jend; j++)
             {
-                vpLoopCandidates.push_back(pKFi);
-                spAlreadyAddedKF.insert(pKFi);
-            }
-        }
-    }
-
+                const unsigned int id = vPostings[j].nKF;
+                if(!mvpKeyFrames[id])
+                    continue;
 
-    return vpLoopCandidates;
-}
-
-vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
-{
-    list<KeyFrame*> lKFsSharingWords;
-
-    // Search all keyframes that share a word with current frame
-    {
-        unique_lock<mutex> lock(mMutex);
-
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
-        {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+                if(scratch.vnStamp[id]!=nStamp)
+                {
+                    scratch.vnStamp[id] = nStamp;
+                    scratch.vnWords[id] = 0;
+                    scratch.vL1[id] = 0;
+                    scratch.vbScored[id] = 0;
+                    if(scratch.vnExcluded[id]!=nStamp)
+                        vnSharingWords.push_back(id);
+                }
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnRelocQuery!=F->mnId)
+                scratch.vnWords[id]++;
+                if(bL1)
                 {
-                    pKFi->mnRelocWords=0;
-                    pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
+                    const double wi = vPostings[j].weight;
+                    scratch.vL1[id] += fabs(vi - wi) - fabs(vi) - fabs(wi);
                 }
-                pKFi->mnRelocWords++;
             }
         }
+
+        vpSharingWords.reserve(vnSharingWords.size());
+        for(size_t i=0; i<vnSharingWords.size(); i++)
+            vpSharingWords.push_back(mvpKeyFrames[vnSharingWords[i]]);
     }
-    if(lKFsSharingWords.empty())
+
+    if(vnSharingWords.empty())
         return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(size_t i=0; i<vnSharingWords.size(); i++)
     {
-        if((*lit)->mnRelocWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnRelocWords;
+        if(scratch.vnWords[vnSharingWords[i]]>maxCommonWords)
+            maxCommonWords=scratch.vnWords[vnSharingWords[i]];
     }
 
     int minCommonWords = maxCommonWords*0.8f;
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
-
-    int nscores=0;
-
-    // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    vector<unsigned int> vnScored;
+    vector<KeyFrame*> vpScored;
+    for(size_t i=0; i<vnSharingWords.size(); i++)
     {
-        KeyFrame* pKFi = *lit;
-
-        if(pKFi->mnRelocWords>minCommonWords)
+        if(scratch.vnWords[vnSharingWords[i]]>minCommonWords)
         {
-            nscores++;
-            float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
+            vnScored.push_back(vnSharingWords[i]);
+            vpScored.push_back(vpSharingWords[i]);
         }
     }
 
-    if(lScoreAndMatch.empty())
-        return vector<KeyFrame*>();
+    // Compute similarity score. The workers write scratch entries of different keyframes.
+    // Without L1 scoring this merges both BoW vectors, hence the smaller chunks.
+    const int nScored = vnScored.size();
+    ParallelFor(nScored, bL1 ? 4096 : 32, [&](const int i)
+    {
+        const unsigned int id = vnScored[i];
+        scratch.vScore[id] = bL1 ? -scratch.vL1[id]/2.0 : mpVoc->score(vBow,vpScored[i]->mBowVec);
+        scratch.vbScored[id] = 1;
+    });
+
+    // Retain the matches whose score is higher than minScore
+    vector<pair<float,KeyFrame*> > vScoreAndMatch;
+    for(int i=0; i<nScored; i++)
+    {
+        const float si = scratch.vScore[vnScored[i]];
+        if(si>=minScore)
+            vScoreAndMatch.push_back(make_pair(si,vpScored[i]));
+    }
 
-    list<pair<float,KeyFrame*> > lAccScoreAndMatch;
-    float bestAccScore = 0;
+    if(vScoreAndMatch.empty())
+        return vector<KeyFrame*>();
 
-    // Lets now accumulate score by covisibility
-    for(list<pair<float,KeyFrame*> >::iterator it=lScoreAndMatch.begin(), itend=lScoreAndMatch.end(); it!=itend; it++)
+    // Lets now accumulate score by covisibility, each candidate group in parallel
+    const int nMatches = vScoreAndMatch.size();
+    vector<pair<float,KeyFrame*> > vAccScoreAndMatch(nMatches);
+    ParallelFor(nMatches, 64, [&](const int i)
     {
-        KeyFrame* pKFi = it->second;
-        vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
+        KeyFrame* pKFi = vScoreAndMatch[i].second;
+        const Covisibility* pCov = pKFi->GetCovisibility();
 
-        float bestScore = it->first;
+        float bestScore = vScoreAndMatch[i].first;
         float accScore = bestScore;
         KeyFrame* pBestKF = pKFi;
-        for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
+        for(size_t j=0, jend=min((size_t)10,pCov->NumOrdered()); j<jend; j++)
         {
-            KeyFrame* pKF2 = *vit;
-            if(pKF2->mnRelocQuery!=F->mnId)
+            KeyFrame* pKF2 = pCov->GetOrdered(j);
+            const unsigned long id = pKF2->mnId;
+            if(id>=scratch.vnStamp.size() || scratch.vnStamp[id]!=nStamp || !scratch.vbScored[id])
                 continue;
 
-            accScore+=pKF2->mRelocScore;
-            if(pKF2->mRelocScore>bestScore)
+            accScore+=scratch.vScore[id];
+            if(scratch.vScore[id]>bestScore)
             {
                 pBestKF=pKF2;
-                bestScore = pKF2->mRelocScore;
+                bestScore = scratch.vScore[id];
             }
-
         }
-        lAccScoreAndMatch.push_back(make_pair(accScore,pBestKF));
-        if(accScore>bestAccScore)
-            bestAccScore=accScore;
+
+        vAccScoreAndMatch[i] = make_pair(accScore,pBestKF);
+    });
+
+    float bestAccScore = minScore;
+    for(int i=0; i<nMatches; i++)
+    {
+        if(vAccScoreAndMatch[i].first>bestAccScore)
+            bestAccScore=vAccScoreAndMatch[i].first;
     }
 
     // Return all those keyframes with a score higher than 0.75*bestScore
     float minScoreToRetain = 0.75f*bestAccScore;
+
     set<KeyFrame*> spAlreadyAddedKF;
-    vector<KeyFrame*> vpRelocCandidates;
-    vpRelocCandidates.reserve(lAccScoreAndMatch.size());
-    for(list<pair<float,KeyFrame*> >::iterator it=lAccScoreAndMatch.begin(), itend=lAccScoreAndMatch.end(); it!=itend; it++)
+    vector<KeyFrame*> vpCandidates;
+    vpCandidates.reserve(vAccScoreAndMatch.size());
+
+    for(size_t i=0; i<vAccScoreAndMatch.size(); i++)
     {
-        const float &si = it->first;
-        if(si>minScoreToRetain)
+        if(vAccScoreAndMatch[i].first>minScoreToRetain)
         {
-            KeyFrame* pKFi = it->second;
+            KeyFrame* pKFi = vAccScoreAndMatch[i].second;
             if(!spAlreadyAddedKF.count(pKFi))
             {
-                vpRelocCandidates.push_back(pKFi);
+                vpCandidates.push_back(pKFi);
                 spAlreadyAddedKF.insert(pKFi);
             }
         }
     }
 
-    return vpRelocCandidates;
+    return vpCandidates;
 }
 
 } //namespace ORB_SLAM
@@ -0,0 +1,318 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalBAGraph.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "Converter.h"
+
+#include "Thirdparty/g2o/g2o/core/block_solver.h"
+#include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
+#include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+LocalBAGraph::LocalBAGraph(): mnStamp(0)
+{
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
+
+    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
+
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+
+    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+    mOptimizer.setAlgorithm(solver);
+}
+
+LocalBAGraph::~LocalBAGraph()
+{
+    // Vertices and edges still in the graph are deleted by the optimizer
+    for(size_t i=0; i<mvpFreeEdgesMono.size(); i++)
+        delete mvpFreeEdgesMono[i];
+    for(size_t i=0; i<mvpFreeEdgesStereo.size(); i++)
+        delete mvpFreeEdgesStereo[i];
+    for(size_t i=0; i<mvpFreeKeyFrameVertices.size(); i++)
+        delete mvpFreeKeyFrameVertices[i];
+    for(size_t i=0; i<mvpFreeMapPointVertices.size(); i++)
+        delete mvpFreeMapPointVertices[i];
+}
+
+int LocalBAGraph::KeyFrameVertexId(KeyFrame *pKF)
+{
+    return 2*pKF->mnId;
+}
+
+int LocalBAGraph::MapPointVertexId(MapPoint *pMP)
+{
+    return 2*pMP->mnId+1;
+}
+
+void LocalBAGraph::BeginUpdate()
+{
+    mnStamp++;
+}
+
+g2o::VertexSE3Expmap* LocalBAGraph::SetKeyFrame(KeyFrame *pKF, const bool bFixed)
+{
+    KeyFrameEntry &entry = mmKeyFrames[pKF];
+    if(entry.pVertex && entry.nId!=pKF->mnId)
+    {
+        // Left by a keyframe that has been deleted, drop its observations first
+        for(unordered_map<MapPoint*,PointEntry>::iterator mit=mmMapPoints.begin(); mit!=mmMapPoints.end(); mit++)
+        {
+            vector<Observation> &vObs = mit->second.vObservations;
+            for(size_t i=0; i<vObs.size(); )
+            {
+                if(vObs[i].pKF==pKF)
+                {
+                    RemoveObservation(vObs[i]);
+                    vObs[i] = vObs.back();
+                    vObs.pop_back();
+                }
+                else
+                    i++;
+            }
+        }
+        mOptimizer.removeVertex(entry.pVertex,true);
+        mvpFreeKeyFrameVertices.push_back(entry.pVertex);
+        entry.pVertex = static_cast<g2o::VertexSE3Expmap*>(NULL);
+    }
+
+    if(!entry.pVertex)
+    {
+        if(mvpFreeKeyFrameVertices.empty())
+            entry.pVertex = new g2o::VertexSE3Expmap();
+        else
+        {
+            entry.pVertex = mvpFreeKeyFrameVertices.back();
+            mvpFreeKeyFrameVertices.pop_back();
+        }
+        entry.pVertex->setId(KeyFrameVertexId(pKF));
+        mOptimizer.addVertex(entry.pVertex);
+        entry.nId = pKF->mnId;
+    }
+
+    entry.nStamp = mnStamp;
+    entry.pVertex->setEstimate(Converter::toSE3Quat(pKF->GetPose()));
+    entry.pVertex->setFixed(bFixed);
+
+    return entry.pVertex;
+}
+
+g2o::VertexSBAPointXYZ* LocalBAGraph::SetMapPoint(MapPoint *pMP)
+{
+    PointEntry &entry = mmMapPoints[pMP];
+    if(entry.pVertex && entry.nId!=pMP->mnId)
+    {
+        // Left by a point that has been deleted
+        for(size_t i=0; i<entry.vObservations.size(); i++)
+            RemoveObservation(entry.vObservations[i]);
+        entry.vObservations.clear();
+        RemovePointVertex(entry);
+    }
+
+    if(!entry.pVertex)
+    {
+        if(mvpFreeMapPointVertices.empty())
+            entry.pVertex = new g2o::VertexSBAPointXYZ();
+        else
+        {
+            entry.pVertex = mvpFreeMapPointVertices.back();
+            mvpFreeMapPointVertices.pop_back();
+        }
+        entry.pVertex->setId(MapPointVertexId(pMP));
+        entry.pVertex->setMarginalized(true);
+        mOptimizer.addVertex(entry.pVertex);
+        entry.nId = pMP->mnId;
+    }
+
+    entry.nStamp = mnStamp;
+    entry.pVertex->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+
+    return entry.pVertex;
+}
+
+LocalBAGraph::Observation* LocalBAGraph::FindObservation(MapPoint *pMP, KeyFrame *pKF)
+{
+    vector<Observation> &vObs = mmMapPoints[pMP].vObservations;
+    for(size_t i=0; i<vObs.size(); i++)
+    {
+        if(vObs[i].pKF==pKF)
+            return &vObs[i];
+    }
+
+    Observation obs;
+    obs.pKF = pKF;
+    obs.pEdgeMono = static_cast<g2o::EdgeSE3ProjectXYZ*>(NULL);
+    obs.pEdgeStereo = static_cast<g2o::EdgeStereoSE3ProjectXYZ*>(NULL);
+    obs.nStamp = mnStamp;
+    vObs.push_back(obs);
+    return &vObs.back();
+}
+
+void LocalBAGraph::RemoveObservation(Observation &obs)
+{
+    if(obs.pEdgeMono)
+    {
+        mOptimizer.removeEdge(obs.pEdgeMono,true);
+        mvpFreeEdgesMono.push_back(obs.pEdgeMono);
+        obs.pEdgeMono = static_cast<g2o::EdgeSE3ProjectXYZ*>(NULL);
+    }
+    if(obs.pEdgeStereo)
+    {
+        mOptimizer.removeEdge(obs.pEdgeStereo,true);
+        mvpFreeEdgesStereo.push_back(obs.pEdgeStereo);
+        obs.pEdgeStereo = static_cast<g2o::EdgeStereoSE3ProjectXYZ*>(NULL);
+    }
+}
+
+void LocalBAGraph::RemovePointVertex(PointEntry &entry)
+{
+    if(entry.pVertex)
+    {
+        mOptimizer.removeVertex(entry.pVertex,true);
+        mvpFreeMapPointVertices.push_back(entry.pVertex);
+        entry.pVertex = static_cast<g2o::VertexSBAPointXYZ*>(NULL);
+    }
+}
+
+g2o::EdgeSE3ProjectXYZ* LocalBAGraph::SetMonoObservation(MapPoint *pMP, KeyFrame *pKF)
+{
+    Observation* pObs = FindObservation(pMP,pKF);
+    pObs->nStamp = mnStamp;
+
+    // The observation may have changed type (the point was fused)
+    if(pObs->pEdgeStereo)
+        RemoveObservation(*pObs);
+
+    g2o::EdgeSE3ProjectXYZ* e = pObs->pEdgeMono;
+    if(!e)
+    {
+        if(mvpFreeEdgesMono.empty())
+        {
+            e = new g2o::EdgeSE3ProjectXYZ();
+            e->setRobustKernel(new g2o::RobustKernelHuber);
+        }
+        else
+        {
+            e = mvpFreeEdgesMono.back();
+            mvpFreeEdgesMono.pop_back();
+        }
+        e->setVertex(0, mmMapPoints[pMP].pVertex);
+        e->setVertex(1, mmKeyFrames[pKF].pVertex);
+        mOptimizer.addEdge(e);
+        pObs->pEdgeMono = e;
+    }
+
+    e->setLevel(0);
+
+    return e;
+}
+
+g2o::EdgeStereoSE3ProjectXYZ* LocalBAGraph::SetStereoObservation(MapPoint *pMP, KeyFrame *pKF)
+{
+    Observation* pObs = FindObservation(pMP,pKF);
+    pObs->nStamp = mnStamp;
+
+    if(pObs->pEdgeMono)
+        RemoveObservation(*pObs);
+
+    g2o::EdgeStereoSE3ProjectXYZ* e = pObs->pEdgeStereo;
+    if(!e)
+    {
+        if(mvpFreeEdgesStereo.empty())
+        {
+            e = new g2o::EdgeStereoSE3ProjectXYZ();
+            e->setRobustKernel(new g2o::RobustKernelHuber);
+        }
+        else
+        {
+            e = mvpFreeEdgesStereo.back();
+            mvpFreeEdgesStereo.pop_back();
+        }
+        e->setVertex(0, mmMapPoints[pMP].pVertex);
+        e->setVertex(1, mmKeyFrames[pKF].pVertex);
+        mOptimizer.addEdge(e);
+        pObs->pEdgeStereo = e;
+    }
+
+    e->setLevel(0);
+
+    return e;
+}
+
+void LocalBAGraph::EndUpdate()
+{
+    // Edges first, a vertex is only removed once it has no edges left
+    for(unordered_map<MapPoint*,PointEntry>::iterator mit=mmMapPoints.begin(); mit!=mmMapPoints.end(); )
+    {
+        PointEntry &entry = mit->second;
+        const bool bStalePoint = entry.nStamp!=mnStamp;
+
+        vector<Observation> &vObs = entry.vObservations;
+        for(size_t i=0; i<vObs.size(); )
+        {
+            if(bStalePoint || vObs[i].nStamp!=mnStamp)
+            {
+                RemoveObservation(vObs[i]);
+                vObs[i] = vObs.back();
+                vObs.pop_back();
+            }
+            else
+                i++;
+        }
+
+        if(bStalePoint)
+        {
+            RemovePointVertex(entry);
+            mit = mmMapPoints.erase(mit);
+        }
+        else
+            mit++;
+    }
+
+    for(unordered_map<KeyFrame*,KeyFrameEntry>::iterator mit=mmKeyFrames.begin(); mit!=mmKeyFrames.end(); )
+    {
+        if(mit->second.nStamp!=mnStamp)
+        {
+            if(mit->second.pVertex)
+            {
+                mOptimizer.removeVertex(mit->second.pVertex,true);
+                mvpFreeKeyFrameVertices.push_back(mit->second.pVertex);
+            }
+            mit = mmKeyFrames.erase(mit);
+        }
+        else
+            mit++;
+    }
+}
+
+void LocalBAGraph::Clear()
+{
+    // Nothing is set in this update, everything goes back to the pools
+    BeginUpdate();
+    EndUpdate();
+}
+
+} //namespace ORB_SLAM
@@ -22,6 +22,9 @@
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
+#include "Converter.h"
+#include "MemoryBudget.h"
+#include "WorkerPool.h"
 
 #include<mutex>
 #include <unistd.h>
@@ -30,8 +33,10 @@ namespace ORB_SLAM2
 
 LocalMapping::LocalMapping(Map *pMap, const float bMonocular):
     mbMonocular(bMonocular), mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
-    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true)
+    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false),
+    mtLocalBALatency(0), mnLocalBA(0), mtWakeUp(0), mnWakeUps(0), mbAcceptKeyFrames(true), mpMemoryBudget(NULL)
 {
+    mnEpochReader = mpMap->mEpochManager.Register();
 }
 
 void LocalMapping::SetLoopCloser(LoopClosing* pLoopCloser)
@@ -44,6 +49,11 @@ void LocalMapping::SetTracker(Tracking *pTracker)
     mpTracker=pTracker;
 }
 
+void LocalMapping::SetMemoryBudget(MemoryBudget *pMemoryBudget)
+{
+    mpMemoryBudget=pMemoryBudget;
+}
+
 void LocalMapping::Run()
 {
 
@@ -57,14 +67,24 @@ void LocalMapping::Run()
         // Check if there are keyframes in the queue
         if(CheckNewKeyFrames())
         {
+            // Keyframes culled while the loop closing was using them
+            EraseRequestedKeyFrames();
+
             // BoW conversion and insertion in Map
             ProcessNewKeyFrame();
 
-            // Check recent MapPoints
+            // Check recent MapPoints. The bad points are dropped from the list, and with them
+            // every point retired before this epoch that Local Mapping could still reach.
+            const unsigned long nEpoch = mpMap->mEpochManager.GetEpoch();
             MapPointCulling();
+            mpMap->mEpochManager.Announce(mnEpochReader,nEpoch);
+
+            // Delete the points that no thread can reach anymore
+            mpMap->mEpochManager.Reclaim();
 
             // Triangulate new MapPoints
-            CreateNewMapPoints();
+            if(!mpMemoryBudget || mpMemoryBudget->AllowNewMapPoints())
+                CreateNewMapPoints();
 
             if(!CheckNewKeyFrames())
             {
@@ -78,20 +98,35 @@ void LocalMapping::Run()
             {
                 // Local BA
                 if(mpMap->KeyFramesInMap()>2)
-                    Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap);
+                {
+                    const double tLatency = chrono::duration<double,milli>(chrono::steady_clock::now()-mtCurrentKeyFrame).count();
+                    {
+                        unique_lock<mutex> lock(mMutexStats);
+                        mtLocalBALatency += tLatency;
+                        mnLocalBA++;
+                    }
+                    Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap, &mLocalBAGraph);
+                }
 
                 // Check redundant local Keyframes
                 KeyFrameCulling();
             }
 
             mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
+
+            if(mpMemoryBudget)
+                mpMemoryBudget->Sample();
         }
         else if(Stop())
         {
-            // Safe area to stop
-            while(isStopped() && !CheckFinish())
+            // Safe area to stop. Resets are served while stopped (localization mode), the
+            // thread requesting one waits for it.
+            while(1)
             {
-                usleep(3000);
+                mEventState.WaitUntil([this]{return !isStopped() || ResetRequested() || CheckFinish();});
+                if(!isStopped() || CheckFinish())
+                    break;
+                ResetIfRequested();
             }
             if(CheckFinish())
                 break;
@@ -105,19 +140,76 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        usleep(3000);
+        // Sleep until there is something to do
+        const bool bIdle = !CheckNewKeyFrames();
+        mEventState.WaitUntil([this]{return CheckNewKeyFrames() || StopPending() || ResetRequested() || CheckFinish();});
+
+        // Time to wake up for a keyframe inserted while idle
+        if(bIdle)
+        {
+            unique_lock<mutex> lock(mMutexNewKFs);
+            if(!mlNewKeyFrameTimes.empty())
+            {
+                const double tWakeUp = chrono::duration<double,milli>(chrono::steady_clock::now()-mlNewKeyFrameTimes.front()).count();
+                unique_lock<mutex> lock2(mMutexStats);
+                mtWakeUp += tWakeUp;
+                mnWakeUps++;
+            }
+        }
     }
 
     SetFinish();
 }
 
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
+{
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mlNewKeyFrames.push_back(pKF);
+        mlNewKeyFrameTimes.push_back(chrono::steady_clock::now());
+        mbAbortBA=true;
+    }
+    mEventState.Notify();
+}
+
+void LocalMapping::EraseKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexNewKFs);
-    mlNewKeyFrames.push_back(pKF);
-    mbAbortBA=true;
+    mlpKeyFramesToErase.push_back(pKF);
 }
 
+void LocalMapping::EraseRequestedKeyFrames()
+{
+    list<KeyFrame*> lpKFs;
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        lpKFs.swap(mlpKeyFramesToErase);
+    }
+
+    // SetBadFlag defers the erasure again if the keyframe is in use
+    for(list<KeyFrame*>::iterator lit=lpKFs.begin(), lend=lpKFs.end(); lit!=lend; lit++)
+        (*lit)->SetBadFlag();
+}
+
+void LocalMapping::ReleaseEpochReader(KeyFrame *pKF)
+{
+    if(pKF->mnEpochReader<0)
+        return;
+    mpMap->mEpochManager.Unregister(pKF->mnEpochReader);
+    pKF->mnEpochReader = -1;
+}
+
+LocalMapping::Stats LocalMapping::GetStats()
+{
+    Stats stats;
+    unique_lock<mutex> lock(mMutexStats);
+    stats.tLocalBALatency = mnLocalBA>0 ? mtLocalBALatency/mnLocalBA : 0;
+    stats.nLocalBA = mnLocalBA;
+    stats.tWakeUp = mnWakeUps>0 ? mtWakeUp/mnWakeUps : 0;
+    stats.nWakeUps = mnWakeUps;
+
+    return stats;
+}
 
 bool LocalMapping::CheckNewKeyFrames()
 {
@@ -131,6 +223,8 @@ void LocalMapping::ProcessNewKeyFrame()
         unique_lock<mutex> lock(mMutexNewKFs);
         mpCurrentKeyFrame = mlNewKeyFrames.front();
         mlNewKeyFrames.pop_front();
+        mtCurrentKeyFrame = mlNewKeyFrameTimes.front();
+        mlNewKeyFrameTimes.pop_front();
     }
 
     // Compute Bags of Words structures
@@ -138,6 +232,8 @@ void LocalMapping::ProcessNewKeyFrame()
 
     // Associate MapPoints to the new keyframe and update normal and descriptor
     const vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
+    vector<MapPoint*> vpUpdated;
+    vpUpdated.reserve(vpMapPointMatches.size());
 
     for(size_t i=0; i<vpMapPointMatches.size(); i++)
     {
@@ -150,16 +246,26 @@ void LocalMapping::ProcessNewKeyFrame()
                 {
                     pMP->AddObservation(mpCurrentKeyFrame, i);
                     pMP->UpdateNormalAndDepth();
-                    pMP->ComputeDistinctiveDescriptors();
+                    vpUpdated.push_back(pMP);
                 }
                 else // this can only happen for new stereo points inserted by the Tracking
                 {
                     mlpRecentAddedMapPoints.push_back(pMP);
                 }
             }
+            else
+            {
+                // The point will not erase itself from a keyframe that does not observe it
+                mpCurrentKeyFrame->EraseMapPointMatch(i);
+            }
         }
     }    
 
+    // The matches are linked to their points now
+    ReleaseEpochReader(mpCurrentKeyFrame);
+
+    MapPoint::ComputeDistinctiveDescriptors(vpUpdated);
+
     // Update links in the Covisibility Graph
     mpCurrentKeyFrame->UpdateConnections();
 
@@ -210,17 +316,73 @@ void LocalMapping::CreateNewMapPoints()
     int nn = 10;
     if(mbMonocular)
         nn=20;
-    const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
+    const Covisibility* pCov = mpCurrentKeyFrame->GetCovisibility();
+
+    const int nNeighs = min((size_t)nn,pCov->NumOrdered());
+    if(nNeighs==0)
+        return;
+
+    // Search matches with epipolar restriction and triangulate, one neighbor per worker.
+    // The first neighbor is always processed, the rest are skipped if new keyframes arrive.
+    vector<vector<TriangulatedPoint> > vvPoints(nNeighs);
+    WorkerPool::Get().ParallelFor(nNeighs,[&](int i)
+    {
+        if(i>0 && CheckNewKeyFrames())
+            return;
+        TriangulateWithNeighbor(pCov->GetOrdered(i),vvPoints[i]);
+    });
+
+    // Insert the new points in neighbor order. As in the sequential search, a keypoint of the
+    // current keyframe is only triangulated once (with the first neighbor that matched it).
+    vector<MapPoint*> vpNewMPs;
+    {
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+        for(int i=0; i<nNeighs; i++)
+        {
+            KeyFrame* pKF2 = pCov->GetOrdered(i);
+            const vector<TriangulatedPoint> &vPoints = vvPoints[i];
+
+            for(size_t j=0; j<vPoints.size(); j++)
+            {
+                const int idx1 = vPoints[j].idx1;
+                const int idx2 = vPoints[j].idx2;
+
+                if(mpCurrentKeyFrame->GetMapPoint(idx1) || pKF2->GetMapPoint(idx2))
+                    continue;
 
+                MapPoint* pMP = new MapPoint(vPoints[j].x3D,mpCurrentKeyFrame,mpMap);
+
+                pMP->AddObservation(mpCurrentKeyFrame,idx1);
+                pMP->AddObservation(pKF2,idx2);
+
+                mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
+                pKF2->AddMapPoint(pMP,idx2);
+
+                pMP->UpdateNormalAndDepth();
+
+                mpMap->AddMapPoint(pMP);
+                mlpRecentAddedMapPoints.push_back(pMP);
+                vpNewMPs.push_back(pMP);
+            }
+        }
+    }
+
+    // Descriptors only need the observations, which are already in place
+    MapPoint::ComputeDistinctiveDescriptors(vpNewMPs);
+}
+
+void LocalMapping::TriangulateWithNeighbor(KeyFrame* pKF2, vector<TriangulatedPoint> &vPoints)
+{
     ORBmatcher matcher(0.6,false);
 
-    cv::Mat Rcw1 = mpCurrentKeyFrame->GetRotation();
-    cv::Mat Rwc1 = Rcw1.t();
-    cv::Mat tcw1 = mpCurrentKeyFrame->GetTranslation();
-    cv::Mat Tcw1(3,4,CV_32F);
-    Rcw1.copyTo(Tcw1.colRange(0,3));
-    tcw1.copyTo(Tcw1.col(3));
-    cv::Mat Ow1 = mpCurrentKeyFrame->GetCameraCenter();
+    Eigen::Matrix3f Rcw1 = mpCurrentKeyFrame->GetRotation();
+    Eigen::Matrix3f Rwc1 = Rcw1.transpose();
+    Eigen::Vector3f tcw1 = mpCurrentKeyFrame->GetTranslation();
+    Eigen::Matrix<float,3,4> Tcw1;
+    Tcw1.block<3,3>(0,0) = Rcw1;
+    Tcw1.col(3) = tcw1;
+    Eigen::Vector3f Ow1 = mpCurrentKeyFrame->GetCameraCenter();
 
     const float &fx1 = mpCurrentKeyFrame->fx;
     const float &fy1 = mpCurrentKeyFrame->fy;
@@ -231,223 +393,197 @@ void LocalMapping::CreateNewMapPoints()
 
     const float ratioFactor = 1.5f*mpCurrentKeyFrame->mfScaleFactor;
 
-    int nnew=0;
+    // Check first that baseline is not too short
+    Eigen::Vector3f Ow2 = pKF2->GetCameraCenter();
+    Eigen::Vector3f vBaseline = Ow2-Ow1;
+    const float baseline = vBaseline.norm();
 
-    // Search matches with epipolar restriction and triangulate
-    for(size_t i=0; i<vpNeighKFs.size(); i++)
+    if(!mbMonocular)
     {
-        if(i>0 && CheckNewKeyFrames())
+        if(baseline<pKF2->mb)
             return;
+    }
+    else
+    {
+        const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
+        const float ratioBaselineDepth = baseline/medianDepthKF2;
 
-        KeyFrame* pKF2 = vpNeighKFs[i];
-
-        // Check first that baseline is not too short
-        cv::Mat Ow2 = pKF2->GetCameraCenter();
-        cv::Mat vBaseline = Ow2-Ow1;
-        const float baseline = cv::norm(vBaseline);
-
-        if(!mbMonocular)
-        {
-            if(baseline<pKF2->mb)
-            continue;
-        }
-        else
-        {
-            const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
-            const float ratioBaselineDepth = baseline/medianDepthKF2;
+        if(ratioBaselineDepth<0.01)
+            return;
+    }
 
-            if(ratioBaselineDepth<0.01)
-                continue;
-        }
+    // Compute Fundamental Matrix
+    Eigen::Matrix3f F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
+
+    // Search matches that fullfil epipolar constraint
+    vector<pair<size_t,size_t> > vMatchedIndices;
+    matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false);
+
+    Eigen::Matrix3f Rcw2 = pKF2->GetRotation();
+    Eigen::Matrix3f Rwc2 = Rcw2.transpose();
+    Eigen::Vector3f tcw2 = pKF2->GetTranslation();
+    Eigen::Matrix<float,3,4> Tcw2;
+    Tcw2.block<3,3>(0,0) = Rcw2;
+    Tcw2.col(3) = tcw2;
+
+    const float &fx2 = pKF2->fx;
+    const float &fy2 = pKF2->fy;
+    const float &cx2 = pKF2->cx;
+    const float &cy2 = pKF2->cy;
+    const float &invfx2 = pKF2->invfx;
+    const float &invfy2 = pKF2->invfy;
+
+    // Triangulate each match
+    const int nmatches = vMatchedIndices.size();
+    for(int ikp=0; ikp<nmatches; ikp++)
+    {
+        const int &idx1 = vMatchedIndices[ikp].first;
+        const int &idx2 = vMatchedIndices[ikp].second;
 
-        // Compute Fundamental Matrix
-        cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
-
-        // Search matches that fullfil epipolar constraint
-        vector<pair<size_t,size_t> > vMatchedIndices;
-        matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false);
-
-        cv::Mat Rcw2 = pKF2->GetRotation();
-        cv::Mat Rwc2 = Rcw2.t();
-        cv::Mat tcw2 = pKF2->GetTranslation();
-        cv::Mat Tcw2(3,4,CV_32F);
-        Rcw2.copyTo(Tcw2.colRange(0,3));
-        tcw2.copyTo(Tcw2.col(3));
-
-        const float &fx2 = pKF2->fx;
-        const float &fy2 = pKF2->fy;
-        const float &cx2 = pKF2->cx;
-        const float &cy2 = pKF2->cy;
-        const float &invfx2 = pKF2->invfx;
-        const float &invfy2 = pKF2->invfy;
-
-        // Triangulate each match
-        const int nmatches = vMatchedIndices.size();
-        for(int ikp=0; ikp<nmatches; ikp++)
-        {
-            const int &idx1 = vMatchedIndices[ikp].first;
-            const int &idx2 = vMatchedIndices[ikp].second;
+        const cv::KeyPoint &kp1 = mpCurrentKeyFrame->mvKeysUn[idx1];
+        const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
+        bool bStereo1 = kp1_ur>=0;
 
-            const cv::KeyPoint &kp1 = mpCurrentKeyFrame->mvKeysUn[idx1];
-            const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
-            bool bStereo1 = kp1_ur>=0;
+        const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
+        const float kp2_ur = pKF2->mvuRight[idx2];
+        bool bStereo2 = kp2_ur>=0;
 
-            const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
-            const float kp2_ur = pKF2->mvuRight[idx2];
-            bool bStereo2 = kp2_ur>=0;
+        // Check parallax between rays
+        const Eigen::Vector3f xn1((kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0f);
+        const Eigen::Vector3f xn2((kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0f);
 
-            // Check parallax between rays
-            cv::Mat xn1 = (cv::Mat_<float>(3,1) << (kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0);
-            cv::Mat xn2 = (cv::Mat_<float>(3,1) << (kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0);
+        const Eigen::Vector3f ray1 = Rwc1*xn1;
+        const Eigen::Vector3f ray2 = Rwc2*xn2;
+        const float cosParallaxRays = ray1.dot(ray2)/(ray1.norm()*ray2.norm());
 
-            cv::Mat ray1 = Rwc1*xn1;
-            cv::Mat ray2 = Rwc2*xn2;
-            const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));
+        float cosParallaxStereo = cosParallaxRays+1;
+        float cosParallaxStereo1 = cosParallaxStereo;
+        float cosParallaxStereo2 = cosParallaxStereo;
 
-            float cosParallaxStereo = cosParallaxRays+1;
-            float cosParallaxStereo1 = cosParallaxStereo;
-            float cosParallaxStereo2 = cosParallaxStereo;
+        if(bStereo1)
+            cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
+        else if(bStereo2)
+            cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
 
-            if(bStereo1)
-                cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
-            else if(bStereo2)
-                cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
+        cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
 
-            cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
+        Eigen::Vector3f x3D;
+        if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))
+        {
+            // Linear Triangulation Method
+            Eigen::Matrix4f A;
+            A.row(0) = xn1(0)*Tcw1.row(2)-Tcw1.row(0);
+            A.row(1) = xn1(1)*Tcw1.row(2)-Tcw1.row(1);
+            A.row(2) = xn2(0)*Tcw2.row(2)-Tcw2.row(0);
+            A.row(3) = xn2(1)*Tcw2.row(2)-Tcw2.row(1);
 
-            cv::Mat x3D;
-            if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))
-            {
-                // Linear Triangulation Method
-                cv::Mat A(4,4,CV_32F);
-                A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
-                A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
-                A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
-                A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
+            Eigen::JacobiSVD<Eigen::Matrix4f> svd(A, Eigen::ComputeFullV);
+            const Eigen::Vector4f x3Dh = svd.matrixV().col(3);
 
-                cv::Mat w,u,vt;
-                cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
+            if(x3Dh(3)==0)
+                continue;
 
-                x3D = vt.row(3).t();
+            // Euclidean coordinates
+            x3D = x3Dh.head(3)/x3Dh(3);
 
-                if(x3D.at<float>(3)==0)
-                    continue;
+        }
+        else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
+        {
+            mpCurrentKeyFrame->UnprojectStereo(idx1,x3D);
+        }
+        else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
+        {
+            pKF2->UnprojectStereo(idx2,x3D);
+        }
+        else
+            continue; //No stereo and very low parallax
 
-                // Euclidean coordinates
-                x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
+        //Check triangulation in front of cameras
+        float z1 = Rcw1.row(2).dot(x3D)+tcw1(2);
+        if(z1<=0)
+            continue;
 
-            }
-            else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
-            {
-                x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);                
-            }
-            else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
-            {
-                x3D = pKF2->UnprojectStereo(idx2);
-            }
-            else
-                continue; //No stereo and very low parallax
+        float z2 = Rcw2.row(2).dot(x3D)+tcw2(2);
+        if(z2<=0)
+            continue;
 
-            cv::Mat x3Dt = x3D.t();
+        //Check reprojection error in first keyframe
+        const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
+        const float x1 = Rcw1.row(0).dot(x3D)+tcw1(0);
+        const float y1 = Rcw1.row(1).dot(x3D)+tcw1(1);
+        const float invz1 = 1.0/z1;
 
-            //Check triangulation in front of cameras
-            float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);
-            if(z1<=0)
+        if(!bStereo1)
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
                 continue;
-
-            float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
-            if(z2<=0)
+        }
+        else
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            float errX1_r = u1_r - kp1_ur;
+            if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
                 continue;
+        }
 
-            //Check reprojection error in first keyframe
-            const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
-            const float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);
-            const float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);
-            const float invz1 = 1.0/z1;
-
-            if(!bStereo1)
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
-                    continue;
-            }
-            else
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                float errX1_r = u1_r - kp1_ur;
-                if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
-                    continue;
-            }
-
-            //Check reprojection error in second keyframe
-            const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
-            const float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
-            const float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
-            const float invz2 = 1.0/z2;
-            if(!bStereo2)
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
-                    continue;
-            }
-            else
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                float errX2_r = u2_r - kp2_ur;
-                if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
-                    continue;
-            }
-
-            //Check scale consistency
-            cv::Mat normal1 = x3D-Ow1;
-            float dist1 = cv::norm(normal1);
-
-            cv::Mat normal2 = x3D-Ow2;
-            float dist2 = cv::norm(normal2);
-
-            if(dist1==0 || dist2==0)
+        //Check reprojection error in second keyframe
+        const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
+        const float x2 = Rcw2.row(0).dot(x3D)+tcw2(0);
+        const float y2 = Rcw2.row(1).dot(x3D)+tcw2(1);
+        const float invz2 = 1.0/z2;
+        if(!bStereo2)
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
                 continue;
-
-            const float ratioDist = dist2/dist1;
-            const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
-
-            /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
-                continue;*/
-            if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
+        }
+        else
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            float errX2_r = u2_r - kp2_ur;
+            if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
                 continue;
+        }
 
-            // Triangulation is succesfull
-            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mpMap);
-
-            pMP->AddObservation(mpCurrentKeyFrame,idx1);            
-            pMP->AddObservation(pKF2,idx2);
+        //Check scale consistency
+        Eigen::Vector3f normal1 = x3D-Ow1;
+        float dist1 = normal1.norm();
 
-            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
-            pKF2->AddMapPoint(pMP,idx2);
+        Eigen::Vector3f normal2 = x3D-Ow2;
+        float dist2 = normal2.norm();
 
-            pMP->ComputeDistinctiveDescriptors();
+        if(dist1==0 || dist2==0)
+            continue;
 
-            pMP->UpdateNormalAndDepth();
+        const float ratioDist = dist2/dist1;
+        const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
 
-            mpMap->AddMapPoint(pMP);
-            mlpRecentAddedMapPoints.push_back(pMP);
+        /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
+            continue;*/
+        if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
+            continue;
 
-            nnew++;
-        }
+        // Triangulation is succesfull
+        TriangulatedPoint point;
+        point.idx1 = idx1;
+        point.idx2 = idx2;
+        point.x3D = x3D;
+        vPoints.push_back(point);
     }
 }
 
@@ -457,21 +593,21 @@ void LocalMapping::SearchInNeighbors()
     int nn = 10;
     if(mbMonocular)
         nn=20;
-    const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
+    const Covisibility* pCov = mpCurrentKeyFrame->GetCovisibility();
     vector<KeyFrame*> vpTargetKFs;
-    for(vector<KeyFrame*>::const_iterator vit=vpNeighKFs.begin(), vend=vpNeighKFs.end(); vit!=vend; vit++)
+    for(size_t i=0, iend=min((size_t)nn,pCov->NumOrdered()); i<iend; i++)
     {
-        KeyFrame* pKFi = *vit;
+        KeyFrame* pKFi = pCov->GetOrdered(i);
         if(pKFi->isBad() || pKFi->mnFuseTargetForKF == mpCurrentKeyFrame->mnId)
             continue;
         vpTargetKFs.push_back(pKFi);
         pKFi->mnFuseTargetForKF = mpCurrentKeyFrame->mnId;
 
         // Extend to some second neighbors
-        const vector<KeyFrame*> vpSecondNeighKFs = pKFi->GetBestCovisibilityKeyFrames(5);
-        for(vector<KeyFrame*>::const_iterator vit2=vpSecondNeighKFs.begin(), vend2=vpSecondNeighKFs.end(); vit2!=vend2; vit2++)
+        const Covisibility* pCov2 = pKFi->GetCovisibility();
+        for(size_t j=0, jend=min((size_t)5,pCov2->NumOrdered()); j<jend; j++)
         {
-            KeyFrame* pKFi2 = *vit2;
+            KeyFrame* pKFi2 = pCov2->GetOrdered(j);
             if(pKFi2->isBad() || pKFi2->mnFuseTargetForKF==mpCurrentKeyFrame->mnId || pKFi2->mnId==mpCurrentKeyFrame->mnId)
                 continue;
             vpTargetKFs.push_back(pKFi2);
@@ -516,6 +652,8 @@ void LocalMapping::SearchInNeighbors()
 
     // Update points
     vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
+    vector<MapPoint*> vpUpdated;
+    vpUpdated.reserve(vpMapPointMatches.size());
     for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
     {
         MapPoint* pMP=vpMapPointMatches[i];
@@ -523,54 +661,76 @@ void LocalMapping::SearchInNeighbors()
         {
             if(!pMP->isBad())
             {
-                pMP->ComputeDistinctiveDescriptors();
                 pMP->UpdateNormalAndDepth();
+                vpUpdated.push_back(pMP);
             }
         }
     }
 
+    MapPoint::ComputeDistinctiveDescriptors(vpUpdated);
+
     // Update connections in covisibility graph
     mpCurrentKeyFrame->UpdateConnections();
 }
 
-cv::Mat LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
+Eigen::Matrix3f LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
 {
-    cv::Mat R1w = pKF1->GetRotation();
-    cv::Mat t1w = pKF1->GetTranslation();
-    cv::Mat R2w = pKF2->GetRotation();
-    cv::Mat t2w = pKF2->GetTranslation();
+    Eigen::Matrix3f R1w = pKF1->GetRotation();
+    Eigen::Vector3f t1w = pKF1->GetTranslation();
+    Eigen::Matrix3f R2w = pKF2->GetRotation();
+    Eigen::Vector3f t2w = pKF2->GetTranslation();
 
-    cv::Mat R12 = R1w*R2w.t();
-    cv::Mat t12 = -R1w*R2w.t()*t2w+t1w;
+    Eigen::Matrix3f R12 = R1w*R2w.transpose();
+    Eigen::Vector3f t12 = -R1w*R2w.transpose()*t2w+t1w;
 
-    cv::Mat t12x = SkewSymmetricMatrix(t12);
+    Eigen::Matrix3f t12x = SkewSymmetricMatrix(t12);
 
-    const cv::Mat &K1 = pKF1->mK;
-    const cv::Mat &K2 = pKF2->mK;
+    const Eigen::Matrix3f K1 = Converter::toMatrix3f(pKF1->mK);
+    const Eigen::Matrix3f K2 = Converter::toMatrix3f(pKF2->mK);
 
 
-    return K1.t().inv()*t12x*R12*K2.inv();
+    return K1.transpose().inverse()*t12x*R12*K2.inverse();
 }
 
 void LocalMapping::RequestStop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    mbStopRequested = true;
-    unique_lock<mutex> lock2(mMutexNewKFs);
-    mbAbortBA = true;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        mbStopRequested = true;
+        unique_lock<mutex> lock2(mMutexNewKFs);
+        mbAbortBA = true;
+    }
+    mEventState.Notify();
 }
 
 bool LocalMapping::Stop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    if(mbStopRequested && !mbNotStop)
     {
+        unique_lock<mutex> lock(mMutexStop);
+        if(!mbStopRequested || mbNotStop)
+            return false;
         mbStopped = true;
-        cout << "Local Mapping STOP" << endl;
-        return true;
     }
 
-    return false;
+    cout << "Local Mapping STOP" << endl;
+    mEventState.Notify();
+    return true;
+}
+
+bool LocalMapping::StopPending()
+{
+    unique_lock<mutex> lock(mMutexStop);
+    return mbStopRequested && !mbNotStop;
+}
+
+void LocalMapping::WaitUntilStopped()
+{
+    mEventState.WaitUntil([this]{return isStopped();});
+}
+
+void LocalMapping::WaitUntilFinished()
+{
+    mEventState.WaitUntil([this]{return isFinished();});
 }
 
 bool LocalMapping::isStopped()
@@ -587,17 +747,24 @@ bool LocalMapping::stopRequested()
 
 void LocalMapping::Release()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    unique_lock<mutex> lock2(mMutexFinish);
-    if(mbFinished)
-        return;
-    mbStopped = false;
-    mbStopRequested = false;
-    for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
-        delete *lit;
-    mlNewKeyFrames.clear();
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        unique_lock<mutex> lock2(mMutexFinish);
+        if(mbFinished)
+            return;
+        mbStopped = false;
+        mbStopRequested = false;
+        for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+        {
+            ReleaseEpochReader(*lit);
+            delete *lit;
+        }
+        mlNewKeyFrames.clear();
+        mlNewKeyFrameTimes.clear();
+    }
 
     cout << "Local Mapping RELEASE" << endl;
+    mEventState.Notify();
 }
 
 bool LocalMapping::AcceptKeyFrames()
@@ -614,13 +781,16 @@ void LocalMapping::SetAcceptKeyFrames(bool flag)
 
 bool LocalMapping::SetNotStop(bool flag)
 {
-    unique_lock<mutex> lock(mMutexStop);
+    {
+        unique_lock<mutex> lock(mMutexStop);
 
-    if(flag && mbStopped)
-        return false;
+        if(flag && mbStopped)
+            return false;
 
-    mbNotStop = flag;
+        mbNotStop = flag;
+    }
 
+    mEventState.Notify();
     return true;
 }
 
@@ -635,71 +805,89 @@ void LocalMapping::KeyFrameCulling()
     // A keyframe is considered redundant if the 90% of the MapPoints it sees, are seen
     // in at least other 3 keyframes (in the same or finer scale)
     // We only consider close stereo points
-    vector<KeyFrame*> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+    // Culling replaces the record of the current keyframe, this one stays valid until the next
+    // epoch announcement
+    const Covisibility* pCov = mpCurrentKeyFrame->GetCovisibility();
+    const int nKFs = pCov->NumOrdered();
+
+    // Test all keyframes concurrently against the map as it is before any culling. Culling a
+    // keyframe removes observations and can make points bad, which changes the result for the
+    // other keyframes in either direction, so after the first cull the remaining ones are
+    // tested again serially, in the same order as a serial pass.
+    vector<char> vbRedundant(nKFs,false);
+    if(nKFs<16)
+    {
+        for(int i=0; i<nKFs; i++)
+            vbRedundant[i] = IsRedundantKeyFrame(pCov->GetOrdered(i));
+    }
+    else
+    {
+        WorkerPool::Get().ParallelFor(nKFs,[&](int i)
+        {
+            vbRedundant[i] = IsRedundantKeyFrame(pCov->GetOrdered(i));
+        });
+    }
 
-    for(vector<KeyFrame*>::iterator vit=vpLocalKeyFrames.begin(), vend=vpLocalKeyFrames.end(); vit!=vend; vit++)
+    bool bCulled = false;
+    for(int i=0; i<nKFs; i++)
     {
-        KeyFrame* pKF = *vit;
-        if(pKF->mnId==0)
-            continue;
-        const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+        const bool bRedundant = bCulled ? IsRedundantKeyFrame(pCov->GetOrdered(i)) : vbRedundant[i];
+        if(bRedundant)
+        {
+            pCov->GetOrdered(i)->SetBadFlag();
+            bCulled = true;
+        }
+    }
+}
 
-        int nObs = 3;
-        const int thObs=nObs;
-        int nRedundantObservations=0;
-        int nMPs=0;
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+bool LocalMapping::IsRedundantKeyFrame(KeyFrame* pKF)
+{
+    if(pKF->mnId==0)
+        return false;
+    const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+
+    const int thObs=3;
+    int nRedundantObservations=0;
+    int nMPs=0;
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(pMP)
         {
-            MapPoint* pMP = vpMapPoints[i];
-            if(pMP)
+            if(!pMP->isBad())
             {
-                if(!pMP->isBad())
+                if(!mbMonocular)
                 {
-                    if(!mbMonocular)
-                    {
-                        if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
-                            continue;
-                    }
+                    if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
+                        continue;
+                }
 
-                    nMPs++;
-                    if(pMP->Observations()>thObs)
+                nMPs++;
+                if(pMP->Observations()>thObs)
+                {
+                    // Observations in other keyframes at the same or finer scale
+                    // (the observation of pKF itself is at scaleLevel)
+                    const int &scaleLevel = pKF->mvKeysUn[i].octave;
+                    const int nObs = pMP->ObservationsUpToLevel(scaleLevel+1)-1;
+                    if(nObs>=thObs)
                     {
-                        const int &scaleLevel = pKF->mvKeysUn[i].octave;
-                        const map<KeyFrame*, size_t> observations = pMP->GetObservations();
-                        int nObs=0;
-                        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-                        {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            const int &scaleLeveli = pKFi->mvKeysUn[mit->second].octave;
-
-                            if(scaleLeveli<=scaleLevel+1)
-                            {
-                                nObs++;
-                                if(nObs>=thObs)
-                                    break;
-                            }
-                        }
-                        if(nObs>=thObs)
-                        {
-                            nRedundantObservations++;
-                        }
+                        nRedundantObservations++;
                     }
                 }
             }
-        }  
-
-        if(nRedundantObservations>0.9*nMPs)
-            pKF->SetBadFlag();
+        }
     }
+
+    return nRedundantObservations>0.9*nMPs;
 }
 
-cv::Mat LocalMapping::SkewSymmetricMatrix(const cv::Mat &v)
+Eigen::Matrix3f LocalMapping::SkewSymmetricMatrix(const Eigen::Vector3f &v)
 {
-    return (cv::Mat_<float>(3,3) <<             0, -v.at<float>(2), v.at<float>(1),
-            v.at<float>(2),               0,-v.at<float>(0),
-            -v.at<float>(1),  v.at<float>(0),              0);
+    Eigen::Matrix3f S;
+    S <<             0, -v(2), v(1),
+            v(2),               0,-v(0),
+            -v(1),  v(0),              0;
+    return S;
 }
 
 void LocalMapping::RequestReset()
@@ -708,33 +896,43 @@ void LocalMapping::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    mEventState.Notify();
 
-    while(1)
-    {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequested)
-                break;
-        }
-        usleep(3000);
-    }
+    mEventState.WaitUntil([this]{return !ResetRequested();});
 }
 
-void LocalMapping::ResetIfRequested()
+bool LocalMapping::ResetRequested()
 {
     unique_lock<mutex> lock(mMutexReset);
-    if(mbResetRequested)
+    return mbResetRequested;
+}
+
+void LocalMapping::ResetIfRequested()
+{
     {
+        unique_lock<mutex> lock(mMutexReset);
+        if(!mbResetRequested)
+            return;
+        for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+            ReleaseEpochReader(*lit);
         mlNewKeyFrames.clear();
+        mlNewKeyFrameTimes.clear();
+        mlpKeyFramesToErase.clear();
         mlpRecentAddedMapPoints.clear();
+        // The keyframes and points in the graph are about to be deleted
+        mLocalBAGraph.Clear();
         mbResetRequested=false;
     }
+    mEventState.Notify();
 }
 
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    mEventState.Notify();
 }
 
 bool LocalMapping::CheckFinish()
@@ -745,10 +943,13 @@ bool LocalMapping::CheckFinish()
 
 void LocalMapping::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;    
-    unique_lock<mutex> lock2(mMutexStop);
-    mbStopped = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+        unique_lock<mutex> lock2(mMutexStop);
+        mbStopped = true;
+    }
+    mEventState.Notify();
 }
 
 bool LocalMapping::isFinished()
@@ -28,6 +28,8 @@
 
 #include "ORBmatcher.h"
 
+#include "WorkerPool.h"
+
 #include<mutex>
 #include<thread>
 #include <unistd.h>
@@ -41,6 +43,7 @@ LoopClosing::LoopClosing(Map *pMap, KeyFrameDatabase *pDB, ORBVocabulary *pVoc,
     mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0)
 {
     mnCovisibilityConsistencyTh = 3;
+    mnEpochReader = mpMap->mEpochManager.Register();
 }
 
 void LoopClosing::SetTracker(Tracking *pTracker)
@@ -60,6 +63,9 @@ void LoopClosing::Run()
 
     while(1)
     {
+        // Nothing is kept from the previous iteration
+        mpMap->mEpochManager.Announce(mnEpochReader,mpMap->mEpochManager.GetEpoch());
+
         // Check if there are keyframes in the queue
         if(CheckNewKeyFrames())
         {
@@ -74,24 +80,49 @@ void LoopClosing::Run()
                    CorrectLoop();
                }
             }
-        }       
+
+            ReleaseEpochReader(mpCurrentKF);
+        }
 
         ResetIfRequested();
 
         if(CheckFinish())
             break;
 
-        usleep(5000);
+        // Sleep until there is something to do
+        mpMap->mEpochManager.SetIdle(mnEpochReader);
+        mEventState.WaitUntil([this]{return CheckNewKeyFrames() || ResetRequested() || CheckFinish();});
     }
 
+    mpMap->mEpochManager.SetIdle(mnEpochReader);
     SetFinish();
 }
 
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexLoopQueue);
-    if(pKF->mnId!=0)
+    {
+        unique_lock<mutex> lock(mMutexLoopQueue);
+        if(pKF->mnId==0)
+            return;
+        // Held until the keyframe has been processed, it may be culled while it waits
+        pKF->mnEpochReader = mpMap->mEpochManager.Register();
         mlpLoopKeyFrameQueue.push_back(pKF);
+    }
+    mEventState.Notify();
+}
+
+void LoopClosing::ReleaseEpochReader(KeyFrame *pKF)
+{
+    if(pKF->mnEpochReader<0)
+        return;
+    mpMap->mEpochManager.Unregister(pKF->mnEpochReader);
+    pKF->mnEpochReader = -1;
+}
+
+void LoopClosing::SetErase(KeyFrame *pKF)
+{
+    if(pKF->SetErase())
+        mpLocalMapper->EraseKeyFrame(pKF);
 }
 
 bool LoopClosing::CheckNewKeyFrames()
@@ -114,19 +145,19 @@ bool LoopClosing::DetectLoop()
     if(mpCurrentKF->mnId<mLastLoopKFid+10)
     {
         mpKeyFrameDB->add(mpCurrentKF);
-        mpCurrentKF->SetErase();
+        SetErase(mpCurrentKF);
         return false;
     }
 
     // Compute reference BoW similarity score
     // This is the lowest score to a connected keyframe in the covisibility graph
     // We will impose loop candidates to have a higher similarity than this
-    const vector<KeyFrame*> vpConnectedKeyFrames = mpCurrentKF->GetVectorCovisibleKeyFrames();
+    const Covisibility* pCov = mpCurrentKF->GetCovisibility();
     const DBoW2::BowVector &CurrentBowVec = mpCurrentKF->mBowVec;
     float minScore = 1;
-    for(size_t i=0; i<vpConnectedKeyFrames.size(); i++)
+    for(size_t i=0, iend=pCov->NumOrdered(); i<iend; i++)
     {
-        KeyFrame* pKF = vpConnectedKeyFrames[i];
+        KeyFrame* pKF = pCov->GetOrdered(i);
         if(pKF->isBad())
             continue;
         const DBoW2::BowVector &BowVec = pKF->mBowVec;
@@ -145,7 +176,7 @@ bool LoopClosing::DetectLoop()
     {
         mpKeyFrameDB->add(mpCurrentKF);
         mvConsistentGroups.clear();
-        mpCurrentKF->SetErase();
+        SetErase(mpCurrentKF);
         return false;
     }
 
@@ -161,17 +192,21 @@ bool LoopClosing::DetectLoop()
     {
         KeyFrame* pCandidateKF = vpCandidateKFs[i];
 
-        set<KeyFrame*> spCandidateGroup = pCandidateKF->GetConnectedKeyFrames();
-        spCandidateGroup.insert(pCandidateKF);
+        // Groups are kept by id, the keyframes of previous groups may have been culled since
+        set<long unsigned int> spCandidateGroup;
+        const Covisibility* pCandidateCov = pCandidateKF->GetCovisibility();
+        for(size_t j=0, jend=pCandidateCov->NumConnections(); j<jend; j++)
+            spCandidateGroup.insert(pCandidateCov->GetConnectionId(j));
+        spCandidateGroup.insert(pCandidateKF->mnId);
 
         bool bEnoughConsistent = false;
         bool bConsistentForSomeGroup = false;
         for(size_t iG=0, iendG=mvConsistentGroups.size(); iG<iendG; iG++)
         {
-            set<KeyFrame*> sPreviousGroup = mvConsistentGroups[iG].first;
+            const set<long unsigned int> &sPreviousGroup = mvConsistentGroups[iG].first;
 
             bool bConsistent = false;
-            for(set<KeyFrame*>::iterator sit=spCandidateGroup.begin(), send=spCandidateGroup.end(); sit!=send;sit++)
+            for(set<long unsigned int>::iterator sit=spCandidateGroup.begin(), send=spCandidateGroup.end(); sit!=send;sit++)
             {
                 if(sPreviousGroup.count(*sit))
                 {
@@ -216,7 +251,7 @@ bool LoopClosing::DetectLoop()
 
     if(mvpEnoughConsistentCandidates.empty())
     {
-        mpCurrentKF->SetErase();
+        SetErase(mpCurrentKF);
         return false;
     }
     else
@@ -224,7 +259,7 @@ bool LoopClosing::DetectLoop()
         return true;
     }
 
-    mpCurrentKF->SetErase();
+    SetErase(mpCurrentKF);
     return false;
 }
 
@@ -320,7 +355,7 @@ bool LoopClosing::ComputeSim3()
                 cv::Mat R = pSolver->GetEstimatedRotation();
                 cv::Mat t = pSolver->GetEstimatedTranslation();
                 const float s = pSolver->GetEstimatedScale();
-                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
+                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,Converter::toMatrix3f(R),Converter::toVector3f(t),7.5);
 
                 g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
                 const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale);
@@ -332,7 +367,7 @@ bool LoopClosing::ComputeSim3()
                     mpMatchedKF = pKF;
                     g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
                     mg2oScw = gScm*gSmw;
-                    mScw = Converter::toCvMat(mg2oScw);
+                    mScw = Converter::toMatrix4f(mg2oScw);
 
                     mvpCurrentMatchedPoints = vpMapPointMatches;
                     break;
@@ -344,18 +379,17 @@ bool LoopClosing::ComputeSim3()
     if(!bMatch)
     {
         for(int i=0; i<nInitialCandidates; i++)
-             mvpEnoughConsistentCandidates[i]->SetErase();
-        mpCurrentKF->SetErase();
+             SetErase(mvpEnoughConsistentCandidates[i]);
+        SetErase(mpCurrentKF);
         return false;
     }
 
     // Retrieve MapPoints seen in Loop Keyframe and neighbors
-    vector<KeyFrame*> vpLoopConnectedKFs = mpMatchedKF->GetVectorCovisibleKeyFrames();
-    vpLoopConnectedKFs.push_back(mpMatchedKF);
+    const Covisibility* pLoopCov = mpMatchedKF->GetCovisibility();
     mvpLoopMapPoints.clear();
-    for(vector<KeyFrame*>::iterator vit=vpLoopConnectedKFs.begin(); vit!=vpLoopConnectedKFs.end(); vit++)
+    for(size_t k=0, kend=pLoopCov->NumOrdered(); k<=kend; k++)
     {
-        KeyFrame* pKF = *vit;
+        KeyFrame* pKF = k<kend ? pLoopCov->GetOrdered(k) : mpMatchedKF;
         vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
         for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
         {
@@ -386,14 +420,14 @@ bool LoopClosing::ComputeSim3()
     {
         for(int i=0; i<nInitialCandidates; i++)
             if(mvpEnoughConsistentCandidates[i]!=mpMatchedKF)
-                mvpEnoughConsistentCandidates[i]->SetErase();
+                SetErase(mvpEnoughConsistentCandidates[i]);
         return true;
     }
     else
     {
         for(int i=0; i<nInitialCandidates; i++)
-            mvpEnoughConsistentCandidates[i]->SetErase();
-        mpCurrentKF->SetErase();
+            SetErase(mvpEnoughConsistentCandidates[i]);
+        SetErase(mpCurrentKF);
         return false;
     }
 
@@ -423,21 +457,21 @@ void LoopClosing::CorrectLoop()
     }
 
     // Wait until Local Mapping has effectively stopped
-    while(!mpLocalMapper->isStopped())
-    {
-        usleep(1000);
-    }
+    mpLocalMapper->WaitUntilStopped();
 
     // Ensure current keyframe is updated
     mpCurrentKF->UpdateConnections();
 
     // Retrive keyframes connected to the current keyframe and compute corrected Sim3 pose by propagation
-    mvpCurrentConnectedKFs = mpCurrentKF->GetVectorCovisibleKeyFrames();
+    const Covisibility* pCurrentCov = mpCurrentKF->GetCovisibility();
+    mvpCurrentConnectedKFs.resize(pCurrentCov->NumOrdered());
+    for(size_t i=0; i<mvpCurrentConnectedKFs.size(); i++)
+        mvpCurrentConnectedKFs[i] = pCurrentCov->GetOrdered(i);
     mvpCurrentConnectedKFs.push_back(mpCurrentKF);
 
     KeyFrameAndPose CorrectedSim3, NonCorrectedSim3;
     CorrectedSim3[mpCurrentKF]=mg2oScw;
-    cv::Mat Twc = mpCurrentKF->GetPoseInverse();
+    Eigen::Matrix4f Twc = mpCurrentKF->GetPoseInverse();
 
 
     {
@@ -448,21 +482,21 @@ void LoopClosing::CorrectLoop()
         {
             KeyFrame* pKFi = *vit;
 
-            cv::Mat Tiw = pKFi->GetPose();
+            Eigen::Matrix4f Tiw = pKFi->GetPose();
 
             if(pKFi!=mpCurrentKF)
             {
-                cv::Mat Tic = Tiw*Twc;
-                cv::Mat Ric = Tic.rowRange(0,3).colRange(0,3);
-                cv::Mat tic = Tic.rowRange(0,3).col(3);
+                Eigen::Matrix4f Tic = Tiw*Twc;
+                Eigen::Matrix3f Ric = Tic.block<3,3>(0,0);
+                Eigen::Vector3f tic = Tic.block<3,1>(0,3);
                 g2o::Sim3 g2oSic(Converter::toMatrix3d(Ric),Converter::toVector3d(tic),1.0);
                 g2o::Sim3 g2oCorrectedSiw = g2oSic*mg2oScw;
                 //Pose corrected with the Sim3 of the loop closure
                 CorrectedSim3[pKFi]=g2oCorrectedSiw;
             }
 
-            cv::Mat Riw = Tiw.rowRange(0,3).colRange(0,3);
-            cv::Mat tiw = Tiw.rowRange(0,3).col(3);
+            Eigen::Matrix3f Riw = Tiw.block<3,3>(0,0);
+            Eigen::Vector3f tiw = Tiw.block<3,1>(0,3);
             g2o::Sim3 g2oSiw(Converter::toMatrix3d(Riw),Converter::toVector3d(tiw),1.0);
             //Pose without correction
             NonCorrectedSim3[pKFi]=g2oSiw;
@@ -489,12 +523,11 @@ void LoopClosing::CorrectLoop()
                     continue;
 
                 // Project with non-corrected pose and project back with corrected pose
-                cv::Mat P3Dw = pMPi->GetWorldPos();
+                Eigen::Vector3f P3Dw = pMPi->GetWorldPos();
                 Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
                 Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
 
-                cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-                pMPi->SetWorldPos(cvCorrectedP3Dw);
+                pMPi->SetWorldPos(Converter::toVector3f(eigCorrectedP3Dw));
                 pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
                 pMPi->mnCorrectedReference = pKFi->mnId;
                 pMPi->UpdateNormalAndDepth();
@@ -507,7 +540,9 @@ void LoopClosing::CorrectLoop()
 
             eigt *=(1./s); //[R t/s;0 1]
 
-            cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
+            Eigen::Matrix4f correctedTiw = Eigen::Matrix4f::Identity();
+            correctedTiw.block<3,3>(0,0) = eigR.cast<float>();
+            correctedTiw.block<3,1>(0,3) = eigt.cast<float>();
 
             pKFi->SetPose(correctedTiw);
 
@@ -548,18 +583,24 @@ void LoopClosing::CorrectLoop()
     for(vector<KeyFrame*>::iterator vit=mvpCurrentConnectedKFs.begin(), vend=mvpCurrentConnectedKFs.end(); vit!=vend; vit++)
     {
         KeyFrame* pKFi = *vit;
-        vector<KeyFrame*> vpPreviousNeighbors = pKFi->GetVectorCovisibleKeyFrames();
+
+        // The previous record stays valid after the update, it is only reclaimed once this
+        // thread announces a new epoch
+        const Covisibility* pPreviousCov = pKFi->GetCovisibility();
 
         // Update connections. Detect new links.
         pKFi->UpdateConnections();
-        LoopConnections[pKFi]=pKFi->GetConnectedKeyFrames();
-        for(vector<KeyFrame*>::iterator vit_prev=vpPreviousNeighbors.begin(), vend_prev=vpPreviousNeighbors.end(); vit_prev!=vend_prev; vit_prev++)
+        const Covisibility* pCov = pKFi->GetCovisibility();
+        set<KeyFrame*> &sConnections = LoopConnections[pKFi];
+        for(size_t i=0, iend=pCov->NumConnections(); i<iend; i++)
+            sConnections.insert(pCov->GetConnection(i));
+        for(size_t i=0, iend=pPreviousCov->NumOrdered(); i<iend; i++)
         {
-            LoopConnections[pKFi].erase(*vit_prev);
+            sConnections.erase(pPreviousCov->GetOrdered(i));
         }
         for(vector<KeyFrame*>::iterator vit2=mvpCurrentConnectedKFs.begin(), vend2=mvpCurrentConnectedKFs.end(); vit2!=vend2; vit2++)
         {
-            LoopConnections[pKFi].erase(*vit2);
+            sConnections.erase(*vit2);
         }
     }
 
@@ -593,10 +634,10 @@ void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap)
         KeyFrame* pKF = mit->first;
 
         g2o::Sim3 g2oScw = mit->second;
-        cv::Mat cvScw = Converter::toCvMat(g2oScw);
+        Eigen::Matrix4f Scw = Converter::toMatrix4f(g2oScw);
 
         vector<MapPoint*> vpReplacePoints(mvpLoopMapPoints.size(),static_cast<MapPoint*>(NULL));
-        matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4,vpReplacePoints);
+        matcher.Fuse(pKF,Scw,mvpLoopMapPoints,4,vpReplacePoints);
 
         // Get Map Mutex
         unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
@@ -619,33 +660,40 @@ void LoopClosing::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    mEventState.Notify();
 
-    while(1)
-    {
-        {
-        unique_lock<mutex> lock2(mMutexReset);
-        if(!mbResetRequested)
-            break;
-        }
-        usleep(5000);
-    }
+    mEventState.WaitUntil([this]{return !ResetRequested();});
 }
 
-void LoopClosing::ResetIfRequested()
+bool LoopClosing::ResetRequested()
 {
     unique_lock<mutex> lock(mMutexReset);
-    if(mbResetRequested)
+    return mbResetRequested;
+}
+
+void LoopClosing::ResetIfRequested()
+{
     {
+        unique_lock<mutex> lock(mMutexReset);
+        if(!mbResetRequested)
+            return;
+        for(list<KeyFrame*>::iterator lit=mlpLoopKeyFrameQueue.begin(), lend=mlpLoopKeyFrameQueue.end(); lit!=lend; lit++)
+            ReleaseEpochReader(*lit);
         mlpLoopKeyFrameQueue.clear();
+        mvConsistentGroups.clear();
         mLastLoopKFid=0;
         mbResetRequested=false;
     }
+    mEventState.Notify();
 }
 
 void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
 {
     cout << "Starting Global Bundle Adjustment" << endl;
 
+    // The points of the global BA stay alive until it has finished
+    const int nEpochReader = mpMap->mEpochManager.Register();
+
     int idx =  mnFullBAIdx;
     Optimizer::GlobalBundleAdjustemnt(mpMap,10,&mbStopGBA,nLoopKF,false);
 
@@ -656,102 +704,141 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
     {
         unique_lock<mutex> lock(mMutexGBA);
         if(idx!=mnFullBAIdx)
+        {
+            mpMap->mEpochManager.Unregister(nEpochReader);
             return;
+        }
 
         if(!mbStopGBA)
         {
             cout << "Global Bundle Adjustment finished" << endl;
             cout << "Updating map ..." << endl;
             mpLocalMapper->RequestStop();
-            // Wait until Local Mapping has effectively stopped
+            // Wait until Local Mapping has effectively stopped (a finished Local Mapping counts as stopped)
+            mpLocalMapper->WaitUntilStopped();
+
+            // Nothing else changes keyframes, the spanning tree or point positions now (loop
+            // correction waits for mMutexGBA), so the new poses and points are computed first
+            // and the map mutex is only held to write them.
+            vector<KeyFrame*> vpKFs;
+            vector<MapPoint*> vpMPs;
+            vector<Eigen::Vector3f> vPos;
+            vector<char> vbUpdate;
+            PropagateGlobalBACorrection(nLoopKF,vpKFs,vpMPs,vPos,vbUpdate);
 
-            while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
             {
-                usleep(1000);
-            }
+                // Get Map Mutex
+                unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
-            // Get Map Mutex
-            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+                for(size_t i=0; i<vpKFs.size(); i++)
+                    vpKFs[i]->SetPose(vpKFs[i]->mTcwGBA);
 
-            // Correct keyframes starting at map first keyframe
-            list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
-
-            while(!lpKFtoCheck.empty())
-            {
-                KeyFrame* pKF = lpKFtoCheck.front();
-                const set<KeyFrame*> sChilds = pKF->GetChilds();
-                cv::Mat Twc = pKF->GetPoseInverse();
-                for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
+                for(size_t i=0; i<vpMPs.size(); i++)
                 {
-                    KeyFrame* pChild = *sit;
-                    if(pChild->mnBAGlobalForKF!=nLoopKF)
-                    {
-                        cv::Mat Tchildc = pChild->GetPose()*Twc;
-                        pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;//*Tcorc*pKF->mTcwGBA;
-                        pChild->mnBAGlobalForKF=nLoopKF;
-
-                    }
-                    lpKFtoCheck.push_back(pChild);
+                    if(vbUpdate[i] && !vpMPs[i]->isBad())
+                        vpMPs[i]->SetWorldPos(vPos[i]);
                 }
 
-                pKF->mTcwBefGBA = pKF->GetPose();
-                pKF->SetPose(pKF->mTcwGBA);
-                lpKFtoCheck.pop_front();
+                mpMap->InformNewBigChange();
             }
 
-            // Correct MapPoints
-            const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+            mpLocalMapper->Release();
+
+            cout << "Map updated!" << endl;
+        }
+
+        mbFinishedGBA = true;
+        mbRunningGBA = false;
+    }
+    mpMap->mEpochManager.Unregister(nEpochReader);
+    mEventState.Notify();
+}
 
-            for(size_t i=0; i<vpMPs.size(); i++)
+void LoopClosing::PropagateGlobalBACorrection(const unsigned long nLoopKF, vector<KeyFrame*> &vpKFs,
+                                              vector<MapPoint*> &vpMPs, vector<Eigen::Vector3f> &vPos,
+                                              vector<char> &vbUpdate)
+{
+    // Correct keyframes starting at map first keyframe. A child only depends on its parent,
+    // this is a cheap traversal compared to the points.
+    list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
+
+    while(!lpKFtoCheck.empty())
+    {
+        KeyFrame* pKF = lpKFtoCheck.front();
+        const set<KeyFrame*> sChilds = pKF->GetChilds();
+        Eigen::Matrix4f Twc = pKF->GetPoseInverse();
+        for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
+        {
+            KeyFrame* pChild = *sit;
+            if(pChild->mnBAGlobalForKF!=nLoopKF)
             {
-                MapPoint* pMP = vpMPs[i];
+                Eigen::Matrix4f Tchildc = pChild->GetPose()*Twc;
+                pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;//*Tcorc*pKF->mTcwGBA;
+                pChild->mnBAGlobalForKF=nLoopKF;
 
-                if(pMP->isBad())
-                    continue;
+            }
+            lpKFtoCheck.push_back(pChild);
+        }
 
-                if(pMP->mnBAGlobalForKF==nLoopKF)
-                {
-                    // If optimized by Global BA, just update
-                    pMP->SetWorldPos(pMP->mPosGBA);
-                }
-                else
-                {
-                    // Update according to the correction of its reference keyframe
-                    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+        pKF->mTcwBefGBA = pKF->GetPose();
+        vpKFs.push_back(pKF);
+        lpKFtoCheck.pop_front();
+    }
 
-                    if(pRefKF->mnBAGlobalForKF!=nLoopKF)
-                        continue;
+    // Correct MapPoints, in parallel by chunks
+    vpMPs = mpMap->GetAllMapPoints();
+    const int nMPs = vpMPs.size();
+    vPos.resize(nMPs);
+    vbUpdate.assign(nMPs,0);
 
-                    // Map to non-corrected camera
-                    cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
-                    cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
-                    cv::Mat Xc = Rcw*pMP->GetWorldPos()+tcw;
+    const int nChunk = 256;
+    WorkerPool::Get().ParallelFor((nMPs+nChunk-1)/nChunk,[&](int c)
+    {
+        const int iend = min(nMPs,(c+1)*nChunk);
+        for(int i=c*nChunk; i<iend; i++)
+        {
+            MapPoint* pMP = vpMPs[i];
 
-                    // Backproject using corrected camera
-                    cv::Mat Twc = pRefKF->GetPoseInverse();
-                    cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
-                    cv::Mat twc = Twc.rowRange(0,3).col(3);
+            if(pMP->isBad())
+                continue;
 
-                    pMP->SetWorldPos(Rwc*Xc+twc);
-                }
-            }            
+            if(pMP->mnBAGlobalForKF==nLoopKF)
+            {
+                // If optimized by Global BA, just update
+                vPos[i] = pMP->mPosGBA;
+            }
+            else
+            {
+                // Update according to the correction of its reference keyframe
+                KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
 
-            mpMap->InformNewBigChange();
+                if(pRefKF->mnBAGlobalForKF!=nLoopKF)
+                    continue;
 
-            mpLocalMapper->Release();
+                // Map to non-corrected camera
+                Eigen::Matrix3f Rcw = pRefKF->mTcwBefGBA.block<3,3>(0,0);
+                Eigen::Vector3f tcw = pRefKF->mTcwBefGBA.block<3,1>(0,3);
+                Eigen::Vector3f Xc = Rcw*pMP->GetWorldPos()+tcw;
 
-            cout << "Map updated!" << endl;
-        }
+                // Backproject using corrected camera
+                Eigen::Matrix4f Tcw = pRefKF->mTcwGBA;
+                Eigen::Matrix3f Rwc = Tcw.block<3,3>(0,0).transpose();
+                Eigen::Vector3f twc = -Rwc*Tcw.block<3,1>(0,3);
 
-        mbFinishedGBA = true;
-        mbRunningGBA = false;
-    }
+                vPos[i] = Rwc*Xc+twc;
+            }
+            vbUpdate[i] = 1;
+        }
+    });
 }
 
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    mEventState.Notify();
 }
 
 bool LoopClosing::CheckFinish()
@@ -762,8 +849,11 @@ bool LoopClosing::CheckFinish()
 
 void LoopClosing::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+    }
+    mEventState.Notify();
 }
 
 bool LoopClosing::isFinished()
@@ -772,5 +862,10 @@ bool LoopClosing::isFinished()
     return mbFinished;
 }
 
+void LoopClosing::WaitUntilFinished()
+{
+    mEventState.WaitUntil([this]{return isFinished() && !isRunningGBA();});
+}
+
 
 } //namespace ORB_SLAM
@@ -19,20 +19,30 @@
 */
 
 #include "Map.h"
+#include "MapImage.h"
+#include "MapJournal.h"
 
 #include<mutex>
 
 namespace ORB_SLAM2
 {
 
-Map::Map():mnMaxKFid(0),mnBigChangeIdx(0)
+Map::Map():mnMapPoints(0),mnKeyFrames(0),mnMaxKFid(0),mpImage(NULL),mpJournal(NULL),mnBigChangeIdx(0)
 {
 }
 
 void Map::AddKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.insert(pKF);
+    if(pKF->mnSlot>=mvpKeyFrames.size())
+        mvpKeyFrames.resize(pKF->mnSlot+1,static_cast<KeyFrame*>(NULL));
+    if(!mvpKeyFrames[pKF->mnSlot])
+    {
+        mvpKeyFrames[pKF->mnSlot] = pKF;
+        mnKeyFrames++;
+    }
+    if(mpJournal)
+        pKF->mbJournalDirty = true;
     if(pKF->mnId>mnMaxKFid)
         mnMaxKFid=pKF->mnId;
 }
@@ -40,25 +50,53 @@ void Map::AddKeyFrame(KeyFrame *pKF)
 void Map::AddMapPoint(MapPoint *pMP)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.insert(pMP);
+    if(pMP->mnSlot>=mvpMapPoints.size())
+        mvpMapPoints.resize(pMP->mnSlot+1,static_cast<MapPoint*>(NULL));
+    if(!mvpMapPoints[pMP->mnSlot])
+    {
+        mvpMapPoints[pMP->mnSlot] = pMP;
+        mnMapPoints++;
+    }
+    if(mpJournal)
+        pMP->mbJournalDirty = true;
 }
 
 void Map::EraseMapPoint(MapPoint *pMP)
 {
+    // A fused point is replayed as replaced (locks the point, taken before the map)
+    MapPoint* pReplacement = mpJournal ? pMP->GetReplaced() : static_cast<MapPoint*>(NULL);
+
     unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.erase(pMP);
+    // A point is erased once, even if it is set bad or replaced again
+    if(pMP->mnSlot>=mvpMapPoints.size() || mvpMapPoints[pMP->mnSlot]!=pMP)
+        return;
+    mvpMapPoints[pMP->mnSlot] = static_cast<MapPoint*>(NULL);
+    mnMapPoints--;
+
+    if(mpJournal)
+        mpJournal.load()->Erase(pMP,pReplacement);
 
-    // TODO: This only erase the pointer.
-    // Delete the MapPoint
+    mEpochManager.Retire(pMP);
 }
 
 void Map::EraseKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.erase(pKF);
+    if(pKF->mnSlot>=mvpKeyFrames.size() || mvpKeyFrames[pKF->mnSlot]!=pKF)
+        return;
+    mvpKeyFrames[pKF->mnSlot] = static_cast<KeyFrame*>(NULL);
+    mnKeyFrames--;
+
+    ErasedKeyFrame erased;
+    erased.mnId = pKF->mnId;
+    erased.mnParentId = pKF->GetParent()->mnId;
+    erased.mTcp = pKF->mTcp;
+    mvErasedKeyFrames.push_back(erased);
+
+    if(mpJournal)
+        mpJournal.load()->Erase(pKF);
 
-    // TODO: This only erase the pointer.
-    // Delete the MapPoint
+    mEpochManager.Retire(pKF);
 }
 
 void Map::SetReferenceMapPoints(const vector<MapPoint *> &vpMPs)
@@ -82,25 +120,46 @@ int Map::GetLastBigChangeIdx()
 vector<KeyFrame*> Map::GetAllKeyFrames()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
+    vector<KeyFrame*> vpKFs;
+    vpKFs.reserve(mnKeyFrames);
+    for(size_t i=0, iend=mvpKeyFrames.size(); i<iend; i++)
+    {
+        if(mvpKeyFrames[i])
+            vpKFs.push_back(mvpKeyFrames[i]);
+    }
+    return vpKFs;
 }
 
 vector<MapPoint*> Map::GetAllMapPoints()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return vector<MapPoint*>(mspMapPoints.begin(),mspMapPoints.end());
+    vector<MapPoint*> vpMPs;
+    vpMPs.reserve(mnMapPoints);
+    for(size_t i=0, iend=mvpMapPoints.size(); i<iend; i++)
+    {
+        if(mvpMapPoints[i])
+            vpMPs.push_back(mvpMapPoints[i]);
+    }
+    return vpMPs;
 }
 
 long unsigned int Map::MapPointsInMap()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return mspMapPoints.size();
+    return mnMapPoints;
 }
 
 long unsigned int Map::KeyFramesInMap()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return mspKeyFrames.size();
+    return mnKeyFrames;
+}
+
+void Map::TakeErasedKeyFrames(vector<ErasedKeyFrame> &vErasedKFs)
+{
+    vErasedKFs.clear();
+    unique_lock<mutex> lock(mMutexMap);
+    vErasedKFs.swap(mvErasedKeyFrames);
 }
 
 vector<MapPoint*> Map::GetReferenceMapPoints()
@@ -115,19 +174,71 @@ long unsigned int Map::GetMaxKFid()
     return mnMaxKFid;
 }
 
+void Map::SetImage(MapImage *pImage)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    delete mpImage;
+    mpImage = pImage;
+}
+
+void Map::SetJournal(MapJournal *pJournal)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    mpJournal = pJournal;
+    if(!pJournal)
+        return;
+
+    for(size_t i=0; i<mvpKeyFrames.size(); i++)
+    {
+        if(mvpKeyFrames[i])
+            mvpKeyFrames[i]->mbJournalDirty = true;
+    }
+    for(size_t i=0; i<mvpMapPoints.size(); i++)
+    {
+        if(mvpMapPoints[i])
+            mvpMapPoints[i]->mbJournalDirty = true;
+    }
+}
+
+void Map::Touch(KeyFrame *pKF)
+{
+    // No lock: the journal takes the flagged keyframes that are still in the map
+    if(mpJournal && !pKF->mbJournalDirty.load(memory_order_relaxed))
+        pKF->mbJournalDirty = true;
+}
+
+void Map::Touch(MapPoint *pMP)
+{
+    if(mpJournal && !pMP->mbJournalDirty.load(memory_order_relaxed))
+        pMP->mbJournalDirty = true;
+}
+
 void Map::clear()
 {
-    for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
-        delete *sit;
+    // The journal stops reading the entities before they are deleted
+    if(mpJournal)
+        mpJournal.load()->Reset();
+
+    for(size_t i=0; i<mvpMapPoints.size(); i++)
+        delete mvpMapPoints[i];
+
+    for(size_t i=0; i<mvpKeyFrames.size(); i++)
+        delete mvpKeyFrames[i];
+
+    mEpochManager.Clear();
 
-    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
-        delete *sit;
+    // Last, the keyframes deleted above kept their descriptors there
+    delete mpImage;
+    mpImage = static_cast<MapImage*>(NULL);
 
-    mspMapPoints.clear();
-    mspKeyFrames.clear();
+    mvpMapPoints.clear();
+    mvpKeyFrames.clear();
+    mnMapPoints = 0;
+    mnKeyFrames = 0;
     mnMaxKFid = 0;
     mvpReferenceMapPoints.clear();
     mvpKeyFrameOrigins.clear();
+    mvErasedKeyFrames.clear();
 }
 
 } //namespace ORB_SLAM
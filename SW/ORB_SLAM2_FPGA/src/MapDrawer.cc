@@ -28,7 +28,7 @@ namespace ORB_SLAM2
 {
 
 
-MapDrawer::MapDrawer(Map* pMap, const string &strSettingPath):mpMap(pMap)
+MapDrawer::MapDrawer(Map* pMap, const string &strSettingPath):mpMap(pMap), mbCameraPose(false)
 {
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
 
@@ -59,8 +59,8 @@ void MapDrawer::DrawMapPoints()
     {
         if(vpMPs[i]->isBad() || spRefMPs.count(vpMPs[i]))
             continue;
-        cv::Mat pos = vpMPs[i]->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
+        const Eigen::Vector3f pos = vpMPs[i]->GetWorldPos();
+        glVertex3f(pos(0),pos(1),pos(2));
     }
     glEnd();
 
@@ -72,8 +72,8 @@ void MapDrawer::DrawMapPoints()
     {
         if((*sit)->isBad())
             continue;
-        cv::Mat pos = (*sit)->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
+        const Eigen::Vector3f pos = (*sit)->GetWorldPos();
+        glVertex3f(pos(0),pos(1),pos(2));
 
     }
 
@@ -93,11 +93,12 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
         for(size_t i=0; i<vpKFs.size(); i++)
         {
             KeyFrame* pKF = vpKFs[i];
-            cv::Mat Twc = pKF->GetPoseInverse().t();
+            // Eigen is column-major, as OpenGL expects
+            const Eigen::Matrix4f Twc = pKF->GetPoseInverse();
 
             glPushMatrix();
 
-            glMultMatrixf(Twc.ptr<GLfloat>(0));
+            glMultMatrixf(Twc.data());
 
             glLineWidth(mKeyFrameLineWidth);
             glColor3f(0.0f,0.0f,1.0f);
@@ -138,16 +139,16 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
         {
             // Covisibility Graph
             const vector<KeyFrame*> vCovKFs = vpKFs[i]->GetCovisiblesByWeight(100);
-            cv::Mat Ow = vpKFs[i]->GetCameraCenter();
+            const Eigen::Vector3f Ow = vpKFs[i]->GetCameraCenter();
             if(!vCovKFs.empty())
             {
                 for(vector<KeyFrame*>::const_iterator vit=vCovKFs.begin(), vend=vCovKFs.end(); vit!=vend; vit++)
                 {
                     if((*vit)->mnId<vpKFs[i]->mnId)
                         continue;
-                    cv::Mat Ow2 = (*vit)->GetCameraCenter();
-                    glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                    glVertex3f(Ow2.at<float>(0),Ow2.at<float>(1),Ow2.at<float>(2));
+                    const Eigen::Vector3f Ow2 = (*vit)->GetCameraCenter();
+                    glVertex3f(Ow(0),Ow(1),Ow(2));
+                    glVertex3f(Ow2(0),Ow2(1),Ow2(2));
                 }
             }
 
@@ -155,9 +156,9 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
             KeyFrame* pParent = vpKFs[i]->GetParent();
             if(pParent)
             {
-                cv::Mat Owp = pParent->GetCameraCenter();
-                glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                glVertex3f(Owp.at<float>(0),Owp.at<float>(1),Owp.at<float>(2));
+                const Eigen::Vector3f Owp = pParent->GetCameraCenter();
+                glVertex3f(Ow(0),Ow(1),Ow(2));
+                glVertex3f(Owp(0),Owp(1),Owp(2));
             }
 
             // Loops
@@ -166,9 +167,9 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
             {
                 if((*sit)->mnId<vpKFs[i]->mnId)
                     continue;
-                cv::Mat Owl = (*sit)->GetCameraCenter();
-                glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                glVertex3f(Owl.at<float>(0),Owl.at<float>(1),Owl.at<float>(2));
+                const Eigen::Vector3f Owl = (*sit)->GetCameraCenter();
+                glVertex3f(Ow(0),Ow(1),Ow(2));
+                glVertex3f(Owl(0),Owl(1),Owl(2));
             }
         }
 
@@ -219,42 +220,43 @@ void MapDrawer::DrawCurrentCamera(pangolin::OpenGlMatrix &Twc)
 }
 
 
-void MapDrawer::SetCurrentCameraPose(const cv::Mat &Tcw)
+void MapDrawer::SetCurrentCameraPose(const Eigen::Matrix4f &Tcw)
 {
     unique_lock<mutex> lock(mMutexCamera);
-    mCameraPose = Tcw.clone();
+    mCameraPose = Tcw;
+    mbCameraPose = true;
 }
 
 void MapDrawer::GetCurrentOpenGLCameraMatrix(pangolin::OpenGlMatrix &M)
 {
-    if(!mCameraPose.empty())
+    if(mbCameraPose)
     {
-        cv::Mat Rwc(3,3,CV_32F);
-        cv::Mat twc(3,1,CV_32F);
+        Eigen::Matrix3f Rwc;
+        Eigen::Vector3f twc;
         {
             unique_lock<mutex> lock(mMutexCamera);
-            Rwc = mCameraPose.rowRange(0,3).colRange(0,3).t();
-            twc = -Rwc*mCameraPose.rowRange(0,3).col(3);
+            Rwc = mCameraPose.block<3,3>(0,0).transpose();
+            twc = -Rwc*mCameraPose.block<3,1>(0,3);
         }
 
-        M.m[0] = Rwc.at<float>(0,0);
-        M.m[1] = Rwc.at<float>(1,0);
-        M.m[2] = Rwc.at<float>(2,0);
+        M.m[0] = Rwc(0,0);
+        M.m[1] = Rwc(1,0);
+        M.m[2] = Rwc(2,0);
         M.m[3]  = 0.0;
 
-        M.m[4] = Rwc.at<float>(0,1);
-        M.m[5] = Rwc.at<float>(1,1);
-        M.m[6] = Rwc.at<float>(2,1);
+        M.m[4] = Rwc(0,1);
+        M.m[5] = Rwc(1,1);
+        M.m[6] = Rwc(2,1);
         M.m[7]  = 0.0;
 
-        M.m[8] = Rwc.at<float>(0,2);
-        M.m[9] = Rwc.at<float>(1,2);
-        M.m[10] = Rwc.at<float>(2,2);
+        M.m[8] = Rwc(0,2);
+        M.m[9] = Rwc(1,2);
+        M.m[10] = Rwc(2,2);
         M.m[11]  = 0.0;
 
-        M.m[12] = twc.at<float>(0);
-        M.m[13] = twc.at<float>(1);
-        M.m[14] = twc.at<float>(2);
+        M.m[12] = twc(0);
+        M.m[13] = twc(1);
+        M.m[14] = twc(2);
         M.m[15]  = 1.0;
     }
     else
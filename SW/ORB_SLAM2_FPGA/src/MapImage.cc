@@ -0,0 +1,839 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapImage.h"
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "KeyFrameDatabase.h"
+
+#include<fstream>
+#include<iostream>
+#include<algorithm>
+#include<unordered_map>
+#include<unordered_set>
+#include<cstring>
+#include<cmath>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+namespace
+{
+
+const uint32_t NO_POINT = ~(uint32_t)0;
+
+bool IsLittleEndian()
+{
+    const uint32_t one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one)==1;
+}
+
+// Append a section to the image, 64-byte aligned
+template<class T>
+void AddSection(vector<unsigned char> &image, MapImage::Header &h, const MapImage::eSection s, const vector<T> &v)
+{
+    const uint64_t offset = (image.size()+63) & ~(uint64_t)63;
+    const uint64_t size = v.size()*sizeof(T);
+    image.resize(offset+size,0);
+    if(size>0)
+        memcpy(&image[offset],&v[0],size);
+    h.section_offset[s] = offset;
+    h.section_size[s] = size;
+}
+
+}
+
+MapImage::MapImage(const unsigned char *pData, const size_t size):
+    mpData(pData), mnSize(size), mpHeader(reinterpret_cast<const Header*>(pData)), mbMapped(true)
+{
+}
+
+MapImage::MapImage(vector<unsigned char> &buffer): mbMapped(false)
+{
+    mvBuffer.swap(buffer);
+    mpData = &mvBuffer[0];
+    mnSize = mvBuffer.size();
+    mpHeader = reinterpret_cast<const Header*>(mpData);
+}
+
+MapImage::~MapImage()
+{
+    if(mbMapped)
+        munmap(const_cast<unsigned char*>(mpData),mnSize);
+}
+
+void MapImage::SetCamera()
+{
+    const Camera &camera = mpHeader->camera;
+
+    mK = cv::Mat::eye(3,3,CV_32F);
+    mK.at<float>(0,0) = camera.fx;
+    mK.at<float>(1,1) = camera.fy;
+    mK.at<float>(0,2) = camera.cx;
+    mK.at<float>(1,2) = camera.cy;
+
+    // Same pyramid as ORBextractor
+    mvScaleFactors.resize(camera.scaleLevels);
+    mvLevelSigma2.resize(camera.scaleLevels);
+    mvInvLevelSigma2.resize(camera.scaleLevels);
+    mvScaleFactors[0] = 1.0f;
+    mvLevelSigma2[0] = 1.0f;
+    for(int i=1; i<camera.scaleLevels; i++)
+    {
+        mvScaleFactors[i] = mvScaleFactors[i-1]*camera.scaleFactor;
+        mvLevelSigma2[i] = mvScaleFactors[i]*mvScaleFactors[i];
+    }
+    for(int i=0; i<camera.scaleLevels; i++)
+        mvInvLevelSigma2[i] = 1.0f/mvLevelSigma2[i];
+}
+
+uint64_t MapImage::Checksum(const unsigned char *data, const size_t size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i=0; i<size; i++)
+    {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void MapImage::GetCamera(KeyFrame *pKF, Camera &camera)
+{
+    camera.fx = pKF->fx;
+    camera.fy = pKF->fy;
+    camera.cx = pKF->cx;
+    camera.cy = pKF->cy;
+    camera.bf = pKF->mbf;
+    camera.thDepth = pKF->mThDepth;
+    camera.minX = pKF->mnMinX;
+    camera.maxX = pKF->mnMaxX;
+    camera.minY = pKF->mnMinY;
+    camera.maxY = pKF->mnMaxY;
+    camera.gridElementWidthInv = pKF->mfGridElementWidthInv;
+    camera.gridElementHeightInv = pKF->mfGridElementHeightInv;
+    camera.gridCols = pKF->mnGridCols;
+    camera.gridRows = pKF->mnGridRows;
+    camera.scaleLevels = pKF->mnScaleLevels;
+    camera.scaleFactor = pKF->mfScaleFactor;
+}
+
+void MapImage::GetKeyFrameData(KeyFrame *pKF, const bool bFeatures, const bool bState, KeyFrameData &data)
+{
+    KeyFrameRecord &r = data.record;
+    memset(&r,0,sizeof(r));
+    r.id = pKF->mnId;
+    r.frame_id = pKF->mnFrameId;
+    r.timestamp = pKF->mTimeStamp;
+    r.parent_id = NO_ID;
+
+    if(bFeatures)
+    {
+        data.vKeys = pKF->mvKeys;
+        data.vKeysUn = pKF->mvKeysUn;
+        data.vuRight = pKF->mvuRight;
+        data.vDepth = pKF->mvDepth;
+        data.vDescriptors.resize(32*pKF->N);
+        for(int j=0; j<pKF->N; j++)
+            memcpy(&data.vDescriptors[32*j],pKF->mDescriptors.ptr<unsigned char>(j),32);
+
+        data.vBowWords.clear();
+        data.vBowWeights.clear();
+        data.vBowWords.reserve(pKF->mBowVec.size());
+        data.vBowWeights.reserve(pKF->mBowVec.size());
+        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
+        {
+            data.vBowWords.push_back(vit->first);
+            data.vBowWeights.push_back(vit->second);
+        }
+
+        data.vFeatNodes.clear();
+        data.vFeatOffsets.clear();
+        data.vFeatIndices.clear();
+        for(size_t j=0; j<pKF->mFeatVec.size(); j++)
+        {
+            const DBoW2::FeatureVector::Features features = pKF->mFeatVec.features(j);
+            data.vFeatNodes.push_back(pKF->mFeatVec.node(j));
+            data.vFeatOffsets.push_back(data.vFeatIndices.size());
+            data.vFeatIndices.insert(data.vFeatIndices.end(),features.begin(),features.end());
+        }
+        data.vFeatOffsets.push_back(data.vFeatIndices.size());
+    }
+
+    if(bState)
+    {
+        const Eigen::Matrix4f Tcw = pKF->GetPose();
+        for(int row=0; row<3; row++)
+            for(int col=0; col<4; col++)
+                r.Tcw[4*row+col] = Tcw(row,col);
+
+        data.vConnectionIds.clear();
+        data.vConnectionWeights.clear();
+        data.vLoopEdges.clear();
+
+        unique_lock<mutex> lock(pKF->mMutexConnections);
+        if(pKF->mpParent)
+            r.parent_id = pKF->mpParent->mnId;
+        const Covisibility* pCov = pKF->mpCovisibility.load(memory_order_relaxed);
+        for(size_t i=0, iend=pCov->NumConnections(); i<iend; i++)
+        {
+            data.vConnectionIds.push_back(pCov->GetConnection(i)->mnId);
+            data.vConnectionWeights.push_back(pCov->GetConnectionWeight(i));
+        }
+        for(set<KeyFrame*>::iterator sit=pKF->mspLoopEdges.begin(), send=pKF->mspLoopEdges.end(); sit!=send; sit++)
+            data.vLoopEdges.push_back((*sit)->mnId);
+    }
+}
+
+void MapImage::GetMapPointData(MapPoint *pMP, MapPointData &data)
+{
+    MapPointRecord &r = data.record;
+    memset(&r,0,sizeof(r));
+
+    r.id = pMP->mnId;
+    r.first_kf_id = pMP->mnFirstKFid;
+    r.first_frame = pMP->mnFirstFrame;
+
+    const Eigen::Vector3f pos = pMP->GetWorldPos();
+    const Eigen::Vector3f normal = pMP->GetNormal();
+    for(int j=0; j<3; j++)
+    {
+        r.pos[j] = pos(j);
+        r.normal[j] = normal(j);
+    }
+
+    const cv::Mat descriptor = pMP->GetDescriptor();
+    if(descriptor.cols==32)
+        memcpy(r.descriptor,descriptor.data,32);
+
+    data.vObservationIds.clear();
+    data.vObservationIndices.clear();
+
+    unique_lock<mutex> lock(pMP->mMutexFeatures);
+    r.ref_kf_id = pMP->mpRefKF ? pMP->mpRefKF->mnId : NO_ID;
+    r.min_distance = pMP->mfMinDistance;
+    r.max_distance = pMP->mfMaxDistance;
+    r.visible = pMP->mnVisible;
+    r.found = pMP->mnFound;
+    for(MapPoint::ObservationVector::const_iterator mit=pMP->mObservations.begin(), mend=pMP->mObservations.end(); mit!=mend; mit++)
+    {
+        data.vObservationIds.push_back(mit->first->mnId);
+        data.vObservationIndices.push_back(mit->second);
+    }
+}
+
+void MapImage::Build(const Camera &camera, const uint64_t nWords, const vector<KeyFrameData> &vKFs,
+                     const vector<MapPointData> &vMPs, vector<unsigned char> &image)
+{
+    // Keyframes in id order, as they are inserted in the database
+    vector<const KeyFrameData*> vpKFs(vKFs.size());
+    unordered_set<uint64_t> sKFIds;
+    for(size_t i=0; i<vKFs.size(); i++)
+    {
+        vpKFs[i] = &vKFs[i];
+        sKFIds.insert(vKFs[i].record.id);
+    }
+    sort(vpKFs.begin(),vpKFs.end(),[](const KeyFrameData* p1, const KeyFrameData* p2){return p1->record.id<p2->record.id;});
+
+    Header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,"ORBSLMAP",8);
+    h.version = VERSION;
+    h.byte_order = 0x01020304;
+    h.camera = camera;
+
+    // Keyframes
+    vector<KeyFrameRecord> vKFRecords(vpKFs.size());
+    vector<float> vKeysX, vKeysY, vKeysUnX, vKeysUnY, vKeysSize, vKeysAngle, vKeysResponse, vuRight, vDepth;
+    vector<int32_t> vKeysOctave;
+    vector<unsigned char> vDescriptors;
+    vector<uint32_t> vBowWords, vFeatNodes, vFeatIndices;
+    vector<double> vBowWeights;
+    vector<uint64_t> vFeatOffsets, vConnectionIds, vLoopEdges;
+    vector<int32_t> vConnectionWeights;
+    vector<vector<pair<uint32_t,double> > > vInvertedFile(nWords);
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        const KeyFrameData &data = *vpKFs[i];
+        KeyFrameRecord &r = vKFRecords[i];
+        r = data.record;
+        if(!sKFIds.count(r.parent_id))
+            r.parent_id = NO_ID;
+
+        r.features = vKeysX.size();
+        r.n_features = data.vKeys.size();
+        for(size_t j=0; j<data.vKeys.size(); j++)
+        {
+            const cv::KeyPoint &kp = data.vKeys[j];
+            const cv::KeyPoint &kpUn = data.vKeysUn[j];
+            vKeysX.push_back(kp.pt.x);
+            vKeysY.push_back(kp.pt.y);
+            vKeysUnX.push_back(kpUn.pt.x);
+            vKeysUnY.push_back(kpUn.pt.y);
+            vKeysSize.push_back(kp.size);
+            vKeysAngle.push_back(kp.angle);
+            vKeysResponse.push_back(kp.response);
+            vKeysOctave.push_back(kp.octave);
+        }
+        vuRight.insert(vuRight.end(),data.vuRight.begin(),data.vuRight.end());
+        vDepth.insert(vDepth.end(),data.vDepth.begin(),data.vDepth.end());
+        vDescriptors.insert(vDescriptors.end(),data.vDescriptors.begin(),data.vDescriptors.end());
+
+        r.bow = vBowWords.size();
+        r.n_bow = data.vBowWords.size();
+        vBowWords.insert(vBowWords.end(),data.vBowWords.begin(),data.vBowWords.end());
+        vBowWeights.insert(vBowWeights.end(),data.vBowWeights.begin(),data.vBowWeights.end());
+        for(size_t j=0; j<data.vBowWords.size(); j++)
+        {
+            if(data.vBowWords[j]<nWords)
+                vInvertedFile[data.vBowWords[j]].push_back(make_pair((uint32_t)r.id,data.vBowWeights[j]));
+        }
+
+        r.feat_nodes = vFeatNodes.size();
+        r.n_feat_nodes = data.vFeatNodes.size();
+        for(size_t j=0; j<data.vFeatNodes.size(); j++)
+        {
+            vFeatNodes.push_back(data.vFeatNodes[j]);
+            vFeatOffsets.push_back(vFeatIndices.size());
+            vFeatIndices.insert(vFeatIndices.end(),data.vFeatIndices.begin()+data.vFeatOffsets[j],
+                                data.vFeatIndices.begin()+data.vFeatOffsets[j+1]);
+        }
+
+        r.connections = vConnectionIds.size();
+        for(size_t j=0; j<data.vConnectionIds.size(); j++)
+        {
+            if(!sKFIds.count(data.vConnectionIds[j]))
+                continue;
+            vConnectionIds.push_back(data.vConnectionIds[j]);
+            vConnectionWeights.push_back(data.vConnectionWeights[j]);
+        }
+        r.n_connections = vConnectionIds.size()-r.connections;
+
+        r.loop_edges = vLoopEdges.size();
+        for(size_t j=0; j<data.vLoopEdges.size(); j++)
+        {
+            if(sKFIds.count(data.vLoopEdges[j]))
+                vLoopEdges.push_back(data.vLoopEdges[j]);
+        }
+        r.n_loop_edges = vLoopEdges.size()-r.loop_edges;
+    }
+    // End of the last node
+    vFeatOffsets.push_back(vFeatIndices.size());
+
+    // Map points observed by at least one of the keyframes
+    vector<MapPointRecord> vMPRecords;
+    vector<uint64_t> vObservationIds;
+    vector<uint32_t> vObservationIndices;
+    vMPRecords.reserve(vMPs.size());
+    for(size_t i=0; i<vMPs.size(); i++)
+    {
+        const MapPointData &data = vMPs[i];
+        MapPointRecord r = data.record;
+
+        r.observations = vObservationIds.size();
+        for(size_t j=0; j<data.vObservationIds.size(); j++)
+        {
+            if(!sKFIds.count(data.vObservationIds[j]))
+                continue;
+            vObservationIds.push_back(data.vObservationIds[j]);
+            vObservationIndices.push_back(data.vObservationIndices[j]);
+        }
+        r.n_observations = vObservationIds.size()-r.observations;
+        if(r.n_observations==0)
+            continue;
+
+        if(!sKFIds.count(r.ref_kf_id))
+            r.ref_kf_id = vObservationIds[r.observations];
+        vMPRecords.push_back(r);
+    }
+
+    // Inverted index
+    vector<uint64_t> vPostingOffsets;
+    vector<uint32_t> vPostingIds;
+    vector<double> vPostingWeights;
+    vPostingOffsets.reserve(nWords+1);
+    for(size_t w=0; w<nWords; w++)
+    {
+        vPostingOffsets.push_back(vPostingIds.size());
+        for(size_t j=0; j<vInvertedFile[w].size(); j++)
+        {
+            vPostingIds.push_back(vInvertedFile[w][j].first);
+            vPostingWeights.push_back(vInvertedFile[w][j].second);
+        }
+    }
+    vPostingOffsets.push_back(vPostingIds.size());
+
+    h.num_keyframes = vKFRecords.size();
+    h.num_mappoints = vMPRecords.size();
+    h.num_features = vKeysX.size();
+    h.num_bow = vBowWords.size();
+    h.num_feat_nodes = vFeatNodes.size();
+    h.num_feat_indices = vFeatIndices.size();
+    h.num_connections = vConnectionIds.size();
+    h.num_loop_edges = vLoopEdges.size();
+    h.num_observations = vObservationIds.size();
+    h.num_words = nWords;
+    h.num_postings = vPostingIds.size();
+
+    image.assign(sizeof(Header),0);
+    AddSection(image,h,KEYFRAMES,vKFRecords);
+    AddSection(image,h,KEYS_X,vKeysX);
+    AddSection(image,h,KEYS_Y,vKeysY);
+    AddSection(image,h,KEYS_UN_X,vKeysUnX);
+    AddSection(image,h,KEYS_UN_Y,vKeysUnY);
+    AddSection(image,h,KEYS_SIZE,vKeysSize);
+    AddSection(image,h,KEYS_ANGLE,vKeysAngle);
+    AddSection(image,h,KEYS_RESPONSE,vKeysResponse);
+    AddSection(image,h,KEYS_OCTAVE,vKeysOctave);
+    AddSection(image,h,KEYS_U_RIGHT,vuRight);
+    AddSection(image,h,KEYS_DEPTH,vDepth);
+    AddSection(image,h,DESCRIPTORS,vDescriptors);
+    AddSection(image,h,BOW_WORDS,vBowWords);
+    AddSection(image,h,BOW_WEIGHTS,vBowWeights);
+    AddSection(image,h,FEAT_NODES,vFeatNodes);
+    AddSection(image,h,FEAT_OFFSETS,vFeatOffsets);
+    AddSection(image,h,FEAT_INDICES,vFeatIndices);
+    AddSection(image,h,CONNECTION_IDS,vConnectionIds);
+    AddSection(image,h,CONNECTION_WEIGHTS,vConnectionWeights);
+    AddSection(image,h,LOOP_EDGES,vLoopEdges);
+    AddSection(image,h,MAPPOINTS,vMPRecords);
+    AddSection(image,h,OBSERVATION_IDS,vObservationIds);
+    AddSection(image,h,OBSERVATION_INDICES,vObservationIndices);
+    AddSection(image,h,POSTING_OFFSETS,vPostingOffsets);
+    AddSection(image,h,POSTING_IDS,vPostingIds);
+    AddSection(image,h,POSTING_WEIGHTS,vPostingWeights);
+    h.file_size = image.size();
+
+    memcpy(&image[0],&h,sizeof(h));
+}
+
+void MapImage::Serialize(Map *pMap, KeyFrameDatabase *pKFDB, vector<unsigned char> &image)
+{
+    vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    vector<KeyFrameData> vKFs;
+    vKFs.reserve(vpKFs.size());
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        if(vpKFs[i]->isBad())
+            continue;
+        vKFs.push_back(KeyFrameData());
+        GetKeyFrameData(vpKFs[i],true,true,vKFs.back());
+    }
+
+    vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    vector<MapPointData> vMPs;
+    vMPs.reserve(vpMPs.size());
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        if(vpMPs[i]->isBad())
+            continue;
+        vMPs.push_back(MapPointData());
+        GetMapPointData(vpMPs[i],vMPs.back());
+    }
+
+    Camera camera;
+    memset(&camera,0,sizeof(camera));
+    if(!vpKFs.empty())
+        GetCamera(vpKFs[0],camera);
+
+    Build(camera,pKFDB->mpVoc->size(),vKFs,vMPs,image);
+}
+
+bool MapImage::Write(const string &filename, vector<unsigned char> &image)
+{
+    if(!IsLittleEndian())
+    {
+        cerr << "Map image: only little-endian hosts are supported" << endl;
+        return false;
+    }
+
+    Header h;
+    memcpy(&h,&image[0],sizeof(h));
+    h.checksum = Checksum(&image[sizeof(Header)],image.size()-sizeof(Header));
+    memcpy(&image[0],&h,sizeof(h));
+
+    ofstream f(filename.c_str(), ios_base::out | ios_base::binary);
+    if(!f.is_open())
+        return false;
+    f.write(reinterpret_cast<const char*>(&image[0]),image.size());
+    return f.good();
+}
+
+const char* MapImage::Check(const Header &h, const size_t size)
+{
+    if(memcmp(h.magic,"ORBSLMAP",8)!=0)
+        return "not a map image";
+    if(h.version!=VERSION)
+        return "unsupported version";
+    if(h.byte_order!=0x01020304)
+        return "wrong byte order";
+    if(h.file_size!=size)
+        return "truncated file";
+    if(h.num_keyframes==0)
+        return "empty map";
+    if(h.camera.gridCols!=FRAME_GRID_COLS || h.camera.gridRows!=FRAME_GRID_ROWS)
+        return "different keypoint grid";
+    if(h.camera.scaleLevels<1 || h.camera.scaleLevels>64 || h.camera.fx<=0 || h.camera.fy<=0)
+        return "invalid camera";
+
+    // Expected size of each section
+    uint64_t vSize[NUM_SECTIONS];
+    vSize[KEYFRAMES] = h.num_keyframes*sizeof(KeyFrameRecord);
+    vSize[KEYS_X] = vSize[KEYS_Y] = vSize[KEYS_UN_X] = vSize[KEYS_UN_Y] = h.num_features*sizeof(float);
+    vSize[KEYS_SIZE] = vSize[KEYS_ANGLE] = vSize[KEYS_RESPONSE] = h.num_features*sizeof(float);
+    vSize[KEYS_OCTAVE] = h.num_features*sizeof(int32_t);
+    vSize[KEYS_U_RIGHT] = vSize[KEYS_DEPTH] = h.num_features*sizeof(float);
+    vSize[DESCRIPTORS] = h.num_features*32;
+    vSize[BOW_WORDS] = h.num_bow*sizeof(uint32_t);
+    vSize[BOW_WEIGHTS] = h.num_bow*sizeof(double);
+    vSize[FEAT_NODES] = h.num_feat_nodes*sizeof(uint32_t);
+    vSize[FEAT_OFFSETS] = (h.num_feat_nodes+1)*sizeof(uint64_t);
+    vSize[FEAT_INDICES] = h.num_feat_indices*sizeof(uint32_t);
+    vSize[CONNECTION_IDS] = h.num_connections*sizeof(uint64_t);
+    vSize[CONNECTION_WEIGHTS] = h.num_connections*sizeof(int32_t);
+    vSize[LOOP_EDGES] = h.num_loop_edges*sizeof(uint64_t);
+    vSize[MAPPOINTS] = h.num_mappoints*sizeof(MapPointRecord);
+    vSize[OBSERVATION_IDS] = h.num_observations*sizeof(uint64_t);
+    vSize[OBSERVATION_INDICES] = h.num_observations*sizeof(uint32_t);
+    vSize[POSTING_OFFSETS] = (h.num_words+1)*sizeof(uint64_t);
+    vSize[POSTING_IDS] = h.num_postings*sizeof(uint32_t);
+    vSize[POSTING_WEIGHTS] = h.num_postings*sizeof(double);
+
+    for(int s=0; s<NUM_SECTIONS; s++)
+    {
+        if(h.section_size[s]!=vSize[s] || h.section_offset[s]%64!=0 || h.section_offset[s]<sizeof(Header) ||
+           h.section_offset[s]>size || h.section_size[s]>size-h.section_offset[s])
+            return "inconsistent sections";
+    }
+
+    return NULL;
+}
+
+vector<cv::KeyPoint> MapImage::GetKeyPoints(const KeyFrameRecord &kf, const bool bUndistorted) const
+{
+    const float* pX = Get<float>(bUndistorted ? KEYS_UN_X : KEYS_X)+kf.features;
+    const float* pY = Get<float>(bUndistorted ? KEYS_UN_Y : KEYS_Y)+kf.features;
+    const float* pSize = Get<float>(KEYS_SIZE)+kf.features;
+    const float* pAngle = Get<float>(KEYS_ANGLE)+kf.features;
+    const float* pResponse = Get<float>(KEYS_RESPONSE)+kf.features;
+    const int32_t* pOctave = Get<int32_t>(KEYS_OCTAVE)+kf.features;
+
+    vector<cv::KeyPoint> vKeys(kf.n_features);
+    for(size_t i=0; i<kf.n_features; i++)
+        vKeys[i] = cv::KeyPoint(cv::Point2f(pX[i],pY[i]),pSize[i],pAngle[i],pResponse[i],pOctave[i]);
+    return vKeys;
+}
+
+vector<float> MapImage::GetFloats(const KeyFrameRecord &kf, const eSection s) const
+{
+    const float* p = Get<float>(s)+kf.features;
+    return vector<float>(p,p+kf.n_features);
+}
+
+bool MapImage::Load(const string &filename, Map *pMap, KeyFrameDatabase *pKFDB, ORBVocabulary *pVoc, const bool verify)
+{
+    if(!IsLittleEndian())
+    {
+        cerr << "Map image: only little-endian hosts are supported" << endl;
+        return false;
+    }
+
+    const int fd = open(filename.c_str(),O_RDONLY);
+    if(fd<0)
+    {
+        cerr << "Failed to open map image at: " << filename << endl;
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd,&st)!=0 || (size_t)st.st_size<sizeof(Header))
+    {
+        close(fd);
+        cerr << "Map image " << filename << ": truncated file" << endl;
+        return false;
+    }
+
+    const size_t size = st.st_size;
+    void* addr = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(addr==MAP_FAILED)
+        return false;
+
+    return Load(new MapImage(reinterpret_cast<const unsigned char*>(addr),size),filename,pMap,pKFDB,pVoc,verify);
+}
+
+bool MapImage::Load(vector<unsigned char> &image, const string &name, Map *pMap, KeyFrameDatabase *pKFDB, ORBVocabulary *pVoc)
+{
+    if(!IsLittleEndian())
+    {
+        cerr << "Map image: only little-endian hosts are supported" << endl;
+        return false;
+    }
+
+    if(image.size()<sizeof(Header))
+    {
+        cerr << "Map image " << name << ": truncated file" << endl;
+        return false;
+    }
+
+    return Load(new MapImage(image),name,pMap,pKFDB,pVoc,false);
+}
+
+bool MapImage::Load(MapImage *pImage, const string &name, Map *pMap, KeyFrameDatabase *pKFDB, ORBVocabulary *pVoc,
+                    const bool verify)
+{
+    const unsigned char* data = pImage->mpData;
+    const size_t size = pImage->mnSize;
+    Header h;
+    memcpy(&h,data,sizeof(h));
+
+    const char* error = Check(h,size);
+    if(!error && h.num_words!=pVoc->size())
+        error = "built with a different vocabulary";
+    if(!error && verify && Checksum(data+sizeof(Header),size-sizeof(Header))!=h.checksum)
+        error = "checksum mismatch";
+
+    // Every reference in the file must be in range
+    const KeyFrameRecord* pKFRecords = reinterpret_cast<const KeyFrameRecord*>(data+h.section_offset[KEYFRAMES]);
+    for(size_t i=0; !error && i<h.num_keyframes; i++)
+    {
+        const KeyFrameRecord &r = pKFRecords[i];
+        if(r.features+r.n_features>h.num_features || r.bow+r.n_bow>h.num_bow ||
+           r.feat_nodes+r.n_feat_nodes>h.num_feat_nodes || r.connections+r.n_connections>h.num_connections ||
+           r.loop_edges+r.n_loop_edges>h.num_loop_edges)
+            error = "keyframe out of range";
+    }
+    const MapPointRecord* pMPRecords = reinterpret_cast<const MapPointRecord*>(data+h.section_offset[MAPPOINTS]);
+    for(size_t i=0; !error && i<h.num_mappoints; i++)
+    {
+        if(pMPRecords[i].observations+pMPRecords[i].n_observations>h.num_observations)
+            error = "map point out of range";
+    }
+    const uint64_t* pFeatOffsets = reinterpret_cast<const uint64_t*>(data+h.section_offset[FEAT_OFFSETS]);
+    for(size_t i=0; !error && i<h.num_feat_nodes; i++)
+    {
+        if(pFeatOffsets[i]>pFeatOffsets[i+1] || pFeatOffsets[i+1]>h.num_feat_indices)
+            error = "feature vector out of range";
+    }
+    const uint64_t* pPostingOffsets = reinterpret_cast<const uint64_t*>(data+h.section_offset[POSTING_OFFSETS]);
+    for(size_t i=0; !error && i<h.num_words; i++)
+    {
+        if(pPostingOffsets[i]>pPostingOffsets[i+1] || pPostingOffsets[i+1]>h.num_postings)
+            error = "inverted index out of range";
+    }
+
+    // Values used as indices once loaded: feature indices and octaves of the keyframes, and
+    // words of their BoW vectors (the inverted index is indexed by word). Checked even
+    // without the checksum.
+    const int32_t* pOctaves = reinterpret_cast<const int32_t*>(data+h.section_offset[KEYS_OCTAVE]);
+    for(size_t i=0; !error && i<h.num_features; i++)
+    {
+        if(pOctaves[i]<0 || pOctaves[i]>=h.camera.scaleLevels)
+            error = "octave out of range";
+    }
+    const uint32_t* pBowWords = reinterpret_cast<const uint32_t*>(data+h.section_offset[BOW_WORDS]);
+    for(size_t i=0; !error && i<h.num_bow; i++)
+    {
+        if(pBowWords[i]>=h.num_words)
+            error = "word out of range";
+    }
+    const uint32_t* pFeatIndices = reinterpret_cast<const uint32_t*>(data+h.section_offset[FEAT_INDICES]);
+    for(size_t i=0; !error && i<h.num_keyframes; i++)
+    {
+        const KeyFrameRecord &r = pKFRecords[i];
+        for(size_t k=pFeatOffsets[r.feat_nodes]; !error && k<pFeatOffsets[r.feat_nodes+r.n_feat_nodes]; k++)
+        {
+            if(pFeatIndices[k]>=r.n_features)
+                error = "feature index out of range";
+        }
+    }
+
+    if(error)
+    {
+        cerr << "Map image " << name << ": " << error << endl;
+        delete pImage;
+        return false;
+    }
+
+    pImage->SetCamera();
+
+    // Keyframes
+    vector<KeyFrame*> vpKFs(h.num_keyframes);
+    unordered_map<uint64_t,KeyFrame*> mIdKFs;
+    long unsigned int nMaxKFId = 0;
+    long unsigned int nMaxFrameId = 0;
+    for(size_t i=0; i<h.num_keyframes; i++)
+    {
+        KeyFrame* pKF = new KeyFrame(*pImage,i,pMap,pKFDB,pVoc);
+        vpKFs[i] = pKF;
+        mIdKFs[pKF->mnId] = pKF;
+        nMaxKFId = max(nMaxKFId,pKF->mnId);
+        nMaxFrameId = max(nMaxFrameId,pKF->mnFrameId);
+    }
+
+    // Covisibility graph, spanning tree and loop edges
+    const uint64_t* pConnectionIds = pImage->Get<uint64_t>(CONNECTION_IDS);
+    const int32_t* pConnectionWeights = pImage->Get<int32_t>(CONNECTION_WEIGHTS);
+    const uint64_t* pLoopEdges = pImage->Get<uint64_t>(LOOP_EDGES);
+    KeyFrame* pRootKF = static_cast<KeyFrame*>(NULL);
+    for(size_t i=0; i<h.num_keyframes; i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        const KeyFrameRecord &r = pKFRecords[i];
+
+        vector<pair<KeyFrame*,int> > vConnections;
+        vConnections.reserve(r.n_connections);
+        for(size_t j=r.connections; j<r.connections+r.n_connections; j++)
+        {
+            unordered_map<uint64_t,KeyFrame*>::iterator mit = mIdKFs.find(pConnectionIds[j]);
+            if(mit!=mIdKFs.end() && mit->second!=pKF)
+                vConnections.push_back(make_pair(mit->second,(int)pConnectionWeights[j]));
+        }
+        {
+            unique_lock<mutex> lock(pKF->mMutexConnections);
+            pKF->SetCovisibility(Covisibility::Create(vConnections));
+        }
+
+        unordered_map<uint64_t,KeyFrame*>::iterator mit = mIdKFs.find(r.parent_id);
+        if(r.parent_id!=NO_ID && mit!=mIdKFs.end() && mit->second!=pKF)
+        {
+            pKF->mpParent = mit->second;
+            mit->second->mspChildrens.insert(pKF);
+        }
+        else if(!pRootKF || pKF->mnId<pRootKF->mnId)
+            pRootKF = pKF;
+
+        for(size_t j=r.loop_edges; j<r.loop_edges+r.n_loop_edges; j++)
+        {
+            mit = mIdKFs.find(pLoopEdges[j]);
+            if(mit!=mIdKFs.end())
+                pKF->mspLoopEdges.insert(mit->second);
+        }
+        pKF->mbNotErase = !pKF->mspLoopEdges.empty();
+    }
+
+    // Map points and their observations (which are also the matches of the keyframes)
+    const uint64_t* pObservationIds = pImage->Get<uint64_t>(OBSERVATION_IDS);
+    const uint32_t* pObservationIndices = pImage->Get<uint32_t>(OBSERVATION_INDICES);
+    vector<MapPoint*> vpMPs;
+    vpMPs.reserve(h.num_mappoints);
+    long unsigned int nMaxMPId = 0;
+    for(size_t i=0; i<h.num_mappoints; i++)
+    {
+        const MapPointRecord &r = pMPRecords[i];
+
+        unordered_map<uint64_t,KeyFrame*>::iterator mit = mIdKFs.find(r.ref_kf_id);
+        if(mit==mIdKFs.end())
+            continue;
+
+        MapPoint* pMP = new MapPoint(Eigen::Vector3f(r.pos[0],r.pos[1],r.pos[2]),mit->second,pMap);
+        pMP->mnId = r.id;
+        pMP->mnFirstKFid = r.first_kf_id;
+        pMP->mnFirstFrame = r.first_frame;
+        pMP->mNormalVector = Eigen::Vector3f(r.normal[0],r.normal[1],r.normal[2]);
+        pMP->mfMinDistance = r.min_distance;
+        pMP->mfMaxDistance = r.max_distance;
+        pMP->mnVisible = r.visible;
+        pMP->mnFound = r.found;
+        // Copied, the descriptor of a point is updated in place
+        pMP->mDescriptor = cv::Mat(1,32,CV_8U);
+        memcpy(pMP->mDescriptor.data,r.descriptor,32);
+
+        for(size_t j=r.observations; j<r.observations+r.n_observations; j++)
+        {
+            mit = mIdKFs.find(pObservationIds[j]);
+            if(mit==mIdKFs.end() || pObservationIndices[j]>=(uint32_t)mit->second->N)
+                continue;
+            KeyFrame* pKF = mit->second;
+            const size_t idx = pObservationIndices[j];
+            if(pKF->mvpMapPoints[idx])
+                continue;
+            pMP->AddObservation(pKF,idx);
+            pKF->mvpMapPoints[idx] = pMP;
+        }
+
+        if(pMP->Observations()==0)
+        {
+            delete pMP;
+            continue;
+        }
+
+        vpMPs.push_back(pMP);
+        nMaxMPId = max(nMaxMPId,pMP->mnId);
+    }
+
+    // Inverted index
+    {
+        const uint32_t* pPostingIds = pImage->Get<uint32_t>(POSTING_IDS);
+        const double* pPostingWeights = pImage->Get<double>(POSTING_WEIGHTS);
+
+        unique_lock<mutex> lock(pKFDB->mMutex);
+        pKFDB->mvpKeyFrames.assign(nMaxKFId+1,static_cast<KeyFrame*>(NULL));
+        pKFDB->mvbErased.assign(nMaxKFId+1,0);
+        for(size_t i=0; i<vpKFs.size(); i++)
+            pKFDB->mvpKeyFrames[vpKFs[i]->mnId] = vpKFs[i];
+
+        pKFDB->mnPostings = 0;
+        pKFDB->mnTombstones = 0;
+        for(size_t w=0; w<h.num_words; w++)
+        {
+            vector<KeyFrameDatabase::Posting> &vPostings = pKFDB->mvInvertedFile[w];
+            vPostings.clear();
+            vPostings.reserve(pPostingOffsets[w+1]-pPostingOffsets[w]);
+            for(size_t j=pPostingOffsets[w]; j<pPostingOffsets[w+1]; j++)
+            {
+                if(pPostingIds[j]<=nMaxKFId && pKFDB->mvpKeyFrames[pPostingIds[j]])
+                    vPostings.push_back(KeyFrameDatabase::Posting(pPostingIds[j],pPostingWeights[j]));
+            }
+            pKFDB->mnPostings += vPostings.size();
+        }
+    }
+
+    // The map is only visible to the other threads from here
+    for(size_t i=0; i<vpKFs.size(); i++)
+        pMap->AddKeyFrame(vpKFs[i]);
+    for(size_t i=0; i<vpMPs.size(); i++)
+        pMap->AddMapPoint(vpMPs[i]);
+    if(pRootKF)
+        pMap->mvpKeyFrameOrigins.push_back(pRootKF);
+    pMap->SetImage(pImage);
+
+    // New keyframes, points and frames continue after the loaded ones
+    KeyFrame::nNextId = nMaxKFId+1;
+    {
+        unique_lock<mutex> lock(pMap->mMutexPointCreation);
+        MapPoint::nNextId = max(MapPoint::nNextId,nMaxMPId+1);
+    }
+    Frame::nNextId = max(Frame::nNextId,nMaxFrameId+1);
+
+    cout << "Map loaded from " << name << ": " << vpKFs.size() << " keyframes, " << vpMPs.size() << " points" << endl;
+
+    return true;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,1041 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapJournal.h"
+#include "MapImage.h"
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+
+#include<opencv2/core/core.hpp>
+#include<fstream>
+#include<iostream>
+#include<algorithm>
+#include<cstring>
+#include<chrono>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/stat.h>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+namespace
+{
+
+const char JOURNAL_MAGIC[8] = {'O','R','B','S','L','J','N','L'};
+const uint32_t JOURNAL_VERSION = 1;
+
+// Compacting small files is not worth it
+const uint64_t MIN_COMPACT_SIZE = 4*1024*1024;
+// Payload of the batches written by a compaction
+const size_t COMPACT_BATCH_SIZE = 4*1024*1024;
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+};
+
+// Followed by the payload: records (type byte, varint size of the body, body)
+struct BatchHeader
+{
+    uint32_t size;
+    uint32_t reserved;
+    // FNV-1a of the payload
+    uint64_t checksum;
+};
+
+class Encoder
+{
+public:
+    Encoder(vector<unsigned char> &buffer): mBuffer(buffer) {}
+
+    void PutVarint(uint64_t v)
+    {
+        while(v>=0x80)
+        {
+            mBuffer.push_back((v&0x7f)|0x80);
+            v >>= 7;
+        }
+        mBuffer.push_back(v);
+    }
+
+    // Zigzag, small magnitudes are short
+    void PutSigned(const int64_t v)
+    {
+        PutVarint(((uint64_t)v<<1)^(uint64_t)(v>>63));
+    }
+
+    void PutFloat(const float v) { PutBytes(&v,sizeof(v)); }
+    void PutDouble(const double v) { PutBytes(&v,sizeof(v)); }
+
+    void PutBytes(const void* p, const size_t n)
+    {
+        const unsigned char* c = static_cast<const unsigned char*>(p);
+        mBuffer.insert(mBuffer.end(),c,c+n);
+    }
+
+protected:
+    vector<unsigned char> &mBuffer;
+};
+
+class Decoder
+{
+public:
+    Decoder(const unsigned char* p, const size_t n): mp(p), mpEnd(p+n), mbOk(true) {}
+
+    uint64_t GetVarint()
+    {
+        uint64_t v = 0;
+        for(int shift=0; mp<mpEnd && shift<64; shift+=7)
+        {
+            const unsigned char c = *mp++;
+            v |= (uint64_t)(c&0x7f)<<shift;
+            if(!(c&0x80))
+                return v;
+        }
+        mbOk = false;
+        return 0;
+    }
+
+    int64_t GetSigned()
+    {
+        const uint64_t v = GetVarint();
+        return (int64_t)(v>>1)^-(int64_t)(v&1);
+    }
+
+    float GetFloat() { float v; GetBytes(&v,sizeof(v)); return v; }
+    double GetDouble() { double v; GetBytes(&v,sizeof(v)); return v; }
+
+    void GetBytes(void* p, const size_t n)
+    {
+        if((size_t)(mpEnd-mp)<n)
+        {
+            mbOk = false;
+            mp = mpEnd;
+            memset(p,0,n);
+            return;
+        }
+        memcpy(p,mp,n);
+        mp += n;
+    }
+
+    // Number of elements that take at least nMinSize bytes each
+    size_t GetCount(const size_t nMinSize)
+    {
+        const uint64_t n = GetVarint();
+        if(n>(uint64_t)(mpEnd-mp)/max((size_t)1,nMinSize))
+        {
+            mbOk = false;
+            return 0;
+        }
+        return n;
+    }
+
+    const unsigned char* GetPosition() const { return mp; }
+    void Skip(const size_t n) { mp += min(n,(size_t)(mpEnd-mp)); }
+    bool IsOk() const { return mbOk; }
+    bool AtEnd() const { return mp>=mpEnd; }
+
+protected:
+    const unsigned char* mp;
+    const unsigned char* mpEnd;
+    bool mbOk;
+};
+
+// Append a record to the payload, returns its offset in the payload
+uint64_t AddRecord(vector<unsigned char> &payload, const int type, const vector<unsigned char> &body)
+{
+    const uint64_t offset = payload.size();
+    Encoder e(payload);
+    e.PutBytes(&type,1);
+    e.PutVarint(body.size());
+    if(!body.empty())
+        e.PutBytes(&body[0],body.size());
+    return offset;
+}
+
+void EncodeKeyFrame(const MapImage::KeyFrameData &data, vector<unsigned char> &body)
+{
+    Encoder e(body);
+    e.PutVarint(data.record.id);
+    e.PutVarint(data.record.frame_id);
+    e.PutDouble(data.record.timestamp);
+
+    const size_t N = data.vKeys.size();
+    e.PutVarint(N);
+    for(size_t i=0; i<N; i++)
+    {
+        const cv::KeyPoint &kp = data.vKeys[i];
+        const cv::KeyPoint &kpUn = data.vKeysUn[i];
+        e.PutFloat(kp.pt.x);
+        e.PutFloat(kp.pt.y);
+        e.PutFloat(kpUn.pt.x);
+        e.PutFloat(kpUn.pt.y);
+        e.PutFloat(kp.size);
+        e.PutFloat(kp.angle);
+        e.PutFloat(kp.response);
+        e.PutSigned(kp.octave);
+        e.PutFloat(data.vuRight[i]);
+        e.PutFloat(data.vDepth[i]);
+    }
+    if(N>0)
+        e.PutBytes(&data.vDescriptors[0],32*N);
+
+    // Words and nodes are sorted
+    e.PutVarint(data.vBowWords.size());
+    int64_t prev = 0;
+    for(size_t i=0; i<data.vBowWords.size(); i++)
+    {
+        e.PutSigned((int64_t)data.vBowWords[i]-prev);
+        prev = data.vBowWords[i];
+        e.PutDouble(data.vBowWeights[i]);
+    }
+
+    e.PutVarint(data.vFeatNodes.size());
+    prev = 0;
+    for(size_t i=0; i<data.vFeatNodes.size(); i++)
+    {
+        e.PutSigned((int64_t)data.vFeatNodes[i]-prev);
+        prev = data.vFeatNodes[i];
+        e.PutVarint(data.vFeatOffsets[i+1]-data.vFeatOffsets[i]);
+        for(uint32_t j=data.vFeatOffsets[i]; j<data.vFeatOffsets[i+1]; j++)
+            e.PutVarint(data.vFeatIndices[j]);
+    }
+}
+
+bool DecodeKeyFrame(Decoder &d, MapImage::KeyFrameData &data)
+{
+    data.record.frame_id = d.GetVarint();
+    data.record.timestamp = d.GetDouble();
+
+    // Keypoint and descriptor
+    const size_t N = d.GetCount(9*sizeof(float)+1+32);
+    data.vKeys.resize(N);
+    data.vKeysUn.resize(N);
+    data.vuRight.resize(N);
+    data.vDepth.resize(N);
+    for(size_t i=0; i<N; i++)
+    {
+        const float x = d.GetFloat();
+        const float y = d.GetFloat();
+        const float ux = d.GetFloat();
+        const float uy = d.GetFloat();
+        const float size = d.GetFloat();
+        const float angle = d.GetFloat();
+        const float response = d.GetFloat();
+        const int octave = d.GetSigned();
+        data.vKeys[i] = cv::KeyPoint(cv::Point2f(x,y),size,angle,response,octave);
+        data.vKeysUn[i] = cv::KeyPoint(cv::Point2f(ux,uy),size,angle,response,octave);
+        data.vuRight[i] = d.GetFloat();
+        data.vDepth[i] = d.GetFloat();
+    }
+    data.vDescriptors.resize(32*N);
+    if(N>0)
+        d.GetBytes(&data.vDescriptors[0],32*N);
+
+    const size_t nBow = d.GetCount(1+sizeof(double));
+    data.vBowWords.resize(nBow);
+    data.vBowWeights.resize(nBow);
+    int64_t prev = 0;
+    for(size_t i=0; i<nBow; i++)
+    {
+        prev += d.GetSigned();
+        data.vBowWords[i] = prev;
+        data.vBowWeights[i] = d.GetDouble();
+    }
+
+    const size_t nNodes = d.GetCount(2);
+    data.vFeatNodes.resize(nNodes);
+    data.vFeatOffsets.assign(1,0);
+    data.vFeatIndices.clear();
+    prev = 0;
+    for(size_t i=0; i<nNodes; i++)
+    {
+        prev += d.GetSigned();
+        data.vFeatNodes[i] = prev;
+        const size_t n = d.GetCount(1);
+        for(size_t j=0; j<n; j++)
+        {
+            const uint64_t idx = d.GetVarint();
+            if(idx<N)
+                data.vFeatIndices.push_back(idx);
+        }
+        data.vFeatOffsets.push_back(data.vFeatIndices.size());
+    }
+
+    return d.IsOk();
+}
+
+void EncodeKeyFrameState(const MapImage::KeyFrameData &data, vector<unsigned char> &body)
+{
+    Encoder e(body);
+    const MapImage::KeyFrameRecord &r = data.record;
+    e.PutVarint(r.id);
+    for(int i=0; i<12; i++)
+        e.PutFloat(r.Tcw[i]);
+    e.PutVarint(r.parent_id==MapImage::NO_ID ? 0 : r.parent_id+1);
+
+    e.PutVarint(data.vConnectionIds.size());
+    for(size_t i=0; i<data.vConnectionIds.size(); i++)
+    {
+        e.PutVarint(data.vConnectionIds[i]);
+        e.PutVarint(data.vConnectionWeights[i]);
+    }
+    e.PutVarint(data.vLoopEdges.size());
+    for(size_t i=0; i<data.vLoopEdges.size(); i++)
+        e.PutVarint(data.vLoopEdges[i]);
+}
+
+bool DecodeKeyFrameState(Decoder &d, MapImage::KeyFrameData &data)
+{
+    MapImage::KeyFrameRecord &r = data.record;
+    for(int i=0; i<12; i++)
+        r.Tcw[i] = d.GetFloat();
+    const uint64_t parent = d.GetVarint();
+    r.parent_id = parent==0 ? MapImage::NO_ID : parent-1;
+
+    const size_t nConnections = d.GetCount(2);
+    data.vConnectionIds.resize(nConnections);
+    data.vConnectionWeights.resize(nConnections);
+    for(size_t i=0; i<nConnections; i++)
+    {
+        data.vConnectionIds[i] = d.GetVarint();
+        data.vConnectionWeights[i] = d.GetVarint();
+    }
+    const size_t nLoopEdges = d.GetCount(1);
+    data.vLoopEdges.resize(nLoopEdges);
+    for(size_t i=0; i<nLoopEdges; i++)
+        data.vLoopEdges[i] = d.GetVarint();
+
+    return d.IsOk();
+}
+
+void EncodeMapPoint(const MapImage::MapPointData &data, vector<unsigned char> &body)
+{
+    Encoder e(body);
+    const MapImage::MapPointRecord &r = data.record;
+    e.PutVarint(r.id);
+    e.PutSigned(r.first_kf_id);
+    e.PutSigned(r.first_frame);
+    e.PutVarint(r.ref_kf_id==MapImage::NO_ID ? 0 : r.ref_kf_id+1);
+    for(int i=0; i<3; i++)
+        e.PutFloat(r.pos[i]);
+    for(int i=0; i<3; i++)
+        e.PutFloat(r.normal[i]);
+    e.PutFloat(r.min_distance);
+    e.PutFloat(r.max_distance);
+    e.PutSigned(r.visible);
+    e.PutSigned(r.found);
+    e.PutBytes(r.descriptor,32);
+
+    e.PutVarint(data.vObservationIds.size());
+    for(size_t i=0; i<data.vObservationIds.size(); i++)
+    {
+        e.PutVarint(data.vObservationIds[i]);
+        e.PutVarint(data.vObservationIndices[i]);
+    }
+}
+
+bool DecodeMapPoint(Decoder &d, MapImage::MapPointData &data)
+{
+    MapImage::MapPointRecord &r = data.record;
+    memset(&r,0,sizeof(r));
+    r.id = d.GetVarint();
+    r.first_kf_id = d.GetSigned();
+    r.first_frame = d.GetSigned();
+    const uint64_t ref = d.GetVarint();
+    r.ref_kf_id = ref==0 ? MapImage::NO_ID : ref-1;
+    for(int i=0; i<3; i++)
+        r.pos[i] = d.GetFloat();
+    for(int i=0; i<3; i++)
+        r.normal[i] = d.GetFloat();
+    r.min_distance = d.GetFloat();
+    r.max_distance = d.GetFloat();
+    r.visible = d.GetSigned();
+    r.found = d.GetSigned();
+    d.GetBytes(r.descriptor,32);
+
+    const size_t nObservations = d.GetCount(2);
+    data.vObservationIds.resize(nObservations);
+    data.vObservationIndices.resize(nObservations);
+    for(size_t i=0; i<nObservations; i++)
+    {
+        data.vObservationIds[i] = d.GetVarint();
+        data.vObservationIndices[i] = d.GetVarint();
+    }
+
+    return d.IsOk();
+}
+
+bool WriteAt(const int fd, const void* p, const size_t n, const uint64_t offset)
+{
+    const char* c = static_cast<const char*>(p);
+    size_t nWritten = 0;
+    while(nWritten<n)
+    {
+        const ssize_t r = pwrite(fd,c+nWritten,n-nWritten,offset+nWritten);
+        if(r<=0)
+            return false;
+        nWritten += r;
+    }
+    return true;
+}
+
+bool ReadAt(const int fd, void* p, const size_t n, const uint64_t offset)
+{
+    char* c = static_cast<char*>(p);
+    size_t nRead = 0;
+    while(nRead<n)
+    {
+        const ssize_t r = pread(fd,c+nRead,n-nRead,offset+nRead);
+        if(r<=0)
+            return false;
+        nRead += r;
+    }
+    return true;
+}
+
+// New journal file with its header
+int CreateFile(const string &filename)
+{
+    const int fd = open(filename.c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+    if(fd<0)
+        return -1;
+
+    FileHeader h;
+    memcpy(h.magic,JOURNAL_MAGIC,8);
+    h.version = JOURNAL_VERSION;
+    h.byte_order = 0x01020304;
+    if(!WriteAt(fd,&h,sizeof(h),0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}
+
+MapJournal::MapJournal(Map *pMap, const uint64_t nWords, const string &strSettingPath):
+    mpMap(pMap), mnWords(nWords), mnPeriod(500), mfCompactRatio(2.0f), mbResetPending(false), mFd(-1),
+    mnFileSize(0), mbSnapshot(false), mnEpochReader(-1), mbCamera(false), mnLiveSize(0), mbFinishRequested(false), mbFinished(true)
+{
+    cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
+
+    cv::FileNode node = fSettings["Journal.File"];
+    if(!node.empty())
+        mStrFile = (string)node;
+    node = fSettings["Journal.Period"];
+    if(!node.empty())
+        mnPeriod = max(1,(int)node);
+    node = fSettings["Journal.CompactRatio"];
+    if(!node.empty())
+        mfCompactRatio = max(0.0f,(float)node);
+
+    memset(&mStats,0,sizeof(mStats));
+    mCamera.nOffset = 0;
+    mCamera.nSize = 0;
+}
+
+MapJournal::~MapJournal()
+{
+    if(mFd>=0)
+    {
+        close(mFd);
+        // Nothing was written, the previous file is kept
+        if(mbSnapshot)
+            unlink((mStrFile+".tmp").c_str());
+    }
+}
+
+bool MapJournal::Open()
+{
+    unique_lock<mutex> lock(mMutexWriter);
+    if(mFd>=0)
+        close(mFd);
+
+    // The file may be the map just loaded: it is only replaced once the first batch is on disk
+    mFd = CreateFile(mStrFile+".tmp");
+    if(mFd<0)
+        return false;
+    mnFileSize = sizeof(FileHeader);
+    mbSnapshot = true;
+    return true;
+}
+
+void MapJournal::Erase(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexQueue);
+    Erased erased;
+    erased.nType = KEYFRAME_ERASED;
+    erased.nId = pKF->mnId;
+    erased.nReplacementId = 0;
+    mvErased.push_back(erased);
+}
+
+void MapJournal::Erase(MapPoint *pMP, MapPoint *pReplacement)
+{
+    unique_lock<mutex> lock(mMutexQueue);
+    Erased erased;
+    erased.nType = pReplacement ? MAPPOINT_REPLACED : MAPPOINT_ERASED;
+    erased.nId = pMP->mnId;
+    erased.nReplacementId = pReplacement ? pReplacement->mnId : 0;
+    mvErased.push_back(erased);
+}
+
+void MapJournal::Reset()
+{
+    // The current batch may be reading entities that are about to be deleted
+    unique_lock<mutex> lock(mMutexWriter);
+    unique_lock<mutex> lock2(mMutexQueue);
+    mvErased.clear();
+    mbResetPending = true;
+}
+
+void MapJournal::Run()
+{
+    mbFinished = false;
+
+    // Idle between batches, the entities are taken from the map after each announcement
+    mnEpochReader = mpMap->mEpochManager.Register();
+    mpMap->mEpochManager.SetIdle(mnEpochReader);
+
+    while(1)
+    {
+        WriteBatch();
+
+        if(CheckFinish())
+            break;
+
+        const chrono::steady_clock::time_point tWake = chrono::steady_clock::now()+chrono::milliseconds(mnPeriod);
+        mEventState.WaitUntil(tWake,[this]{return CheckFinish();});
+    }
+
+    // Changes made until the other threads finished
+    WriteBatch();
+
+    mpMap->mEpochManager.Unregister(mnEpochReader);
+    mnEpochReader = -1;
+
+    SetFinish();
+}
+
+void MapJournal::WriteBatch()
+{
+    unique_lock<mutex> lock(mMutexWriter);
+    if(mFd<0)
+        return;
+
+    // Entities erased from now on are not deleted before the batch is written, so the ones
+    // still in the map below can be read.
+    const unsigned long nEpoch = mpMap->mEpochManager.GetEpoch();
+    mpMap->mEpochManager.Announce(mnEpochReader,nEpoch);
+
+    // The marked entities. The mark is cleared before the state is read: a later change marks
+    // the entity again for the next batch.
+    vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    vpKFs.erase(remove_if(vpKFs.begin(),vpKFs.end(),[](KeyFrame* pKF){return !pKF->mbJournalDirty.exchange(false);}),vpKFs.end());
+    vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+    vpMPs.erase(remove_if(vpMPs.begin(),vpMPs.end(),[](MapPoint* pMP){return !pMP->mbJournalDirty.exchange(false);}),vpMPs.end());
+
+    // Erasures after the states: a point erased after it was taken above is written and erased
+    vector<Erased> vErased;
+    bool bReset;
+    {
+        unique_lock<mutex> lock2(mMutexQueue);
+        vErased.swap(mvErased);
+        bReset = mbResetPending;
+        mbResetPending = false;
+    }
+
+    vector<unsigned char> payload;
+    vector<unsigned char> body;
+    // Records of the batch: type, id and offset in the payload
+    vector<Erased> vRecords;
+    vector<Extent> vExtents;
+
+    if(bReset)
+    {
+        vRecords.push_back(Erased{RESET,0,0});
+        vExtents.push_back(Extent{AddRecord(payload,RESET,body),0});
+    }
+
+    // New keyframes in insertion order
+    sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
+
+    MapImage::KeyFrameData kfData;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+
+        const bool bNew = bReset || !mmKeyFrames.count(pKF->mnId);
+        MapImage::GetKeyFrameData(pKF,bNew,true,kfData);
+
+        if(bNew)
+        {
+            if(!mbCamera || bReset)
+            {
+                MapImage::Camera camera;
+                MapImage::GetCamera(pKF,camera);
+                body.clear();
+                Encoder e(body);
+                e.PutBytes(&camera,sizeof(camera));
+                e.PutVarint(mnWords);
+                vRecords.push_back(Erased{CAMERA,0,0});
+                vExtents.push_back(Extent{AddRecord(payload,CAMERA,body),0});
+            }
+
+            body.clear();
+            EncodeKeyFrame(kfData,body);
+            vRecords.push_back(Erased{KEYFRAME,pKF->mnId,0});
+            vExtents.push_back(Extent{AddRecord(payload,KEYFRAME,body),0});
+        }
+
+        body.clear();
+        EncodeKeyFrameState(kfData,body);
+        vRecords.push_back(Erased{KEYFRAME_STATE,pKF->mnId,0});
+        vExtents.push_back(Extent{AddRecord(payload,KEYFRAME_STATE,body),0});
+    }
+
+    MapImage::MapPointData mpData;
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
+            continue;
+
+        MapImage::GetMapPointData(pMP,mpData);
+        body.clear();
+        EncodeMapPoint(mpData,body);
+        vRecords.push_back(Erased{MAPPOINT,pMP->mnId,0});
+        vExtents.push_back(Extent{AddRecord(payload,MAPPOINT,body),0});
+    }
+
+    // Nothing is read from the map anymore
+    mpMap->mEpochManager.SetIdle(mnEpochReader);
+
+    for(size_t i=0; i<vErased.size(); i++)
+    {
+        const Erased &erased = vErased[i];
+        body.clear();
+        Encoder e(body);
+        e.PutVarint(erased.nId);
+        if(erased.nType==MAPPOINT_REPLACED)
+            e.PutVarint(erased.nReplacementId);
+        vRecords.push_back(erased);
+        vExtents.push_back(Extent{AddRecord(payload,erased.nType,body),0});
+    }
+
+    if(payload.empty())
+        return;
+
+    // Sizes of the records
+    for(size_t i=0; i<vExtents.size(); i++)
+        vExtents[i].nSize = (i+1<vExtents.size() ? vExtents[i+1].nOffset : payload.size())-vExtents[i].nOffset;
+
+    if(!Append(mFd,mnFileSize,payload,vExtents))
+    {
+        cerr << "Map journal: failed to write " << mStrFile << endl;
+        return;
+    }
+
+    if(mbSnapshot)
+    {
+        const string strTmpFile = mStrFile+".tmp";
+        if(fsync(mFd)!=0 || rename(strTmpFile.c_str(),mStrFile.c_str())!=0)
+        {
+            cerr << "Map journal: failed to replace " << mStrFile << ", journal disabled" << endl;
+            close(mFd);
+            unlink(strTmpFile.c_str());
+            mFd = -1;
+            return;
+        }
+        mbSnapshot = false;
+    }
+
+    // Live records
+    for(size_t i=0; i<vRecords.size(); i++)
+    {
+        const Erased &record = vRecords[i];
+        const Extent &extent = vExtents[i];
+        switch(record.nType)
+        {
+        case RESET:
+            mmKeyFrames.clear();
+            mmKeyFrameStates.clear();
+            mmMapPoints.clear();
+            mbCamera = false;
+            mnLiveSize = 0;
+            break;
+        case CAMERA:
+            if(mbCamera)
+                mnLiveSize -= mCamera.nSize;
+            mCamera = extent;
+            mbCamera = true;
+            mnLiveSize += extent.nSize;
+            break;
+        case KEYFRAME:
+        case KEYFRAME_STATE:
+        case MAPPOINT:
+        {
+            unordered_map<uint64_t,Extent> &mLive = record.nType==KEYFRAME ? mmKeyFrames :
+                                                   (record.nType==KEYFRAME_STATE ? mmKeyFrameStates : mmMapPoints);
+            unordered_map<uint64_t,Extent>::iterator mit = mLive.find(record.nId);
+            if(mit!=mLive.end())
+                mnLiveSize -= mit->second.nSize;
+            mLive[record.nId] = extent;
+            mnLiveSize += extent.nSize;
+            break;
+        }
+        case KEYFRAME_ERASED:
+        case MAPPOINT_ERASED:
+        case MAPPOINT_REPLACED:
+        {
+            const bool bKF = record.nType==KEYFRAME_ERASED;
+            unordered_map<uint64_t,Extent> &mLive = bKF ? mmKeyFrames : mmMapPoints;
+            unordered_map<uint64_t,Extent>::iterator mit = mLive.find(record.nId);
+            if(mit!=mLive.end())
+            {
+                mnLiveSize -= mit->second.nSize;
+                mLive.erase(mit);
+            }
+            if(bKF)
+            {
+                mit = mmKeyFrameStates.find(record.nId);
+                if(mit!=mmKeyFrameStates.end())
+                {
+                    mnLiveSize -= mit->second.nSize;
+                    mmKeyFrameStates.erase(mit);
+                }
+            }
+            break;
+        }
+        }
+    }
+
+    {
+        unique_lock<mutex> lock2(mMutexStats);
+        mStats.nBatches++;
+        mStats.nBytes += sizeof(BatchHeader)+payload.size();
+        mStats.nFileSize = mnFileSize;
+    }
+
+    if(mfCompactRatio>0 && mnFileSize>MIN_COMPACT_SIZE && mnFileSize>mfCompactRatio*mnLiveSize)
+        Compact();
+}
+
+bool MapJournal::Append(const int fd, uint64_t &nFileSize, const vector<unsigned char> &payload, vector<Extent> &vRecords)
+{
+    BatchHeader h;
+    h.size = payload.size();
+    h.reserved = 0;
+    h.checksum = MapImage::Checksum(&payload[0],payload.size());
+
+    // A failed batch is overwritten by the next one
+    const uint64_t nPayloadOffset = nFileSize+sizeof(BatchHeader);
+    if(!WriteAt(fd,&h,sizeof(h),nFileSize) || !WriteAt(fd,&payload[0],payload.size(),nPayloadOffset))
+        return false;
+    fdatasync(fd);
+
+    nFileSize = nPayloadOffset+payload.size();
+    for(size_t i=0; i<vRecords.size(); i++)
+        vRecords[i].nOffset += nPayloadOffset;
+
+    return true;
+}
+
+void MapJournal::Compact()
+{
+    const string strTmpFile = mStrFile+".tmp";
+    const int fd = CreateFile(strTmpFile);
+    if(fd<0)
+    {
+        cerr << "Map journal: failed to create " << strTmpFile << endl;
+        return;
+    }
+    uint64_t nFileSize = sizeof(FileHeader);
+
+    // Live records copied in batches: camera, keyframes, their states and points
+    vector<pair<unordered_map<uint64_t,Extent>*,uint64_t> > vLive;
+    for(unordered_map<uint64_t,Extent>::iterator mit=mmKeyFrames.begin(); mit!=mmKeyFrames.end(); mit++)
+        vLive.push_back(make_pair(&mmKeyFrames,mit->first));
+    for(unordered_map<uint64_t,Extent>::iterator mit=mmKeyFrameStates.begin(); mit!=mmKeyFrameStates.end(); mit++)
+        vLive.push_back(make_pair(&mmKeyFrameStates,mit->first));
+    for(unordered_map<uint64_t,Extent>::iterator mit=mmMapPoints.begin(); mit!=mmMapPoints.end(); mit++)
+        vLive.push_back(make_pair(&mmMapPoints,mit->first));
+
+    vector<Extent*> vpExtents;
+    vector<Extent> vNewExtents;
+    if(mbCamera)
+        vpExtents.push_back(&mCamera);
+    for(size_t i=0; i<vLive.size(); i++)
+        vpExtents.push_back(&(*vLive[i].first)[vLive[i].second]);
+
+    // New extents are only set once the new file replaces the old one
+    vector<Extent> vAllExtents;
+    vAllExtents.reserve(vpExtents.size());
+
+    vector<unsigned char> payload;
+    vector<Extent> vBatchExtents;
+    bool bOk = true;
+    for(size_t i=0; bOk && i<vpExtents.size(); i++)
+    {
+        const Extent &old = *vpExtents[i];
+        const size_t nOffset = payload.size();
+        payload.resize(nOffset+old.nSize);
+        bOk = ReadAt(mFd,&payload[nOffset],old.nSize,old.nOffset);
+        vBatchExtents.push_back(Extent{nOffset,old.nSize});
+
+        if(bOk && (payload.size()>=COMPACT_BATCH_SIZE || i+1==vpExtents.size()))
+        {
+            bOk = Append(fd,nFileSize,payload,vBatchExtents);
+            vAllExtents.insert(vAllExtents.end(),vBatchExtents.begin(),vBatchExtents.end());
+            payload.clear();
+            vBatchExtents.clear();
+        }
+    }
+
+    if(bOk)
+        bOk = fsync(fd)==0 && rename(strTmpFile.c_str(),mStrFile.c_str())==0;
+
+    if(!bOk)
+    {
+        cerr << "Map journal: failed to compact " << mStrFile << endl;
+        close(fd);
+        unlink(strTmpFile.c_str());
+        return;
+    }
+
+    for(size_t i=0; i<vpExtents.size(); i++)
+        *vpExtents[i] = vAllExtents[i];
+
+    close(mFd);
+    mFd = fd;
+    mnFileSize = nFileSize;
+
+    unique_lock<mutex> lock(mMutexStats);
+    mStats.nCompactions++;
+    mStats.nFileSize = mnFileSize;
+}
+
+void MapJournal::RequestFinish()
+{
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    mEventState.Notify();
+}
+
+bool MapJournal::CheckFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void MapJournal::SetFinish()
+{
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+    }
+    mEventState.Notify();
+}
+
+bool MapJournal::isFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+void MapJournal::WaitUntilFinished()
+{
+    mEventState.WaitUntil([this]{return isFinished();});
+}
+
+MapJournal::Stats MapJournal::GetStats()
+{
+    unique_lock<mutex> lock(mMutexStats);
+    return mStats;
+}
+
+bool MapJournal::IsJournal(const string &filename)
+{
+    ifstream f(filename.c_str(), ios_base::in | ios_base::binary);
+    char magic[8];
+    if(!f.read(magic,8))
+        return false;
+    return memcmp(magic,JOURNAL_MAGIC,8)==0;
+}
+
+bool MapJournal::Replay(const string &filename, vector<unsigned char> &image)
+{
+    vector<unsigned char> data;
+    {
+        ifstream f(filename.c_str(), ios_base::in | ios_base::binary);
+        if(!f.is_open())
+        {
+            cerr << "Failed to open map journal at: " << filename << endl;
+            return false;
+        }
+        f.seekg(0,ios_base::end);
+        data.resize(f.tellg());
+        f.seekg(0,ios_base::beg);
+        if(!data.empty())
+            f.read(reinterpret_cast<char*>(&data[0]),data.size());
+    }
+
+    FileHeader h;
+    if(data.size()<sizeof(h))
+    {
+        cerr << "Map journal " << filename << ": truncated file" << endl;
+        return false;
+    }
+    memcpy(&h,&data[0],sizeof(h));
+    if(memcmp(h.magic,JOURNAL_MAGIC,8)!=0 || h.version!=JOURNAL_VERSION || h.byte_order!=0x01020304)
+    {
+        cerr << "Map journal " << filename << ": unsupported file" << endl;
+        return false;
+    }
+
+    // Latest state of every entity
+    MapImage::Camera camera;
+    memset(&camera,0,sizeof(camera));
+    uint64_t nWords = 0;
+    bool bCamera = false;
+    unordered_map<uint64_t,MapImage::KeyFrameData> mKFs;
+    unordered_map<uint64_t,MapImage::MapPointData> mMPs;
+
+    size_t nPos = sizeof(h);
+    size_t nBatches = 0;
+    bool bOk = true;
+    while(bOk && nPos+sizeof(BatchHeader)<=data.size())
+    {
+        BatchHeader bh;
+        memcpy(&bh,&data[nPos],sizeof(bh));
+        const unsigned char* pPayload = &data[nPos+sizeof(bh)];
+
+        // Last batch, not completely written
+        if(bh.size>data.size()-nPos-sizeof(bh) || MapImage::Checksum(pPayload,bh.size)!=bh.checksum)
+            break;
+        nPos += sizeof(bh)+bh.size;
+        nBatches++;
+
+        Decoder batch(pPayload,bh.size);
+        while(bOk && !batch.AtEnd())
+        {
+            unsigned char type = 0;
+            batch.GetBytes(&type,1);
+            const size_t size = batch.GetCount(1);
+            Decoder d(batch.GetPosition(),size);
+            batch.Skip(size);
+            if(!batch.IsOk())
+            {
+                bOk = false;
+                break;
+            }
+
+            switch(type)
+            {
+            case CAMERA:
+                d.GetBytes(&camera,sizeof(camera));
+                nWords = d.GetVarint();
+                bCamera = d.IsOk();
+                break;
+            case RESET:
+                mKFs.clear();
+                mMPs.clear();
+                break;
+            case KEYFRAME:
+            {
+                const uint64_t id = d.GetVarint();
+                MapImage::KeyFrameData &kf = mKFs[id];
+                memset(&kf.record,0,sizeof(kf.record));
+                kf.record.id = id;
+                kf.record.parent_id = MapImage::NO_ID;
+                bOk = DecodeKeyFrame(d,kf);
+                break;
+            }
+            case KEYFRAME_STATE:
+            {
+                const uint64_t id = d.GetVarint();
+                unordered_map<uint64_t,MapImage::KeyFrameData>::iterator mit = mKFs.find(id);
+                if(mit!=mKFs.end())
+                    bOk = DecodeKeyFrameState(d,mit->second);
+                break;
+            }
+            case KEYFRAME_ERASED:
+                mKFs.erase(d.GetVarint());
+                break;
+            case MAPPOINT:
+            {
+                MapImage::MapPointData mp;
+                bOk = DecodeMapPoint(d,mp);
+                mMPs[mp.record.id] = mp;
+                break;
+            }
+            case MAPPOINT_ERASED:
+            case MAPPOINT_REPLACED:
+                mMPs.erase(d.GetVarint());
+                break;
+            default:
+                // Unknown records are skipped
+                break;
+            }
+        }
+    }
+
+    if(!bOk)
+    {
+        cerr << "Map journal " << filename << ": corrupted batch " << nBatches << endl;
+        return false;
+    }
+
+    if(!bCamera || mKFs.empty())
+    {
+        cerr << "Map journal " << filename << ": no keyframes" << endl;
+        return false;
+    }
+
+    vector<MapImage::KeyFrameData> vKFs;
+    vKFs.reserve(mKFs.size());
+    for(unordered_map<uint64_t,MapImage::KeyFrameData>::iterator mit=mKFs.begin(); mit!=mKFs.end(); mit++)
+        vKFs.push_back(mit->second);
+    vector<MapImage::MapPointData> vMPs;
+    vMPs.reserve(mMPs.size());
+    for(unordered_map<uint64_t,MapImage::MapPointData>::iterator mit=mMPs.begin(); mit!=mMPs.end(); mit++)
+        vMPs.push_back(mit->second);
+
+    MapImage::Build(camera,nWords,vKFs,vMPs,image);
+
+    cout << "Map journal " << filename << ": replayed " << nBatches << " batches, " << vKFs.size()
+         << " keyframes, " << vMPs.size() << " points" << endl;
+
+    return true;
+}
+
+} //namespace ORB_SLAM
@@ -20,42 +20,68 @@
 
 #include "MapPoint.h"
 #include "ORBmatcher.h"
+#include "WorkerPool.h"
 
 #include<mutex>
+#include<algorithm>
+#include<cstring>
+#include<cassert>
 
 namespace ORB_SLAM2
 {
 
 long unsigned int MapPoint::nNextId=0;
 mutex MapPoint::mGlobalMutex;
+EntityArena<MapPoint> MapPoint::mArena;
 
-MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
+void* MapPoint::operator new(size_t size)
+{
+    // The arena keeps the slot index right after the object
+    assert(size<=sizeof(MapPoint));
+    return mArena.Allocate();
+}
+
+void MapPoint::operator delete(void *p)
+{
+    mArena.Free(p);
+}
+
+MapPoint::MapPoint(const Eigen::Vector3f &Pos, KeyFrame *pRefKF, Map* pMap):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
     mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
 {
-    Pos.copyTo(mWorldPos);
-    mNormalVector = cv::Mat::zeros(3,1,CV_32F);
+    mWorldPos = Pos;
+    mnTrackLocalMapRefs = 0;
+    mnTrackLocalMapIdx = -1;
+    mbJournalDirty = false;
+    fill(mnObsPerLevel,mnObsPerLevel+OBS_LEVELS,0);
+    mNormalVector.setZero();
 
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
     unique_lock<mutex> lock(mpMap->mMutexPointCreation);
     mnId=nNextId++;
+    mnSlot=mArena.GetSlot(this);
 }
 
-MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
+MapPoint::MapPoint(const Eigen::Vector3f &Pos, Map* pMap, Frame* pFrame, const int &idxF):
     mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
     mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
     mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap)
 {
-    Pos.copyTo(mWorldPos);
-    cv::Mat Ow = pFrame->GetCameraCenter();
+    mWorldPos = Pos;
+    mnTrackLocalMapRefs = 0;
+    mnTrackLocalMapIdx = -1;
+    mbJournalDirty = false;
+    fill(mnObsPerLevel,mnObsPerLevel+OBS_LEVELS,0);
+    const Eigen::Vector3f Ow = pFrame->GetCameraCenter();
     mNormalVector = mWorldPos - Ow;
-    mNormalVector = mNormalVector/cv::norm(mNormalVector);
+    mNormalVector.normalize();
 
-    cv::Mat PC = Pos - Ow;
-    const float dist = cv::norm(PC);
+    const Eigen::Vector3f PC = Pos - Ow;
+    const float dist = PC.norm();
     const int level = pFrame->mvKeysUn[idxF].octave;
     const float levelScaleFactor =  pFrame->mvScaleFactors[level];
     const int nLevels = pFrame->mnScaleLevels;
@@ -68,25 +94,29 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
     unique_lock<mutex> lock(mpMap->mMutexPointCreation);
     mnId=nNextId++;
+    mnSlot=mArena.GetSlot(this);
 }
 
-void MapPoint::SetWorldPos(const cv::Mat &Pos)
+void MapPoint::SetWorldPos(const Eigen::Vector3f &Pos)
 {
-    unique_lock<mutex> lock2(mGlobalMutex);
-    unique_lock<mutex> lock(mMutexPos);
-    Pos.copyTo(mWorldPos);
+    {
+        unique_lock<mutex> lock2(mGlobalMutex);
+        unique_lock<mutex> lock(mMutexPos);
+        mWorldPos = Pos;
+    }
+    mpMap->Touch(this);
 }
 
-cv::Mat MapPoint::GetWorldPos()
+Eigen::Vector3f MapPoint::GetWorldPos()
 {
     unique_lock<mutex> lock(mMutexPos);
-    return mWorldPos.clone();
+    return mWorldPos;
 }
 
-cv::Mat MapPoint::GetNormal()
+Eigen::Vector3f MapPoint::GetNormal()
 {
     unique_lock<mutex> lock(mMutexPos);
-    return mNormalVector.clone();
+    return mNormalVector;
 }
 
 KeyFrame* MapPoint::GetReferenceKeyFrame()
@@ -97,15 +127,19 @@ KeyFrame* MapPoint::GetReferenceKeyFrame()
 
 void MapPoint::AddObservation(KeyFrame* pKF, size_t idx)
 {
-    unique_lock<mutex> lock(mMutexFeatures);
-    if(mObservations.count(pKF))
-        return;
-    mObservations[pKF]=idx;
+    {
+        unique_lock<mutex> lock(mMutexFeatures);
+        if(FindObservation(pKF)!=mObservations.end())
+            return;
+        mObservations.push_back(make_pair(pKF,idx));
+        mnObsPerLevel[min(pKF->mvKeysUn[idx].octave,OBS_LEVELS-1)]++;
 
-    if(pKF->mvuRight[idx]>=0)
-        nObs+=2;
-    else
-        nObs++;
+        if(pKF->mvuRight[idx]>=0)
+            nObs+=2;
+        else
+            nObs++;
+    }
+    mpMap->Touch(this);
 }
 
 void MapPoint::EraseObservation(KeyFrame* pKF)
@@ -113,18 +147,20 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
     bool bBad=false;
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        if(mObservations.count(pKF))
+        ObservationVector::iterator it = FindObservation(pKF);
+        if(it!=mObservations.end())
         {
-            int idx = mObservations[pKF];
+            int idx = it->second;
             if(pKF->mvuRight[idx]>=0)
                 nObs-=2;
             else
                 nObs--;
+            mnObsPerLevel[min(pKF->mvKeysUn[idx].octave,OBS_LEVELS-1)]--;
 
-            mObservations.erase(pKF);
+            mObservations.erase(it);
 
-            if(mpRefKF==pKF)
-                mpRefKF=mObservations.begin()->first;
+            if(mpRefKF==pKF && !mObservations.empty())
+                mpRefKF=mObservations[0].first;
 
             // If only 2 observations or less, discard point
             if(nObs<=2)
@@ -134,9 +170,11 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
 
     if(bBad)
         SetBadFlag();
+    else
+        mpMap->Touch(this);
 }
 
-map<KeyFrame*, size_t> MapPoint::GetObservations()
+MapPoint::ObservationVector MapPoint::GetObservations()
 {
     unique_lock<mutex> lock(mMutexFeatures);
     return mObservations;
@@ -148,17 +186,27 @@ int MapPoint::Observations()
     return nObs;
 }
 
+int MapPoint::ObservationsUpToLevel(const int maxLevel)
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    int n=0;
+    for(int i=0, iend=min(maxLevel,OBS_LEVELS-1); i<=iend; i++)
+        n+=mnObsPerLevel[i];
+    return n;
+}
+
 void MapPoint::SetBadFlag()
 {
-    map<KeyFrame*,size_t> obs;
+    ObservationVector obs;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
         mbBad=true;
         obs = mObservations;
         mObservations.clear();
+        fill(mnObsPerLevel,mnObsPerLevel+OBS_LEVELS,0);
     }
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(ObservationVector::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         pKF->EraseMapPointMatch(mit->second);
@@ -180,19 +228,20 @@ void MapPoint::Replace(MapPoint* pMP)
         return;
 
     int nvisible, nfound;
-    map<KeyFrame*,size_t> obs;
+    ObservationVector obs;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
         obs=mObservations;
         mObservations.clear();
+        fill(mnObsPerLevel,mnObsPerLevel+OBS_LEVELS,0);
         mbBad=true;
         nvisible = mnVisible;
         nfound = mnFound;
         mpReplaced = pMP;
     }
 
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(ObservationVector::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         // Replace measurement in keyframe
         KeyFrame* pKF = mit->first;
@@ -241,57 +290,68 @@ float MapPoint::GetFoundRatio()
 
 void MapPoint::ComputeDistinctiveDescriptors()
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
-
-    map<KeyFrame*,size_t> observations;
+    // Scratch buffers, reused between calls of the same thread
+    static thread_local vector<pair<KeyFrame*,size_t> > vObs;
+    static thread_local vector<uint64_t> vDesc;
+    static thread_local vector<int> vDistances;
+    static thread_local vector<int> vRow;
 
+    // Retrieve all observations
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         if(mbBad)
             return;
-        observations=mObservations;
+        vObs.assign(mObservations.begin(),mObservations.end());
     }
 
-    if(observations.empty())
+    if(vObs.empty())
         return;
 
-    vDescriptors.reserve(observations.size());
-
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    // Gather the observed descriptors in a contiguous buffer (4 words per descriptor)
+    vDesc.resize(4*vObs.size());
+    size_t N=0;
+    for(size_t i=0; i<vObs.size(); i++)
     {
-        KeyFrame* pKF = mit->first;
+        KeyFrame* pKF = vObs[i].first;
 
         if(!pKF->isBad())
-            vDescriptors.push_back(pKF->mDescriptors.row(mit->second));
+        {
+            memcpy(&vDesc[4*N],pKF->mDescriptors.ptr<uchar>(vObs[i].second),32);
+            N++;
+        }
     }
 
-    if(vDescriptors.empty())
+    if(N==0)
         return;
 
     // Compute distances between them
-    const size_t N = vDescriptors.size();
-
-    float Distances[N][N];
+    vDistances.resize(N*N);
+    int* Distances = vDistances.data();
+    const uint64_t* pDesc = vDesc.data();
     for(size_t i=0;i<N;i++)
     {
-        Distances[i][i]=0;
+        Distances[i*N+i]=0;
+        const uint64_t* a = pDesc+4*i;
         for(size_t j=i+1;j<N;j++)
         {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
+            const uint64_t* b = pDesc+4*j;
+            const int distij = __builtin_popcountll(a[0]^b[0]) + __builtin_popcountll(a[1]^b[1]) +
+                               __builtin_popcountll(a[2]^b[2]) + __builtin_popcountll(a[3]^b[3]);
+            Distances[i*N+j]=distij;
+            Distances[j*N+i]=distij;
         }
     }
 
     // Take the descriptor with least median distance to the rest
     int BestMedian = INT_MAX;
     int BestIdx = 0;
+    const size_t nMedian = (N-1)/2;
+    vRow.resize(N);
     for(size_t i=0;i<N;i++)
     {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
+        copy(Distances+i*N,Distances+(i+1)*N,vRow.begin());
+        nth_element(vRow.begin(),vRow.begin()+nMedian,vRow.end());
+        const int median = vRow[nMedian];
 
         if(median<BestMedian)
         {
@@ -302,8 +362,33 @@ void MapPoint::ComputeDistinctiveDescriptors()
 
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
+        mDescriptor.create(1,32,CV_8U);
+        memcpy(mDescriptor.data,&vDesc[4*BestIdx],32);
+    }
+
+    mpMap->Touch(this);
+}
+
+void MapPoint::ComputeDistinctiveDescriptors(const vector<MapPoint*> &vpMPs)
+{
+    // Chunks of points, so that small batches do not pay the pool hand-off per point
+    const int nMPs = vpMPs.size();
+    const int nChunk = 64;
+    const int nChunks = (nMPs+nChunk-1)/nChunk;
+
+    if(nChunks<=1)
+    {
+        for(int i=0; i<nMPs; i++)
+            vpMPs[i]->ComputeDistinctiveDescriptors();
+        return;
     }
+
+    WorkerPool::Get().ParallelFor(nChunks,[&vpMPs,nMPs](int c)
+    {
+        const int end = min(nMPs,(c+1)*nChunk);
+        for(int i=c*nChunk; i<end; i++)
+            vpMPs[i]->ComputeDistinctiveDescriptors();
+    });
 }
 
 cv::Mat MapPoint::GetDescriptor()
@@ -312,11 +397,23 @@ cv::Mat MapPoint::GetDescriptor()
     return mDescriptor.clone();
 }
 
+MapPoint::ObservationVector::iterator MapPoint::FindObservation(KeyFrame *pKF)
+{
+    ObservationVector::iterator it = mObservations.begin();
+    for(ObservationVector::iterator end = mObservations.end(); it!=end; it++)
+    {
+        if(it->first==pKF)
+            break;
+    }
+    return it;
+}
+
 int MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    if(mObservations.count(pKF))
-        return mObservations[pKF];
+    ObservationVector::iterator it = FindObservation(pKF);
+    if(it!=mObservations.end())
+        return it->second;
     else
         return -1;
 }
@@ -324,14 +421,14 @@ int MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 bool MapPoint::IsInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    return (mObservations.count(pKF));
+    return FindObservation(pKF)!=mObservations.end();
 }
 
 void MapPoint::UpdateNormalAndDepth()
 {
-    map<KeyFrame*,size_t> observations;
+    ObservationVector observations;
     KeyFrame* pRefKF;
-    cv::Mat Pos;
+    Eigen::Vector3f Pos;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
@@ -339,26 +436,29 @@ void MapPoint::UpdateNormalAndDepth()
             return;
         observations=mObservations;
         pRefKF=mpRefKF;
-        Pos = mWorldPos.clone();
+        Pos = mWorldPos;
     }
 
     if(observations.empty())
         return;
 
-    cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
     int n=0;
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    size_t nRefIdx=0;
+    for(ObservationVector::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
-        cv::Mat Owi = pKF->GetCameraCenter();
-        cv::Mat normali = mWorldPos - Owi;
-        normal = normal + normali/cv::norm(normali);
+        if(pKF==pRefKF)
+            nRefIdx = mit->second;
+        const Eigen::Vector3f Owi = pKF->GetCameraCenter();
+        const Eigen::Vector3f normali = Pos - Owi;
+        normal = normal + normali/normali.norm();
         n++;
     }
 
-    cv::Mat PC = Pos - pRefKF->GetCameraCenter();
-    const float dist = cv::norm(PC);
-    const int level = pRefKF->mvKeysUn[observations[pRefKF]].octave;
+    const Eigen::Vector3f PC = Pos - pRefKF->GetCameraCenter();
+    const float dist = PC.norm();
+    const int level = pRefKF->mvKeysUn[nRefIdx].octave;
     const float levelScaleFactor =  pRefKF->mvScaleFactors[level];
     const int nLevels = pRefKF->mnScaleLevels;
 
@@ -368,6 +468,8 @@ void MapPoint::UpdateNormalAndDepth()
         mfMinDistance = mfMaxDistance/pRefKF->mvScaleFactors[nLevels-1];
         mNormalVector = normal/n;
     }
+
+    mpMap->Touch(this);
 }
 
 float MapPoint::GetMinDistanceInvariance()
@@ -0,0 +1,174 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MemoryBudget.h"
+#include "Map.h"
+
+#include<opencv2/core/core.hpp>
+#include<cstdio>
+#include<unistd.h>
+#include<iostream>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+MemoryBudget::MemoryBudget(Map *pMap, const string &strSettingPath):
+    mpMap(pMap), mnMaxKeyFrames(0), mnMaxMapPoints(0), mnMaxRSS(0), mnRSS(0), mnPeakRSS(0),
+    mtNextSample(chrono::steady_clock::now()), mbKeyFramesFull(false), mbMapPointsFull(false)
+{
+    cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
+
+    cv::FileNode node = fSettings["Memory.MaxKeyFrames"];
+    if(!node.empty())
+        mnMaxKeyFrames = max(0,(int)node);
+    node = fSettings["Memory.MaxMapPoints"];
+    if(!node.empty())
+        mnMaxMapPoints = max(0,(int)node);
+    node = fSettings["Memory.MaxRSS"];
+    if(!node.empty())
+        mnMaxRSS = (size_t)max(0,(int)node)*1024*1024;
+    node = fSettings["Memory.TrajectoryFile"];
+    if(!node.empty())
+        mStrTrajectoryFile = (string)node;
+
+    mnResumeKeyFrames = mnMaxKeyFrames*9/10;
+    mnResumeRSS = mnMaxRSS/10*9;
+
+    if(mnMaxKeyFrames>0 || mnMaxMapPoints>0 || mnMaxRSS>0)
+    {
+        cout << endl << "Memory budget: ";
+        if(mnMaxKeyFrames>0)
+            cout << mnMaxKeyFrames << " keyframes ";
+        if(mnMaxMapPoints>0)
+            cout << mnMaxMapPoints << " points ";
+        if(mnMaxRSS>0)
+            cout << mnMaxRSS/(1024*1024) << " MB";
+        cout << endl;
+    }
+}
+
+bool MemoryBudget::AllowNewKeyFrame()
+{
+    if(mnMaxKeyFrames==0 && mnMaxRSS==0)
+        return true;
+
+    const long unsigned int nKFs = mpMap->KeyFramesInMap();
+    const size_t nRSS = mnMaxRSS>0 ? GetSampledRSS() : 0;
+
+    unique_lock<mutex> lock(mMutex);
+    if(!mbKeyFramesFull)
+    {
+        const bool bKeyFramesFull = mnMaxKeyFrames>0 && nKFs>=mnMaxKeyFrames;
+        const bool bRSSFull = mnMaxRSS>0 && nRSS>=mnMaxRSS;
+        if(bKeyFramesFull || bRSSFull)
+        {
+            cout << "Memory budget: " << (bKeyFramesFull ? "keyframe" : "memory")
+                 << " limit reached, no new keyframes are created while over it" << endl;
+            mbKeyFramesFull = true;
+        }
+    }
+    else if((mnMaxKeyFrames==0 || nKFs<mnResumeKeyFrames) && (mnMaxRSS==0 || nRSS<mnResumeRSS))
+    {
+        cout << "Memory budget: back under the limits, new keyframes are created again" << endl;
+        mbKeyFramesFull = false;
+    }
+
+    return !mbKeyFramesFull;
+}
+
+bool MemoryBudget::AllowNewMapPoints()
+{
+    if(mnMaxMapPoints==0)
+        return true;
+
+    const bool bMapPointsFull = mpMap->MapPointsInMap()>=mnMaxMapPoints;
+
+    unique_lock<mutex> lock(mMutex);
+    if(bMapPointsFull && !mbMapPointsFull)
+    {
+        cout << "Memory budget: point limit reached, no new points are created while over it" << endl;
+        mbMapPointsFull = true;
+    }
+
+    return !bMapPointsFull;
+}
+
+size_t MemoryBudget::Sample()
+{
+    const size_t nRSS = GetRSS();
+    unique_lock<mutex> lock(mMutex);
+    mnRSS = nRSS;
+    mnPeakRSS = max(mnPeakRSS,nRSS);
+    mtNextSample = chrono::steady_clock::now()+chrono::seconds(1);
+    return nRSS;
+}
+
+size_t MemoryBudget::GetSampledRSS()
+{
+    {
+        unique_lock<mutex> lock(mMutex);
+        if(chrono::steady_clock::now()<mtNextSample)
+            return mnRSS;
+    }
+    return Sample();
+}
+
+void MemoryBudget::Reset()
+{
+    {
+        unique_lock<mutex> lock(mMutex);
+        mbKeyFramesFull = false;
+        mbMapPointsFull = false;
+    }
+    Sample();
+}
+
+MemoryBudget::Stats MemoryBudget::GetStats()
+{
+    Stats stats;
+    stats.nKeyFrames = mpMap->KeyFramesInMap();
+    stats.nMapPoints = mpMap->MapPointsInMap();
+    stats.nRetired = mpMap->mEpochManager.NumRetired();
+    stats.nReclaimed = mpMap->mEpochManager.NumReclaimed();
+    stats.nRSS = GetRSS();
+
+    unique_lock<mutex> lock(mMutex);
+    mnPeakRSS = max(mnPeakRSS,stats.nRSS);
+    stats.nPeakRSS = mnPeakRSS;
+    return stats;
+}
+
+size_t MemoryBudget::GetRSS()
+{
+    // Second field of statm: resident pages
+    FILE* f = fopen("/proc/self/statm","r");
+    if(!f)
+        return 0;
+    unsigned long nSize = 0, nResident = 0;
+    const int n = fscanf(f,"%lu %lu",&nSize,&nResident);
+    fclose(f);
+    if(n!=2)
+        return 0;
+    return (size_t)nResident*sysconf(_SC_PAGESIZE);
+}
+
+} //namespace ORB_SLAM
@@ -27,6 +27,7 @@
 
 #include "KeyFrame.h"
 #include "ORBmatcher.h"
+#include "Converter.h"
 
 #include "Thirdparty/DBoW2/DUtils/Random.h"
 
@@ -51,10 +52,10 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
     mvX3Dc1.reserve(mN1);
     mvX3Dc2.reserve(mN1);
 
-    cv::Mat Rcw1 = pKF1->GetRotation();
-    cv::Mat tcw1 = pKF1->GetTranslation();
-    cv::Mat Rcw2 = pKF2->GetRotation();
-    cv::Mat tcw2 = pKF2->GetTranslation();
+    Eigen::Matrix3f Rcw1 = pKF1->GetRotation();
+    Eigen::Vector3f tcw1 = pKF1->GetTranslation();
+    Eigen::Matrix3f Rcw2 = pKF2->GetRotation();
+    Eigen::Vector3f tcw2 = pKF2->GetTranslation();
 
     mvAllIndices.reserve(mN1);
 
@@ -91,11 +92,11 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
             mvpMapPoints2.push_back(pMP2);
             mvnIndices1.push_back(i1);
 
-            cv::Mat X3D1w = pMP1->GetWorldPos();
-            mvX3Dc1.push_back(Rcw1*X3D1w+tcw1);
+            Eigen::Vector3f X3D1w = pMP1->GetWorldPos();
+            mvX3Dc1.push_back(Converter::toCvMat(Eigen::Vector3f(Rcw1*X3D1w+tcw1)));
 
-            cv::Mat X3D2w = pMP2->GetWorldPos();
-            mvX3Dc2.push_back(Rcw2*X3D2w+tcw2);
+            Eigen::Vector3f X3D2w = pMP2->GetWorldPos();
+            mvX3Dc2.push_back(Converter::toCvMat(Eigen::Vector3f(Rcw2*X3D2w+tcw2)));
 
             mvAllIndices.push_back(idx);
             idx++;
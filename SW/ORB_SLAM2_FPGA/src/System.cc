@@ -22,9 +22,16 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "Optimizer.h"
+#include "MemoryBudget.h"
+#include "WorkerPool.h"
+#include "MapImage.h"
+#include "MapJournal.h"
 #include <thread>
+#include <chrono>
 #include <pangolin/pangolin.h>
 #include <iomanip>
+#include <unordered_map>
 #include <unistd.h>
 #include <time.h>
 
@@ -36,8 +43,10 @@ namespace ORB_SLAM2
 {
 
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
-               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
-        mbDeactivateLocalizationMode(false)
+               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)),
+        mptMapWriter(static_cast<thread*>(NULL)), mpJournal(static_cast<MapJournal*>(NULL)),
+        mptJournal(static_cast<thread*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
+        mbDeactivateLocalizationMode(false), mpPipeline(static_cast<TrackingPipeline*>(NULL))
 {
     // Output welcome message
     cout << endl <<
@@ -63,6 +72,19 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
        exit(-1);
     }
 
+    cv::FileNode nodeOptimizerThreads = fsSettings["Optimizer.nThreads"];
+    if(!nodeOptimizerThreads.empty())
+        Optimizer::SetNumThreads((int)nodeOptimizerThreads);
+    // The same number of threads runs the parallel loops of all the other threads
+    WorkerPool::Get().SetNumThreads(Optimizer::GetNumThreads());
+    cout << "Bundle adjustment and worker threads: " << Optimizer::GetNumThreads() << endl;
+
+    cv::FileNode nodePCGMinKeyFrames = fsSettings["Optimizer.PCGMinKeyFrames"];
+    if(!nodePCGMinKeyFrames.empty())
+        Optimizer::SetPCGMinKeyFrames((int)nodePCGMinKeyFrames);
+    if(Optimizer::GetPCGMinKeyFrames()>0)
+        cout << "Global BA with PCG from " << Optimizer::GetPCGMinKeyFrames() << " keyframes" << endl;
+
 
     //Load ORB Vocabulary
     cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
@@ -72,6 +94,8 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     bool bVocLoad = false; // chose loading method based on file extension
     if (has_suffix(strVocFile, ".txt"))
 	    bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
+    else if (has_suffix(strVocFile, ".img"))
+	    bVocLoad = mpVocabulary->loadFromImageFile(strVocFile);
 	else
 	    bVocLoad = mpVocabulary->loadFromBinaryFile(strVocFile);
     // bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
@@ -84,12 +108,19 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     // cout << "Vocabulary loaded!" << endl << endl;
     printf("Vocabulary loaded in %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
 
+    // Descriptors of frames and keyframes are converted to words in parallel
+    mpVocabulary->setNumThreads(WorkerPool::Get().GetNumThreads());
+    mpVocabulary->setParallelFor([](int n, const function<void(int)> &f){WorkerPool::Get().ParallelFor(n,f);});
+
     //Create KeyFrame Database
     mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
 
     //Create the Map
     mpMap = new Map();
 
+    //Memory limits, and trajectory streamed to disk
+    mpMemoryBudget = new MemoryBudget(mpMap, strSettingsFile);
+
     //Create Drawers. These are used by the Viewer
     mpFrameDrawer = new FrameDrawer(mpMap);
     mpMapDrawer = new MapDrawer(mpMap, strSettingsFile);
@@ -98,6 +129,13 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     //(it will live in the main thread of execution, the one that called this constructor)
     mpTracker = new Tracking(this, mpVocabulary, mpFrameDrawer, mpMapDrawer,
                              mpMap, mpKeyFrameDatabase, strSettingsFile, mSensor);
+    if(!mpMemoryBudget->GetTrajectoryFile().empty())
+    {
+        if(mpTracker->mTrajectory.SetFile(mpMemoryBudget->GetTrajectoryFile()))
+            cout << "Trajectory streamed to " << mpMemoryBudget->GetTrajectoryFile() << endl;
+        else
+            cerr << "Failed to open trajectory file: " << mpMemoryBudget->GetTrajectoryFile() << endl;
+    }
 
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(mpMap, mSensor==MONOCULAR);
@@ -118,12 +156,41 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     //Set pointers between threads
     mpTracker->SetLocalMapper(mpLocalMapper);
     mpTracker->SetLoopClosing(mpLoopCloser);
+    mpTracker->SetMemoryBudget(mpMemoryBudget);
 
     mpLocalMapper->SetTracker(mpTracker);
     mpLocalMapper->SetLoopCloser(mpLoopCloser);
+    mpLocalMapper->SetMemoryBudget(mpMemoryBudget);
 
     mpLoopCloser->SetTracker(mpTracker);
     mpLoopCloser->SetLocalMapper(mpLocalMapper);
+
+    //Prebuilt map to localize in
+    cv::FileNode nodeMapFile = fsSettings["Map.LoadFile"];
+    if(!nodeMapFile.empty())
+    {
+        if(!LoadMap((string)nodeMapFile))
+        {
+            cerr << "Failed to load map at: " << (string)nodeMapFile << endl;
+            exit(-1);
+        }
+        ActivateLocalizationMode();
+    }
+
+    //Journal of the map changes. Opened last: the loaded map may come from the same file.
+    cv::FileNode nodeJournalFile = fsSettings["Journal.File"];
+    if(!nodeJournalFile.empty())
+    {
+        mpJournal = new MapJournal(mpMap, mpVocabulary->size(), strSettingsFile);
+        if(!mpJournal->Open())
+        {
+            cerr << "Failed to open map journal: " << mpJournal->GetFile() << endl;
+            exit(-1);
+        }
+        mpMap->SetJournal(mpJournal);
+        mptJournal = new thread(&ORB_SLAM2::MapJournal::Run, mpJournal);
+        cout << "Map journal written to " << mpJournal->GetFile() << endl;
+    }
 }
 
 cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
@@ -134,47 +201,14 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
         exit(-1);
     }   
 
-    // Check mode change
-    {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+    if(mpPipeline)
+        mpPipeline->Flush();
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
-
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
-    }
-
-    // Check reset
-    {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
-    {
-        mpTracker->Reset();
-        mbReset = false;
-    }
-    }
+    CheckModeChangeAndReset();
 
-    cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
+    Eigen::Matrix4f Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
 
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
-    return Tcw;
+    return UpdateTrackingState(Tcw);
 }
 
 cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp)
@@ -185,57 +219,103 @@ cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const doub
         exit(-1);
     }    
 
-    // Check mode change
-    {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+    if(mpPipeline)
+        mpPipeline->Flush();
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+    CheckModeChangeAndReset();
 
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
-    }
+    Eigen::Matrix4f Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp);
 
-    // Check reset
+    return UpdateTrackingState(Tcw);
+}
+
+cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
+{
+    if(mSensor!=MONOCULAR)
     {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
+        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular." << endl;
+        exit(-1);
+    }
+
+    if(mpPipeline)
+        mpPipeline->Flush();
+
+    CheckModeChangeAndReset();
+
+    Eigen::Matrix4f Tcw = mpTracker->GrabImageMonocular(im,timestamp);
+
+    return UpdateTrackingState(Tcw);
+}
+
+future<cv::Mat> System::TrackStereoAsync(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
+{
+    if(mSensor!=STEREO)
     {
-        mpTracker->Reset();
-        mbReset = false;
+        cerr << "ERROR: you called TrackStereoAsync but input sensor was not set to STEREO." << endl;
+        exit(-1);
     }
+
+    if(!mpPipeline)
+        mpPipeline = new TrackingPipeline(this,mpTracker,mSensor);
+
+    return mpPipeline->Push(imLeft,imRight,timestamp);
+}
+
+future<cv::Mat> System::TrackRGBDAsync(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp)
+{
+    if(mSensor!=RGBD)
+    {
+        cerr << "ERROR: you called TrackRGBDAsync but input sensor was not set to RGBD." << endl;
+        exit(-1);
     }
 
-    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp);
+    if(!mpPipeline)
+        mpPipeline = new TrackingPipeline(this,mpTracker,mSensor);
 
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
-    return Tcw;
+    return mpPipeline->Push(im,depthmap,timestamp);
 }
 
-cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
+future<cv::Mat> System::TrackMonocularAsync(const cv::Mat &im, const double &timestamp)
 {
     if(mSensor!=MONOCULAR)
     {
-        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular." << endl;
+        cerr << "ERROR: you called TrackMonocularAsync but input sensor was not set to Monocular." << endl;
         exit(-1);
     }
 
+    if(!mpPipeline)
+        mpPipeline = new TrackingPipeline(this,mpTracker,mSensor);
+
+    return mpPipeline->Push(im,cv::Mat(),timestamp);
+}
+
+TrackingPipeline::Stats System::GetPipelineStats()
+{
+    if(!mpPipeline)
+        return TrackingPipeline::Stats();
+    return mpPipeline->GetStats();
+}
+
+cv::Mat System::TrackFrame(const Frame &frame, const cv::Mat &imGray)
+{
+    Eigen::Matrix4f Tcw = mpTracker->TrackFrame(frame,imGray);
+
+    return UpdateTrackingState(Tcw);
+}
+
+bool System::ModeChangeOrResetPending()
+{
+    {
+        unique_lock<mutex> lock(mMutexMode);
+        if(mbActivateLocalizationMode || mbDeactivateLocalizationMode)
+            return true;
+    }
+    unique_lock<mutex> lock(mMutexReset);
+    return mbReset;
+}
+
+void System::CheckModeChangeAndReset()
+{
     // Check mode change
     {
         unique_lock<mutex> lock(mMutexMode);
@@ -244,10 +324,7 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -269,15 +346,19 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
         mbReset = false;
     }
     }
+}
 
-    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp);
-
-    unique_lock<mutex> lock2(mMutexState);
+cv::Mat System::UpdateTrackingState(const Eigen::Matrix4f &Tcw)
+{
+    unique_lock<mutex> lock(mMutexState);
     mTrackingState = mpTracker->mState;
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
 
-    return Tcw;
+    // Poses are cv::Mat only at this interface. An empty matrix means no pose was estimated.
+    if(!mpTracker->mCurrentFrame.mbHasPose)
+        return cv::Mat();
+    return Converter::toCvMat(Tcw);
 }
 
 void System::ActivateLocalizationMode()
@@ -311,23 +392,130 @@ void System::Reset()
     mbReset = true;
 }
 
+bool System::SaveMap(const string &filename)
+{
+    if(mpPipeline)
+        mpPipeline->Flush();
+
+    // The previous map must be written before another one is serialized
+    if(mptMapWriter)
+    {
+        mptMapWriter->join();
+        delete mptMapWriter;
+        mptMapWriter = static_cast<thread*>(NULL);
+    }
+
+    // Local Mapping stops once its queue is empty (nothing is tracked meanwhile). It is already
+    // stopped in localization mode. A stop requested by the loop closing may be released before
+    // Local Mapping stops, so the request is repeated.
+    const bool bStop = !mpLocalMapper->isStopped();
+    while(!mpLocalMapper->isStopped())
+    {
+        mpLocalMapper->RequestStop();
+        usleep(1000);
+    }
+
+    vector<unsigned char>* pImage = new vector<unsigned char>();
+    {
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+        if(mpMap->KeyFramesInMap()>0)
+            MapImage::Serialize(mpMap,mpKeyFrameDatabase,*pImage);
+    }
+
+    if(bStop)
+        mpLocalMapper->Release();
+
+    if(pImage->empty())
+    {
+        cerr << "ERROR: SaveMap called with an empty map." << endl;
+        delete pImage;
+        return false;
+    }
+
+    cout << endl << "Saving map to " << filename << " ..." << endl;
+    mptMapWriter = new thread([pImage,filename]
+    {
+        if(MapImage::Write(filename,*pImage))
+            cout << "Map saved (" << pImage->size()/(1024*1024) << " MB)" << endl;
+        else
+            cerr << "Failed to write map at: " << filename << endl;
+        delete pImage;
+    });
+
+    return true;
+}
+
+bool System::LoadMap(const string &filename)
+{
+    if(mpPipeline)
+        mpPipeline->Flush();
+
+    // A journal is replayed into an image first, it may be the journal of the current map
+    vector<unsigned char> journalImage;
+    const bool bJournal = MapJournal::IsJournal(filename);
+    if(bJournal && !MapJournal::Replay(filename,journalImage))
+        return false;
+
+    // Clear the current map, if any
+    if(mpTracker->mState!=Tracking::NO_IMAGES_YET || mpMap->KeyFramesInMap()>0)
+        mpTracker->Reset();
+
+    cout << endl << "Loading map from " << filename << " ..." << endl;
+    const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    {
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+        if(bJournal ? !MapImage::Load(journalImage,filename,mpMap,mpKeyFrameDatabase,mpVocabulary) :
+                      !MapImage::Load(filename,mpMap,mpKeyFrameDatabase,mpVocabulary))
+            return false;
+    }
+    cout << "Map loaded in " << chrono::duration<double>(chrono::steady_clock::now()-tStart).count() << " s" << endl;
+
+    mpTracker->InformMapLoaded();
+    mpMap->InformNewBigChange();
+
+    return true;
+}
+
 void System::Shutdown()
 {
+    if(mpPipeline)
+        mpPipeline->Shutdown();
+
+    if(mptMapWriter)
+    {
+        mptMapWriter->join();
+        delete mptMapWriter;
+        mptMapWriter = static_cast<thread*>(NULL);
+    }
+
     mpLocalMapper->RequestFinish();
     mpLoopCloser->RequestFinish();
     if(mpViewer)
     {
         mpViewer->RequestFinish();
-        while(!mpViewer->isFinished())
-            usleep(5000);
+        mpViewer->WaitUntilFinished();
     }
 
     // Wait until all thread have effectively stopped
-    while(!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished() || mpLoopCloser->isRunningGBA())
+    mpLocalMapper->WaitUntilFinished();
+    mpLoopCloser->WaitUntilFinished();
+
+    // Last batch, with the final state of the map
+    if(mpJournal)
     {
-        usleep(5000);
+        mpJournal->RequestFinish();
+        mpJournal->WaitUntilFinished();
+        const MapJournal::Stats stats = mpJournal->GetStats();
+        cout << "Journal: " << stats.nBatches << " batches, " << stats.nBytes/(1024*1024) << " MB written, "
+             << stats.nCompactions << " compactions, file " << stats.nFileSize/(1024*1024) << " MB" << endl;
     }
 
+    const MemoryBudget::Stats stats = mpMemoryBudget->GetStats();
+    cout << "Memory: " << stats.nKeyFrames << " keyframes and " << stats.nMapPoints << " points in the map, "
+         << stats.nReclaimed << " deleted and " << stats.nRetired << " waiting, "
+         << mpTracker->mTrajectory.InMemory() << " trajectory records in memory" << endl;
+    cout << "Memory: resident " << stats.nRSS/(1024*1024) << " MB, peak " << stats.nPeakRSS/(1024*1024) << " MB" << endl;
+
     if(mpViewer)
         pangolin::BindToContext("ORB-SLAM2: Map Viewer");
 }
@@ -346,7 +534,7 @@ void System::SaveTrajectoryTUM(const string &filename)
 
     // Transform all keyframes so that the first keyframe is at the origin.
     // After a loop closure the first keyframe might not be at the origin.
-    cv::Mat Two = vpKFs[0]->GetPoseInverse();
+    Eigen::Matrix4f Two = vpKFs[0]->GetPoseInverse();
 
     ofstream f;
     f.open(filename.c_str());
@@ -356,37 +544,35 @@ void System::SaveTrajectoryTUM(const string &filename)
     // We need to get first the keyframe pose and then concatenate the relative transformation.
     // Frames not localized (tracking failure) are not saved.
 
-    // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
-    // which is true when tracking failed (lbL).
-    list<ORB_SLAM2::KeyFrame*>::iterator lRit = mpTracker->mlpReferences.begin();
-    list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-    list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-    for(list<cv::Mat>::iterator lit=mpTracker->mlRelativeFramePoses.begin(),
-        lend=mpTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++, lbL++)
+    // For each frame we have the id of its reference keyframe, the timestamp and a flag
+    // which is true when tracking failed.
+    unordered_map<long unsigned int,KeyFrame*> mpKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+        if(!vpKFs[i]->isBad())
+            mpKFs[vpKFs[i]->mnId] = vpKFs[i];
+
+    // The records of the culled keyframes are placed relative to keyframes in the map
+    mpTracker->UpdateTrajectory();
+    const vector<Trajectory::Record> vRecords = mpTracker->mTrajectory.GetRecords();
+    for(size_t i=0; i<vRecords.size(); i++)
     {
-        if(*lbL)
+        const Trajectory::Record &r = vRecords[i];
+        if(r.mbLost)
             continue;
 
-        KeyFrame* pKF = *lRit;
-
-        cv::Mat Trw = cv::Mat::eye(4,4,CV_32F);
-
-        // If the reference keyframe was culled, traverse the spanning tree to get a suitable keyframe.
-        while(pKF->isBad())
-        {
-            Trw = Trw*pKF->mTcp;
-            pKF = pKF->GetParent();
-        }
+        unordered_map<long unsigned int,KeyFrame*>::const_iterator kit = mpKFs.find(r.mnRefKFId);
+        if(kit==mpKFs.end())
+            continue;
 
-        Trw = Trw*pKF->GetPose()*Two;
+        Eigen::Matrix4f Trw = kit->second->GetPose()*Two;
 
-        cv::Mat Tcw = (*lit)*Trw;
-        cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
-        cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
+        Eigen::Matrix4f Tcw = r.GetTcr()*Trw;
+        Eigen::Matrix3f Rwc = Tcw.block<3,3>(0,0).transpose();
+        Eigen::Vector3f twc = -Rwc*Tcw.block<3,1>(0,3);
 
         vector<float> q = Converter::toQuaternion(Rwc);
 
-        f << setprecision(6) << *lT << " " <<  setprecision(9) << twc.at<float>(0) << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+        f << setprecision(6) << r.mTimeStamp << " " <<  setprecision(9) << twc(0) << " " << twc(1) << " " << twc(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
     }
     f.close();
     cout << endl << "trajectory saved!" << endl;
@@ -417,10 +603,10 @@ void System::SaveKeyFrameTrajectoryTUM(const string &filename)
         if(pKF->isBad())
             continue;
 
-        cv::Mat R = pKF->GetRotation().t();
+        Eigen::Matrix3f R = pKF->GetRotation().transpose();
         vector<float> q = Converter::toQuaternion(R);
-        cv::Mat t = pKF->GetCameraCenter();
-        f << setprecision(6) << pKF->mTimeStamp << setprecision(7) << " " << t.at<float>(0) << " " << t.at<float>(1) << " " << t.at<float>(2)
+        Eigen::Vector3f t = pKF->GetCameraCenter();
+        f << setprecision(6) << pKF->mTimeStamp << setprecision(7) << " " << t(0) << " " << t(1) << " " << t(2)
           << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
 
     }
@@ -443,7 +629,7 @@ void System::SaveTrajectoryKITTI(const string &filename)
 
     // Transform all keyframes so that the first keyframe is at the origin.
     // After a loop closure the first keyframe might not be at the origin.
-    cv::Mat Two = vpKFs[0]->GetPoseInverse();
+    Eigen::Matrix4f Two = vpKFs[0]->GetPoseInverse();
 
     ofstream f;
     f.open(filename.c_str());
@@ -453,32 +639,32 @@ void System::SaveTrajectoryKITTI(const string &filename)
     // We need to get first the keyframe pose and then concatenate the relative transformation.
     // Frames not localized (tracking failure) are not saved.
 
-    // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
-    // which is true when tracking failed (lbL).
-    list<ORB_SLAM2::KeyFrame*>::iterator lRit = mpTracker->mlpReferences.begin();
-    list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-    for(list<cv::Mat>::iterator lit=mpTracker->mlRelativeFramePoses.begin(), lend=mpTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++)
-    {
-        ORB_SLAM2::KeyFrame* pKF = *lRit;
+    // For each frame we have the id of its reference keyframe and the timestamp.
+    unordered_map<long unsigned int,KeyFrame*> mpKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+        if(!vpKFs[i]->isBad())
+            mpKFs[vpKFs[i]->mnId] = vpKFs[i];
 
-        cv::Mat Trw = cv::Mat::eye(4,4,CV_32F);
+    // The records of the culled keyframes are placed relative to keyframes in the map
+    mpTracker->UpdateTrajectory();
+    const vector<Trajectory::Record> vRecords = mpTracker->mTrajectory.GetRecords();
+    for(size_t i=0; i<vRecords.size(); i++)
+    {
+        const Trajectory::Record &r = vRecords[i];
 
-        while(pKF->isBad())
-        {
-          //  cout << "bad parent" << endl;
-            Trw = Trw*pKF->mTcp;
-            pKF = pKF->GetParent();
-        }
+        unordered_map<long unsigned int,KeyFrame*>::const_iterator kit = mpKFs.find(r.mnRefKFId);
+        if(kit==mpKFs.end())
+            continue;
 
-        Trw = Trw*pKF->GetPose()*Two;
+        Eigen::Matrix4f Trw = kit->second->GetPose()*Two;
 
-        cv::Mat Tcw = (*lit)*Trw;
-        cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
-        cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
+        Eigen::Matrix4f Tcw = r.GetTcr()*Trw;
+        Eigen::Matrix3f Rwc = Tcw.block<3,3>(0,0).transpose();
+        Eigen::Vector3f twc = -Rwc*Tcw.block<3,1>(0,3);
 
-        f << setprecision(9) << Rwc.at<float>(0,0) << " " << Rwc.at<float>(0,1)  << " " << Rwc.at<float>(0,2) << " "  << twc.at<float>(0) << " " <<
-             Rwc.at<float>(1,0) << " " << Rwc.at<float>(1,1)  << " " << Rwc.at<float>(1,2) << " "  << twc.at<float>(1) << " " <<
-             Rwc.at<float>(2,0) << " " << Rwc.at<float>(2,1)  << " " << Rwc.at<float>(2,2) << " "  << twc.at<float>(2) << endl;
+        f << setprecision(9) << Rwc(0,0) << " " << Rwc(0,1)  << " " << Rwc(0,2) << " "  << twc(0) << " " <<
+             Rwc(1,0) << " " << Rwc(1,1)  << " " << Rwc(1,2) << " "  << twc(1) << " " <<
+             Rwc(2,0) << " " << Rwc(2,1)  << " " << Rwc(2,2) << " "  << twc(2) << endl;
     }
     f.close();
     cout << endl << "trajectory saved!" << endl;
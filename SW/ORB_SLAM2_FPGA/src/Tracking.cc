@@ -32,6 +32,7 @@
 
 #include"Optimizer.h"
 #include"PnPsolver.h"
+#include"MemoryBudget.h"
 
 #include<iostream>
 
@@ -45,9 +46,12 @@ namespace ORB_SLAM2
 
 Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Map *pMap, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor):
     mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpORBVocabulary(pVoc),
-    mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
-    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnLastRelocFrameId(0)
+    mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mnLocalMapStamp(0), mpSystem(pSys), mpViewer(NULL),
+    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnLastRelocFrameId(0), mbVelocity(false), mpMemoryBudget(NULL)
 {
+    mnEpochReader = mpMap->mEpochManager.Register();
+    mnEpoch = mpMap->mEpochManager.GetEpoch();
+
     // Load camera parameters from settings file
 
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
@@ -76,6 +80,11 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     }
     DistCoef.copyTo(mDistCoef);
 
+    // Image size of the undistortion grid (exact undistortion if missing)
+    const int width = fSettings["Camera.width"];
+    const int height = fSettings["Camera.height"];
+    mUndistorter.SetCalibration(mK,mDistCoef,width,height);
+
     mbf = fSettings["Camera.bf"];
 
     float fps = fSettings["Camera.fps"];
@@ -153,6 +162,11 @@ void Tracking::SetLocalMapper(LocalMapping *pLocalMapper)
     mpLocalMapper=pLocalMapper;
 }
 
+void Tracking::SetMemoryBudget(MemoryBudget *pMemoryBudget)
+{
+    mpMemoryBudget=pMemoryBudget;
+}
+
 void Tracking::SetLoopClosing(LoopClosing *pLoopClosing)
 {
     mpLoopClosing=pLoopClosing;
@@ -164,104 +178,103 @@ void Tracking::SetViewer(Viewer *pViewer)
 }
 
 
-cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
+Eigen::Matrix4f Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
 {
-    mImGray = imRectLeft;
-    cv::Mat imGrayRight = imRectRight;
-
-    if(mImGray.channels()==3)
-    {
-        if(mbRGB)
-        {
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_RGB2GRAY);
-        }
-        else
-        {
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_BGR2GRAY);
-        }
-    }
-    else if(mImGray.channels()==4)
-    {
-        if(mbRGB)
-        {
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_RGBA2GRAY);
-        }
-        else
-        {
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_BGRA2GRAY);
-        }
-    }
+    mImGray = ConvertToGray(imRectLeft);
+    cv::Mat imGrayRight = ConvertToGray(imRectRight);
 
-    mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+    mCurrentFrame = CreateFrameStereo(mImGray,imGrayRight,timestamp);
 
     Track();
 
-    return mCurrentFrame.mTcw.clone();
+    return mCurrentFrame.mTcw;
 }
 
 
-cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp)
+Eigen::Matrix4f Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp)
 {
-    mImGray = imRGB;
-    cv::Mat imDepth = imD;
+    mImGray = ConvertToGray(imRGB);
+    cv::Mat imDepth = ConvertDepth(imD);
 
-    if(mImGray.channels()==3)
-    {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
-        else
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
-    }
-    else if(mImGray.channels()==4)
-    {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
-        else
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
-    }
+    mCurrentFrame = CreateFrameRGBD(mImGray,imDepth,timestamp);
 
-    if((fabs(mDepthMapFactor-1.0f)>1e-5) || imDepth.type()!=CV_32F)
-        imDepth.convertTo(imDepth,CV_32F,mDepthMapFactor);
+    Track();
+
+    return mCurrentFrame.mTcw;
+}
 
-    mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+
+Eigen::Matrix4f Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
+{
+    mImGray = ConvertToGray(im);
+
+    mCurrentFrame = CreateFrameMonocular(mImGray,timestamp);
 
     Track();
 
-    return mCurrentFrame.mTcw.clone();
+    return mCurrentFrame.mTcw;
 }
 
-
-cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
+cv::Mat Tracking::ConvertToGray(const cv::Mat &im)
 {
-    mImGray = im;
+    cv::Mat imGray = im;
 
-    if(mImGray.channels()==3)
+    if(imGray.channels()==3)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
+            cvtColor(imGray,imGray,CV_RGB2GRAY);
         else
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
+            cvtColor(imGray,imGray,CV_BGR2GRAY);
     }
-    else if(mImGray.channels()==4)
+    else if(imGray.channels()==4)
     {
         if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
+            cvtColor(imGray,imGray,CV_RGBA2GRAY);
         else
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
+            cvtColor(imGray,imGray,CV_BGRA2GRAY);
     }
 
+    return imGray;
+}
+
+cv::Mat Tracking::ConvertDepth(const cv::Mat &imD)
+{
+    cv::Mat imDepth = imD;
+
+    if((fabs(mDepthMapFactor-1.0f)>1e-5) || imDepth.type()!=CV_32F)
+        imDepth.convertTo(imDepth,CV_32F,mDepthMapFactor);
+
+    return imDepth;
+}
+
+Frame Tracking::CreateFrameStereo(const cv::Mat &imGrayLeft, const cv::Mat &imGrayRight, const double &timestamp)
+{
+    return Frame(imGrayLeft,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,&mUndistorter,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+}
+
+Frame Tracking::CreateFrameRGBD(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timestamp)
+{
+    return Frame(imGray,imDepth,timestamp,mpORBextractorLeft,&mUndistorter,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+}
+
+Frame Tracking::CreateFrameMonocular(const cv::Mat &imGray, const double &timestamp)
+{
+    // When pipelined this reads the state left by the last tracked frame. Resets are applied
+    // before the frame is built (see TrackingPipeline::RunExtract).
     if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
-        mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+        return Frame(imGray,timestamp,mpIniORBextractor,&mUndistorter,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
     else
-        mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+        return Frame(imGray,timestamp,mpORBextractorLeft,&mUndistorter,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+}
+
+Eigen::Matrix4f Tracking::TrackFrame(const Frame &frame, const cv::Mat &imGray)
+{
+    mImGray = imGray;
+    mCurrentFrame = frame;
 
     Track();
 
-    return mCurrentFrame.mTcw.clone();
+    return mCurrentFrame.mTcw;
 }
 
 void Tracking::Track()
@@ -276,6 +289,10 @@ void Tracking::Track()
     // Get Map Mutex -> Map cannot be changed
     unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
+    // Points retired before this epoch are removed from the frame and the local map below
+    mnEpoch = mpMap->mEpochManager.GetEpoch();
+    bool bLocalMapTracked = false;
+
     if(mState==NOT_INITIALIZED)
     {
         if(mSensor==System::STEREO || mSensor==System::RGBD)
@@ -304,7 +321,7 @@ void Tracking::Track()
                 // Local Mapping might have changed some MapPoints tracked in last frame
                 CheckReplacedInLastFrame();
 
-                if(mVelocity.empty() || mCurrentFrame.mnId<mnLastRelocFrameId+2)
+                if(!mbVelocity || mCurrentFrame.mnId<mnLastRelocFrameId+2)
                 {
                     bOK = TrackReferenceKeyFrame();
                 }
@@ -335,7 +352,7 @@ void Tracking::Track()
                 {
                     // In last frame we tracked enough MapPoints in the map
 
-                    if(!mVelocity.empty())
+                    if(mbVelocity)
                     {
                         bOK = TrackWithMotionModel();
                     }
@@ -356,13 +373,13 @@ void Tracking::Track()
                     bool bOKReloc = false;
                     vector<MapPoint*> vpMPsMM;
                     vector<bool> vbOutMM;
-                    cv::Mat TcwMM;
-                    if(!mVelocity.empty())
+                    Eigen::Matrix4f TcwMM;
+                    if(mbVelocity)
                     {
                         bOKMM = TrackWithMotionModel();
                         vpMPsMM = mCurrentFrame.mvpMapPoints;
                         vbOutMM = mCurrentFrame.mvbOutlier;
-                        TcwMM = mCurrentFrame.mTcw.clone();
+                        TcwMM = mCurrentFrame.mTcw;
                     }
                     bOKReloc = Relocalization();
 
@@ -415,6 +432,9 @@ void Tracking::Track()
         else
             mState=LOST;
 
+        // The local map was updated in this frame
+        bLocalMapTracked = bOK && (!mbOnlyTracking || !mbVO);
+
         // Update drawer
         mpFrameDrawer->Update(this);
 
@@ -422,28 +442,33 @@ void Tracking::Track()
         if(bOK)
         {
             // Update motion model
-            if(!mLastFrame.mTcw.empty())
+            if(mLastFrame.mbHasPose)
             {
-                cv::Mat LastTwc = cv::Mat::eye(4,4,CV_32F);
-                mLastFrame.GetRotationInverse().copyTo(LastTwc.rowRange(0,3).colRange(0,3));
-                mLastFrame.GetCameraCenter().copyTo(LastTwc.rowRange(0,3).col(3));
+                Eigen::Matrix4f LastTwc = Eigen::Matrix4f::Identity();
+                LastTwc.block<3,3>(0,0) = mLastFrame.GetRotationInverse();
+                LastTwc.block<3,1>(0,3) = mLastFrame.GetCameraCenter();
                 mVelocity = mCurrentFrame.mTcw*LastTwc;
+                mbVelocity = true;
             }
             else
-                mVelocity = cv::Mat();
+                mbVelocity = false;
 
             mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
 
-            // Clean VO matches
+            // Clean VO matches, and points set bad during the frame (or their replacement)
             for(int i=0; i<mCurrentFrame.N; i++)
             {
                 MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
                 if(pMP)
-                    if(pMP->Observations()<1)
-                    {
+                {
+                    while(pMP && pMP->isBad())
+                        pMP = pMP->GetReplaced();
+                    if(pMP && pMP->Observations()<1)
+                        pMP = static_cast<MapPoint*>(NULL);
+                    if(!pMP)
                         mCurrentFrame.mvbOutlier[i] = false;
-                        mCurrentFrame.mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
-                    }
+                    mCurrentFrame.mvpMapPoints[i]=pMP;
+                }
             }
 
             // Delete temporal MapPoints
@@ -483,27 +508,49 @@ void Tracking::Track()
         if(!mCurrentFrame.mpReferenceKF)
             mCurrentFrame.mpReferenceKF = mpReferenceKF;
 
+        // Culled keyframes are deleted once the epoch is announced, fall back to their parents
+        mpReferenceKF = GetGoodKeyFrame(mpReferenceKF);
+        mCurrentFrame.mpReferenceKF = GetGoodKeyFrame(mCurrentFrame.mpReferenceKF);
+        mpLastKeyFrame = GetGoodKeyFrame(mpLastKeyFrame);
+
         mLastFrame = Frame(mCurrentFrame);
+
+        if(bLocalMapTracked)
+            mpMap->mEpochManager.Announce(mnEpochReader,mnEpoch);
     }
 
     // Store frame pose information to retrieve the complete camera trajectory afterwards.
-    if(!mCurrentFrame.mTcw.empty())
+    if(mCurrentFrame.mbHasPose)
     {
-        cv::Mat Tcr = mCurrentFrame.mTcw*mCurrentFrame.mpReferenceKF->GetPoseInverse();
-        mlRelativeFramePoses.push_back(Tcr);
-        mlpReferences.push_back(mpReferenceKF);
-        mlFrameTimes.push_back(mCurrentFrame.mTimeStamp);
-        mlbLost.push_back(mState==LOST);
+        Eigen::Matrix4f Tcr = mCurrentFrame.mTcw*mCurrentFrame.mpReferenceKF->GetPoseInverse();
+        mTrajectory.Add(mCurrentFrame.mTimeStamp,mCurrentFrame.mpReferenceKF->mnId,Tcr,mState==LOST);
     }
     else
     {
         // This can happen if tracking is lost
-        mlRelativeFramePoses.push_back(mlRelativeFramePoses.back());
-        mlpReferences.push_back(mlpReferences.back());
-        mlFrameTimes.push_back(mlFrameTimes.back());
-        mlbLost.push_back(mState==LOST);
+        mTrajectory.AddLast(mState==LOST);
+    }
+
+    // After the record: a reference keyframe erased from now on is still reparented
+    UpdateTrajectory();
+}
+
+void Tracking::UpdateTrajectory()
+{
+    mpMap->TakeErasedKeyFrames(mvErasedKeyFrames);
+    for(size_t i=0; i<mvErasedKeyFrames.size(); i++)
+    {
+        const Map::ErasedKeyFrame &erased = mvErasedKeyFrames[i];
+        mTrajectory.Reparent(erased.mnId,erased.mnParentId,erased.mTcp);
     }
+}
 
+KeyFrame* Tracking::GetGoodKeyFrame(KeyFrame *pKF)
+{
+    // The first keyframe is never set bad
+    while(pKF && pKF->isBad())
+        pKF = pKF->GetParent();
+    return pKF;
 }
 
 
@@ -512,7 +559,7 @@ void Tracking::StereoInitialization()
     if(mCurrentFrame.N>500)
     {
         // Set Frame pose to the origin
-        mCurrentFrame.SetPose(cv::Mat::eye(4,4,CV_32F));
+        mCurrentFrame.SetPose(Eigen::Matrix4f::Identity());
 
         // Create KeyFrame
         KeyFrame* pKFini = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB);
@@ -526,7 +573,8 @@ void Tracking::StereoInitialization()
             float z = mCurrentFrame.mvDepth[i];
             if(z>0)
             {
-                cv::Mat x3D = mCurrentFrame.UnprojectStereo(i);
+                Eigen::Vector3f x3D;
+                mCurrentFrame.UnprojectStereo(i,x3D);
                 MapPoint* pNewMP = new MapPoint(x3D,pKFini,mpMap);
                 pNewMP->AddObservation(pKFini,i);
                 pKFini->AddMapPoint(pNewMP,i);
@@ -547,7 +595,7 @@ void Tracking::StereoInitialization()
         mpLastKeyFrame = pKFini;
 
         mvpLocalKeyFrames.push_back(pKFini);
-        mvpLocalMapPoints=mpMap->GetAllMapPoints();
+        UpdateLocalPoints();
         mpReferenceKF = pKFini;
         mCurrentFrame.mpReferenceKF = pKFini;
 
@@ -624,10 +672,10 @@ void Tracking::MonocularInitialization()
             }
 
             // Set Frame Poses
-            mInitialFrame.SetPose(cv::Mat::eye(4,4,CV_32F));
-            cv::Mat Tcw = cv::Mat::eye(4,4,CV_32F);
-            Rcw.copyTo(Tcw.rowRange(0,3).colRange(0,3));
-            tcw.copyTo(Tcw.rowRange(0,3).col(3));
+            mInitialFrame.SetPose(Eigen::Matrix4f::Identity());
+            Eigen::Matrix4f Tcw = Eigen::Matrix4f::Identity();
+            Tcw.block<3,3>(0,0) = Converter::toMatrix3f(Rcw);
+            Tcw.block<3,1>(0,3) = Converter::toVector3f(tcw);
             mCurrentFrame.SetPose(Tcw);
 
             CreateInitialMapMonocular();
@@ -656,7 +704,7 @@ void Tracking::CreateInitialMapMonocular()
             continue;
 
         //Create MapPoint.
-        cv::Mat worldPos(mvIniP3D[i]);
+        Eigen::Vector3f worldPos = Converter::toVector3f(mvIniP3D[i]);
 
         MapPoint* pMP = new MapPoint(worldPos,pKFcur,mpMap);
 
@@ -698,8 +746,8 @@ void Tracking::CreateInitialMapMonocular()
     }
 
     // Scale initial baseline
-    cv::Mat Tc2w = pKFcur->GetPose();
-    Tc2w.col(3).rowRange(0,3) = Tc2w.col(3).rowRange(0,3)*invMedianDepth;
+    Eigen::Matrix4f Tc2w = pKFcur->GetPose();
+    Tc2w.block<3,1>(0,3) *= invMedianDepth;
     pKFcur->SetPose(Tc2w);
 
     // Scale points
@@ -722,7 +770,7 @@ void Tracking::CreateInitialMapMonocular()
 
     mvpLocalKeyFrames.push_back(pKFcur);
     mvpLocalKeyFrames.push_back(pKFini);
-    mvpLocalMapPoints=mpMap->GetAllMapPoints();
+    UpdateLocalPoints();
     mpReferenceKF = pKFcur;
     mCurrentFrame.mpReferenceKF = pKFcur;
 
@@ -803,7 +851,7 @@ void Tracking::UpdateLastFrame()
 {
     // Update pose according to reference keyframe
     KeyFrame* pRef = mLastFrame.mpReferenceKF;
-    cv::Mat Tlr = mlRelativeFramePoses.back();
+    const Eigen::Matrix4f Tlr = mTrajectory.Last().GetTcr();
 
     mLastFrame.SetPose(Tlr*pRef->GetPose());
 
@@ -847,7 +895,8 @@ void Tracking::UpdateLastFrame()
 
         if(bCreateNew)
         {
-            cv::Mat x3D = mLastFrame.UnprojectStereo(i);
+            Eigen::Vector3f x3D;
+            mLastFrame.UnprojectStereo(i,x3D);
             MapPoint* pNewMP = new MapPoint(x3D,mpMap,&mLastFrame,i);
 
             mLastFrame.mvpMapPoints[i]=pNewMP;
@@ -984,6 +1033,10 @@ bool Tracking::NeedNewKeyFrame()
     if(mpLocalMapper->isStopped() || mpLocalMapper->stopRequested())
         return false;
 
+    // The map is full: keep tracking in the existing map
+    if(mpMemoryBudget && !mpMemoryBudget->AllowNewKeyFrame())
+        return false;
+
     const int nKFs = mpMap->KeyFramesInMap();
 
     // Do not insert keyframes if not enough frames have passed from last relocalisation
@@ -1067,11 +1120,13 @@ void Tracking::CreateNewKeyFrame()
         return;
 
     KeyFrame* pKF = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB);
+    // The matches of the frame are clean since the beginning of the frame
+    pKF->mnEpochReader = mpMap->mEpochManager.Register(mnEpoch);
 
     mpReferenceKF = pKF;
     mCurrentFrame.mpReferenceKF = pKF;
 
-    if(mSensor!=System::MONOCULAR)
+    if(mSensor!=System::MONOCULAR && (!mpMemoryBudget || mpMemoryBudget->AllowNewMapPoints()))
     {
         mCurrentFrame.UpdatePoseMatrices();
 
@@ -1111,7 +1166,8 @@ void Tracking::CreateNewKeyFrame()
 
                 if(bCreateNew)
                 {
-                    cv::Mat x3D = mCurrentFrame.UnprojectStereo(i);
+                    Eigen::Vector3f x3D;
+                    mCurrentFrame.UnprojectStereo(i,x3D);
                     MapPoint* pNewMP = new MapPoint(x3D,pKF,mpMap);
                     pNewMP->AddObservation(pKF,i);
                     pKF->AddMapPoint(pNewMP,i);
@@ -1195,44 +1251,98 @@ void Tracking::SearchLocalPoints()
 
 void Tracking::UpdateLocalMap()
 {
-    // This is for visualization
-    mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
-
     // Update
     UpdateLocalKeyFrames();
     UpdateLocalPoints();
+
+    // This is for visualization
+    mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
 }
 
 void Tracking::UpdateLocalPoints()
 {
-    mvpLocalMapPoints.clear();
+    const long unsigned int nStamp = ++mnLocalMapStamp;
 
+    // Keyframes entering the local map, and local keyframes whose matches changed
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
         KeyFrame* pKF = *itKF;
-        const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+        if(pKF->mnTrackLocalMapStamp==nStamp)
+            continue;
+        pKF->mnTrackLocalMapStamp=nStamp;
 
-        for(vector<MapPoint*>::const_iterator itMP=vpMPs.begin(), itEndMP=vpMPs.end(); itMP!=itEndMP; itMP++)
+        if(!pKF->mbTrackInLocalMap)
         {
-            MapPoint* pMP = *itMP;
-            if(!pMP)
-                continue;
-            if(pMP->mnTrackReferenceForFrame==mCurrentFrame.mnId)
-                continue;
-            if(!pMP->isBad())
+            pKF->mvpTrackLocalMapPoints = pKF->GetMapPointMatches(pKF->mnTrackLocalMapVersion);
+            pKF->mbTrackInLocalMap = true;
+
+            const vector<MapPoint*> &vpMPs = pKF->mvpTrackLocalMapPoints;
+            for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+                if(vpMPs[i])
+                    AddLocalMapPoint(vpMPs[i]);
+        }
+        else if(pKF->GetMatchesVersion()!=pKF->mnTrackLocalMapVersion)
+        {
+            vector<MapPoint*> vpMPs = pKF->GetMapPointMatches(pKF->mnTrackLocalMapVersion);
+            vector<MapPoint*> &vpOldMPs = pKF->mvpTrackLocalMapPoints;
+            for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
             {
-                mvpLocalMapPoints.push_back(pMP);
-                pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
+                if(vpMPs[i]==vpOldMPs[i])
+                    continue;
+                if(vpMPs[i])
+                    AddLocalMapPoint(vpMPs[i]);
+                if(vpOldMPs[i])
+                    EraseLocalMapPoint(vpOldMPs[i]);
             }
+            vpOldMPs.swap(vpMPs);
         }
     }
+
+    // Keyframes leaving the local map
+    for(vector<KeyFrame*>::const_iterator itKF=mvpLastLocalKeyFrames.begin(), itEndKF=mvpLastLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
+    {
+        KeyFrame* pKF = *itKF;
+        if(pKF->mnTrackLocalMapStamp==nStamp)
+            continue;
+
+        const vector<MapPoint*> &vpMPs = pKF->mvpTrackLocalMapPoints;
+        for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+            if(vpMPs[i])
+                EraseLocalMapPoint(vpMPs[i]);
+
+        pKF->mbTrackInLocalMap = false;
+        vector<MapPoint*>().swap(pKF->mvpTrackLocalMapPoints);
+    }
+
+    mvpLastLocalKeyFrames = mvpLocalKeyFrames;
+}
+
+void Tracking::AddLocalMapPoint(MapPoint* pMP)
+{
+    if(pMP->mnTrackLocalMapRefs++==0)
+    {
+        pMP->mnTrackLocalMapIdx = mvpLocalMapPoints.size();
+        mvpLocalMapPoints.push_back(pMP);
+    }
+}
+
+void Tracking::EraseLocalMapPoint(MapPoint* pMP)
+{
+    if(--pMP->mnTrackLocalMapRefs==0)
+    {
+        MapPoint* pLast = mvpLocalMapPoints.back();
+        mvpLocalMapPoints[pMP->mnTrackLocalMapIdx] = pLast;
+        pLast->mnTrackLocalMapIdx = pMP->mnTrackLocalMapIdx;
+        mvpLocalMapPoints.pop_back();
+        pMP->mnTrackLocalMapIdx = -1;
+    }
 }
 
 
 void Tracking::UpdateLocalKeyFrames()
 {
     // Each map point vote for the keyframes in which it has been observed
-    map<KeyFrame*,int> keyframeCounter;
+    mvpVotedKeyFrames.clear();
     for(int i=0; i<mCurrentFrame.N; i++)
     {
         if(mCurrentFrame.mvpMapPoints[i])
@@ -1240,9 +1350,18 @@ void Tracking::UpdateLocalKeyFrames()
             MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
             if(!pMP->isBad())
             {
-                const map<KeyFrame*,size_t> observations = pMP->GetObservations();
-                for(map<KeyFrame*,size_t>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                    keyframeCounter[it->first]++;
+                const MapPoint::ObservationVector observations = pMP->GetObservations();
+                for(MapPoint::ObservationVector::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
+                {
+                    KeyFrame* pKF = it->first;
+                    if(pKF->mnTrackVotesForFrame!=mCurrentFrame.mnId)
+                    {
+                        pKF->mnTrackVotesForFrame=mCurrentFrame.mnId;
+                        pKF->mnTrackVotes=0;
+                        mvpVotedKeyFrames.push_back(pKF);
+                    }
+                    pKF->mnTrackVotes++;
+                }
             }
             else
             {
@@ -1251,30 +1370,30 @@ void Tracking::UpdateLocalKeyFrames()
         }
     }
 
-    if(keyframeCounter.empty())
+    if(mvpVotedKeyFrames.empty())
         return;
 
     int max=0;
     KeyFrame* pKFmax= static_cast<KeyFrame*>(NULL);
 
     mvpLocalKeyFrames.clear();
-    mvpLocalKeyFrames.reserve(3*keyframeCounter.size());
+    mvpLocalKeyFrames.reserve(3*mvpVotedKeyFrames.size());
 
     // All keyframes that observe a map point are included in the local map. Also check which keyframe shares most points
-    for(map<KeyFrame*,int>::const_iterator it=keyframeCounter.begin(), itEnd=keyframeCounter.end(); it!=itEnd; it++)
+    for(vector<KeyFrame*>::const_iterator it=mvpVotedKeyFrames.begin(), itEnd=mvpVotedKeyFrames.end(); it!=itEnd; it++)
     {
-        KeyFrame* pKF = it->first;
+        KeyFrame* pKF = *it;
 
         if(pKF->isBad())
             continue;
 
-        if(it->second>max)
+        if(pKF->mnTrackVotes>max)
         {
-            max=it->second;
+            max=pKF->mnTrackVotes;
             pKFmax=pKF;
         }
 
-        mvpLocalKeyFrames.push_back(it->first);
+        mvpLocalKeyFrames.push_back(pKF);
         pKF->mnTrackReferenceForFrame = mCurrentFrame.mnId;
     }
 
@@ -1288,11 +1407,11 @@ void Tracking::UpdateLocalKeyFrames()
 
         KeyFrame* pKF = *itKF;
 
-        const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+        const Covisibility* pCov = pKF->GetCovisibility();
 
-        for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
+        for(size_t i=0, iend=min((size_t)10,pCov->NumOrdered()); i<iend; i++)
         {
-            KeyFrame* pNeighKF = *itNeighKF;
+            KeyFrame* pNeighKF = pCov->GetOrdered(i);
             if(!pNeighKF->isBad())
             {
                 if(pNeighKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
@@ -1421,7 +1540,7 @@ bool Tracking::Relocalization()
             // If a Camera Pose is computed, optimize
             if(!Tcw.empty())
             {
-                Tcw.copyTo(mCurrentFrame.mTcw);
+                mCurrentFrame.SetPose(Converter::toMatrix4f(Tcw));
 
                 set<MapPoint*> sFound;
 
@@ -1509,8 +1628,7 @@ void Tracking::Reset()
     if(mpViewer)
     {
         mpViewer->RequestStop();
-        while(!mpViewer->isStopped())
-            usleep(3000);
+        mpViewer->WaitUntilStopped();
     }
 
     // Reset Local Mapping
@@ -1531,6 +1649,15 @@ void Tracking::Reset()
     // Clear Map (this erase MapPoints and KeyFrames)
     mpMap->clear();
 
+    // The keyframe limit is checked again in the empty map
+    if(mpMemoryBudget)
+        mpMemoryBudget->Reset();
+
+    mvpLocalKeyFrames.clear();
+    mvpLastLocalKeyFrames.clear();
+    mvpLocalMapPoints.clear();
+    mpReferenceKF = static_cast<KeyFrame*>(NULL);
+
     KeyFrame::nNextId = 0;
     Frame::nNextId = 0;
     mState = NO_IMAGES_YET;
@@ -1541,10 +1668,7 @@ void Tracking::Reset()
         mpInitializer = static_cast<Initializer*>(NULL);
     }
 
-    mlRelativeFramePoses.clear();
-    mlpReferences.clear();
-    mlFrameTimes.clear();
-    mlbLost.clear();
+    mTrajectory.Clear();
 
     if(mpViewer)
         mpViewer->Release();
@@ -1578,6 +1702,11 @@ void Tracking::ChangeCalibration(const string &strSettingPath)
     }
     DistCoef.copyTo(mDistCoef);
 
+    // Image size of the undistortion grid (exact undistortion if missing)
+    const int width = fSettings["Camera.width"];
+    const int height = fSettings["Camera.height"];
+    mUndistorter.SetCalibration(mK,mDistCoef,width,height);
+
     mbf = fSettings["Camera.bf"];
 
     Frame::mbInitialComputations = true;
@@ -1588,6 +1717,15 @@ void Tracking::InformOnlyTracking(const bool &flag)
     mbOnlyTracking = flag;
 }
 
+void Tracking::InformMapLoaded()
+{
+    // No initialization, the next frames are relocalized until one is found
+    mState = LOST;
+    mnLastRelocFrameId = 0;
+    mnLastKeyFrameId = 0;
+    mpLastKeyFrame = static_cast<KeyFrame*>(NULL);
+}
+
 
 
 } //namespace ORB_SLAM
@@ -0,0 +1,243 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TrackingPipeline.h"
+#include "System.h"
+#include "Tracking.h"
+
+#include<stdexcept>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+TrackingPipeline::TrackingPipeline(System* pSystem, Tracking* pTracker, const int sensor, const size_t nQueueSize):
+    mpSystem(pSystem), mpTracker(pTracker), mSensor(sensor), mQueueConvert(nQueueSize), mQueueExtract(nQueueSize),
+    mQueueTrack(nQueueSize), mnPending(0), mnBuilt(0), mbShutdown(false), mtLatency(0), mnFrames(0)
+{
+    for(int i=0; i<3; i++)
+        mtStage[i]=0;
+
+    mptConvert = new thread(&TrackingPipeline::RunConvert,this);
+    mptExtract = new thread(&TrackingPipeline::RunExtract,this);
+    mptTrack = new thread(&TrackingPipeline::RunTrack,this);
+}
+
+TrackingPipeline::~TrackingPipeline()
+{
+    Shutdown();
+}
+
+future<cv::Mat> TrackingPipeline::Push(const cv::Mat &im, const cv::Mat &im2, const double &timestamp)
+{
+    {
+        unique_lock<mutex> lock(mMutexPending);
+        if(mbShutdown)
+        {
+            // The stages are stopped, the frame would never be tracked
+            promise<cv::Mat> failed;
+            failed.set_exception(make_exception_ptr(runtime_error("Tracking pipeline: frame pushed after shutdown")));
+            return failed.get_future();
+        }
+        mnPending++;
+    }
+
+    Request* pRequest = new Request();
+    pRequest->im = im;
+    pRequest->im2 = im2;
+    pRequest->timestamp = timestamp;
+    pRequest->pFrame = static_cast<Frame*>(NULL);
+    pRequest->tSubmit = chrono::steady_clock::now();
+    future<cv::Mat> pose = pRequest->pose.get_future();
+
+    mQueueConvert.Push(pRequest);
+
+    return pose;
+}
+
+void TrackingPipeline::Flush()
+{
+    unique_lock<mutex> lock(mMutexPending);
+    mCondPending.wait(lock, [this]{return mnPending==0;});
+}
+
+void TrackingPipeline::Shutdown()
+{
+    {
+        unique_lock<mutex> lock(mMutexPending);
+        if(mbShutdown)
+            return;
+        mbShutdown = true;
+
+        // Frames accepted before may not be queued yet, they must be ahead of the null request
+        mCondPending.wait(lock, [this]{return mnPending==0;});
+    }
+
+    // A null request flows through all stages and stops them
+    mQueueConvert.Push(static_cast<Request*>(NULL));
+
+    mptConvert->join();
+    mptExtract->join();
+    mptTrack->join();
+
+    delete mptConvert;
+    delete mptExtract;
+    delete mptTrack;
+}
+
+TrackingPipeline::Stats TrackingPipeline::GetStats()
+{
+    Stats stats;
+    stats.nQueued[0] = mQueueConvert.Size();
+    stats.nQueued[1] = mQueueExtract.Size();
+    stats.nQueued[2] = mQueueTrack.Size();
+
+    unique_lock<mutex> lock(mMutexStats);
+    for(int i=0; i<3; i++)
+        stats.tStage[i] = mnFrames>0 ? mtStage[i]/mnFrames : 0;
+    stats.tLatency = mnFrames>0 ? mtLatency/mnFrames : 0;
+    stats.nFrames = mnFrames;
+
+    return stats;
+}
+
+void TrackingPipeline::AddStageTime(const int stage, const chrono::steady_clock::time_point &t0)
+{
+    const double t = chrono::duration<double,milli>(chrono::steady_clock::now()-t0).count();
+    unique_lock<mutex> lock(mMutexStats);
+    mtStage[stage] += t;
+}
+
+void TrackingPipeline::RunConvert()
+{
+    while(1)
+    {
+        Request* pRequest = mQueueConvert.Pop();
+        if(!pRequest)
+        {
+            mQueueExtract.Push(pRequest);
+            break;
+        }
+
+        const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+        // Grayscale input is not converted, copy it so that the caller can reuse its buffer
+        cv::Mat imGray = mpTracker->ConvertToGray(pRequest->im);
+        pRequest->im = imGray.data==pRequest->im.data ? imGray.clone() : imGray;
+
+        if(mSensor==System::STEREO)
+        {
+            cv::Mat imGrayRight = mpTracker->ConvertToGray(pRequest->im2);
+            pRequest->im2 = imGrayRight.data==pRequest->im2.data ? imGrayRight.clone() : imGrayRight;
+        }
+        else if(mSensor==System::RGBD)
+        {
+            cv::Mat imDepth = mpTracker->ConvertDepth(pRequest->im2);
+            pRequest->im2 = imDepth.data==pRequest->im2.data ? imDepth.clone() : imDepth;
+        }
+
+        AddStageTime(0,t0);
+
+        mQueueExtract.Push(pRequest);
+    }
+}
+
+void TrackingPipeline::RunExtract()
+{
+    while(1)
+    {
+        Request* pRequest = mQueueExtract.Pop();
+        if(!pRequest)
+        {
+            mQueueTrack.Push(pRequest);
+            break;
+        }
+
+        // Frames already built are tracked first: a reset (frame ids, map) or a mode change
+        // must not run while a frame is in flight, and the next frames are built after it
+        if(mpSystem->ModeChangeOrResetPending())
+        {
+            {
+                unique_lock<mutex> lock(mMutexPending);
+                mCondPending.wait(lock, [this]{return mnBuilt==0;});
+            }
+            mpSystem->CheckModeChangeAndReset();
+        }
+
+        const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+        if(mSensor==System::STEREO)
+            pRequest->pFrame = new Frame(mpTracker->CreateFrameStereo(pRequest->im,pRequest->im2,pRequest->timestamp));
+        else if(mSensor==System::RGBD)
+            pRequest->pFrame = new Frame(mpTracker->CreateFrameRGBD(pRequest->im,pRequest->im2,pRequest->timestamp));
+        else
+            pRequest->pFrame = new Frame(mpTracker->CreateFrameMonocular(pRequest->im,pRequest->timestamp));
+
+        // Only the grayscale image is needed from now on (for the frame drawer)
+        pRequest->im2.release();
+
+        AddStageTime(1,t0);
+
+        {
+            unique_lock<mutex> lock(mMutexPending);
+            mnBuilt++;
+        }
+
+        mQueueTrack.Push(pRequest);
+    }
+}
+
+void TrackingPipeline::RunTrack()
+{
+    while(1)
+    {
+        Request* pRequest = mQueueTrack.Pop();
+        if(!pRequest)
+            break;
+
+        const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+        cv::Mat Tcw = mpSystem->TrackFrame(*pRequest->pFrame,pRequest->im);
+
+        AddStageTime(2,t0);
+
+        {
+            const double tLatency = chrono::duration<double,milli>(chrono::steady_clock::now()-pRequest->tSubmit).count();
+            unique_lock<mutex> lock(mMutexStats);
+            mtLatency += tLatency;
+            mnFrames++;
+        }
+
+        pRequest->pose.set_value(Tcw);
+
+        delete pRequest->pFrame;
+        delete pRequest;
+
+        {
+            unique_lock<mutex> lock(mMutexPending);
+            mnPending--;
+            mnBuilt--;
+            mCondPending.notify_all();
+        }
+    }
+}
+
+} //namespace ORB_SLAM2
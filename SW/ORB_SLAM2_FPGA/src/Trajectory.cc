@@ -0,0 +1,240 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Trajectory.h"
+
+#include<iostream>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+// Records written at once when streaming
+static const size_t FLUSH_RECORDS = 256;
+
+Eigen::Matrix4f Trajectory::Record::GetTcr() const
+{
+    Eigen::Matrix4f Tcr = Eigen::Matrix4f::Identity();
+    for(int i=0; i<3; i++)
+        for(int j=0; j<4; j++)
+            Tcr(i,j) = mTcr[4*i+j];
+    return Tcr;
+}
+
+void Trajectory::Record::SetTcr(const Eigen::Matrix4f &Tcr)
+{
+    for(int i=0; i<3; i++)
+        for(int j=0; j<4; j++)
+            mTcr[4*i+j] = Tcr(i,j);
+}
+
+// Place the records of keyframe nKFId relative to its parent (Tcr = Tcr*Tcp)
+static void ReparentRecords(vector<Trajectory::Record> &vRecords, unordered_map<long unsigned int,vector<size_t> > &mRecordsByKF,
+                            const long unsigned int nKFId, const long unsigned int nParentId, const Eigen::Matrix4f &Tcp)
+{
+    unordered_map<long unsigned int,vector<size_t> >::iterator it = mRecordsByKF.find(nKFId);
+    if(it==mRecordsByKF.end())
+        return;
+
+    vector<size_t> vKFRecords;
+    vKFRecords.swap(it->second);
+    mRecordsByKF.erase(it);
+
+    vector<size_t> &vParentRecords = mRecordsByKF[nParentId];
+    for(size_t i=0; i<vKFRecords.size(); i++)
+    {
+        Trajectory::Record &r = vRecords[vKFRecords[i]];
+        r.SetTcr(r.GetTcr()*Tcp);
+        r.mnRefKFId = nParentId;
+        vParentRecords.push_back(vKFRecords[i]);
+    }
+}
+
+Trajectory::Trajectory(): mnRecords(0)
+{
+}
+
+Trajectory::~Trajectory()
+{
+    if(mFile.is_open())
+    {
+        Flush();
+        mFile.close();
+    }
+    if(mFileErased.is_open())
+        mFileErased.close();
+}
+
+bool Trajectory::SetFile(const string &filename)
+{
+    if(mFile.is_open())
+        mFile.close();
+    if(mFileErased.is_open())
+        mFileErased.close();
+
+    mFile.open(filename.c_str(),ios::out | ios::binary | ios::trunc);
+    mFileErased.open((filename+".erased").c_str(),ios::out | ios::binary | ios::trunc);
+    if(!mFile.is_open() || !mFileErased.is_open())
+    {
+        cerr << "Failed to create trajectory file at: " << filename << endl;
+        mFile.close();
+        mFileErased.close();
+        mFilename.clear();
+        return false;
+    }
+    mFilename = filename;
+
+    // The records so far go to the file as well
+    Flush();
+    return true;
+}
+
+void Trajectory::Add(const double timestamp, const long unsigned int nRefKFId, const Eigen::Matrix4f &Tcr, const bool bLost)
+{
+    Record r;
+    r.mTimeStamp = timestamp;
+    r.mnRefKFId = nRefKFId;
+    r.SetTcr(Tcr);
+    r.mbLost = bLost;
+
+    mmRecordsByKF[r.mnRefKFId].push_back(mvRecords.size());
+    mvRecords.push_back(r);
+    mLast = r;
+    mLastRecord = r;
+    mnRecords++;
+
+    if(IsStreaming() && mvRecords.size()>=FLUSH_RECORDS)
+        Flush();
+}
+
+void Trajectory::AddLast(const bool bLost)
+{
+    if(mnRecords==0)
+        return;
+
+    Record r = mLastRecord;
+    r.mbLost = bLost;
+
+    mmRecordsByKF[r.mnRefKFId].push_back(mvRecords.size());
+    mvRecords.push_back(r);
+    mLast.mbLost = bLost;
+    mLastRecord = r;
+    mnRecords++;
+
+    if(IsStreaming() && mvRecords.size()>=FLUSH_RECORDS)
+        Flush();
+}
+
+void Trajectory::Flush()
+{
+    if(mvRecords.empty())
+        return;
+    mFile.write(reinterpret_cast<const char*>(&mvRecords[0]),mvRecords.size()*sizeof(Record));
+    mFile.flush();
+    mvRecords.clear();
+    mmRecordsByKF.clear();
+}
+
+void Trajectory::Reparent(const long unsigned int nKFId, const long unsigned int nParentId, const Eigen::Matrix4f &Tcp)
+{
+    ReparentRecords(mvRecords,mmRecordsByKF,nKFId,nParentId,Tcp);
+
+    if(mnRecords>0 && mLastRecord.mnRefKFId==nKFId)
+    {
+        mLastRecord.SetTcr(mLastRecord.GetTcr()*Tcp);
+        mLastRecord.mnRefKFId = nParentId;
+    }
+
+    // The records in the file are placed when read back
+    if(IsStreaming())
+    {
+        ErasedKeyFrame erased;
+        erased.mnKFId = nKFId;
+        erased.mnParentId = nParentId;
+        for(int i=0; i<3; i++)
+            for(int j=0; j<4; j++)
+                erased.mTcp[4*i+j] = Tcp(i,j);
+        mFileErased.write(reinterpret_cast<const char*>(&erased),sizeof(ErasedKeyFrame));
+    }
+}
+
+vector<Trajectory::Record> Trajectory::GetRecords()
+{
+    if(!IsStreaming())
+        return mvRecords;
+
+    Flush();
+
+    vector<Record> vRecords;
+    ifstream f(mFilename.c_str(),ios::in | ios::binary);
+    if(!f.is_open())
+    {
+        cerr << "Failed to read trajectory file at: " << mFilename << endl;
+        return vRecords;
+    }
+
+    vRecords.resize(mnRecords);
+    if(mnRecords>0)
+        f.read(reinterpret_cast<char*>(&vRecords[0]),mnRecords*sizeof(Record));
+    vRecords.resize(f.gcount()/sizeof(Record));
+
+    // Every record with the id of an erased keyframe was written before that keyframe was
+    // erased (later ones were placed in memory), so the keyframes are replayed in order
+    mFileErased.flush();
+    ifstream fErased((mFilename+".erased").c_str(),ios::in | ios::binary);
+    if(!fErased.is_open())
+    {
+        cerr << "Failed to read trajectory file at: " << mFilename << ".erased" << endl;
+        return vRecords;
+    }
+
+    unordered_map<long unsigned int,vector<size_t> > mRecordsByKF;
+    for(size_t i=0; i<vRecords.size(); i++)
+        mRecordsByKF[vRecords[i].mnRefKFId].push_back(i);
+
+    ErasedKeyFrame erased;
+    while(fErased.read(reinterpret_cast<char*>(&erased),sizeof(ErasedKeyFrame)))
+    {
+        Eigen::Matrix4f Tcp = Eigen::Matrix4f::Identity();
+        for(int i=0; i<3; i++)
+            for(int j=0; j<4; j++)
+                Tcp(i,j) = erased.mTcp[4*i+j];
+        ReparentRecords(vRecords,mRecordsByKF,erased.mnKFId,erased.mnParentId,Tcp);
+    }
+
+    return vRecords;
+}
+
+void Trajectory::Clear()
+{
+    mvRecords.clear();
+    mmRecordsByKF.clear();
+    mnRecords = 0;
+
+    // Start the files again
+    if(IsStreaming())
+    {
+        const string filename = mFilename;
+        SetFile(filename);
+    }
+}
+
+} //namespace ORB_SLAM
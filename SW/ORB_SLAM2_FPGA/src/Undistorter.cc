@@ -0,0 +1,252 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Undistorter.h"
+
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include<chrono>
+#include<cmath>
+#include<iostream>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+// Maximum interpolation error (pixels) accepted when validating the grid.
+const float TH_MAX_ERROR = 0.02f;
+
+Undistorter::Undistorter():
+    mbDistorted(false), mnStep(0), mfInvStep(0), mnCols(0), mnRows(0), mnWidth(0), mnHeight(0), mbUseGrid(false)
+{
+}
+
+void Undistorter::SetCalibration(const cv::Mat &K, const cv::Mat &DistCoef, const int width, const int height)
+{
+    K.copyTo(mK);
+    DistCoef.copyTo(mDistCoef);
+    mbDistorted = mDistCoef.at<float>(0)!=0.0;
+
+    mvMapX.clear();
+    mvMapY.clear();
+    mnWidth = 0;
+    mnHeight = 0;
+    mbUseGrid = false;
+
+    if(!mbDistorted)
+        return;
+
+    if(width>0 && height>0)
+        Build(width,height);
+    else
+        cout << endl << "Undistortion Grid: image size (Camera.width, Camera.height) not set, using exact undistortion" << endl;
+}
+
+void Undistorter::Build(const int width, const int height)
+{
+    auto start = chrono::steady_clock::now();
+
+    mnWidth = width;
+    mnHeight = height;
+    mbUseGrid = false;
+
+    float maxError = 0;
+    double tExact = 0, tGrid = 0;
+
+    for(mnStep=8; mnStep>=1; mnStep/=2)
+    {
+        mfInvStep = 1.0f/mnStep;
+        mnCols = (width+mnStep-1)/mnStep+1;
+        mnRows = (height+mnStep-1)/mnStep+1;
+
+        // Undistort every grid node exactly
+        vector<cv::KeyPoint> vNodes(mnCols*mnRows), vNodesUn;
+        for(int r=0; r<mnRows; r++)
+            for(int c=0; c<mnCols; c++)
+                vNodes[r*mnCols+c].pt = cv::Point2f(c*mnStep,r*mnStep);
+        UndistortExact(vNodes,vNodesUn);
+
+        mvMapX.resize(vNodesUn.size());
+        mvMapY.resize(vNodesUn.size());
+        for(size_t i=0; i<vNodesUn.size(); i++)
+        {
+            mvMapX[i] = vNodesUn[i].pt.x;
+            mvMapY[i] = vNodesUn[i].pt.y;
+        }
+
+        // Validate at the cell centres, where the interpolation error is largest
+        vector<cv::KeyPoint> vCheck;
+        vCheck.reserve((mnCols-1)*(mnRows-1));
+        for(int r=0; r<mnRows-1; r++)
+            for(int c=0; c<mnCols-1; c++)
+            {
+                const float x = (c+0.5f)*mnStep;
+                const float y = (r+0.5f)*mnStep;
+                if(x<width && y<height)
+                {
+                    cv::KeyPoint kp;
+                    kp.pt = cv::Point2f(x,y);
+                    vCheck.push_back(kp);
+                }
+            }
+
+        vector<cv::KeyPoint> vCheckExact, vCheckGrid;
+        auto t0 = chrono::steady_clock::now();
+        UndistortExact(vCheck,vCheckExact);
+        auto t1 = chrono::steady_clock::now();
+        mbUseGrid = true;
+        Undistort(vCheck,vCheckGrid,width,height);
+        auto t2 = chrono::steady_clock::now();
+        tExact = chrono::duration<double,milli>(t1-t0).count();
+        tGrid = chrono::duration<double,milli>(t2-t1).count();
+
+        maxError = 0;
+        for(size_t i=0; i<vCheck.size(); i++)
+        {
+            const float ex = vCheckExact[i].pt.x-vCheckGrid[i].pt.x;
+            const float ey = vCheckExact[i].pt.y-vCheckGrid[i].pt.y;
+            maxError = max(maxError,sqrt(ex*ex+ey*ey));
+        }
+
+        if(maxError<=TH_MAX_ERROR)
+            break;
+
+        mbUseGrid = false;
+    }
+
+    auto end = chrono::steady_clock::now();
+
+    cout << endl << "Undistortion Grid: " << endl;
+    if(mbUseGrid)
+    {
+        cout << "- step: " << mnStep << " px (" << mnCols << "x" << mnRows << " nodes)" << endl;
+        cout << "- max error: " << maxError << " px" << endl;
+        cout << "- exact / grid time (validation points): " << tExact << " / " << tGrid << " ms" << endl;
+    }
+    else
+    {
+        cout << "- max error " << maxError << " px above threshold, using exact undistortion" << endl;
+    }
+    cout << "- build time: " << chrono::duration<double,milli>(end-start).count() << " ms" << endl;
+}
+
+void Undistorter::Undistort(const vector<cv::KeyPoint> &vKeys, vector<cv::KeyPoint> &vKeysUn,
+                            const int width, const int height) const
+{
+    if(!mbDistorted)
+    {
+        vKeysUn=vKeys;
+        return;
+    }
+
+    if(!mbUseGrid || width!=mnWidth || height!=mnHeight)
+    {
+        UndistortExact(vKeys,vKeysUn);
+        return;
+    }
+
+    const int N = vKeys.size();
+    vKeysUn = vKeys;
+
+    const float *mapX = mvMapX.data();
+    const float *mapY = mvMapY.data();
+    const float maxX = (mnCols-1)*mnStep;
+    const float maxY = (mnRows-1)*mnStep;
+
+    vector<int> vOutside;
+
+    for(int i=0; i<N; i++)
+    {
+        const float x = vKeys[i].pt.x;
+        const float y = vKeys[i].pt.y;
+
+        if(x<0 || y<0 || x>=maxX || y>=maxY)
+        {
+            vOutside.push_back(i);
+            continue;
+        }
+
+        const float gx = x*mfInvStep;
+        const float gy = y*mfInvStep;
+        const int c = static_cast<int>(gx);
+        const int r = static_cast<int>(gy);
+        const float ax = gx-c;
+        const float ay = gy-r;
+
+        const int i00 = r*mnCols+c;
+        const int i10 = i00+mnCols;
+
+        const float w00 = (1.f-ax)*(1.f-ay);
+        const float w01 = ax*(1.f-ay);
+        const float w10 = (1.f-ax)*ay;
+        const float w11 = ax*ay;
+
+        vKeysUn[i].pt.x = w00*mapX[i00]+w01*mapX[i00+1]+w10*mapX[i10]+w11*mapX[i10+1];
+        vKeysUn[i].pt.y = w00*mapY[i00]+w01*mapY[i00+1]+w10*mapY[i10]+w11*mapY[i10+1];
+    }
+
+    // Keypoints outside the grid (should not happen for keypoints inside the image)
+    if(!vOutside.empty())
+    {
+        vector<cv::KeyPoint> vOut(vOutside.size()), vOutUn;
+        for(size_t j=0; j<vOutside.size(); j++)
+            vOut[j] = vKeys[vOutside[j]];
+        UndistortExact(vOut,vOutUn);
+        for(size_t j=0; j<vOutside.size(); j++)
+            vKeysUn[vOutside[j]] = vOutUn[j];
+    }
+}
+
+void Undistorter::UndistortExact(const vector<cv::KeyPoint> &vKeys, vector<cv::KeyPoint> &vKeysUn) const
+{
+    UndistortExact(vKeys,vKeysUn,mK,mDistCoef);
+}
+
+void Undistorter::UndistortExact(const vector<cv::KeyPoint> &vKeys, vector<cv::KeyPoint> &vKeysUn,
+                                 const cv::Mat &K, const cv::Mat &DistCoef)
+{
+    const int N = vKeys.size();
+    vKeysUn = vKeys;
+    if(N==0)
+        return;
+
+    // Fill matrix with points
+    cv::Mat mat(N,2,CV_32F);
+    for(int i=0; i<N; i++)
+    {
+        mat.at<float>(i,0)=vKeys[i].pt.x;
+        mat.at<float>(i,1)=vKeys[i].pt.y;
+    }
+
+    // Undistort points
+    mat=mat.reshape(2);
+    cv::undistortPoints(mat,mat,K,DistCoef,cv::Mat(),K);
+    mat=mat.reshape(1);
+
+    // Fill undistorted keypoint vector
+    for(int i=0; i<N; i++)
+    {
+        vKeysUn[i].pt.x=mat.at<float>(i,0);
+        vKeysUn[i].pt.y=mat.at<float>(i,1);
+    }
+}
+
+} //namespace ORB_SLAM2
@@ -92,8 +92,14 @@ void Viewer::Run()
     bool bFollow = true;
     bool bLocalizationMode = false;
 
+    // The map points drawn are only kept during one iteration
+    EpochManager &epochs = mpMapDrawer->mpMap->mEpochManager;
+    const int nEpochReader = epochs.Register();
+
     while(1)
     {
+        epochs.Announce(nEpochReader,epochs.GetEpoch());
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         mpMapDrawer->GetCurrentOpenGLCameraMatrix(Twc);
@@ -155,23 +161,25 @@ void Viewer::Run()
 
         if(Stop())
         {
-            while(isStopped())
-            {
-                usleep(3000);
-            }
+            epochs.SetIdle(nEpochReader);
+            mEventState.WaitUntil([this]{return !isStopped() || CheckFinish();});
         }
 
         if(CheckFinish())
             break;
     }
 
+    epochs.Unregister(nEpochReader);
     SetFinish();
 }
 
 void Viewer::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    mEventState.Notify();
 }
 
 bool Viewer::CheckFinish()
@@ -182,8 +190,11 @@ bool Viewer::CheckFinish()
 
 void Viewer::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+    }
+    mEventState.Notify();
 }
 
 bool Viewer::isFinished()
@@ -207,26 +218,38 @@ bool Viewer::isStopped()
 
 bool Viewer::Stop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    unique_lock<mutex> lock2(mMutexFinish);
-
-    if(mbFinishRequested)
-        return false;
-    else if(mbStopRequested)
     {
+        unique_lock<mutex> lock(mMutexStop);
+        unique_lock<mutex> lock2(mMutexFinish);
+
+        if(mbFinishRequested || !mbStopRequested)
+            return false;
+
         mbStopped = true;
         mbStopRequested = false;
-        return true;
     }
 
-    return false;
-
+    mEventState.Notify();
+    return true;
 }
 
 void Viewer::Release()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    mbStopped = false;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        mbStopped = false;
+    }
+    mEventState.Notify();
+}
+
+void Viewer::WaitUntilStopped()
+{
+    mEventState.WaitUntil([this]{return isStopped() || isFinished();});
+}
+
+void Viewer::WaitUntilFinished()
+{
+    mEventState.WaitUntil([this]{return isFinished();});
 }
 
 }
@@ -0,0 +1,136 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WorkerPool.h"
+
+#include<atomic>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+// A loop. Threads that take it after all the indices are gone return right away, they never
+// touch f: it is only valid while the caller waits.
+struct WorkerPool::Job
+{
+    Job(const int n, const function<void(int)>* pf): mn(n), mpf(pf), mnNext(0), mnDone(0) {}
+
+    void Run()
+    {
+        int i;
+        while((i=mnNext++)<mn)
+        {
+            (*mpf)(i);
+            if(++mnDone==mn)
+                mEventDone.Notify();
+        }
+    }
+
+    const int mn;
+    const function<void(int)>* mpf;
+    atomic<int> mnNext;
+    atomic<int> mnDone;
+    ThreadEvent mEventDone;
+};
+
+WorkerPool& WorkerPool::Get()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+WorkerPool::WorkerPool(): mnThreads(1), mbStop(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    StopThreads();
+}
+
+void WorkerPool::SetNumThreads(const int nThreads)
+{
+    StopThreads();
+
+    mnThreads = nThreads>0 ? nThreads : 1;
+    mbStop = false;
+    for(int t=1; t<mnThreads; t++)
+        mvThreads.push_back(thread(&WorkerPool::Run,this));
+}
+
+void WorkerPool::StopThreads()
+{
+    {
+        unique_lock<mutex> lock(mMutexJobs);
+        mbStop = true;
+    }
+    mCondJobs.notify_all();
+
+    for(size_t t=0; t<mvThreads.size(); t++)
+        mvThreads[t].join();
+    mvThreads.clear();
+    mqJobs.clear();
+}
+
+void WorkerPool::ParallelFor(const int n, const function<void(int)> &f)
+{
+    const int nHelpers = min(n,mnThreads)-1;
+    if(nHelpers<=0)
+    {
+        for(int i=0; i<n; i++)
+            f(i);
+        return;
+    }
+
+    shared_ptr<Job> pJob = make_shared<Job>(n,&f);
+    {
+        unique_lock<mutex> lock(mMutexJobs);
+        for(int t=0; t<nHelpers; t++)
+            mqJobs.push_back(pJob);
+    }
+    if(nHelpers==1)
+        mCondJobs.notify_one();
+    else
+        mCondJobs.notify_all();
+
+    pJob->Run();
+    pJob->mEventDone.WaitUntil([&]{return pJob->mnDone==n;});
+}
+
+void WorkerPool::Run()
+{
+    while(1)
+    {
+        shared_ptr<Job> pJob;
+        {
+            unique_lock<mutex> lock(mMutexJobs);
+            mCondJobs.wait(lock,[this]{return !mqJobs.empty() || mbStop;});
+            if(mqJobs.empty())
+                break;
+            pJob = mqJobs.front();
+            mqJobs.pop_front();
+        }
+
+        pJob->Run();
+    }
+}
+
+} //namespace ORB_SLAM
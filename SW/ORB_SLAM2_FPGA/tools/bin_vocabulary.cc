@@ -1,4 +1,5 @@
 #include <time.h>
+#include <stdlib.h>
 
 #include "ORBVocabulary.h"
 using namespace std;
@@ -40,13 +41,121 @@ void save_as_binary(ORB_SLAM2::ORBVocabulary* voc, const std::string outfile) {
   printf("Saving as binary: %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
 }
 
+bool load_as_image(ORB_SLAM2::ORBVocabulary* voc, const std::string infile, bool verify) {
+  clock_t tStart = clock();
+  bool res = voc->loadFromImageFile(infile, verify);
+  printf("Loading from image%s: %.4fs\n", verify ? " (checksum)" : "", (double)(clock() - tStart)/CLOCKS_PER_SEC);
+  return res;
+}
+
+bool save_as_image(ORB_SLAM2::ORBVocabulary* voc, const std::string outfile) {
+  clock_t tStart = clock();
+  bool res = voc->saveToImageFile(outfile);
+  printf("Saving as image: %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
+  return res;
+}
+
+bool has_suffix(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() &&
+    str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool load_any(ORB_SLAM2::ORBVocabulary* voc, const std::string infile) {
+  if (has_suffix(infile, ".txt"))
+    return load_as_text(voc, infile);
+  if (has_suffix(infile, ".img"))
+    return load_as_image(voc, infile, true);
+  load_as_binary(voc, infile);
+  return !voc->empty();
+}
+
+// Checks the checksum of the image and, with a reference vocabulary, that both
+// give the same words and direct index for random descriptors
+bool verify_image(const std::string imgfile, ORB_SLAM2::ORBVocabulary* ref) {
+  ORB_SLAM2::ORBVocabulary img;
+  if (!load_as_image(&img, imgfile, true)) {
+    cerr << "Failed to load " << imgfile << endl;
+    return false;
+  }
+  cout << "Image: k = " << img.getBranchingFactor() << ", L = " << img.getDepthLevels()
+       << ", " << img.size() << " words" << endl;
+
+  if (!ref)
+    return true;
+
+  if (img.size() != ref->size() || img.getBranchingFactor() != ref->getBranchingFactor() ||
+      img.getDepthLevels() != ref->getDepthLevels()) {
+    cerr << "Image and reference vocabularies differ" << endl;
+    return false;
+  }
+
+  srand(0);
+  const int nFrames = 20;
+  const int nFeatures = 1000;
+  for (int f = 0; f < nFrames; f++) {
+    vector<cv::Mat> features(nFeatures);
+    for (int i = 0; i < nFeatures; i++) {
+      features[i].create(1, 32, CV_8U);
+      for (int j = 0; j < 32; j++)
+        features[i].at<unsigned char>(0, j) = rand() & 0xff;
+    }
+
+    DBoW2::BowVector bow1, bow2;
+    DBoW2::FeatureVector fv1, fv2;
+    ref->transform(features, bow1, fv1, 4);
+    img.transform(features, bow2, fv2, 4);
+    if (bow1 != bow2 || fv1 != fv2) {
+      cerr << "Image and reference vocabularies give different words" << endl;
+      return false;
+    }
+  }
+
+  cout << "Image verified against the reference vocabulary (" << nFrames*nFeatures << " descriptors)" << endl;
+  return true;
+}
+
+void usage() {
+  cout << "Usage: bin_vocabulary" << endl
+       << "         converts Vocabulary/RSBvockitti.txt to Vocabulary/RSBvockitti.bin" << endl
+       << "       bin_vocabulary <input.txt|input.bin> <output.img>" << endl
+       << "         converts a vocabulary to a memory-mapped image and verifies it" << endl
+       << "       bin_vocabulary --verify <input.img> [reference.txt|reference.bin]" << endl
+       << "         verifies an image, against a reference vocabulary if given" << endl;
+}
 
 int main(int argc, char **argv) {
-  cout << "BoW load/save benchmark" << endl;
-  ORB_SLAM2::ORBVocabulary* voc = new ORB_SLAM2::ORBVocabulary();
+  if (argc == 1) {
+    cout << "BoW load/save benchmark" << endl;
+    ORB_SLAM2::ORBVocabulary* voc = new ORB_SLAM2::ORBVocabulary();
+
+    load_as_text(voc, "Vocabulary/RSBvockitti.txt");
+    save_as_binary(voc, "Vocabulary/RSBvockitti.bin");
+
+    return 0;
+  }
+
+  if (argc >= 3 && std::string(argv[1]) == "--verify") {
+    ORB_SLAM2::ORBVocabulary ref;
+    if (argc >= 4 && !load_any(&ref, argv[3])) {
+      cerr << "Failed to load " << argv[3] << endl;
+      return 1;
+    }
+    return verify_image(argv[2], argc >= 4 ? &ref : NULL) ? 0 : 1;
+  }
 
-  load_as_text(voc, "Vocabulary/RSBvockitti.txt");
-  save_as_binary(voc, "Vocabulary/RSBvockitti.bin");
+  if (argc == 3) {
+    ORB_SLAM2::ORBVocabulary voc;
+    if (!load_any(&voc, argv[1])) {
+      cerr << "Failed to load " << argv[1] << endl;
+      return 1;
+    }
+    if (!save_as_image(&voc, argv[2])) {
+      cerr << "Failed to save " << argv[2] << endl;
+      return 1;
+    }
+    return verify_image(argv[2], &voc) ? 0 : 1;
+  }
 
-  return 0;
+  usage();
+  return 1;
 }